@@ -0,0 +1,398 @@
+#include "../Common/Base.hpp"
+#include "../Common/FreeList.hpp"
+#include "../Common/Error.hpp"
+#include "../Common/Math.hpp"
+#include "../Common/Profiler.hpp"
+#include "../Common/Benchmark.hpp"
+#include "../Common/Stream.hpp"
+#include "../Common/Files.hpp"
+#include "../Common/Tokenizer.hpp"
+#include "../Common/Logger.hpp"
+
+#include <iostream>
+
+using namespace std;
+using namespace common;
+
+#ifdef _UNICODE
+	#define tcout wcout
+#else
+	#define tcout cout
+#endif
+
+static BenchmarkRunner g_Runner;
+
+static void RunBenchmark(const tstring &Name, const BENCHMARK_FUNC &Func, uint64 BytesPerIteration = 0)
+{
+	if (g_Runner.Run(Name, Func, BytesPerIteration))
+	{
+		tstring Line;
+		BenchmarkRunner::FormatResult(&Line, g_Runner.GetResult(g_Runner.GetResultCount()-1));
+		tcout << Line << endl;
+	}
+}
+
+//HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
+// FreeList
+
+struct LARGE_ELEMENT
+{
+	char Data[1024];
+};
+
+template <typename T>
+void BenchmarkFreeListType(const tstring &TypeName)
+{
+	// Wzorzec jak w grze - kilka obiektw yje jednoczenie
+	const uint LIVE_COUNT = 64;
+
+	RunBenchmark(_T("FreeList<") + TypeName + _T(">"), [](uint64 Iterations) {
+		FreeList<T> List(LIVE_COUNT);
+		T *Ptrs[LIVE_COUNT];
+		for (uint64 i = 0; i < Iterations; i++)
+		{
+			for (uint j = 0; j < LIVE_COUNT; j++)
+				Ptrs[j] = List.New();
+			DoNotOptimize(Ptrs);
+			for (uint j = 0; j < LIVE_COUNT; j++)
+				List.Delete(Ptrs[j]);
+		}
+	});
+	RunBenchmark(_T("DynamicFreeList<") + TypeName + _T(">"), [](uint64 Iterations) {
+		DynamicFreeList<T> List(LIVE_COUNT / 4);
+		T *Ptrs[LIVE_COUNT];
+		for (uint64 i = 0; i < Iterations; i++)
+		{
+			for (uint j = 0; j < LIVE_COUNT; j++)
+				Ptrs[j] = List.New();
+			DoNotOptimize(Ptrs);
+			for (uint j = 0; j < LIVE_COUNT; j++)
+				List.Delete(Ptrs[j]);
+		}
+	});
+	RunBenchmark(_T("new/delete<") + TypeName + _T(">"), [](uint64 Iterations) {
+		T *Ptrs[LIVE_COUNT];
+		for (uint64 i = 0; i < Iterations; i++)
+		{
+			for (uint j = 0; j < LIVE_COUNT; j++)
+				Ptrs[j] = new T;
+			DoNotOptimize(Ptrs);
+			for (uint j = 0; j < LIVE_COUNT; j++)
+				delete Ptrs[j];
+		}
+	});
+}
+
+void BenchmarkFreeList()
+{
+	BenchmarkFreeListType<uint64>(_T("uint64"));
+	BenchmarkFreeListType<LARGE_ELEMENT>(_T("1KB"));
+}
+
+//HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
+// Stream encoders and hashing
+
+static const size_t DATA_SIZE = 64 * 1024;
+
+void BenchmarkStream()
+{
+	std::vector<char> Data(DATA_SIZE);
+	RandomGenerator Rand(123);
+	for (size_t i = 0; i < DATA_SIZE; i++)
+		Data[i] = (char)Rand.RandUint(256);
+
+	string Hex, Base64;
+	{
+		StringStream HexStream(&Hex);
+		HexEncoder Encoder(&HexStream);
+		Encoder.Write(&Data[0], DATA_SIZE);
+	}
+	{
+		StringStream Base64Stream(&Base64);
+		Base64Encoder Encoder(&Base64Stream);
+		Encoder.Write(&Data[0], DATA_SIZE);
+	}
+	std::vector<char> Decoded(DATA_SIZE);
+
+	RunBenchmark(_T("HexEncoder"), [&](uint64 Iterations) {
+		for (uint64 i = 0; i < Iterations; i++)
+		{
+			NullStream Null;
+			HexEncoder Encoder(&Null);
+			Encoder.Write(&Data[0], DATA_SIZE);
+		}
+	}, DATA_SIZE);
+	RunBenchmark(_T("HexDecoder"), [&](uint64 Iterations) {
+		for (uint64 i = 0; i < Iterations; i++)
+		{
+			MemoryStream Input(Hex.length(), &Hex[0]);
+			HexDecoder Decoder(&Input);
+			Decoder.MustRead(&Decoded[0], DATA_SIZE);
+		}
+	}, DATA_SIZE);
+	RunBenchmark(_T("Base64Encoder"), [&](uint64 Iterations) {
+		for (uint64 i = 0; i < Iterations; i++)
+		{
+			NullStream Null;
+			Base64Encoder Encoder(&Null);
+			Encoder.Write(&Data[0], DATA_SIZE);
+		}
+	}, DATA_SIZE);
+	RunBenchmark(_T("Base64Decoder"), [&](uint64 Iterations) {
+		for (uint64 i = 0; i < Iterations; i++)
+		{
+			MemoryStream Input(Base64.length(), &Base64[0]);
+			Base64Decoder Decoder(&Input);
+			Decoder.MustRead(&Decoded[0], DATA_SIZE);
+		}
+	}, DATA_SIZE);
+
+	RunBenchmark(_T("CRC32_Calc"), [&](uint64 Iterations) {
+		for (uint64 i = 0; i < Iterations; i++)
+			DoNotOptimize(CRC32_Calc::Calc(&Data[0], DATA_SIZE));
+	}, DATA_SIZE);
+	RunBenchmark(_T("MD5_Calc"), [&](uint64 Iterations) {
+		MD5_SUM Sum;
+		for (uint64 i = 0; i < Iterations; i++)
+		{
+			MD5_Calc::Calc(&Sum, &Data[0], DATA_SIZE);
+			DoNotOptimize(Sum);
+		}
+	}, DATA_SIZE);
+	RunBenchmark(_T("Hash_Calc"), [&](uint64 Iterations) {
+		for (uint64 i = 0; i < Iterations; i++)
+			DoNotOptimize(Hash_Calc::Calc(&Data[0], DATA_SIZE));
+	}, DATA_SIZE);
+	RunBenchmark(_T("MurmurHash"), [&](uint64 Iterations) {
+		for (uint64 i = 0; i < Iterations; i++)
+			DoNotOptimize(MurmurHash(&Data[0], (uint)DATA_SIZE, 0));
+	}, DATA_SIZE);
+	RunBenchmark(_T("SuperFastHash"), [&](uint64 Iterations) {
+		for (uint64 i = 0; i < Iterations; i++)
+			DoNotOptimize(SuperFastHash(&Data[0], DATA_SIZE));
+	}, DATA_SIZE);
+}
+
+//HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
+// Tokenizer
+
+void BenchmarkTokenizer()
+{
+	// Dokument w stylu plikw konfiguracyjnych
+	tstring Text;
+	for (uint i = 0; i < 1000; i++)
+	{
+		Text += _T("Object \"Name");
+		Text += UintToStrR(i);
+		Text += _T("\" {\n\tPosition = { ");
+		Text += DoubleToStrR(i * 0.5);
+		Text += _T(", -12.75, 3e2 };\n\tCount = ");
+		Text += UintToStrR(i * 7);
+		Text += _T("; // comment\n\tVisible = true;\n}\n");
+	}
+
+	RunBenchmark(_T("Tokenizer"), [&](uint64 Iterations) {
+		for (uint64 i = 0; i < Iterations; i++)
+		{
+			Tokenizer Tok(&Text, 0);
+			uint TokenCount = 0;
+			do
+			{
+				Tok.Next();
+				TokenCount++;
+			} while (Tok.GetToken() != Tokenizer::TOKEN_EOF);
+			DoNotOptimize(TokenCount);
+		}
+	}, Text.length() * sizeof(tchar));
+}
+
+//HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
+// Math
+
+void BenchmarkMath()
+{
+	// Stae dane, eby wyniki byy porwnywalne midzy uruchomieniami
+	const uint COUNT = 1024;
+	RandomGenerator Rand(456);
+	std::vector<VEC3> Origins(COUNT), Dirs(COUNT), Points(COUNT);
+	std::vector<BOX> Boxes(COUNT);
+	for (uint i = 0; i < COUNT; i++)
+	{
+		Origins[i] = VEC3(Rand.RandFloat(-10.f, 10.f), Rand.RandFloat(-10.f, 10.f), Rand.RandFloat(-10.f, 10.f));
+		Normalize(&Dirs[i], VEC3(Rand.RandFloat(-1.f, 1.f), Rand.RandFloat(-1.f, 1.f), Rand.RandFloat(-1.f, 1.f) + 0.01f));
+		Points[i] = VEC3(Rand.RandFloat(-5.f, 5.f), Rand.RandFloat(-5.f, 5.f), Rand.RandFloat(-5.f, 5.f));
+		Boxes[i] = BOX(Points[i], Points[i] + VEC3(Rand.RandFloat(0.1f, 3.f), Rand.RandFloat(0.1f, 3.f), Rand.RandFloat(0.1f, 3.f)));
+	}
+	MATRIX View, Proj, ViewProj;
+	LookAtLH(&View, VEC3(0.f, 0.f, -20.f), VEC3(0.f, 0.f, 1.f), VEC3(0.f, 1.f, 0.f));
+	PerspectiveFovLH(&Proj, PI_4, 4.f / 3.f, 0.5f, 100.f);
+	Mul(&ViewProj, View, Proj);
+	FRUSTUM_PLANES Frustum(ViewProj);
+
+	RunBenchmark(_T("RayToBox x1024"), [&](uint64 Iterations) {
+		float T;
+		uint Hits = 0;
+		for (uint64 i = 0; i < Iterations; i++)
+			for (uint j = 0; j < COUNT; j++)
+				Hits += RayToBox(&T, Origins[j], Dirs[j], Boxes[j]) ? 1 : 0;
+		DoNotOptimize(Hits);
+	});
+	RunBenchmark(_T("RayToSphere x1024"), [&](uint64 Iterations) {
+		float T;
+		uint Hits = 0;
+		for (uint64 i = 0; i < Iterations; i++)
+			for (uint j = 0; j < COUNT; j++)
+				Hits += RayToSphere(Origins[j], Dirs[j], Points[j], 2.f, &T) ? 1 : 0;
+		DoNotOptimize(Hits);
+	});
+	RunBenchmark(_T("RayToTriangle x1024"), [&](uint64 Iterations) {
+		float T;
+		uint Hits = 0;
+		for (uint64 i = 0; i < Iterations; i++)
+			for (uint j = 0; j < COUNT; j++)
+				Hits += RayToTriangle(Origins[j], Dirs[j], Boxes[j].Min, Boxes[j].Max, Points[(j+1) % COUNT], false, &T) ? 1 : 0;
+		DoNotOptimize(Hits);
+	});
+	RunBenchmark(_T("SphereToBox x1024"), [&](uint64 Iterations) {
+		uint Hits = 0;
+		for (uint64 i = 0; i < Iterations; i++)
+			for (uint j = 0; j < COUNT; j++)
+				Hits += SphereToBox(Origins[j], 1.f, Boxes[j]) ? 1 : 0;
+		DoNotOptimize(Hits);
+	});
+	RunBenchmark(_T("BoxToFrustum_Fast x1024"), [&](uint64 Iterations) {
+		uint Hits = 0;
+		for (uint64 i = 0; i < Iterations; i++)
+			for (uint j = 0; j < COUNT; j++)
+				Hits += BoxToFrustum_Fast(Boxes[j], Frustum) ? 1 : 0;
+		DoNotOptimize(Hits);
+	});
+	RunBenchmark(_T("SphereToFrustum_Fast x1024"), [&](uint64 Iterations) {
+		uint Hits = 0;
+		for (uint64 i = 0; i < Iterations; i++)
+			for (uint j = 0; j < COUNT; j++)
+				Hits += SphereToFrustum_Fast(Points[j], 1.f, Frustum) ? 1 : 0;
+		DoNotOptimize(Hits);
+	});
+}
+
+//HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
+// Logger
+
+// Log ktry nic nie robi - mierzy si sam koszt loggera
+class NullLog : public ILog
+{
+protected:
+	virtual void OnLog(uint32 Type, const tstring &Prefix, const tstring &TypePrefix, const tstring &Message) { DoNotOptimize(Message); }
+};
+
+void BenchmarkLogger()
+{
+	NullLog Log;
+	CreateLogger(false);
+	GetLogger().AddLogMapping(0xFFFFFFFF, &Log);
+	GetLogger().SetPrefixFormat(_T("[%D %T] "));
+
+	RunBenchmark(_T("Logger::Log"), [&](uint64 Iterations) {
+		for (uint64 i = 0; i < Iterations; i++)
+			GetLogger().Log(1, _T("Benchmark message"));
+	});
+	RunBenchmark(_T("Logger::Log with Format"), [&](uint64 Iterations) {
+		for (uint64 i = 0; i < Iterations; i++)
+			GetLogger().Log(1, Format(_T("Benchmark message # of #")) % i % Iterations);
+	});
+
+	DestroyLogger();
+}
+
+//HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
+
+enum OPT
+{
+	OPT_FILTER = 1,
+	OPT_REPETITIONS,
+	OPT_MIN_TIME,
+	OPT_CSV,
+	OPT_JSON,
+};
+
+void Benchmark(int argc, tchar **argv)
+{
+	GameTime::Initialize();
+
+	tstring CsvFileName, JsonFileName;
+	CmdLineParser Parser(argc, argv);
+	Parser.RegisterOpt(OPT_FILTER, _T("filter"), true);
+	Parser.RegisterOpt(OPT_REPETITIONS, _T("repetitions"), true);
+	Parser.RegisterOpt(OPT_MIN_TIME, _T("min-time"), true);
+	Parser.RegisterOpt(OPT_CSV, _T("csv"), true);
+	Parser.RegisterOpt(OPT_JSON, _T("json"), true);
+	CmdLineParser::RESULT R;
+	while ((R = Parser.ReadNext()) == CmdLineParser::RESULT_OPT)
+	{
+		const tstring &Param = Parser.GetParameter();
+		uint32 Repetitions;
+		double MinTime;
+		switch (Parser.GetOptId())
+		{
+		case OPT_FILTER:
+			g_Runner.SetFilter(Param);
+			break;
+		case OPT_REPETITIONS:
+			if (StrToUint(&Repetitions, Param) != 0)
+				throw Error(_T("Invalid --repetitions: ") + Param, __TFILE__, __LINE__);
+			g_Runner.SetRepetitions(Repetitions);
+			break;
+		case OPT_MIN_TIME:
+			if (StrToDouble(&MinTime, Param) != 0)
+				throw Error(_T("Invalid --min-time: ") + Param, __TFILE__, __LINE__);
+			g_Runner.SetMinRepetitionSeconds(MinTime);
+			break;
+		case OPT_CSV:
+			CsvFileName = Param;
+			break;
+		case OPT_JSON:
+			JsonFileName = Param;
+			break;
+		}
+	}
+	if (R == CmdLineParser::RESULT_ERROR || R == CmdLineParser::RESULT_PARAMETER)
+		throw Error(_T("Usage: BenchmarkExe [--filter Name] [--repetitions N] [--min-time Seconds] [--csv File] [--json File]"), __TFILE__, __LINE__);
+
+	BenchmarkFreeList();
+	BenchmarkStream();
+	BenchmarkTokenizer();
+	BenchmarkMath();
+	BenchmarkLogger();
+
+	if (!CsvFileName.empty())
+	{
+		FileStream File(CsvFileName, FM_WRITE);
+		g_Runner.ExportCsv(&File);
+	}
+	if (!JsonFileName.empty())
+	{
+		FileStream File(JsonFileName, FM_WRITE);
+		g_Runner.ExportJson(&File);
+	}
+}
+
+#ifdef _WIN32
+int _tmain(int argc, tchar* argv[], tchar* envp[])
+#else
+int main(int argc, char* argv[])
+#endif
+{
+	try
+	{
+		Benchmark(argc, argv);
+	}
+	catch (const Error& Err)
+	{
+		tstring s;
+		Err.GetMessage_(&s);
+		tcout << s << endl;
+		return 1;
+	}
+	return 0;
+}
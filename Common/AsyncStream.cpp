@@ -0,0 +1,411 @@
+/** \file
+\brief Asynchronous overlay stream
+\author Adam Sawicki - sawickiap@poczta.onet.pl - http://asawicki.info/ \n
+
+Part of CommonLib library. \n
+Encoding UTF-8, end of line CR+LF \n
+License: GNU LGPL. \n
+Documentation: \ref Module_Stream \n
+Module components: \ref code_stream
+*/
+#include "Base.hpp"
+#include <deque>
+#include "Error.hpp"
+#include "Threads.hpp"
+#include "AsyncStream.hpp"
+
+
+namespace common
+{
+
+//HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
+// Klasa AsyncOverlayStream
+
+class AsyncOverlayStream_pimpl
+{
+	DECLARE_NO_COPY_CLASS(AsyncOverlayStream_pimpl)
+
+public:
+	class IoThread : public Thread
+	{
+	private:
+		AsyncOverlayStream_pimpl *m_Pimpl;
+	protected:
+		virtual void Run() { m_Pimpl->ThreadFunc(); }
+	public:
+		IoThread(AsyncOverlayStream_pimpl *Pimpl) : m_Pimpl(Pimpl) { }
+	};
+
+	Stream *m_Stream;
+	ASYNC_STREAM_MODE m_Mode;
+	size_t m_BufferSize;
+	std::vector< std::vector<char> > m_Buffers;
+	// Liczba bajtów danych w każdym buforze
+	std::vector<size_t> m_Sizes;
+
+	Mutex m_Mutex;
+	Cond m_Cond;
+	// Bufory wolne i bufory z danymi - dla ASYNC_READ wątek bierze wolne i oddaje pełne,
+	// dla ASYNC_WRITE odwrotnie
+	std::deque<uint> m_Free, m_Filled;
+	// Wątek właśnie przetwarza bufor
+	bool m_Busy;
+	// Wątek skończył - koniec danych albo błąd odczytu
+	bool m_Done;
+	bool m_Stop;
+	// Błąd z wątku, rzucany przy następnym wywołaniu po stronie użytkownika
+	scoped_ptr<Error> m_Error;
+	// m_Error został już rzucony do użytkownika
+	bool m_ErrorReported;
+	scoped_ptr<IoThread> m_Thread;
+
+	// Bufor używany przez stronę użytkownika i pozycja w nim, albo MAXUINT32
+	uint m_Current;
+	size_t m_CurrentPos;
+
+	AsyncOverlayStream_pimpl() : m_Mutex(0) { }
+	void ThreadFunc();
+	// Wywoływać pod m_Mutex
+	void ThrowError();
+	// ASYNC_READ: zapewnia, że bieżący bufor ma nieprzeczytane dane. Zwraca false, jeśli koniec.
+	bool EnsureReadBuffer();
+	// ASYNC_WRITE: zapewnia bieżący bufor z co najmniej MinSize bajtów wolnego miejsca
+	void EnsureWriteBuffer(size_t MinSize);
+	// ASYNC_WRITE: oddaje bieżący bufor wątkowi do zapisania
+	void SubmitWriteBuffer();
+	// ASYNC_WRITE: czeka, aż wątek zapisze wszystkie oddane bufory
+	void WaitForWrites();
+	// Kończy wątek i czeka na niego
+	void StopThread();
+};
+
+void AsyncOverlayStream_pimpl::ThreadFunc()
+{
+	uint Index;
+	bool Last;
+	for (;;)
+	{
+		{
+			MUTEX_LOCK(m_Mutex);
+			std::deque<uint> &Input = (m_Mode == ASYNC_READ) ? m_Free : m_Filled;
+			while (Input.empty() && !m_Stop)
+				m_Cond.Wait(&m_Mutex);
+			// Przy zapisie kończy dopiero, kiedy wszystko zapisane
+			if (m_Stop && (m_Mode == ASYNC_READ || Input.empty()))
+				break;
+			Index = Input.front();
+			Input.pop_front();
+			m_Busy = true;
+		}
+
+		Last = false;
+		try
+		{
+			if (m_Mode == ASYNC_READ)
+			{
+				m_Sizes[Index] = m_Stream->Read(&m_Buffers[Index][0], m_BufferSize);
+				Last = (m_Sizes[Index] < m_BufferSize);
+			}
+			// Po błędzie zapisu pozostałe dane są tylko odrzucane
+			else if (m_Error.is_null())
+				m_Stream->Write(&m_Buffers[Index][0], m_Sizes[Index]);
+		}
+		catch (const Error &e)
+		{
+			MUTEX_LOCK(m_Mutex);
+			m_Error.reset(new Error(e));
+		}
+		catch (...)
+		{
+			MUTEX_LOCK(m_Mutex);
+			m_Error.reset(new Error(_T("Unknown error."), __TFILE__, __LINE__));
+		}
+
+		{
+			MUTEX_LOCK(m_Mutex);
+			m_Busy = false;
+			if (m_Mode == ASYNC_WRITE)
+				m_Free.push_back(Index);
+			else if (!m_Error.is_null())
+			{
+				m_Free.push_back(Index);
+				Last = true;
+			}
+			else
+				m_Filled.push_back(Index);
+			if (Last)
+				m_Done = true;
+			m_Cond.Broadcast();
+			if (Last)
+				break;
+		}
+	}
+}
+
+void AsyncOverlayStream_pimpl::ThrowError()
+{
+	m_ErrorReported = true;
+	Error E(*m_Error.get());
+	E.Push(_T("AsyncOverlayStream: Background I/O failed."), __TFILE__, __LINE__);
+	throw E;
+}
+
+bool AsyncOverlayStream_pimpl::EnsureReadBuffer()
+{
+	if (m_Mode != ASYNC_READ)
+		throw Error(_T("AsyncOverlayStream: Cannot read in ASYNC_WRITE mode."), __TFILE__, __LINE__);
+	assert(!m_Thread.is_null() && "AsyncOverlayStream used after Close.");
+	if (m_Current != MAXUINT32 && m_CurrentPos < m_Sizes[m_Current])
+		return true;
+
+	MUTEX_LOCK(m_Mutex);
+	// Przeczytany bufor wraca do wątku
+	if (m_Current != MAXUINT32)
+	{
+		m_Free.push_back(m_Current);
+		m_Current = MAXUINT32;
+		m_Cond.Broadcast();
+	}
+	while (m_Filled.empty() && !m_Done)
+		m_Cond.Wait(&m_Mutex);
+	if (m_Filled.empty())
+	{
+		if (!m_Error.is_null())
+			ThrowError();
+		return false;
+	}
+	m_Current = m_Filled.front();
+	m_Filled.pop_front();
+	m_CurrentPos = 0;
+	return m_Sizes[m_Current] > 0;
+}
+
+void AsyncOverlayStream_pimpl::EnsureWriteBuffer(size_t MinSize)
+{
+	if (m_Mode != ASYNC_WRITE)
+		throw Error(_T("AsyncOverlayStream: Cannot write in ASYNC_READ mode."), __TFILE__, __LINE__);
+	assert(!m_Thread.is_null() && "AsyncOverlayStream used after Close.");
+	if (m_Current != MAXUINT32 && m_BufferSize - m_CurrentPos >= MinSize)
+		return;
+	SubmitWriteBuffer();
+
+	MUTEX_LOCK(m_Mutex);
+	while (m_Free.empty())
+		m_Cond.Wait(&m_Mutex);
+	if (!m_Error.is_null())
+		ThrowError();
+	m_Current = m_Free.front();
+	m_Free.pop_front();
+	m_CurrentPos = 0;
+}
+
+void AsyncOverlayStream_pimpl::SubmitWriteBuffer()
+{
+	if (m_Current == MAXUINT32)
+		return;
+	MUTEX_LOCK(m_Mutex);
+	m_Sizes[m_Current] = m_CurrentPos;
+	if (m_CurrentPos > 0)
+		m_Filled.push_back(m_Current);
+	else
+		m_Free.push_back(m_Current);
+	m_Current = MAXUINT32;
+	m_Cond.Broadcast();
+}
+
+void AsyncOverlayStream_pimpl::WaitForWrites()
+{
+	SubmitWriteBuffer();
+	MUTEX_LOCK(m_Mutex);
+	while (!m_Filled.empty() || m_Busy)
+		m_Cond.Wait(&m_Mutex);
+	if (!m_Error.is_null())
+		ThrowError();
+}
+
+void AsyncOverlayStream_pimpl::StopThread()
+{
+	{
+		MUTEX_LOCK(m_Mutex);
+		m_Stop = true;
+		m_Cond.Broadcast();
+	}
+	m_Thread->Join();
+	m_Thread.reset();
+}
+
+AsyncOverlayStream::AsyncOverlayStream(Stream *a_Stream, ASYNC_STREAM_MODE Mode, size_t BufferSize, uint BufferCount) :
+	OverlayStream(a_Stream),
+	pimpl(new AsyncOverlayStream_pimpl)
+{
+	assert(BufferSize > 0);
+	// Co najmniej jeden bufor dla użytkownika i jeden dla wątku
+	BufferCount = std::max(BufferCount, 2u);
+
+	pimpl->m_Stream = a_Stream;
+	pimpl->m_Mode = Mode;
+	pimpl->m_BufferSize = BufferSize;
+	pimpl->m_Buffers.resize(BufferCount);
+	pimpl->m_Sizes.resize(BufferCount, 0);
+	for (uint i = 0; i < BufferCount; i++)
+	{
+		pimpl->m_Buffers[i].resize(BufferSize);
+		pimpl->m_Free.push_back(i);
+	}
+	pimpl->m_Busy = false;
+	pimpl->m_Done = false;
+	pimpl->m_Stop = false;
+	pimpl->m_ErrorReported = false;
+	pimpl->m_Current = MAXUINT32;
+	pimpl->m_CurrentPos = 0;
+
+	pimpl->m_Thread.reset(new AsyncOverlayStream_pimpl::IoThread(pimpl.get()));
+	pimpl->m_Thread->Start();
+}
+
+AsyncOverlayStream::~AsyncOverlayStream()
+{
+	if (pimpl->m_Thread.is_null())
+		return;
+	bool Reported;
+	{
+		MUTEX_LOCK(pimpl->m_Mutex);
+		Reported = pimpl->m_ErrorReported;
+	}
+	// Błąd już rzucony do użytkownika nie jest zgłaszany drugi raz
+	if (pimpl->m_Mode == ASYNC_WRITE && !Reported)
+	{
+		try
+		{
+			Flush();
+		}
+		catch (...)
+		{
+			// Użytkownik nie dowiedział się, że dane nie zostały zapisane
+			assert(0 && "AsyncOverlayStream: Background write failed after the last call. Call AsyncOverlayStream::Close to get the error.");
+		}
+	}
+	pimpl->StopThread();
+}
+
+void AsyncOverlayStream::Close()
+{
+	if (pimpl->m_Thread.is_null())
+		return;
+	try
+	{
+		Flush();
+	}
+	catch (...)
+	{
+		pimpl->StopThread();
+		throw;
+	}
+	pimpl->StopThread();
+}
+
+void AsyncOverlayStream::Write(const void *Data, size_t Size)
+{
+	const char *CharData = (const char*)Data;
+	size_t BlockSize;
+	// Size będzie zmniejszany, CharData przesuwany.
+	while (Size > 0)
+	{
+		pimpl->EnsureWriteBuffer(1);
+		BlockSize = std::min(pimpl->m_BufferSize - pimpl->m_CurrentPos, Size);
+		common_memcpy(&pimpl->m_Buffers[pimpl->m_Current][pimpl->m_CurrentPos], CharData, BlockSize);
+		pimpl->m_CurrentPos += BlockSize;
+		CharData += BlockSize;
+		Size -= BlockSize;
+		if (pimpl->m_CurrentPos == pimpl->m_BufferSize)
+			pimpl->SubmitWriteBuffer();
+	}
+}
+
+void AsyncOverlayStream::Flush()
+{
+	// Przy odczycie strumień należy do wątku - nie ma czego opróżniać
+	if (pimpl->m_Mode == ASYNC_WRITE)
+	{
+		pimpl->WaitForWrites();
+		GetStream()->Flush();
+	}
+}
+
+size_t AsyncOverlayStream::Read(void *Data, size_t MaxLength)
+{
+	char *OutChars = (char*)Data;
+	size_t BlockSize, Sum = 0;
+	// MaxLength będzie zmniejszane, OutChars przesuwane.
+	while (MaxLength > 0)
+	{
+		if (!pimpl->EnsureReadBuffer())
+			break;
+		BlockSize = std::min(pimpl->m_Sizes[pimpl->m_Current] - pimpl->m_CurrentPos, MaxLength);
+		common_memcpy(OutChars, &pimpl->m_Buffers[pimpl->m_Current][pimpl->m_CurrentPos], BlockSize);
+		pimpl->m_CurrentPos += BlockSize;
+		OutChars += BlockSize;
+		MaxLength -= BlockSize;
+		Sum += BlockSize;
+	}
+	return Sum;
+}
+
+bool AsyncOverlayStream::End()
+{
+	if (pimpl->m_Mode != ASYNC_READ)
+		return Stream::End();
+	return !pimpl->EnsureReadBuffer();
+}
+
+size_t AsyncOverlayStream::Skip(size_t MaxLength)
+{
+	size_t BlockSize, Sum = 0;
+	while (MaxLength > 0)
+	{
+		if (!pimpl->EnsureReadBuffer())
+			break;
+		BlockSize = std::min(pimpl->m_Sizes[pimpl->m_Current] - pimpl->m_CurrentPos, MaxLength);
+		pimpl->m_CurrentPos += BlockSize;
+		MaxLength -= BlockSize;
+		Sum += BlockSize;
+	}
+	return Sum;
+}
+
+size_t AsyncOverlayStream::AcquireReadSpan(const void **OutData)
+{
+	*OutData = NULL;
+	if (pimpl->m_Mode != ASYNC_READ || !pimpl->EnsureReadBuffer())
+		return 0;
+	*OutData = &pimpl->m_Buffers[pimpl->m_Current][pimpl->m_CurrentPos];
+	return pimpl->m_Sizes[pimpl->m_Current] - pimpl->m_CurrentPos;
+}
+
+void AsyncOverlayStream::ReleaseRead(size_t Size)
+{
+	assert(Size == 0 || (pimpl->m_Current != MAXUINT32 && pimpl->m_CurrentPos + Size <= pimpl->m_Sizes[pimpl->m_Current]));
+	pimpl->m_CurrentPos += Size;
+}
+
+size_t AsyncOverlayStream::AcquireWriteSpan(void **OutData, size_t MinSize)
+{
+	*OutData = NULL;
+	if (pimpl->m_Mode != ASYNC_WRITE || MinSize == 0 || MinSize > pimpl->m_BufferSize)
+		return 0;
+	pimpl->EnsureWriteBuffer(MinSize);
+	*OutData = &pimpl->m_Buffers[pimpl->m_Current][pimpl->m_CurrentPos];
+	return pimpl->m_BufferSize - pimpl->m_CurrentPos;
+}
+
+void AsyncOverlayStream::CommitWrite(size_t Size)
+{
+	if (Size == 0)
+		return;
+	assert(pimpl->m_Current != MAXUINT32 && pimpl->m_CurrentPos + Size <= pimpl->m_BufferSize);
+	pimpl->m_CurrentPos += Size;
+	if (pimpl->m_CurrentPos == pimpl->m_BufferSize)
+		pimpl->SubmitWriteBuffer();
+}
+
+} // namespace common
@@ -0,0 +1,83 @@
+/** \file
+\brief Asynchronous overlay stream
+\author Adam Sawicki - sawickiap@poczta.onet.pl - http://asawicki.info/ \n
+
+Part of CommonLib library. \n
+Encoding UTF-8, end of line CR+LF \n
+License: GNU LGPL. \n
+Documentation: \ref Module_Stream \n
+Module components: \ref code_stream
+*/
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#pragma once
+#endif
+#ifndef COMMON_ASYNC_STREAM_H_
+#define COMMON_ASYNC_STREAM_H_
+
+#include "Stream.hpp"
+
+namespace common
+{
+
+/** \addtogroup code_stream
+Nagwek: AsyncStream.hpp */
+//@{
+
+/// Direction of data in common::AsyncOverlayStream
+enum ASYNC_STREAM_MODE
+{
+	ASYNC_READ,  ///< Background thread reads ahead from the underlying stream
+	ASYNC_WRITE, ///< Background thread writes to the underlying stream
+};
+
+/// \internal
+class AsyncOverlayStream_pimpl;
+
+/// Overlay that does I/O of the underlying stream on a background thread
+/** Data goes through BufferCount buffers of BufferSize bytes each.
+- In ASYNC_READ mode the thread reads ahead into free buffers, while Read takes
+  data from buffers already filled.
+- In ASYNC_WRITE mode Write fills a buffer and hands it to the thread when full,
+  without waiting for the underlying Write. Flush waits until all data is written.
+
+This way e.g. decompression can run at the same time as reading the file.
+Underlying stream mustn't be used directly while this object exists.
+Errors of the background thread are thrown from the next call on this stream.
+In ASYNC_WRITE mode call Close at the end to get also errors of the last writes -
+the destructor cannot throw them.
+Supports Stream::AcquireReadSpan / Stream::AcquireWriteSpan, giving access
+directly to its buffers. */
+class AsyncOverlayStream : public OverlayStream
+{
+public:
+	AsyncOverlayStream(Stream *a_Stream, ASYNC_STREAM_MODE Mode, size_t BufferSize = 64*1024, uint BufferCount = 3);
+	/** Calls Close if it wasn't called before. Error of the background thread that
+	wasn't thrown to the user before is reported with an assert. */
+	~AsyncOverlayStream();
+
+	/// Writes all remaining data and stops the background thread
+	/** Throws error of the background thread, if any. Stream mustn't be used after
+	this call. Calling Close again does nothing. */
+	void Close();
+
+	// ====== Implementacja Stream ======
+	virtual void Write(const void *Data, size_t Size);
+	virtual void Flush();
+	virtual size_t Read(void *Data, size_t MaxLength);
+	virtual bool End();
+	virtual size_t Skip(size_t MaxLength);
+	virtual size_t AcquireReadSpan(const void **OutData);
+	virtual void ReleaseRead(size_t Size);
+	virtual size_t AcquireWriteSpan(void **OutData, size_t MinSize = 1);
+	virtual void CommitWrite(size_t Size);
+
+private:
+	scoped_ptr<AsyncOverlayStream_pimpl> pimpl;
+};
+
+//@}
+// code_stream
+
+} // namespace common
+
+#endif
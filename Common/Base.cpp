@@ -511,6 +511,34 @@ void DuplicateString(tstring *Out, const tstring &s, size_t count)
 		*Out += s;
 }
 
+void AppendJsonString(tstring *InOut, const tchar *s, size_t Length)
+{
+	*InOut += _T('"');
+	for (size_t i = 0; i < Length; i++)
+	{
+		tchar ch = s[i];
+		switch (ch)
+		{
+		case _T('"'):  *InOut += _T("\\\""); break;
+		case _T('\\'): *InOut += _T("\\\\"); break;
+		case _T('\n'): *InOut += _T("\\n"); break;
+		case _T('\r'): *InOut += _T("\\r"); break;
+		case _T('\t'): *InOut += _T("\\t"); break;
+		default:
+			if ((uint)ch < 0x20)
+			{
+				tstring Code;
+				UintToStr2(&Code, (uint)ch, 4, 16);
+				*InOut += _T("\\u");
+				*InOut += Code;
+			}
+			else
+				*InOut += ch;
+		}
+	}
+	*InOut += _T('"');
+}
+
 void RightStr(tstring *Out, const tstring &s, size_t Length)
 {
 	Length = std::min(Length, s.length());
@@ -2055,7 +2083,7 @@ uint log2u(uint v)
 	v |= v >> 8;
 	v |= v >> 16;
 	v = (v >> 1) + 1;
-	return MultiplyDeBruijnBitPosition[(v * 0x077CB531UL) >> 27];
+	return MultiplyDeBruijnBitPosition[(uint32)(v * 0x077CB531u) >> 27];
 }
 
 /// \internal
@@ -195,6 +195,15 @@ typedef std::vector<tstring> STRING_VECTOR;
 	#else
 		#define ASSERT_INT3_DEBUG(x) { }
 	#endif
+#else
+	/// Assert that ALWAYS breaks the program when false.
+	#define	ASSERT_INT3(x) if ((x) == 0) { __builtin_trap(); }
+	/// Assert that in Debug configuration breaks the program when false.
+	#ifdef _DEBUG
+		#define	ASSERT_INT3_DEBUG(x) if ((x) == 0) { __builtin_trap(); }
+	#else
+		#define ASSERT_INT3_DEBUG(x) { }
+	#endif
 #endif
 
 /// For making structures aligned to one byte - without paddings
@@ -1568,6 +1577,11 @@ void NormalizeWhitespace(tstring *result, const tstring &s);
 /// Zwraca acuch powtrzony podan liczb razy
 void DuplicateString(tstring *Out, const tstring &s, size_t count);
 
+/// Appends string in quotes, escaped the way JSON requires
+/** Escapes quotes, backslashes and control characters. */
+void AppendJsonString(tstring *InOut, const tchar *s, size_t Length);
+inline void AppendJsonString(tstring *InOut, const tstring &s) { AppendJsonString(InOut, s.data(), s.length()); }
+
 /// Zwraca podacuch z prawej strony
 void RightStr(tstring *Out, const tstring &s, size_t Length);
 
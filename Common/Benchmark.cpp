@@ -0,0 +1,228 @@
+/** \file
+\brief Microbenchmark harness
+\author Adam Sawicki - sawickiap@poczta.onet.pl - http://asawicki.info/ \n
+
+Part of CommonLib library. \n
+Encoding UTF-8, end of line CR+LF \n
+License: GNU LGPL. \n
+Documentation: \ref Module_Benchmark \n
+Module components: \ref code_benchmark
+*/
+#include "Base.hpp"
+#include "Stream.hpp"
+#include "Profiler.hpp"
+#include "Benchmark.hpp"
+#include <algorithm>
+#include <cmath>
+
+
+namespace common
+{
+
+// Runs the function once and returns its time in seconds
+static double MeasureBenchmark(const BENCHMARK_FUNC &Func, uint64 Iterations)
+{
+	int64 Begin = GetProfilerTicks();
+	Func(Iterations);
+	int64 End = GetProfilerTicks();
+	return (double)(End - Begin) / (double)GetProfilerTickFrequency();
+}
+
+static void WriteUtf8(Stream *Out, const tstring &S)
+{
+#ifdef _UNICODE
+	string Utf8;
+	ConvertUnicodeToChars(&Utf8, S, CP_UTF8);
+	Out->Write(Utf8.data(), Utf8.length());
+#else
+	Out->Write(S.data(), S.length());
+#endif
+}
+
+// Appends time in nanoseconds
+static void AppendNanoseconds(tstring *Out, double Seconds)
+{
+	*Out += DoubleToStrR(Seconds * 1e9, 'f', 3);
+}
+
+// Appends time with unit suitable for its magnitude
+static void AppendTime(tstring *Out, double Seconds)
+{
+	if (Seconds < 1e-6)
+	{
+		*Out += DoubleToStrR(Seconds * 1e9, 'f', 2);
+		*Out += _T(" ns");
+	}
+	else if (Seconds < 1e-3)
+	{
+		*Out += DoubleToStrR(Seconds * 1e6, 'f', 2);
+		*Out += _T(" us");
+	}
+	else
+	{
+		*Out += DoubleToStrR(Seconds * 1e3, 'f', 2);
+		*Out += _T(" ms");
+	}
+}
+
+BenchmarkRunner::BenchmarkRunner() :
+	m_Repetitions(10),
+	m_MinRepetitionSeconds(0.05),
+	m_WarmupSeconds(0.1)
+{
+}
+
+bool BenchmarkRunner::Run(const tstring &Name, const BENCHMARK_FUNC &Func, uint64 BytesPerIteration)
+{
+	if (!m_Filter.empty() && Name.find(m_Filter) == tstring::npos)
+		return false;
+
+	// Kalibracja liczby iteracji - przy okazji rozgrzewa
+	uint64 Iterations = 1;
+	double WarmupTime = 0.0;
+	for (;;)
+	{
+		double Time = MeasureBenchmark(Func, Iterations);
+		WarmupTime += Time;
+		if (Time >= m_MinRepetitionSeconds)
+			break;
+		// Z zapasem 20%, ale nie więcej niż 10 razy na raz, bo pierwsze pomiary są niedokładne
+		double Factor = Time > 0.0 ? m_MinRepetitionSeconds * 1.2 / Time : 10.0;
+		Factor = std::min(std::max(Factor, 2.0), 10.0);
+		Iterations = (uint64)((double)Iterations * Factor);
+	}
+	while (WarmupTime < m_WarmupSeconds)
+		WarmupTime += MeasureBenchmark(Func, Iterations);
+
+	std::vector<double> Times(m_Repetitions);
+	for (uint i = 0; i < m_Repetitions; i++)
+		Times[i] = MeasureBenchmark(Func, Iterations) / (double)Iterations;
+
+	BENCHMARK_RESULT Result;
+	Result.Name = Name;
+	Result.Iterations = Iterations;
+	Result.Repetitions = m_Repetitions;
+	Result.BytesPerIteration = BytesPerIteration;
+
+	double Sum = 0.0;
+	for (uint i = 0; i < m_Repetitions; i++)
+		Sum += Times[i];
+	Result.MeanSeconds = Sum / (double)m_Repetitions;
+	double SqSum = 0.0;
+	for (uint i = 0; i < m_Repetitions; i++)
+		SqSum += (Times[i] - Result.MeanSeconds) * (Times[i] - Result.MeanSeconds);
+	Result.StdDevSeconds = m_Repetitions > 1 ? sqrt(SqSum / (double)(m_Repetitions - 1)) : 0.0;
+
+	std::sort(Times.begin(), Times.end());
+	Result.MinSeconds = Times.front();
+	Result.MaxSeconds = Times.back();
+	size_t Middle = m_Repetitions / 2;
+	Result.MedianSeconds = (m_Repetitions % 2) ? Times[Middle] : (Times[Middle-1] + Times[Middle]) * 0.5;
+
+	m_Results.push_back(Result);
+	return true;
+}
+
+void BenchmarkRunner::FormatResult(tstring *Out, const BENCHMARK_RESULT &Result)
+{
+	Out->clear();
+	*Out += Result.Name;
+	*Out += _T(" : ");
+	AppendTime(Out, Result.MedianSeconds);
+	*Out += _T(" (min ");
+	AppendTime(Out, Result.MinSeconds);
+	*Out += _T(", max ");
+	AppendTime(Out, Result.MaxSeconds);
+	*Out += _T(", stddev ");
+	*Out += DoubleToStrR(Result.MeanSeconds > 0.0 ? Result.StdDevSeconds / Result.MeanSeconds * 100.0 : 0.0, 'f', 1);
+	*Out += _T("%)");
+	if (Result.BytesPerIteration > 0)
+	{
+		*Out += _T(", ");
+		*Out += DoubleToStrR(Result.GetBytesPerSecond() / (1024.0 * 1024.0), 'f', 1);
+		*Out += _T(" MB/s");
+	}
+}
+
+void BenchmarkRunner::FormatString(tstring *Out)
+{
+	Out->clear();
+	tstring Line;
+	for (size_t i = 0; i < m_Results.size(); i++)
+	{
+		FormatResult(&Line, m_Results[i]);
+		*Out += Line;
+		*Out += _T('\n');
+	}
+}
+
+void BenchmarkRunner::ExportCsv(Stream *Out)
+{
+	tstring Csv = _T("name,iterations,repetitions,min_ns,median_ns,mean_ns,max_ns,stddev_ns,bytes_per_iteration,mb_per_s\n");
+	for (size_t i = 0; i < m_Results.size(); i++)
+	{
+		const BENCHMARK_RESULT &R = m_Results[i];
+		// Nazwa w cudzysłowach, cudzysłów podwojony
+		Csv += _T('"');
+		for (size_t j = 0; j < R.Name.length(); j++)
+		{
+			if (R.Name[j] == _T('"'))
+				Csv += _T('"');
+			Csv += R.Name[j];
+		}
+		Csv += _T("\",");
+		Csv += UintToStrR(R.Iterations);
+		Csv += _T(',');
+		Csv += UintToStrR(R.Repetitions);
+		Csv += _T(',');
+		AppendNanoseconds(&Csv, R.MinSeconds);
+		Csv += _T(',');
+		AppendNanoseconds(&Csv, R.MedianSeconds);
+		Csv += _T(',');
+		AppendNanoseconds(&Csv, R.MeanSeconds);
+		Csv += _T(',');
+		AppendNanoseconds(&Csv, R.MaxSeconds);
+		Csv += _T(',');
+		AppendNanoseconds(&Csv, R.StdDevSeconds);
+		Csv += _T(',');
+		Csv += UintToStrR(R.BytesPerIteration);
+		Csv += _T(',');
+		Csv += DoubleToStrR(R.GetBytesPerSecond() / (1024.0 * 1024.0), 'f', 3);
+		Csv += _T('\n');
+	}
+	WriteUtf8(Out, Csv);
+}
+
+void BenchmarkRunner::ExportJson(Stream *Out)
+{
+	tstring Json = _T("{\"benchmarks\":[");
+	for (size_t i = 0; i < m_Results.size(); i++)
+	{
+		const BENCHMARK_RESULT &R = m_Results[i];
+		Json += (i > 0 ? _T(",\n") : _T("\n"));
+		Json += _T("{\"name\":");
+		AppendJsonString(&Json, R.Name);
+		Json += _T(",\"iterations\":");
+		Json += UintToStrR(R.Iterations);
+		Json += _T(",\"repetitions\":");
+		Json += UintToStrR(R.Repetitions);
+		Json += _T(",\"min_ns\":");
+		AppendNanoseconds(&Json, R.MinSeconds);
+		Json += _T(",\"median_ns\":");
+		AppendNanoseconds(&Json, R.MedianSeconds);
+		Json += _T(",\"mean_ns\":");
+		AppendNanoseconds(&Json, R.MeanSeconds);
+		Json += _T(",\"max_ns\":");
+		AppendNanoseconds(&Json, R.MaxSeconds);
+		Json += _T(",\"stddev_ns\":");
+		AppendNanoseconds(&Json, R.StdDevSeconds);
+		Json += _T(",\"bytes_per_iteration\":");
+		Json += UintToStrR(R.BytesPerIteration);
+		Json += _T('}');
+	}
+	Json += _T("\n]}\n");
+	WriteUtf8(Out, Json);
+}
+
+
+} // namespace common
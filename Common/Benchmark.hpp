@@ -0,0 +1,119 @@
+/** \file
+\brief Microbenchmark harness
+\author Adam Sawicki - sawickiap@poczta.onet.pl - http://asawicki.info/ \n
+
+Part of CommonLib library. \n
+Encoding UTF-8, end of line CR+LF \n
+License: GNU LGPL. \n
+Documentation: \ref Module_Benchmark \n
+Module components: \ref code_benchmark
+*/
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#pragma once
+#endif
+#ifndef COMMON_BENCHMARK_H_
+#define COMMON_BENCHMARK_H_
+
+#include <functional>
+#ifdef _MSC_VER
+	#include <intrin.h> // dla _ReadWriteBarrier
+#endif
+
+namespace common
+{
+
+class Stream;
+
+/** \addtogroup code_benchmark Benchmark module
+Documentation: \ref Module_Benchmark \n
+Header: Benchmark.hpp */
+//@{
+
+/// Prevents compiler from removing computation of the value as unused.
+template <typename T>
+inline void DoNotOptimize(const T &Value)
+{
+#ifdef _MSC_VER
+	const volatile char *Ptr = (const volatile char*)&Value;
+	(void)*Ptr;
+	_ReadWriteBarrier();
+#else
+	asm volatile("" : : "g"(&Value) : "memory");
+#endif
+}
+
+/// Result of a single benchmark. Times are per one iteration.
+struct BENCHMARK_RESULT
+{
+	tstring Name;
+	/// Number of iterations in each repetition
+	uint64 Iterations;
+	uint Repetitions;
+	double MinSeconds;
+	double MedianSeconds;
+	double MeanSeconds;
+	double MaxSeconds;
+	/// Standard deviation of the repetitions
+	double StdDevSeconds;
+	/// Number of bytes processed by one iteration, 0 if not given
+	uint64 BytesPerIteration;
+
+	/// Returns throughput based on the median time, 0 if BytesPerIteration is 0.
+	double GetBytesPerSecond() const { return MedianSeconds > 0.0 ? (double)BytesPerIteration / MedianSeconds : 0.0; }
+};
+
+/// Function measured by BenchmarkRunner. Must execute the operation given number of times.
+typedef std::function<void(uint64 Iterations)> BENCHMARK_FUNC;
+
+/// Runs benchmarks, computes statistics of their times and writes the results.
+/** Each benchmark is first called with growing number of iterations until one
+call takes at least the minimum repetition time, then called repeatedly during
+warmup time and then measured given number of times. Statistics are computed over
+the measured repetitions, so the median is stable even if some of them are
+disturbed by other processes. */
+class BenchmarkRunner
+{
+	DECLARE_NO_COPY_CLASS(BenchmarkRunner)
+
+public:
+	BenchmarkRunner();
+
+	/// Number of measured repetitions, default 10.
+	void SetRepetitions(uint Repetitions) { m_Repetitions = std::max(Repetitions, 1u); }
+	/// Minimum time of one repetition, default 0.05 s.
+	void SetMinRepetitionSeconds(double Seconds) { m_MinRepetitionSeconds = Seconds; }
+	/// Time of running the benchmark before measurement, default 0.1 s.
+	void SetWarmupSeconds(double Seconds) { m_WarmupSeconds = Seconds; }
+	/// Only benchmarks with names containing this string will run. Empty runs all.
+	void SetFilter(const tstring &Filter) { m_Filter = Filter; }
+
+	/// Runs the benchmark and remembers its result.
+	/** Returns false if the benchmark was skipped by the filter. */
+	bool Run(const tstring &Name, const BENCHMARK_FUNC &Func, uint64 BytesPerIteration = 0);
+
+	size_t GetResultCount() const { return m_Results.size(); }
+	const BENCHMARK_RESULT & GetResult(size_t Index) const { return m_Results[Index]; }
+	void ClearResults() { m_Results.clear(); }
+
+	/// Writes one line with the result: name, median, min, max, deviation and throughput.
+	static void FormatResult(tstring *Out, const BENCHMARK_RESULT &Result);
+	/// Writes results of all benchmarks, one per line.
+	void FormatString(tstring *Out);
+	/// Writes results as CSV with header row, times in nanoseconds, in UTF-8.
+	void ExportCsv(Stream *Out);
+	/// Writes results as JSON object with array "benchmarks", times in nanoseconds, in UTF-8.
+	void ExportJson(Stream *Out);
+
+private:
+	uint m_Repetitions;
+	double m_MinRepetitionSeconds;
+	double m_WarmupSeconds;
+	tstring m_Filter;
+	std::vector<BENCHMARK_RESULT> m_Results;
+};
+
+//@}
+
+} // namespace common
+
+#endif
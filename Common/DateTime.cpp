@@ -11,8 +11,19 @@ Documentation: \ref Module_DateTime
 #include "DateTime.hpp"
 #ifdef _WIN32
 	#include <windows.h>
+	#include <intrin.h> // dla __rdtsc, __cpuid
 #else
 	#include <sys/time.h> // dla gettimeofday
+	#include <time.h> // dla clock_gettime
+	#if defined(__i386__) || defined(__x86_64__)
+		#include <x86intrin.h> // dla __rdtsc
+		#include <cpuid.h>
+	#endif
+#endif
+
+// Czy jest instrukcja RDTSC
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+	#define COMMON_GAMETIME_TSC
 #endif
 
 namespace common
@@ -991,28 +1002,98 @@ bool StrToDate(TMSTRUCT *Out, const tstring &s, const tstring &Format)
 //HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
 // class GameTime
 
-#ifdef _WIN32
-
 const GameTime GameTime::ZERO = GameTime(0ll);
 const GameTime GameTime::MIN_VALUE = GameTime(MININT64);
 const GameTime GameTime::MAX_VALUE = GameTime(MAXINT64);
 bool GameTime::s_Initialized = false;
+bool GameTime::s_UseTsc = false;
 int64 GameTime::s_PerfFreq = 0;
 int64 GameTime::s_StartPerfCount = 0;
 
-GameTime GetCurrentGameTime()
+int64 GetSystemCounter()
 {
-	ASSERT_INT3_DEBUG(GameTime::s_Initialized);
-
+#ifdef _WIN32
 	int64 v;
+	QueryPerformanceCounter((LARGE_INTEGER*)&v);
+	return v;
+#else
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64)ts.tv_sec * 1000000000ll + (int64)ts.tv_nsec;
+#endif
+}
 
+int64 GetSystemCounterFrequency()
+{
 #ifdef _WIN32
-	QueryPerformanceCounter((LARGE_INTEGER*)&v);
+	static int64 Freq = 0;
+	if (Freq == 0)
+		QueryPerformanceFrequency((LARGE_INTEGER*)&Freq);
+	return Freq;
+#else
+	return 1000000000ll; // Nanoseconds
+#endif
+}
+
+// Value * Mul / Div rounded to nearest, without overflow of the intermediate product.
+// Remainder is smaller than Div, so Rem * Mul fits as long as Div * Mul does.
+static int64 MulDivRound(int64 Value, int64 Mul, int64 Div)
+{
+	int64 Quot = Value / Div, Rem = Value % Div;
+	int64 Frac = Rem * Mul;
+	Frac = (Frac >= 0) ? (Frac + Div / 2) / Div : (Frac - Div / 2) / Div;
+	return Quot * Mul + Frac;
+}
+
+#ifdef COMMON_GAMETIME_TSC
+
+// Invariant TSC runs at constant rate regardless of power states and frequency changes
+static bool HasInvariantTsc()
+{
+	uint Regs[4];
+#ifdef _MSC_VER
+	__cpuid((int*)Regs, 0x80000000);
+	if (Regs[0] < 0x80000007)
+		return false;
+	__cpuid((int*)Regs, 0x80000007);
 #else
-	timeval tv;
-	gettimeofday(&tv, 0);
-	v = (int64)tv.tv_sec * 1000000ll + (int64)tv.tv_usec;
+	if (__get_cpuid_max(0x80000000, NULL) < 0x80000007)
+		return false;
+	if (!__get_cpuid(0x80000007, &Regs[0], &Regs[1], &Regs[2], &Regs[3]))
+		return false;
 #endif
+	return (Regs[3] & (1 << 8)) != 0;
+}
+
+// Measures TSC frequency against the system clock
+static int64 CalibrateTsc()
+{
+	int64 SysFreq = GetSystemCounterFrequency();
+	int64 Sys1 = GetSystemCounter(), Tsc1 = (int64)__rdtsc();
+	int64 Sys2, Tsc2;
+	do
+	{
+		Sys2 = GetSystemCounter();
+		Tsc2 = (int64)__rdtsc();
+	}
+	while (Sys2 - Sys1 < SysFreq / 20);
+
+	return (int64)((double)(Tsc2 - Tsc1) * (double)SysFreq / (double)(Sys2 - Sys1));
+}
+
+#endif
+
+GameTime GetCurrentGameTime()
+{
+	ASSERT_INT3_DEBUG(GameTime::s_Initialized);
+
+	int64 v;
+#ifdef COMMON_GAMETIME_TSC
+	if (GameTime::s_UseTsc)
+		v = (int64)__rdtsc();
+	else
+#endif
+		v = GetSystemCounter();
 
 	return GameTime(v - GameTime::s_StartPerfCount);
 }
@@ -1026,7 +1107,7 @@ GameTime MillisecondsToGameTime(int64 Milliseconds)
 {
 	ASSERT_INT3_DEBUG(GameTime::s_Initialized);
 
-	return GameTime(Milliseconds * GameTime::s_PerfFreq / 1000);
+	return GameTime(MulDivRound(Milliseconds, GameTime::s_PerfFreq, 1000));
 }
 
 GameTime SecondsToGameTime(float Seconds)
@@ -1045,26 +1126,29 @@ GameTime SecondsToGameTime(double Seconds)
 
 int64 GameTime::ToMilliseconds() const
 {
-	return round_div(m_PerfCount * 1000ll, s_PerfFreq);
+	return MulDivRound(m_PerfCount, 1000, s_PerfFreq);
 }
 
-void GameTime::Initialize()
+void GameTime::Initialize(bool UseTsc)
 {
 	ASSERT_INT3_DEBUG(!s_Initialized);
 
-#ifdef _WIN32
-	QueryPerformanceFrequency((LARGE_INTEGER*)&s_PerfFreq);
-	QueryPerformanceCounter((LARGE_INTEGER*)&s_StartPerfCount);
-#else
-	timeval tv;
-	gettimeofday(&tv, 0);
-	s_StartPerfCount = (int64)tv.tv_sec * 1000000ll + (int64)tv.tv_usec;
-	s_PerfFreq = 1000000ll; // Microseconds
+	s_UseTsc = false;
+#ifdef COMMON_GAMETIME_TSC
+	if (UseTsc && HasInvariantTsc())
+	{
+		s_PerfFreq = CalibrateTsc();
+		s_StartPerfCount = (int64)__rdtsc();
+		s_UseTsc = true;
+	}
+	else
 #endif
+	{
+		s_PerfFreq = GetSystemCounterFrequency();
+		s_StartPerfCount = GetSystemCounter();
+	}
 
 	s_Initialized = true;
 }
 
-#endif
-
 } // namespace common
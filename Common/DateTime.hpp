@@ -381,8 +381,6 @@ MONTH StrToMonth(const tstring &s);
 eby to miao sens, musz si znale tam co najmniej rok, miesic i dzie.*/
 bool StrToDate(TMSTRUCT *Out, const tstring &s, const tstring &Format);
 
-#ifdef _WIN32
-
 /// Reprezentuje bd to bezwzgldny czas systemowy, bd te odcinek (rznic) czasu, jeli odjte dwa GameTime.
 /** Warto bezwzgldna jest mierzona od chwili startu programu. */
 struct GameTime
@@ -392,7 +390,16 @@ public:
 	static const GameTime MIN_VALUE;
 	static const GameTime MAX_VALUE;
 	/// Trzeba wywoa na pocztku programu, eby poprawnie dziaaa klasa GameTime.
-	static void Initialize();
+	/** Time is read with QueryPerformanceCounter on Windows and with
+	clock_gettime(CLOCK_MONOTONIC) on other systems. \n
+	When UseTsc is true and the processor has invariant TSC, time is read with RDTSC
+	instruction instead, which costs just a few cycles. Its frequency is calibrated
+	against the system clock, which takes about 50 ms. */
+	static void Initialize(bool UseTsc = false);
+	/// Returns true if Initialize chose RDTSC as the source of time.
+	static bool IsUsingTsc() { return s_UseTsc; }
+	/// Returns number of GameTime units per second.
+	static int64 GetFrequency() { return s_PerfFreq; }
 
 	GameTime() { }
 	explicit GameTime(int64 v) : m_PerfCount(v) { }
@@ -437,6 +444,7 @@ private:
 	int64 m_PerfCount;
 
 	static bool s_Initialized;
+	static bool s_UseTsc;
 	static int64 s_PerfFreq;
 	static int64 s_StartPerfCount;
 };
@@ -444,13 +452,17 @@ private:
 inline GameTime operator * (int64 v, const GameTime &t) { return GameTime(t.GetInt8() * v); }
 
 GameTime GetCurrentGameTime();
+/// Returns current value of monotonic system clock.
+/** QueryPerformanceCounter on Windows, clock_gettime(CLOCK_MONOTONIC) on other systems.
+Unlike GetCurrentGameTime, doesn't need GameTime::Initialize. */
+int64 GetSystemCounter();
+/// Returns number of GetSystemCounter units per second.
+int64 GetSystemCounterFrequency();
 GameTime MillisecondsToGameTime(int Milliseconds);
 GameTime MillisecondsToGameTime(int64 Milliseconds);
 GameTime SecondsToGameTime(float Seconds);
 GameTime SecondsToGameTime(double Seconds);
 
-#endif // _WIN32
-
 //@}
 // code_datetime
 
@@ -25,13 +25,32 @@ Module components: \ref code_files
 		#include <sys/file.h> // dla flock
 		#include <dirent.h>
 		#include <utime.h> // dla utime
+		#include <fcntl.h> // dla open
+		#include <unistd.h> // dla close, ftruncate
+		#include <sys/mman.h> // dla mmap
+		#include <sys/uio.h> // dla preadv, pwritev
+		#include <sys/syscall.h> // dla syscall
+		#ifdef __linux__
+			#include <sys/sendfile.h> // dla sendfile
+		#endif
 	}
+	// io_uring - nagwek jest tylko w nowszych systemach, bez niego FileIoEngine uywa puli wtkw
+	#if defined(__linux__) && defined(__has_include)
+		#if __has_include(<linux/io_uring.h>)
+			#include <linux/io_uring.h>
+			#if defined(__NR_io_uring_setup) && defined(IORING_OFF_SQES)
+				#define COMMON_IO_URING
+			#endif
+		#endif
+	#endif
 #endif
 #include <stack>
+#include <deque>
 
 #include "Error.hpp"
 #include "Files.hpp"
 #include "DateTime.hpp"
+#include "Threads.hpp"
 
 
 namespace common
@@ -40,6 +59,17 @@ namespace common
 //HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
 // Klasa FileStream
 
+// Maksymalna liczba bajtw kopiowana jednym wywoaniem systemowym w DirectCopyFrom
+const size_t FILE_COPY_CHUNK_SIZE = 0x40000000;
+
+// Ustawiane tylko w testach
+static bool g_ForceSendfile = false;
+
+void _SetForceSendfile(bool Force)
+{
+	g_ForceSendfile = Force;
+}
+
 #ifdef _WIN32
 
 	class File_pimpl
@@ -188,6 +218,50 @@ namespace common
 		return GetSize() == (uint64)GetPos();
 	}
 
+	bool FileStream::DirectCopyFrom(Stream *s, size_t MaxSize, size_t *OutSize)
+	{
+		return false;
+	}
+
+	size_t FileStream::ReadAt(uint64 Offset, void *Data, size_t Size)
+	{
+		OVERLAPPED Overlapped;
+		ZeroMemory(&Overlapped, sizeof(Overlapped));
+		Overlapped.Offset = (DWORD)Offset;
+		Overlapped.OffsetHigh = (DWORD)(Offset >> 32);
+		uint32 ReadSize;
+		assert(Size <= (size_t)UINT_MAX);
+		if (ReadFile(pimpl->m_File, Data, (DWORD)Size, (LPDWORD)&ReadSize, &Overlapped) == 0)
+		{
+			if (GetLastError() == ERROR_HANDLE_EOF)
+				return 0;
+			throw Win32Error(Format(_T("Cannot read # bytes from file at offset #.")) % Size % Offset, __TFILE__, __LINE__);
+		}
+		return (size_t)ReadSize;
+	}
+
+	void FileStream::WriteAt(uint64 Offset, const void *Data, size_t Size)
+	{
+		OVERLAPPED Overlapped;
+		ZeroMemory(&Overlapped, sizeof(Overlapped));
+		Overlapped.Offset = (DWORD)Offset;
+		Overlapped.OffsetHigh = (DWORD)(Offset >> 32);
+		uint32 WrittenSize;
+		assert(Size <= (size_t)UINT_MAX);
+		if (WriteFile(pimpl->m_File, Data, (DWORD)Size, (LPDWORD)&WrittenSize, &Overlapped) == 0)
+			throw Win32Error(Format(_T("Cannot write # bytes to file at offset #.")) % Size % Offset, __TFILE__, __LINE__);
+		if ((size_t)WrittenSize != Size)
+			throw Error(Format(_T("Cannot write to file. #/# bytes written.")) % WrittenSize % Size, __TFILE__, __LINE__);
+	}
+
+	void FileStream::Advise(FILE_ACCESS_HINT Hint, uint64 Offset, uint64 Length)
+	{
+	}
+
+	void FileStream::Preallocate(uint64 Size)
+	{
+	}
+
 	HANDLE FileStream::GetNativeHandle()
 	{
 		return pimpl->m_File;
@@ -198,128 +272,242 @@ namespace common
 	class File_pimpl
 	{
 	public:
-		FILE *m_File;
+		int m_File;
 		bool m_Lock;
+		// Tryb dopisywania - zapis zawsze idzie na koniec pliku (O_APPEND)
+		bool m_Append;
+		// Wasna pozycja - pread i pwrite nie korzystaj z pozycji deskryptora
+		uint64 m_Pos;
+		// Pozycja to koniec pliku - po zapisie w trybie dopisywania.
+		// Rozmiar pliku jest sprawdzany dopiero kiedy pozycja jest potrzebna, nie przy kadym zapisie.
+		bool m_PosAtEnd;
+
+		uint64 GetSize();
+		uint64 GetPos() { if (m_PosAtEnd) { m_Pos = GetSize(); m_PosAtEnd = false; } return m_Pos; }
 	};
 
+	uint64 File_pimpl::GetSize()
+	{
+		struct stat s;
+		if (fstat(m_File, &s) != 0)
+			throw ErrnoError(_T("Cannot get file size."), __TFILE__, __LINE__);
+		return (uint64)s.st_size;
+	}
+
+	// Zapisuje lub odczytuje dane z wielu buforw, ponawiajc przy czciowym
+	// zapisie/odczycie i przerwaniu sygnaem. Offset < 0 oznacza zapis w biecym
+	// miejscu deskryptora (writev - dla trybu dopisywania).
+	// Zwraca liczb bajtw - przy odczycie mniej ni suma rozmiarw oznacza koniec pliku.
+	static size_t FdTransferV(int File, const IO_BUFFER *Buffers, size_t BufferCount, int64 Offset, bool Write)
+	{
+		const size_t MAX_IOV = 64;
+		iovec Iov[MAX_IOV];
+		size_t IovCount, IovSize, Left, Sum = 0, BufIndex = 0, BufOffset = 0;
+		ssize_t r;
+
+		while (BufIndex < BufferCount)
+		{
+			IovCount = 0;
+			IovSize = 0;
+			for (size_t i = BufIndex; i < BufferCount && IovCount < MAX_IOV; i++)
+			{
+				size_t Skip = (i == BufIndex) ? BufOffset : 0;
+				Iov[IovCount].iov_base = (char*)Buffers[i].Data + Skip;
+				Iov[IovCount].iov_len = Buffers[i].Size - Skip;
+				IovSize += Iov[IovCount].iov_len;
+				IovCount++;
+			}
+
+			if (Write)
+				r = (Offset < 0) ? writev(File, Iov, (int)IovCount) : pwritev(File, Iov, (int)IovCount, (off_t)(Offset + Sum));
+			else
+				r = preadv(File, Iov, (int)IovCount, (off_t)(Offset + Sum));
+			if (r < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				if (Write)
+					throw ErrnoError(Format(_T("Cannot write to file. # bytes written.")) % Sum, __TFILE__, __LINE__);
+				else
+					throw ErrnoError(Format(_T("Cannot read from file. # bytes read.")) % Sum, __TFILE__, __LINE__);
+			}
+			if (r == 0 && IovSize > 0)
+			{
+				// Koniec pliku
+				if (!Write)
+					break;
+				throw Error(Format(_T("Cannot write to file. # bytes written.")) % Sum, __TFILE__, __LINE__);
+			}
+
+			// Przesunicie za przetworzone dane
+			Sum += (size_t)r;
+			Left = (size_t)r;
+			while (BufIndex < BufferCount && Left >= Buffers[BufIndex].Size - BufOffset)
+			{
+				Left -= Buffers[BufIndex].Size - BufOffset;
+				BufIndex++;
+				BufOffset = 0;
+			}
+			BufOffset += Left;
+		}
+		return Sum;
+	}
+
+	static size_t FdTransfer(int File, void *Data, size_t Size, int64 Offset, bool Write)
+	{
+		IO_BUFFER Buffer = { Data, Size };
+		return FdTransferV(File, &Buffer, 1, Offset, Write);
+	}
+
 	FileStream::FileStream(const tstring &FileName, FILE_MODE FileMode, bool Lock) :
 		pimpl(new File_pimpl)
 	{
 		pimpl->m_Lock = Lock;
+		pimpl->m_Append = false;
 
 		const char *m = 0;
+		int Flags = 0;
 
 		switch (FileMode)
 		{
 		case FM_WRITE:
 			m = "wb";
+			Flags = O_WRONLY | O_CREAT | O_TRUNC;
 			break;
 		case FM_WRITE_PLUS:
 			m = "w+b";
+			Flags = O_RDWR | O_CREAT | O_TRUNC;
 			break;
 		case FM_READ:
 			m = "rb";
+			Flags = O_RDONLY;
 			break;
 		case FM_READ_PLUS:
 			m = "r+b";
+			Flags = O_RDWR;
 			break;
 		case FM_APPEND:
 			m = "ab";
+			Flags = O_WRONLY | O_CREAT | O_APPEND;
+			pimpl->m_Append = true;
 			break;
 		case FM_APPEND_PLUS:
 			m = "a+b";
+			Flags = O_RDWR | O_CREAT | O_APPEND;
+			pimpl->m_Append = true;
 			break;
 		}
 
-		pimpl->m_File = fopen(FileName.c_str(), m);
-		if (pimpl->m_File == 0)
+		pimpl->m_File = open(FileName.c_str(), Flags, 0666);
+		if (pimpl->m_File < 0)
 			throw ErrnoError(Format(_T("Cannot open file \"#\" in mode \"#\".")) % FileName % m, __TFILE__, __LINE__);
 		if (Lock)
 		{
-			if (flock(fileno(pimpl->m_File), LOCK_EX | LOCK_NB) != 0)
-				throw ErrnoError(Format(_T("Cannot open file \"#\" in mode \"#\" - error while locking.")) % FileName % m, __TFILE__, __LINE__);
+			if (flock(pimpl->m_File, LOCK_EX | LOCK_NB) != 0)
+			{
+				int ErrorCode = errno;
+				close(pimpl->m_File);
+				throw ErrnoError(ErrorCode, Format(_T("Cannot open file \"#\" in mode \"#\" - error while locking.")) % FileName % m, __TFILE__, __LINE__);
+			}
 		}
+
+		pimpl->m_Pos = 0;
+		pimpl->m_PosAtEnd = pimpl->m_Append;
 	}
 
 	FileStream::~FileStream()
 	{
-		if (pimpl->m_File != 0)
+		if (pimpl->m_File >= 0)
 		{
 			// Kiedy deskryptor int zostaje zamknity, podobno blokada sama si zwalania. Ale kto tam tego Linuksa wie... :)
 			if (pimpl->m_Lock)
-				flock(fileno(pimpl->m_File), LOCK_UN);
-			fclose(pimpl->m_File);
+				flock(pimpl->m_File, LOCK_UN);
+			close(pimpl->m_File);
 		}
 	}
 
 	void FileStream::Write(const void *Data, size_t Size)
 	{
-		size_t Written = fwrite(Data, 1, Size, pimpl->m_File);
-		if (Written != Size || ferror(pimpl->m_File) != 0)
-			throw Error(Format(_T("Cannot write to file. #/# bytes written.")) % Written % Size, __TFILE__, __LINE__);
+		if (pimpl->m_Append)
+		{
+			FdTransfer(pimpl->m_File, const_cast<void*>(Data), Size, -1, true);
+			pimpl->m_PosAtEnd = true;
+		}
+		else
+		{
+			FdTransfer(pimpl->m_File, const_cast<void*>(Data), Size, (int64)pimpl->m_Pos, true);
+			pimpl->m_Pos += Size;
+		}
 	}
 
 	size_t FileStream::Read(void *Data, size_t Size)
 	{
-		size_t BytesRead = fread(Data, 1, Size, pimpl->m_File);
-		if (ferror(pimpl->m_File) != 0)
-			throw Error(Format(_T("Cannot read from file. #/# bytes read.")) % BytesRead % Size, __TFILE__, __LINE__);
+		size_t BytesRead = FdTransfer(pimpl->m_File, Data, Size, (int64)pimpl->GetPos(), false);
+		pimpl->m_Pos += BytesRead;
+		return BytesRead;
+	}
+
+	void FileStream::WriteV(const IO_BUFFER *Buffers, size_t BufferCount)
+	{
+		if (pimpl->m_Append)
+		{
+			FdTransferV(pimpl->m_File, Buffers, BufferCount, -1, true);
+			pimpl->m_PosAtEnd = true;
+		}
+		else
+			pimpl->m_Pos += FdTransferV(pimpl->m_File, Buffers, BufferCount, (int64)pimpl->m_Pos, true);
+	}
+
+	size_t FileStream::ReadV(const IO_BUFFER *Buffers, size_t BufferCount)
+	{
+		size_t BytesRead = FdTransferV(pimpl->m_File, Buffers, BufferCount, (int64)pimpl->GetPos(), false);
+		pimpl->m_Pos += BytesRead;
 		return BytesRead;
 	}
 
 	void FileStream::Flush()
 	{
-		fflush(pimpl->m_File);
+		// Nie ma bufora - dane trafiaj do systemu od razu
 	}
 
 	uint64 FileStream::GetSize()
 	{
-		// Wersja 1
-		int64 SavedPos = GetPos();
-		SetPosFromEnd(0);
-		int64 EndPos = GetPos();
-		SetPos(SavedPos);
-		return (uint64)EndPos;
-
-		// Ta wersja jest za bo moe nie pokazywa aktualnego rozmiaru, bo jest bufor
-/*		// Wersja 2
-		struct stat s;
-		fstat(fileno(pimpl->m_File), &s);
-		return s.st_size;*/
+		return pimpl->GetSize();
 	}
 
 	int64 FileStream::GetPos()
 	{
-		int r = ftell(pimpl->m_File);
-		if (r < 0)
-			throw ErrnoError(_T("Cannot get current position in file."), __TFILE__, __LINE__);
-		return r;
+		return (int64)pimpl->GetPos();
 	}
 
 	void FileStream::SetPos(int64 pos)
 	{
-		int r = fseek(pimpl->m_File, (long)pos, SEEK_SET);
-		if (r < 0)
-			throw ErrnoError(Format(_T("Cannot set position in file stream to # from the beginning.")) % pos, __TFILE__, __LINE__);
+		if (pos < 0)
+			throw Error(Format(_T("Cannot set position in file stream to # from the beginning.")) % pos, __TFILE__, __LINE__);
+		pimpl->m_Pos = (uint64)pos;
+		pimpl->m_PosAtEnd = false;
 	}
 
 	void FileStream::SetPosFromCurrent(int64 pos)
 	{
-		int r = fseek(pimpl->m_File, (long)pos, SEEK_CUR);
-		if (r < 0)
-			throw ErrnoError(Format(_T("Cannot set position in file stream to # from current.")) % pos, __TFILE__, __LINE__);
+		if ((int64)pimpl->GetPos() + pos < 0)
+			throw Error(Format(_T("Cannot set position in file stream to # from current.")) % pos, __TFILE__, __LINE__);
+		pimpl->m_Pos = (uint64)((int64)pimpl->m_Pos + pos);
 	}
 
-	void FileStream::SetPosFromEnd(int pos)
+	void FileStream::SetPosFromEnd(int64 pos)
 	{
-		int r = fseek(pimpl->m_File, (long)pos, SEEK_END);
-		if (r < 0)
-			throw ErrnoError(Format(_T("Cannot set position in file stream to # from the end.")) % pos, __TFILE__, __LINE__);
+		int64 NewPos = (int64)GetSize() + pos;
+		if (NewPos < 0)
+			throw Error(Format(_T("Cannot set position in file stream to # from the end.")) % pos, __TFILE__, __LINE__);
+		pimpl->m_Pos = (uint64)NewPos;
+		pimpl->m_PosAtEnd = false;
 	}
 
 	void FileStream::SetSize(uint64 Size)
 	{
-		ftruncate(fileno(pimpl->m_File), (off_t)Size);
+		if (ftruncate(pimpl->m_File, (off_t)Size) != 0)
+			throw ErrnoError(Format(_T("Cannot set file size to #.")) % Size, __TFILE__, __LINE__);
 	}
 
 	void FileStream::Truncate()
@@ -329,16 +517,1060 @@ namespace common
 
 	bool FileStream::End()
 	{
-		// Fuj! Ale to nieeleganckie. Szkoda, e nie ma lepszego sposobu.
-		// UWAGA! Jak byo zamienione miejscami, najpierw wyliczane GetSize
-		// a potem GetPos to za pierwszym wyliczaniem wychodzio false a dopiero
-		// za drugim true - LOL!
-		return (uint64)GetPos() == GetSize();
+		return pimpl->GetPos() >= GetSize();
+	}
+
+	bool FileStream::DirectCopyFrom(Stream *s, size_t MaxSize, size_t *OutSize)
+	{
+#ifdef __linux__
+		FileStream *Src = dynamic_cast<FileStream*>(s);
+		// Dopisywanie (O_APPEND) nie dziaa ani z copy_file_range, ani z sendfile
+		if (Src == NULL || pimpl->m_Append)
+			return false;
+
+		// copy_file_range nie przechodzi midzy rnymi systemami plikw na starszych jdrach
+#ifdef __NR_copy_file_range
+		bool UseSendfile = g_ForceSendfile;
+#else
+		bool UseSendfile = true;
+#endif
+		size_t Size;
+		ssize_t r;
+		*OutSize = 0;
+		// rdo w trybie dopisywania moe mie jeszcze nieustalon pozycj
+		Src->pimpl->GetPos();
+		while (*OutSize < MaxSize)
+		{
+			Size = std::min<size_t>(MaxSize - *OutSize, FILE_COPY_CHUNK_SIZE);
+			if (!UseSendfile)
+			{
+#ifdef __NR_copy_file_range
+				loff_t InOffset = (loff_t)Src->pimpl->m_Pos, OutOffset = (loff_t)pimpl->m_Pos;
+				r = (ssize_t)syscall(__NR_copy_file_range, Src->pimpl->m_File, &InOffset, pimpl->m_File, &OutOffset, Size, 0u);
+				if (r < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP))
+				{
+					UseSendfile = true;
+					continue;
+				}
+#endif
+			}
+			else
+			{
+				// sendfile zapisuje w biecym miejscu deskryptora celu
+				off_t InOffset = (off_t)Src->pimpl->m_Pos;
+				if (lseek(pimpl->m_File, (off_t)pimpl->m_Pos, SEEK_SET) < 0)
+					throw ErrnoError(_T("Cannot set file position."), __TFILE__, __LINE__);
+				r = sendfile(pimpl->m_File, Src->pimpl->m_File, &InOffset, Size);
+				// Nic jeszcze nie skopiowane - mona wrci do zwykego kopiowania
+				if (r < 0 && *OutSize == 0 && (errno == EINVAL || errno == ENOSYS))
+					return false;
+			}
+
+			if (r < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				throw ErrnoError(Format(_T("Cannot copy file data. # bytes copied.")) % *OutSize, __TFILE__, __LINE__);
+			}
+			// Koniec pliku rdowego
+			if (r == 0)
+				break;
+			Src->pimpl->m_Pos += (uint64)r;
+			pimpl->m_Pos += (uint64)r;
+			*OutSize += (size_t)r;
+		}
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	size_t FileStream::ReadAt(uint64 Offset, void *Data, size_t Size)
+	{
+		return FdTransfer(pimpl->m_File, Data, Size, (int64)Offset, false);
+	}
+
+	void FileStream::WriteAt(uint64 Offset, const void *Data, size_t Size)
+	{
+		// Uwaga! W trybie dopisywania Linux i tak zapisuje na kocu pliku.
+		FdTransfer(pimpl->m_File, const_cast<void*>(Data), Size, (int64)Offset, true);
+	}
+
+	void FileStream::Advise(FILE_ACCESS_HINT Hint, uint64 Offset, uint64 Length)
+	{
+		int Advice;
+		switch (Hint)
+		{
+		case FILE_ACCESS_SEQUENTIAL: Advice = POSIX_FADV_SEQUENTIAL; break;
+		case FILE_ACCESS_RANDOM:     Advice = POSIX_FADV_RANDOM; break;
+		case FILE_ACCESS_WILLNEED:   Advice = POSIX_FADV_WILLNEED; break;
+		case FILE_ACCESS_DONTNEED:   Advice = POSIX_FADV_DONTNEED; break;
+		default:                     Advice = POSIX_FADV_NORMAL; break;
+		}
+		// To tylko wskazwka - bd nie jest istotny
+		posix_fadvise(pimpl->m_File, (off_t)Offset, (off_t)Length, Advice);
+	}
+
+	void FileStream::Preallocate(uint64 Size)
+	{
+#ifdef __linux__
+		if (fallocate(pimpl->m_File, FALLOC_FL_KEEP_SIZE, 0, (off_t)Size) != 0 && errno != EOPNOTSUPP && errno != ENOSYS)
+			throw ErrnoError(Format(_T("Cannot preallocate # bytes for file.")) % Size, __TFILE__, __LINE__);
+#endif
+	}
+
+	int FileStream::GetNativeHandle()
+	{
+		return pimpl->m_File;
 	}
 
 #endif
 
 
+//HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
+// Klasa MappedFileStream
+
+// Minimalny przyrost mapowania przy zapisie za kocem pliku
+const size_t MAPPED_FILE_MIN_GROWTH = 64 * 1024;
+
+#ifdef _WIN32
+
+	class MappedFile_pimpl
+	{
+	public:
+		HANDLE m_File;
+		HANDLE m_Mapping;
+		bool m_Writable;
+		char *m_Data;
+		// Rozmiar danych
+		size_t m_Size;
+		// Rozmiar mapowania, a zarazem pliku na dysku - moe by wikszy ni m_Size
+		size_t m_MappedSize;
+		size_t m_Pos;
+		FILE_ACCESS_HINT m_Hint;
+
+		void Open(const tstring &FileName, FILE_MODE FileMode, bool Lock);
+		void Close();
+		// Zmienia rozmiar pliku i mapowania na podany
+		void Remap(size_t NewMappedSize);
+		void Advise(FILE_ACCESS_HINT Hint, size_t Offset, size_t Length) { }
+		void Sync();
+
+	private:
+		void Unmap();
+	};
+
+	void MappedFile_pimpl::Open(const tstring &FileName, FILE_MODE FileMode, bool Lock)
+	{
+		uint32 DesiredAccess = GENERIC_READ | GENERIC_WRITE, ShareMode = 0, CreationDisposition;
+		switch (FileMode)
+		{
+		case FM_WRITE:
+		case FM_WRITE_PLUS:
+			CreationDisposition = CREATE_ALWAYS;
+			break;
+		case FM_READ:
+			DesiredAccess = GENERIC_READ;
+			ShareMode = FILE_SHARE_READ;
+			CreationDisposition = OPEN_EXISTING;
+			break;
+		case FM_READ_PLUS:
+			CreationDisposition = OPEN_EXISTING;
+			break;
+		default: // FM_APPEND, FM_APPEND_PLUS
+			CreationDisposition = OPEN_ALWAYS;
+			break;
+		}
+		if (!Lock)
+			ShareMode = FILE_SHARE_READ | FILE_SHARE_WRITE;
+
+		m_File = CreateFile(FileName.c_str(), DesiredAccess, ShareMode, 0, CreationDisposition, FILE_ATTRIBUTE_NORMAL, 0);
+		if (m_File == INVALID_HANDLE_VALUE)
+			throw Win32Error(_T("Cannot open file: ") + FileName, __TFILE__, __LINE__);
+
+		LARGE_INTEGER FileSize;
+		if (!GetFileSizeEx(m_File, &FileSize))
+		{
+			CloseHandle(m_File);
+			throw Win32Error(_T("Cannot get file size: ") + FileName, __TFILE__, __LINE__);
+		}
+		if ((uint64)FileSize.QuadPart > SIZE_MAX)
+		{
+			CloseHandle(m_File);
+			throw Error(_T("File too large to map: ") + FileName, __TFILE__, __LINE__);
+		}
+		m_Size = (size_t)FileSize.QuadPart;
+	}
+
+	void MappedFile_pimpl::Unmap()
+	{
+		if (m_Data != NULL)
+		{
+			UnmapViewOfFile(m_Data);
+			m_Data = NULL;
+		}
+		if (m_Mapping != NULL)
+		{
+			CloseHandle(m_Mapping);
+			m_Mapping = NULL;
+		}
+	}
+
+	void MappedFile_pimpl::Remap(size_t NewMappedSize)
+	{
+		Unmap();
+		// CreateFileMapping sam powiksza plik, ale nie zmniejsza
+		if (m_Writable && NewMappedSize < m_MappedSize)
+		{
+			LARGE_INTEGER Pos;
+			Pos.QuadPart = (LONGLONG)NewMappedSize;
+			if (!SetFilePointerEx(m_File, Pos, NULL, FILE_BEGIN) || !SetEndOfFile(m_File))
+				throw Win32Error(Format(_T("Cannot set size of mapped file to #.")) % NewMappedSize, __TFILE__, __LINE__);
+		}
+		m_MappedSize = NewMappedSize;
+		if (NewMappedSize == 0)
+			return;
+
+		uint64 Size64 = NewMappedSize;
+		m_Mapping = CreateFileMapping(m_File, NULL, m_Writable ? PAGE_READWRITE : PAGE_READONLY, (DWORD)(Size64 >> 32), (DWORD)Size64, NULL);
+		if (m_Mapping == NULL)
+			throw Win32Error(Format(_T("Cannot create mapping of # bytes.")) % NewMappedSize, __TFILE__, __LINE__);
+		m_Data = (char*)MapViewOfFile(m_Mapping, m_Writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, NewMappedSize);
+		if (m_Data == NULL)
+			throw Win32Error(Format(_T("Cannot map view of # bytes.")) % NewMappedSize, __TFILE__, __LINE__);
+	}
+
+	void MappedFile_pimpl::Sync()
+	{
+		if (m_Data != NULL)
+			FlushViewOfFile(m_Data, 0);
+	}
+
+	void MappedFile_pimpl::Close()
+	{
+		Unmap();
+		if (m_Writable && m_MappedSize != m_Size)
+		{
+			LARGE_INTEGER Pos;
+			Pos.QuadPart = (LONGLONG)m_Size;
+			if (SetFilePointerEx(m_File, Pos, NULL, FILE_BEGIN))
+				SetEndOfFile(m_File);
+		}
+		CloseHandle(m_File);
+	}
+
+#else
+
+	class MappedFile_pimpl
+	{
+	public:
+		int m_File;
+		bool m_Lock;
+		bool m_Writable;
+		char *m_Data;
+		// Rozmiar danych
+		size_t m_Size;
+		// Rozmiar mapowania, a zarazem pliku na dysku - moe by wikszy ni m_Size
+		size_t m_MappedSize;
+		size_t m_Pos;
+		FILE_ACCESS_HINT m_Hint;
+
+		void Open(const tstring &FileName, FILE_MODE FileMode, bool Lock);
+		void Close();
+		// Zmienia rozmiar pliku i mapowania na podany
+		void Remap(size_t NewMappedSize);
+		void Advise(FILE_ACCESS_HINT Hint, size_t Offset, size_t Length);
+		void Sync();
+	};
+
+	void MappedFile_pimpl::Open(const tstring &FileName, FILE_MODE FileMode, bool Lock)
+	{
+		int Flags;
+		switch (FileMode)
+		{
+		case FM_WRITE:
+		case FM_WRITE_PLUS:
+			Flags = O_RDWR | O_CREAT | O_TRUNC;
+			break;
+		case FM_READ:
+			Flags = O_RDONLY;
+			break;
+		case FM_READ_PLUS:
+			Flags = O_RDWR;
+			break;
+		default: // FM_APPEND, FM_APPEND_PLUS
+			Flags = O_RDWR | O_CREAT;
+			break;
+		}
+
+		m_File = open(FileName.c_str(), Flags, 0666);
+		if (m_File < 0)
+			throw ErrnoError(Format(_T("Cannot open file \"#\" for mapping.")) % FileName, __TFILE__, __LINE__);
+		m_Lock = Lock;
+		if (Lock && flock(m_File, LOCK_EX | LOCK_NB) != 0)
+		{
+			int ErrorCode = errno;
+			close(m_File);
+			throw ErrnoError(ErrorCode, Format(_T("Cannot open file \"#\" for mapping - error while locking.")) % FileName, __TFILE__, __LINE__);
+		}
+
+		struct stat s;
+		if (fstat(m_File, &s) != 0)
+		{
+			int ErrorCode = errno;
+			close(m_File);
+			throw ErrnoError(ErrorCode, Format(_T("Cannot get size of file \"#\".")) % FileName, __TFILE__, __LINE__);
+		}
+		if ((uint64)s.st_size > SIZE_MAX)
+		{
+			close(m_File);
+			throw Error(Format(_T("File \"#\" too large to map.")) % FileName, __TFILE__, __LINE__);
+		}
+		m_Size = (size_t)s.st_size;
+	}
+
+	void MappedFile_pimpl::Remap(size_t NewMappedSize)
+	{
+		if (m_Writable && NewMappedSize != m_MappedSize && ftruncate(m_File, (off_t)NewMappedSize) != 0)
+			throw ErrnoError(Format(_T("Cannot set size of mapped file to #.")) % NewMappedSize, __TFILE__, __LINE__);
+
+		void *NewData;
+#ifdef __linux__
+		// Linux potrafi zmieni rozmiar mapowania bez ponownego mapowania caoci
+		if (m_Data != NULL && NewMappedSize > 0)
+			NewData = mremap(m_Data, m_MappedSize, NewMappedSize, MREMAP_MAYMOVE);
+		else
+#endif
+		{
+			if (m_Data != NULL)
+				munmap(m_Data, m_MappedSize);
+			m_Data = NULL;
+			m_MappedSize = 0;
+			if (NewMappedSize == 0)
+				return;
+			NewData = mmap(NULL, NewMappedSize, m_Writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, m_File, 0);
+		}
+		if (NewData == MAP_FAILED)
+			throw ErrnoError(Format(_T("Cannot map # bytes of file.")) % NewMappedSize, __TFILE__, __LINE__);
+		m_Data = (char*)NewData;
+		m_MappedSize = NewMappedSize;
+
+		if (m_Hint != FILE_ACCESS_NORMAL)
+			Advise(m_Hint, 0, m_MappedSize);
+	}
+
+	void MappedFile_pimpl::Advise(FILE_ACCESS_HINT Hint, size_t Offset, size_t Length)
+	{
+		if (m_Data == NULL || Offset >= m_MappedSize)
+			return;
+		int Advice;
+		switch (Hint)
+		{
+		case FILE_ACCESS_SEQUENTIAL: Advice = MADV_SEQUENTIAL; break;
+		case FILE_ACCESS_RANDOM:     Advice = MADV_RANDOM; break;
+		case FILE_ACCESS_WILLNEED:   Advice = MADV_WILLNEED; break;
+		case FILE_ACCESS_DONTNEED:   Advice = MADV_DONTNEED; break;
+		default:                     Advice = MADV_NORMAL; break;
+		}
+		// Pocztek musi by wyrwnany do strony
+		size_t PageSize = (size_t)sysconf(_SC_PAGESIZE);
+		size_t Beg = Offset / PageSize * PageSize;
+		size_t End = (Length == 0 || Length > m_MappedSize - Offset) ? m_MappedSize : Offset + Length;
+		// To tylko wskazwka - bd nie jest istotny
+		madvise(m_Data + Beg, End - Beg, Advice);
+	}
+
+	void MappedFile_pimpl::Sync()
+	{
+		if (m_Data != NULL)
+			msync(m_Data, m_MappedSize, MS_ASYNC);
+	}
+
+	void MappedFile_pimpl::Close()
+	{
+		if (m_Data != NULL)
+			munmap(m_Data, m_MappedSize);
+		if (m_Writable && m_MappedSize != m_Size)
+			ftruncate(m_File, (off_t)m_Size);
+		if (m_Lock)
+			flock(m_File, LOCK_UN);
+		close(m_File);
+	}
+
+#endif
+
+MappedFileStream::MappedFileStream(const tstring &FileName, FILE_MODE FileMode, FILE_ACCESS_HINT Hint, bool Lock) :
+	pimpl(new MappedFile_pimpl)
+{
+	pimpl->m_Writable = (FileMode != FM_READ);
+	pimpl->m_Data = NULL;
+	pimpl->m_MappedSize = 0;
+#ifdef _WIN32
+	pimpl->m_Mapping = NULL;
+#endif
+	pimpl->m_Hint = Hint;
+
+	pimpl->Open(FileName, FileMode, Lock);
+	try
+	{
+		pimpl->Remap(pimpl->m_Size);
+	}
+	catch (...)
+	{
+		pimpl->Close();
+		throw;
+	}
+
+	pimpl->m_Pos = (FileMode == FM_APPEND || FileMode == FM_APPEND_PLUS) ? pimpl->m_Size : 0;
+}
+
+MappedFileStream::~MappedFileStream()
+{
+	pimpl->Close();
+}
+
+void MappedFileStream::Write(const void *Data, size_t Size)
+{
+	if (Size == 0) return;
+	void *Dest;
+	if (AcquireWriteSpan(&Dest, Size) < Size)
+		throw Error(Format(_T("Cannot write # bytes to mapped file.")) % Size, __TFILE__, __LINE__);
+	common_memcpy(Dest, Data, Size);
+	CommitWrite(Size);
+}
+
+size_t MappedFileStream::Read(void *Data, size_t Size)
+{
+	if (pimpl->m_Pos >= pimpl->m_Size)
+		return 0;
+	Size = std::min(Size, pimpl->m_Size - pimpl->m_Pos);
+	common_memcpy(Data, pimpl->m_Data + pimpl->m_Pos, Size);
+	pimpl->m_Pos += Size;
+	return Size;
+}
+
+void MappedFileStream::MustRead(void *Data, size_t Size)
+{
+	if (pimpl->m_Pos > pimpl->m_Size || Size > pimpl->m_Size - pimpl->m_Pos)
+		throw Error(Format(_T("Cannot read # bytes from mapped file - end of file met (pos: #, size: #).")) % Size % pimpl->m_Pos % pimpl->m_Size, __TFILE__, __LINE__);
+	common_memcpy(Data, pimpl->m_Data + pimpl->m_Pos, Size);
+	pimpl->m_Pos += Size;
+}
+
+void MappedFileStream::Flush()
+{
+	if (pimpl->m_Writable)
+	{
+		if (pimpl->m_MappedSize != pimpl->m_Size)
+			pimpl->Remap(pimpl->m_Size);
+		pimpl->Sync();
+	}
+}
+
+bool MappedFileStream::End()
+{
+	return pimpl->m_Pos >= pimpl->m_Size;
+}
+
+size_t MappedFileStream::Skip(size_t MaxLength)
+{
+	if (pimpl->m_Pos >= pimpl->m_Size)
+		return 0;
+	MaxLength = std::min(MaxLength, pimpl->m_Size - pimpl->m_Pos);
+	pimpl->m_Pos += MaxLength;
+	return MaxLength;
+}
+
+size_t MappedFileStream::AcquireReadSpan(const void **OutData)
+{
+	if (pimpl->m_Pos >= pimpl->m_Size)
+	{
+		*OutData = NULL;
+		return 0;
+	}
+	*OutData = pimpl->m_Data + pimpl->m_Pos;
+	return pimpl->m_Size - pimpl->m_Pos;
+}
+
+void MappedFileStream::ReleaseRead(size_t Size)
+{
+	assert(pimpl->m_Pos + Size <= pimpl->m_Size);
+	pimpl->m_Pos += Size;
+}
+
+size_t MappedFileStream::AcquireWriteSpan(void **OutData, size_t MinSize)
+{
+	if (!pimpl->m_Writable)
+		throw Error(_T("Cannot write to mapped file opened for reading only."), __TFILE__, __LINE__);
+	*OutData = NULL;
+	if (MinSize == 0 && pimpl->m_Pos >= pimpl->m_MappedSize)
+		return 0;
+	if (pimpl->m_Pos + MinSize > pimpl->m_MappedSize)
+		pimpl->Remap(std::max(pimpl->m_Pos + MinSize, pimpl->m_MappedSize + std::max(pimpl->m_MappedSize / 2, MAPPED_FILE_MIN_GROWTH)));
+	*OutData = pimpl->m_Data + pimpl->m_Pos;
+	return pimpl->m_MappedSize - pimpl->m_Pos;
+}
+
+void MappedFileStream::CommitWrite(size_t Size)
+{
+	assert(pimpl->m_Pos + Size <= pimpl->m_MappedSize);
+	pimpl->m_Pos += Size;
+	if (pimpl->m_Pos > pimpl->m_Size)
+		pimpl->m_Size = pimpl->m_Pos;
+}
+
+uint64 MappedFileStream::GetSize()
+{
+	return pimpl->m_Size;
+}
+
+int64 MappedFileStream::GetPos()
+{
+	return (int64)pimpl->m_Pos;
+}
+
+void MappedFileStream::SetPos(int64 pos)
+{
+	if (pos < 0 || (uint64)pos > SIZE_MAX)
+		throw Error(Format(_T("Cannot set position in mapped file to #.")) % pos, __TFILE__, __LINE__);
+	pimpl->m_Pos = (size_t)pos;
+}
+
+void MappedFileStream::SetSize(uint64 Size)
+{
+	if (!pimpl->m_Writable)
+		throw Error(_T("Cannot change size of mapped file opened for reading only."), __TFILE__, __LINE__);
+	if (Size > SIZE_MAX)
+		throw Error(Format(_T("Cannot set size of mapped file to #.")) % Size, __TFILE__, __LINE__);
+	pimpl->Remap((size_t)Size);
+	pimpl->m_Size = (size_t)Size;
+}
+
+void MappedFileStream::Advise(FILE_ACCESS_HINT Hint, uint64 Offset, uint64 Length)
+{
+	if (Offset >= pimpl->m_MappedSize)
+		return;
+	pimpl->Advise(Hint, (size_t)Offset, (size_t)std::min<uint64>(Length, pimpl->m_MappedSize - (size_t)Offset));
+}
+
+bool MappedFileStream::IsWritable()
+{
+	return pimpl->m_Writable;
+}
+
+char *MappedFileStream::Data()
+{
+	return pimpl->m_Data;
+}
+
+
+//HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
+// Klasa FileIoEngine
+
+#ifdef COMMON_IO_URING
+
+// Minimalna obsuga io_uring bezporednio wywoaniami systemowymi, bez liburing.
+// Kolejka zgosze (SQ) jest uywana tylko pod muteksem silnika.
+class IoUring
+{
+	DECLARE_NO_COPY_CLASS(IoUring)
+
+public:
+	int m_Fd;
+	uint m_SqEntries;
+	void *m_SqRing, *m_CqRing;
+	size_t m_SqRingSize, m_CqRingSize;
+	io_uring_sqe *m_Sqes;
+	size_t m_SqesSize;
+	unsigned *m_SqHead, *m_SqTail, *m_SqMask, *m_SqArray;
+	unsigned *m_CqHead, *m_CqTail, *m_CqMask;
+	io_uring_cqe *m_Cqes;
+
+	IoUring() : m_Fd(-1), m_SqRing(MAP_FAILED), m_CqRing(MAP_FAILED), m_Sqes((io_uring_sqe*)MAP_FAILED) { }
+	~IoUring() { Close(); }
+	// Zwraca false, jeli io_uring jest niedostpny
+	bool Init(uint Entries);
+	void Close();
+	int Enter(uint ToSubmit, uint MinComplete, uint Flags);
+};
+
+bool IoUring::Init(uint Entries)
+{
+	io_uring_params Params;
+	common_memzero(&Params, sizeof(Params));
+	m_Fd = (int)syscall(__NR_io_uring_setup, Entries, &Params);
+	if (m_Fd < 0)
+		return false;
+	m_SqEntries = Params.sq_entries;
+
+	m_SqRingSize = Params.sq_off.array + Params.sq_entries * sizeof(unsigned);
+	m_CqRingSize = Params.cq_off.cqes + Params.cq_entries * sizeof(io_uring_cqe);
+	m_SqesSize = Params.sq_entries * sizeof(io_uring_sqe);
+	m_SqRing = mmap(NULL, m_SqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_Fd, IORING_OFF_SQ_RING);
+	m_CqRing = mmap(NULL, m_CqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_Fd, IORING_OFF_CQ_RING);
+	m_Sqes = (io_uring_sqe*)mmap(NULL, m_SqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_Fd, IORING_OFF_SQES);
+	if (m_SqRing == MAP_FAILED || m_CqRing == MAP_FAILED || m_Sqes == (io_uring_sqe*)MAP_FAILED)
+	{
+		Close();
+		return false;
+	}
+
+	char *Sq = (char*)m_SqRing, *Cq = (char*)m_CqRing;
+	m_SqHead = (unsigned*)(Sq + Params.sq_off.head);
+	m_SqTail = (unsigned*)(Sq + Params.sq_off.tail);
+	m_SqMask = (unsigned*)(Sq + Params.sq_off.ring_mask);
+	m_SqArray = (unsigned*)(Sq + Params.sq_off.array);
+	m_CqHead = (unsigned*)(Cq + Params.cq_off.head);
+	m_CqTail = (unsigned*)(Cq + Params.cq_off.tail);
+	m_CqMask = (unsigned*)(Cq + Params.cq_off.ring_mask);
+	m_Cqes = (io_uring_cqe*)(Cq + Params.cq_off.cqes);
+	return true;
+}
+
+void IoUring::Close()
+{
+	if (m_Sqes != (io_uring_sqe*)MAP_FAILED) { munmap(m_Sqes, m_SqesSize); m_Sqes = (io_uring_sqe*)MAP_FAILED; }
+	if (m_CqRing != MAP_FAILED) { munmap(m_CqRing, m_CqRingSize); m_CqRing = MAP_FAILED; }
+	if (m_SqRing != MAP_FAILED) { munmap(m_SqRing, m_SqRingSize); m_SqRing = MAP_FAILED; }
+	if (m_Fd >= 0) { close(m_Fd); m_Fd = -1; }
+}
+
+int IoUring::Enter(uint ToSubmit, uint MinComplete, uint Flags)
+{
+	return (int)syscall(__NR_io_uring_enter, m_Fd, ToSubmit, MinComplete, Flags, NULL, 0);
+}
+
+#endif
+
+class FileIoEngine_pimpl
+{
+	DECLARE_NO_COPY_CLASS(FileIoEngine_pimpl)
+
+public:
+	class WorkerThread : public Thread
+	{
+	private:
+		FileIoEngine_pimpl *m_Pimpl;
+	protected:
+		virtual void Run() { m_Pimpl->ThreadFunc(); }
+	public:
+		WorkerThread(FileIoEngine_pimpl *Pimpl) : m_Pimpl(Pimpl) { }
+	};
+
+	Mutex m_Mutex;
+	Cond m_Cond;
+	// dania czekajce na wykonanie (lub na ponowienie reszty po czciowym transferze)
+	std::deque<FILE_IO_REQUEST*> m_Queue;
+	// dania zgoszone, ktrych callback jeszcze nie wrci
+	size_t m_Outstanding;
+	bool m_Stop;
+	std::vector<WorkerThread*> m_Threads;
+
+#ifdef COMMON_IO_URING
+	bool m_UseRing;
+	IoUring m_Ring;
+	// danie przekazane do jdra w kadym slocie albo NULL - user_data w SQE to indeks slotu + 1
+	std::vector<FILE_IO_REQUEST*> m_Slots;
+	std::vector<iovec> m_SlotIovecs;
+	std::vector<uint> m_FreeSlots;
+	// Wpisane do SQ, ale jeszcze nie przyjte przez io_uring_enter
+	uint m_Unsubmitted;
+	// dania, ktrych nie udao si przekaza do jdra - wtek koczy je z podanym kodem bdu
+	std::vector< std::pair<FILE_IO_REQUEST*, int> > m_RingFailed;
+	// Bd io_uring, po ktrym kolejka nie jest ju uywana, albo 0
+	int m_RingError;
+	// Ostatni bd chwilowego braku zasobw i liczba ponowie przez wtek
+	int m_RingBusyError;
+	uint m_RingRetries;
+
+	// Wywoywa pod m_Mutex
+	// Liczba da przyjtych przez jdro, na ktrych zakoczenie mona czeka
+	uint RingInFlight() { return (uint)(m_Slots.size() - m_FreeSlots.size()) - m_Unsubmitted; }
+	void RingSubmit();
+	// Wycofuje z SQ dania nieprzyjte przez jdro i razem z kolejk przenosi do m_RingFailed
+	void RingFailUnsubmitted(int ErrorCode);
+	void RingThreadFunc();
+#endif
+
+	FileIoEngine_pimpl() : m_Mutex(0), m_Outstanding(0), m_Stop(false) { }
+	void ThreadFunc();
+	void PoolThreadFunc();
+	// Wywoywa bez m_Mutex
+	void Complete(FILE_IO_REQUEST *Request, int ErrorCode);
+};
+
+// Wykonuje (reszt) dania synchronicznie. Zwraca kod bdu albo 0.
+static int FileIoTransfer(FILE_IO_REQUEST *Request)
+{
+	while (Request->Transferred < Request->Size)
+	{
+		char *Data = (char*)Request->Data + Request->Transferred;
+		uint64 Offset = Request->Offset + Request->Transferred;
+#ifdef _WIN32
+		OVERLAPPED Overlapped;
+		ZeroMemory(&Overlapped, sizeof(Overlapped));
+		Overlapped.Offset = (DWORD)Offset;
+		Overlapped.OffsetHigh = (DWORD)(Offset >> 32);
+		DWORD Size = (DWORD)std::min<size_t>(Request->Size - Request->Transferred, 0x40000000), Done;
+		BOOL R = Request->Write ?
+			WriteFile(Request->File->GetNativeHandle(), Data, Size, &Done, &Overlapped) :
+			ReadFile(Request->File->GetNativeHandle(), Data, Size, &Done, &Overlapped);
+		if (R == 0)
+		{
+			DWORD Code = GetLastError();
+			return (!Request->Write && Code == ERROR_HANDLE_EOF) ? 0 : (int)Code;
+		}
+		if (Done == 0)
+			return Request->Write ? (int)ERROR_WRITE_FAULT : 0;
+#else
+		size_t Size = Request->Size - Request->Transferred;
+		ssize_t Done = Request->Write ?
+			pwrite(Request->File->GetNativeHandle(), Data, Size, (off_t)Offset) :
+			pread(Request->File->GetNativeHandle(), Data, Size, (off_t)Offset);
+		if (Done < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		if (Done == 0)
+			return Request->Write ? EIO : 0;
+#endif
+		Request->Transferred += (size_t)Done;
+	}
+	return 0;
+}
+
+void FileIoEngine_pimpl::ThreadFunc()
+{
+#ifdef COMMON_IO_URING
+	if (m_UseRing)
+	{
+		RingThreadFunc();
+		return;
+	}
+#endif
+	PoolThreadFunc();
+}
+
+void FileIoEngine_pimpl::PoolThreadFunc()
+{
+	FILE_IO_REQUEST *Request;
+	for (;;)
+	{
+		{
+			MUTEX_LOCK(m_Mutex);
+			while (m_Queue.empty() && !m_Stop)
+				m_Cond.Wait(&m_Mutex);
+			if (m_Queue.empty())
+				break;
+			Request = m_Queue.front();
+			m_Queue.pop_front();
+		}
+		Complete(Request, FileIoTransfer(Request));
+	}
+}
+
+void FileIoEngine_pimpl::Complete(FILE_IO_REQUEST *Request, int ErrorCode)
+{
+	Request->ErrorCode = ErrorCode;
+	if (Request->Callback != NULL)
+	{
+		try
+		{
+			Request->Callback(Request);
+		}
+		catch (...)
+		{
+			assert(0 && "Exception caught in FileIoEngine while calling FILE_IO_REQUEST::Callback.");
+		}
+	}
+
+	MUTEX_LOCK(m_Mutex);
+	m_Outstanding--;
+	if (m_Outstanding == 0)
+		m_Cond.Broadcast();
+}
+
+#ifdef COMMON_IO_URING
+
+// Liczba ponowie io_uring_enter co 1 ms przez wtek, kiedy jdro nie przyjmuje da, a w nim nic nie ma
+static const uint RING_SUBMIT_RETRIES = 100;
+
+void FileIoEngine_pimpl::RingSubmit()
+{
+	if (m_RingError != 0)
+	{
+		RingFailUnsubmitted(m_RingError);
+		return;
+	}
+
+	unsigned Tail = *m_Ring.m_SqTail, Count = 0;
+	while (!m_Queue.empty() && !m_FreeSlots.empty())
+	{
+		FILE_IO_REQUEST *Request = m_Queue.front();
+		m_Queue.pop_front();
+		uint Slot = m_FreeSlots.back();
+		m_FreeSlots.pop_back();
+		m_Slots[Slot] = Request;
+
+		iovec &Iov = m_SlotIovecs[Slot];
+		Iov.iov_base = (char*)Request->Data + Request->Transferred;
+		Iov.iov_len = Request->Size - Request->Transferred;
+
+		unsigned Index = Tail & *m_Ring.m_SqMask;
+		io_uring_sqe *Sqe = &m_Ring.m_Sqes[Index];
+		common_memzero(Sqe, sizeof(*Sqe));
+		Sqe->opcode = Request->Write ? IORING_OP_WRITEV : IORING_OP_READV;
+		Sqe->fd = Request->File->GetNativeHandle();
+		Sqe->addr = (uint64)(size_t)&Iov;
+		Sqe->len = 1;
+		Sqe->off = Request->Offset + Request->Transferred;
+		Sqe->user_data = Slot + 1;
+		m_Ring.m_SqArray[Index] = Index;
+		Tail++;
+		Count++;
+	}
+	if (Count > 0)
+	{
+		__atomic_store_n(m_Ring.m_SqTail, Tail, __ATOMIC_RELEASE);
+		m_Unsubmitted += Count;
+	}
+
+	while (m_Unsubmitted > 0)
+	{
+		int R = m_Ring.Enter(m_Unsubmitted, 0, 0);
+		if (R > 0)
+		{
+			m_Unsubmitted -= (uint)R;
+			m_RingRetries = 0;
+			continue;
+		}
+		int ErrorCode = (R < 0) ? errno : EAGAIN;
+		if (ErrorCode == EINTR)
+			continue;
+		if (ErrorCode != EAGAIN && ErrorCode != EBUSY)
+		{
+			// Kolejka nie dziaa - to i wszystkie dalsze dania kocz si tym bdem
+			m_RingError = ErrorCode;
+			RingFailUnsubmitted(ErrorCode);
+			break;
+		}
+		// Brak zasobw w jdrze - wtek ponowi po najbliszym zakoczeniu dania,
+		// a jeli w jdrze nic nie ma, po krtkiej przerwie. Submit nie czeka.
+		m_RingBusyError = ErrorCode;
+		break;
+	}
+}
+
+void FileIoEngine_pimpl::RingFailUnsubmitted(int ErrorCode)
+{
+	// Jdro nie przeczytao jeszcze tych wpisw SQ, wic mona cofn ogon
+	unsigned Tail = *m_Ring.m_SqTail;
+	for (; m_Unsubmitted > 0; m_Unsubmitted--)
+	{
+		Tail--;
+		const io_uring_sqe &Sqe = m_Ring.m_Sqes[m_Ring.m_SqArray[Tail & *m_Ring.m_SqMask]];
+		uint Slot = (uint)Sqe.user_data - 1;
+		m_RingFailed.push_back(std::make_pair(m_Slots[Slot], ErrorCode));
+		m_Slots[Slot] = NULL;
+		m_FreeSlots.push_back(Slot);
+	}
+	__atomic_store_n(m_Ring.m_SqTail, Tail, __ATOMIC_RELEASE);
+
+	for (; !m_Queue.empty(); m_Queue.pop_front())
+		m_RingFailed.push_back(std::make_pair(m_Queue.front(), ErrorCode));
+	m_Cond.Broadcast();
+}
+
+void FileIoEngine_pimpl::RingThreadFunc()
+{
+	std::vector< std::pair<FILE_IO_REQUEST*, int> > Finished;
+	bool Retry;
+	for (;;)
+	{
+		Finished.clear();
+		{
+			MUTEX_LOCK(m_Mutex);
+			// W jdrze nic nie ma - nie ma na co czeka w io_uring_enter
+			while (RingInFlight() == 0 && m_Unsubmitted == 0 && m_RingFailed.empty() && !m_Stop)
+				m_Cond.Wait(&m_Mutex);
+			if (RingInFlight() == 0 && m_Unsubmitted == 0 && m_RingFailed.empty())
+				break;
+			Finished.swap(m_RingFailed);
+			// S tylko dania, ktrych jdro nie przyjo
+			Retry = (RingInFlight() == 0);
+		}
+		if (!Finished.empty())
+		{
+			for (size_t i = 0; i < Finished.size(); i++)
+				Complete(Finished[i].first, Finished[i].second);
+			continue;
+		}
+
+		if (Retry)
+		{
+			// Przerwa bez muteksu, eby nie blokowa Submit
+			usleep(1000);
+			MUTEX_LOCK(m_Mutex);
+			if (m_Unsubmitted > 0 && RingInFlight() == 0)
+			{
+				if (++m_RingRetries > RING_SUBMIT_RETRIES)
+				{
+					m_RingRetries = 0;
+					RingFailUnsubmitted(m_RingBusyError);
+				}
+				else
+					RingSubmit();
+			}
+			continue;
+		}
+
+		if (m_Ring.Enter(0, 1, IORING_ENTER_GETEVENTS) < 0)
+		{
+			int ErrorCode = errno;
+			if (ErrorCode != EINTR && ErrorCode != EAGAIN && ErrorCode != EBUSY)
+			{
+				// Kolejka nie przyjmuje ju nowych da. dania w jdrze zostaj w slotach
+				// do nadejcia swoich CQE, bo jdro moe jeszcze uywa ich buforw.
+				MUTEX_LOCK(m_Mutex);
+				if (m_RingError == 0)
+				{
+					m_RingError = ErrorCode;
+					RingFailUnsubmitted(ErrorCode);
+				}
+			}
+			// Bez czekania w jdrze sprawdza CQ co 1 ms
+			if (ErrorCode != EINTR)
+				usleep(1000);
+		}
+
+		{
+			MUTEX_LOCK(m_Mutex);
+			unsigned Head = *m_Ring.m_CqHead;
+			unsigned Tail = __atomic_load_n(m_Ring.m_CqTail, __ATOMIC_ACQUIRE);
+			for (; Head != Tail; Head++)
+			{
+				const io_uring_cqe &Cqe = m_Ring.m_Cqes[Head & *m_Ring.m_CqMask];
+				uint Slot = (uint)Cqe.user_data - 1;
+				FILE_IO_REQUEST *Request = m_Slots[Slot];
+				assert(Request != NULL);
+				m_Slots[Slot] = NULL;
+				m_FreeSlots.push_back(Slot);
+
+				if (Cqe.res == -EINTR || Cqe.res == -EAGAIN)
+					m_Queue.push_front(Request);
+				else if (Cqe.res < 0)
+					Finished.push_back(std::make_pair(Request, -Cqe.res));
+				else if (Cqe.res == 0 && Request->Transferred < Request->Size)
+					// Koniec pliku przy odczycie
+					Finished.push_back(std::make_pair(Request, Request->Write ? EIO : 0));
+				else
+				{
+					Request->Transferred += (size_t)Cqe.res;
+					// Czciowy transfer - reszta idzie jeszcze raz
+					if (Request->Transferred < Request->Size)
+						m_Queue.push_front(Request);
+					else
+						Finished.push_back(std::make_pair(Request, 0));
+				}
+			}
+			__atomic_store_n(m_Ring.m_CqHead, Head, __ATOMIC_RELEASE);
+			RingSubmit();
+		}
+
+		for (size_t i = 0; i < Finished.size(); i++)
+			Complete(Finished[i].first, Finished[i].second);
+	}
+}
+
+#endif
+
+FileIoEngine::FileIoEngine(uint QueueDepth, uint ThreadCount, bool AllowKernelAsync) :
+	pimpl(new FileIoEngine_pimpl)
+{
+	assert(QueueDepth > 0);
+
+#ifdef COMMON_IO_URING
+	pimpl->m_UseRing = AllowKernelAsync && pimpl->m_Ring.Init(QueueDepth);
+	if (pimpl->m_UseRing)
+	{
+		uint SlotCount = std::min(QueueDepth, pimpl->m_Ring.m_SqEntries);
+		pimpl->m_Slots.resize(SlotCount, NULL);
+		pimpl->m_SlotIovecs.resize(SlotCount);
+		for (uint i = SlotCount; i > 0; i--)
+			pimpl->m_FreeSlots.push_back(i - 1);
+		pimpl->m_Unsubmitted = 0;
+		pimpl->m_RingError = 0;
+		pimpl->m_RingBusyError = 0;
+		pimpl->m_RingRetries = 0;
+		// Jeden wtek tylko odbiera zakoczenia - ca prac robi jdro
+		ThreadCount = 1;
+	}
+#endif
+
+	if (ThreadCount == 0)
+		ThreadCount = 1;
+	for (uint i = 0; i < ThreadCount; i++)
+	{
+		pimpl->m_Threads.push_back(new FileIoEngine_pimpl::WorkerThread(pimpl.get()));
+		pimpl->m_Threads.back()->Start();
+	}
+}
+
+FileIoEngine::~FileIoEngine()
+{
+	Wait();
+
+	{
+		MUTEX_LOCK(pimpl->m_Mutex);
+		pimpl->m_Stop = true;
+		pimpl->m_Cond.Broadcast();
+	}
+
+	for (size_t i = 0; i < pimpl->m_Threads.size(); i++)
+	{
+		pimpl->m_Threads[i]->Join();
+		delete pimpl->m_Threads[i];
+	}
+}
+
+void FileIoEngine::Submit(FILE_IO_REQUEST *Requests, size_t Count)
+{
+	MUTEX_LOCK(pimpl->m_Mutex);
+	for (size_t i = 0; i < Count; i++)
+	{
+		Requests[i].Transferred = 0;
+		Requests[i].ErrorCode = 0;
+		pimpl->m_Queue.push_back(&Requests[i]);
+	}
+	pimpl->m_Outstanding += Count;
+
+#ifdef COMMON_IO_URING
+	if (pimpl->m_UseRing)
+		pimpl->RingSubmit();
+#endif
+	// Budzi wtki puli albo wtek io_uring czekajcy, a co trafi do jdra
+	pimpl->m_Cond.Broadcast();
+}
+
+void FileIoEngine::Wait()
+{
+	MUTEX_LOCK(pimpl->m_Mutex);
+	while (pimpl->m_Outstanding > 0)
+		pimpl->m_Cond.Wait(&pimpl->m_Mutex);
+}
+
+bool FileIoEngine::IsKernelAsync()
+{
+#ifdef COMMON_IO_URING
+	return pimpl->m_UseRing;
+#else
+	return false;
+#endif
+}
+
+
 //HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
 // Klasa DirLister
 
@@ -984,6 +2216,81 @@ ENC DetectEncoding(const char *Data, size_t NumBytes, unsigned SuggestedEncoding
 }
 
 
+// Rest of the stream data, available read-only in memory.
+// If the stream can lend it whole (e.g. MappedFileStream), it is not copied and is
+// given back by ReleaseRead in the destructor - also when decoding throws.
+// Otherwise it is copied. Has the reading methods of MemoryStream used by decoding.
+class StreamDataView
+{
+	DECLARE_NO_COPY_CLASS(StreamDataView)
+
+public:
+	StreamDataView(SeekableStream *Src);
+	~StreamDataView();
+
+	const char * Data() const { return m_Data; }
+	uint64 GetSize() const { return m_Size; }
+	void SetPos(size_t Pos) { m_Pos = std::min(Pos, m_Size); }
+	void SetPosFromCurrent(size_t Offset) { SetPos(m_Pos + Offset); }
+	void ReadStringToEnd(string *Out);
+	void ReadStringToEnd(wstring *Out);
+
+private:
+	SeekableStream *m_Src;
+	VectorStream m_Copy;
+	const char *m_Data;
+	size_t m_Size;
+	size_t m_Pos;
+	// Liczba bajtw do oddania przez ReleaseRead, 0 jeli dane s skopiowane
+	size_t m_Borrowed;
+};
+
+StreamDataView::StreamDataView(SeekableStream *Src) :
+	m_Src(Src),
+	m_Pos(0),
+	m_Borrowed(0)
+{
+	uint64 size = Src->GetSize();
+	if(size > SIZE_MAX)
+		throw Error(_T("Stream too long."), __TFILE__, __LINE__);
+	uint64 Remaining = size - (uint64)Src->GetPos();
+
+	const void *Span;
+	size_t SpanSize = Src->AcquireReadSpan(&Span);
+	if (SpanSize > 0 && SpanSize == Remaining)
+	{
+		m_Data = (const char*)Span;
+		m_Size = m_Borrowed = SpanSize;
+		return;
+	}
+	m_Copy.SetCapacity((size_t)size);
+	CopyToEnd(&m_Copy, Src);
+	m_Data = m_Copy.Data();
+	m_Size = (size_t)m_Copy.GetSize();
+}
+
+StreamDataView::~StreamDataView()
+{
+	if (m_Borrowed > 0)
+		m_Src->ReleaseRead(m_Borrowed);
+}
+
+void StreamDataView::ReadStringToEnd(string *Out)
+{
+	Out->assign(m_Data + m_Pos, m_Size - m_Pos);
+	m_Pos = m_Size;
+}
+
+void StreamDataView::ReadStringToEnd(wstring *Out)
+{
+	if (((m_Size - m_Pos) & 0x01) != 0)
+		throw Error(_T("End of data inside an Unicode character."), __TFILE__, __LINE__);
+	Out->resize((m_Size - m_Pos) / sizeof(wchar_t));
+	if (!Out->empty())
+		memcpy(&(*Out)[0], m_Data + m_Pos, Out->length() * sizeof(wchar_t));
+	m_Pos = m_Size;
+}
+
 void LoadUnicodeFromFile(const tstring &FileName, wstring *Out, unsigned Encoding, FILE_ENCODING *OutEncoding)
 {
 	ERR_TRY;
@@ -1008,16 +2315,8 @@ void LoadUnicodeFromStream(SeekableStream *Src, wstring *Out, unsigned Encoding,
 {
 	ERR_TRY;
 
-	// Wczytaj cay plik do pamici
-	VectorStream VS;
-	{
-        uint64 size = Src->GetSize();
-        if(size > SIZE_MAX)
-            throw Error(_T("Stream too long."), __TFILE__, __LINE__);
-		VS.SetCapacity((size_t)size);
-		CopyToEnd(&VS, Src);
-		VS.Rewind();
-	}
+	// Poycz cay plik ze strumienia albo wczytaj go do pamici
+	StreamDataView VS(Src);
 
 	// Nie ma automatycznego wykrywania - koniecznie podane kodowanie
 	if ((Encoding & FILE_ENCODING_AUTODETECT) == 0)
@@ -1108,16 +2407,8 @@ void LoadUnicodeFromStream(SeekableStream *Src, string *Out, unsigned Encoding,
 {
 	ERR_TRY;
 
-	// Wczytaj cay plik do pamici
-	VectorStream VS;
-	{
-        uint64 size = Src->GetSize();
-        if(size > SIZE_MAX)
-            throw Error(_T("Stream too long."), __TFILE__, __LINE__);
-		VS.SetCapacity((size_t)size);
-		CopyToEnd(&VS, Src);
-		VS.Rewind();
-	}
+	// Poycz cay plik ze strumienia albo wczytaj go do pamici
+	StreamDataView VS(Src);
 
 	// Nie ma automatycznego wykrywania - koniecznie podane kodowanie
 	if ((Encoding & FILE_ENCODING_AUTODETECT) == 0)
@@ -70,10 +70,25 @@ enum FILE_MODE
 	FM_APPEND_PLUS,
 };
 
+/// Hint about the way file data will be accessed
+/** Used by common::FileStream and common::MappedFileStream. Ignored on Windows. */
+enum FILE_ACCESS_HINT
+{
+	FILE_ACCESS_NORMAL,     ///< No special treatment
+	FILE_ACCESS_SEQUENTIAL, ///< Data will be accessed sequentially - read ahead aggressively
+	FILE_ACCESS_RANDOM,     ///< Data will be accessed at random offsets - don't read ahead
+	FILE_ACCESS_WILLNEED,   ///< Data will be needed soon - start reading it now
+	FILE_ACCESS_DONTNEED,   ///< Data won't be needed soon - it can be dropped from memory
+};
+
 /// \internal
 class File_pimpl;
 
 /// Strumie plikowy
+/** Doesn't buffer data - each Write and Read is a system call. Wrap it in
+common::BufferingStream if you write or read many small pieces.
+On Linux it uses file descriptor and its own position, so ReadAt and WriteAt
+can be called from many threads at once. */
 class FileStream : public SeekableStream
 {
 private:
@@ -85,6 +100,12 @@ public:
 
 	virtual void Write(const void *Data, size_t Size);
 	virtual size_t Read(void *Data, size_t Size);
+#ifndef _WIN32
+	/** Single system call (pwritev). */
+	virtual void WriteV(const IO_BUFFER *Buffers, size_t BufferCount);
+	/** Single system call (preadv). */
+	virtual size_t ReadV(const IO_BUFFER *Buffers, size_t BufferCount);
+#endif
 	virtual void Flush();
 	virtual uint64 GetSize();
 	virtual int64 GetPos();
@@ -94,12 +115,157 @@ public:
 	virtual void SetSize(uint64 Size);
 	virtual void Truncate();
 	virtual bool End();
+	/** On Linux, when s is also a common::FileStream, copies inside the kernel
+	(copy_file_range, or sendfile if file systems don't support it). Not in append modes. */
+	virtual bool DirectCopyFrom(Stream *s, size_t MaxSize, size_t *OutSize);
+
+	/// Reads data from given offset, doesn't use current position
+	/** On Linux it doesn't change current position and is safe to call from
+	multiple threads at once (pread). On Windows current position is moved after
+	the data read.
+	\return Number of bytes read. Less than Size means end of file. */
+	size_t ReadAt(uint64 Offset, void *Data, size_t Size);
+	/// Writes data at given offset, doesn't use current position
+	/** On Linux it doesn't change current position and is safe to call from
+	multiple threads at once (pwrite). On Windows current position is moved after
+	the data written. */
+	void WriteAt(uint64 Offset, const void *Data, size_t Size);
+	/// Tells the system how given range of the file will be accessed
+	/** On Linux - posix_fadvise, on Windows does nothing.
+	\param Length 0 means to the end of file. */
+	void Advise(FILE_ACCESS_HINT Hint, uint64 Offset = 0, uint64 Length = 0);
+	/// Reserves disk space for the file to grow up to given size, without changing its size
+	/** Makes writing faster and the file less fragmented.
+	On Linux - fallocate, ignored if file system doesn't support it. On Windows does nothing. */
+	void Preallocate(uint64 Size);
 
 #ifdef _WIN32
 	HANDLE GetNativeHandle();
+#else
+	int GetNativeHandle();
 #endif
 };
 
+/// \internal
+/** Makes FileStream::DirectCopyFrom use sendfile, as on kernels without
+copy_file_range - for testing. */
+void _SetForceSendfile(bool Force);
+
+/// \internal
+class MappedFile_pimpl;
+
+/// File stream that maps whole file into memory
+/** Reading and writing only copy to and from the mapped memory, so loading a file
+costs only page faults. The mapping can also be accessed directly with Data() or
+AcquireReadSpan() / AcquireWriteSpan(), e.g. to parse it without any copy.
+
+Modes FM_READ maps file read-only, others map it read-write. Writing past the end
+extends the file. While the stream is open, the file on disk can be larger than
+GetSize() - it gets its real size in Flush() and in the destructor.
+
+Lock works the same way as in common::FileStream. */
+class MappedFileStream : public SeekableStream
+{
+private:
+	scoped_ptr<MappedFile_pimpl> pimpl;
+
+public:
+	MappedFileStream(const tstring &FileName, FILE_MODE FileMode, FILE_ACCESS_HINT Hint = FILE_ACCESS_NORMAL, bool Lock = true);
+	virtual ~MappedFileStream();
+
+	virtual void Write(const void *Data, size_t Size);
+	virtual size_t Read(void *Data, size_t Size);
+	virtual void MustRead(void *Data, size_t Size);
+	virtual void Flush();
+	virtual bool End();
+	virtual size_t Skip(size_t MaxLength);
+	virtual size_t AcquireReadSpan(const void **OutData);
+	virtual void ReleaseRead(size_t Size);
+	virtual size_t AcquireWriteSpan(void **OutData, size_t MinSize = 1);
+	virtual void CommitWrite(size_t Size);
+
+	virtual uint64 GetSize();
+	virtual int64 GetPos();
+	virtual void SetPos(int64 pos);
+	virtual void SetSize(uint64 Size);
+
+	/// Tells the system how given range of the file will be accessed
+	/** \param Length 0 means to the end of file. */
+	void Advise(FILE_ACCESS_HINT Hint, uint64 Offset = 0, uint64 Length = 0);
+	/// Returns true if file is mapped read-write
+	bool IsWritable();
+	/** Nie musi pozosta aktualny po wywoaniach Write, SetSize i Flush!
+	(mapowanie moe zosta przeniesione). Jest NULL, jeli plik jest pusty. */
+	char *Data();
+};
+
+struct FILE_IO_REQUEST;
+
+/// Function called when a request of common::FileIoEngine completes
+/** Called from a background thread of the engine. Must not throw and must not
+call FileIoEngine::Wait(). Can call FileIoEngine::Submit(). */
+typedef void (*FILE_IO_CALLBACK)(FILE_IO_REQUEST *Request);
+
+/// Single read or write request for common::FileIoEngine
+/** Request, its data buffer and the file must stay alive until the request completes. */
+struct FILE_IO_REQUEST
+{
+	/// File to read from or write to
+	FileStream *File;
+	/// true - write, false - read
+	bool Write;
+	/// Offset in the file
+	uint64 Offset;
+	/// Buffer with data to write or for data to read
+	void *Data;
+	/// Number of bytes to write or read
+	size_t Size;
+	/// Called when request completes. Can be NULL.
+	FILE_IO_CALLBACK Callback;
+	/// For your use
+	void *UserData;
+
+	/// [Out] Number of bytes transferred. For read less than Size means end of file.
+	size_t Transferred;
+	/// [Out] 0 if succeeded, otherwise system error code - errno on Linux, GetLastError on Windows.
+	int ErrorCode;
+};
+
+/// \internal
+class FileIoEngine_pimpl;
+
+/// Performs many file read and write requests asynchronously
+/** On Linux uses io_uring - whole batch of requests is passed to the kernel in one
+system call. If io_uring is not available (old kernel, blocked by the system), and on
+Windows, requests are executed with ReadAt / WriteAt-like calls on a pool of threads.
+
+Doesn't throw errors of requests - they are returned in FILE_IO_REQUEST::ErrorCode.
+Also when the kernel doesn't accept requests to io_uring, they complete with the
+error code of io_uring_enter instead of waiting forever. */
+class FileIoEngine
+{
+	DECLARE_NO_COPY_CLASS(FileIoEngine)
+
+private:
+	scoped_ptr<FileIoEngine_pimpl> pimpl;
+
+public:
+	/** \param QueueDepth Maximum number of requests processed by the kernel at once (io_uring).
+	\param ThreadCount Number of threads if thread pool is used.
+	\param AllowKernelAsync Pass false to always use the thread pool. */
+	FileIoEngine(uint QueueDepth = 128, uint ThreadCount = 4, bool AllowKernelAsync = true);
+	/// Waits for all submitted requests to complete
+	~FileIoEngine();
+
+	/// Starts given requests
+	/** Returns immediately. Fills Transferred and ErrorCode when each request completes. */
+	void Submit(FILE_IO_REQUEST *Requests, size_t Count = 1);
+	/// Waits until all submitted requests complete and their callbacks return
+	void Wait();
+	/// Returns true if io_uring is used, false if the thread pool
+	bool IsKernelAsync();
+};
+
 /// \internal
 class DirLister_pimpl;
 
@@ -7,7 +7,62 @@ Encoding UTF-8, end of line CR+LF \n
 License: GNU LGPL. \n
 Documentation: \ref FreeList
 */
-//#include "Base.hpp"
-//#include "FreeList.hpp"
+#include "Base.hpp"
+#include "FreeList.hpp"
+#include <cstdlib> // dla malloc, free
 
-// Totally empty.
+namespace common
+{
+
+std::atomic<bool> g_AllocationTrackingEnabled(false);
+thread_local ALLOCATION_COUNTERS g_ThreadAllocationCounters;
+
+void ALLOCATION_COUNTERS::Add(const ALLOCATION_COUNTERS &Begin, const ALLOCATION_COUNTERS &End)
+{
+	HeapAllocCount += End.HeapAllocCount - Begin.HeapAllocCount;
+	HeapAllocBytes += End.HeapAllocBytes - Begin.HeapAllocBytes;
+	HeapFreeCount += End.HeapFreeCount - Begin.HeapFreeCount;
+	FreeListAllocCount += End.FreeListAllocCount - Begin.FreeListAllocCount;
+	FreeListAllocBytes += End.FreeListAllocBytes - Begin.FreeListAllocBytes;
+}
+
+void EnableAllocationTracking(bool Enable)
+{
+	g_AllocationTrackingEnabled = Enable;
+}
+
+void * TrackedAlloc(size_t Size)
+{
+	// Counters are plain data with no constructor, so they are safe to use
+	// also from allocations made before main and during thread exit
+	if (IsAllocationTrackingEnabled())
+	{
+		ALLOCATION_COUNTERS &Counters = g_ThreadAllocationCounters;
+		Counters.HeapAllocCount++;
+		Counters.HeapAllocBytes += Size;
+	}
+
+	if (Size == 0)
+		Size = 1;
+	for (;;)
+	{
+		void *Ptr = malloc(Size);
+		if (Ptr != NULL)
+			return Ptr;
+		std::new_handler Handler = std::get_new_handler();
+		if (Handler == NULL)
+			throw std::bad_alloc();
+		Handler();
+	}
+}
+
+void TrackedFree(void *Ptr)
+{
+	if (Ptr == NULL)
+		return;
+	if (IsAllocationTrackingEnabled())
+		g_ThreadAllocationCounters.HeapFreeCount++;
+	free(Ptr);
+}
+
+} // namespace common
@@ -15,6 +15,7 @@ Module components: \ref code_freelist
 #define COMMON_FREELIST_H_
 
 #include <new> // dla bad_alloc
+#include <atomic>
 
 namespace common
 {
@@ -24,6 +25,61 @@ Dokumentacja: \ref Module_FreeList \n
 Nagwek: FreeList.hpp */
 //@{
 
+/// Numbers of memory allocations made by a thread, see \ref FreeList_Tracking.
+/** Values only grow - measure difference between two moments. */
+struct ALLOCATION_COUNTERS
+{
+	/// Calls to operator new and new[]
+	uint64 HeapAllocCount;
+	uint64 HeapAllocBytes;
+	/// Calls to operator delete and delete[] with not null pointer
+	uint64 HeapFreeCount;
+	/// Objects allocated from FreeList and DynamicFreeList
+	uint64 FreeListAllocCount;
+	uint64 FreeListAllocBytes;
+
+	void Clear() { HeapAllocCount = HeapAllocBytes = HeapFreeCount = FreeListAllocCount = FreeListAllocBytes = 0; }
+	/// Adds difference End - Begin.
+	void Add(const ALLOCATION_COUNTERS &Begin, const ALLOCATION_COUNTERS &End);
+};
+
+/// \internal
+extern std::atomic<bool> g_AllocationTrackingEnabled;
+/// \internal
+extern thread_local ALLOCATION_COUNTERS g_ThreadAllocationCounters;
+
+/// Turns on or off counting of allocations. Off by default.
+/** Heap allocations are counted only if global new and delete are replaced
+with COMMON_TRACK_NEW_DELETE. */
+void EnableAllocationTracking(bool Enable);
+inline bool IsAllocationTrackingEnabled() { return g_AllocationTrackingEnabled.load(std::memory_order_relaxed); }
+/// Returns allocations made so far by the calling thread.
+inline const ALLOCATION_COUNTERS & GetThreadAllocationCounters() { return g_ThreadAllocationCounters; }
+
+/// \internal
+inline void TrackFreeListAllocation(size_t Size)
+{
+	if (IsAllocationTrackingEnabled())
+	{
+		ALLOCATION_COUNTERS &Counters = g_ThreadAllocationCounters;
+		Counters.FreeListAllocCount++;
+		Counters.FreeListAllocBytes += Size;
+	}
+}
+
+/// Allocates memory like operator new and counts it if tracking is enabled.
+void * TrackedAlloc(size_t Size);
+/// Frees memory allocated with TrackedAlloc.
+void TrackedFree(void *Ptr);
+
+/// Replaces global operators new and delete with TrackedAlloc and TrackedFree.
+/** Use it once, outside any namespace, in a source file of the program. */
+#define COMMON_TRACK_NEW_DELETE() \
+	void * operator new(size_t Size) { return common::TrackedAlloc(Size); } \
+	void * operator new[](size_t Size) { return common::TrackedAlloc(Size); } \
+	void operator delete(void *Ptr) noexcept { common::TrackedFree(Ptr); } \
+	void operator delete[](void *Ptr) noexcept { common::TrackedFree(Ptr); }
+
 /// Alokator posiadajcy sta pul pamici
 template <typename T>
 class FreeList
@@ -50,6 +106,7 @@ private:
 		T *Ptr = (T*)m_FreeBlocks;
 		m_FreeBlocks = m_FreeBlocks->Next;
 		m_FreeCount--;
+		TrackFreeListAllocation(sizeof(T));
 		return Ptr;
 	}
 
@@ -9,13 +9,24 @@ Documentation: \ref Module_Logger \n
 Module components: \ref code_logger
 */
 #include "Base.hpp"
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <sys/types.h>
+	#include <sys/mman.h> // dla mmap
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+#include "Error.hpp"
 #include "Math.hpp"
 #include "Threads.hpp"
 #include "Files.hpp"
 #include "Logger.hpp"
 #include "DateTime.hpp"
+#include "ZlibUtils.hpp"
 #include <iostream>
 #include <deque>
+#include <atomic>
 
 
 namespace common
@@ -32,6 +43,26 @@ struct PREFIX_INFO
 
 const uint32 MAX_QUEUE_SIZE = 1024;
 
+// All existing LogSite objects, for suppression summary
+struct LOG_SITE_REGISTRY
+{
+	Mutex m_Mutex;
+	std::vector<LogSite*> m_Sites;
+
+	LOG_SITE_REGISTRY() : m_Mutex(0) { }
+};
+
+// Created on first use, so it exists before any static LogSite and is destroyed after all of them.
+LOG_SITE_REGISTRY & GetLogSiteRegistry()
+{
+	static LOG_SITE_REGISTRY Registry;
+	return Registry;
+}
+
+// Set when any LogSite suppresses a message, cleared by the summary.
+// Lets Logger::Log skip the summary check without locking while nothing was suppressed.
+static std::atomic<bool> g_LogSitesSuppressed(false);
+
 tstring HtmlSpecialChars(const tstring &s)
 {
 	tstring s1, s2;
@@ -45,6 +76,257 @@ tstring HtmlSpecialChars(const tstring &s)
 	return s1;
 }
 
+//HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
+// Klasa LogFields
+
+void LogFields::WriteHeader(FIELD_TYPE Type, const char *Key)
+{
+	size_t KeyLength = strlen(Key);
+	assert(KeyLength <= 255);
+	KeyLength = std::min<size_t>(KeyLength, 255);
+
+	size_t Pos = m_Data.size();
+	m_Data.resize(Pos + 2 + KeyLength);
+	m_Data[Pos] = (uint8)Type;
+	m_Data[Pos+1] = (uint8)KeyLength;
+	if (KeyLength > 0)
+		common_memcpy(&m_Data[Pos+2], Key, KeyLength);
+}
+
+void LogFields::WriteData(const void *Data, size_t Size)
+{
+	size_t Pos = m_Data.size();
+	m_Data.resize(Pos + Size);
+	if (Size > 0)
+		common_memcpy(&m_Data[Pos], Data, Size);
+}
+
+LogFields & LogFields::Add(const char *Key, bool Value)
+{
+	WriteHeader(FIELD_BOOL, Key);
+	m_Data.push_back(Value ? 1 : 0);
+	return *this;
+}
+
+LogFields & LogFields::Add(const char *Key, const tchar *Value)
+{
+	return AddString(Key, Value, common_strlen(Value));
+}
+
+LogFields & LogFields::Add(const char *Key, const tstring &Value)
+{
+	return AddString(Key, Value.data(), Value.length());
+}
+
+LogFields & LogFields::AddInt(const char *Key, int64 Value)
+{
+	WriteHeader(FIELD_INT, Key);
+	WriteData(&Value, sizeof(Value));
+	return *this;
+}
+
+LogFields & LogFields::AddUint(const char *Key, uint64 Value)
+{
+	WriteHeader(FIELD_UINT, Key);
+	WriteData(&Value, sizeof(Value));
+	return *this;
+}
+
+LogFields & LogFields::AddFloat(const char *Key, double Value)
+{
+	WriteHeader(FIELD_FLOAT, Key);
+	WriteData(&Value, sizeof(Value));
+	return *this;
+}
+
+LogFields & LogFields::AddVec3(const char *Key, float x, float y, float z)
+{
+	float v[3] = { x, y, z };
+	WriteHeader(FIELD_VEC3, Key);
+	WriteData(v, sizeof(v));
+	return *this;
+}
+
+LogFields & LogFields::AddString(const char *Key, const tchar *Value, size_t Length)
+{
+	uint32 Length32 = (uint32)Length;
+	WriteHeader(FIELD_STRING, Key);
+	WriteData(&Length32, sizeof(Length32));
+	WriteData(Value, Length * sizeof(tchar));
+	return *this;
+}
+
+void LogFields::SetData(const void *Data, size_t Size)
+{
+	m_Data.clear();
+	WriteData(Data, Size);
+}
+
+bool LogFields::GetNextField(size_t *InOutOffset, FIELD *OutField) const
+{
+	size_t Pos = *InOutOffset;
+	if (Pos + 2 > m_Data.size())
+		return false;
+
+	OutField->Type = (FIELD_TYPE)m_Data[Pos];
+	OutField->KeyLength = m_Data[Pos+1];
+	OutField->Key = (const char*)&m_Data[Pos+2];
+	Pos += 2 + OutField->KeyLength;
+
+	size_t ValueSize;
+	switch (OutField->Type)
+	{
+	case FIELD_INT:
+	case FIELD_UINT:
+	case FIELD_FLOAT:
+		ValueSize = 8;
+		break;
+	case FIELD_BOOL:
+		ValueSize = 1;
+		break;
+	case FIELD_VEC3:
+		ValueSize = 3 * sizeof(float);
+		break;
+	case FIELD_STRING:
+		{
+			if (Pos + sizeof(uint32) > m_Data.size())
+				return false;
+			uint32 Length32;
+			common_memcpy(&Length32, &m_Data[Pos], sizeof(Length32));
+			Pos += sizeof(uint32);
+			OutField->StringLength = Length32;
+			ValueSize = Length32 * sizeof(tchar);
+		}
+		break;
+	default:
+		// Broken data
+		return false;
+	}
+	if (Pos + ValueSize > m_Data.size())
+		return false;
+
+	switch (OutField->Type)
+	{
+	case FIELD_INT:   common_memcpy(&OutField->Int, &m_Data[Pos], 8); break;
+	case FIELD_UINT:  common_memcpy(&OutField->Uint, &m_Data[Pos], 8); break;
+	case FIELD_FLOAT: common_memcpy(&OutField->Float, &m_Data[Pos], 8); break;
+	case FIELD_BOOL:  OutField->Bool = (m_Data[Pos] != 0); break;
+	case FIELD_VEC3:  common_memcpy(OutField->Vec3, &m_Data[Pos], 3 * sizeof(float)); break;
+	case FIELD_STRING:
+		// May be not aligned, but tchar is read only by bytes when copied to tstring anyway.
+		OutField->String = (const tchar*)(m_Data.empty() ? NULL : &m_Data[0] + Pos);
+		break;
+	}
+	if (OutField->Type != FIELD_STRING)
+	{
+		OutField->String = NULL;
+		OutField->StringLength = 0;
+	}
+
+	*InOutOffset = Pos + ValueSize;
+	return true;
+}
+
+void LogFields::FormatText(tstring *InOut) const
+{
+	size_t Offset = 0;
+	FIELD Field;
+	tstring Tmp;
+	bool First = true;
+	while (GetNextField(&Offset, &Field))
+	{
+		if (!First)
+			*InOut += _T(' ');
+		First = false;
+
+		for (size_t i = 0; i < Field.KeyLength; i++)
+			*InOut += (tchar)Field.Key[i];
+		*InOut += _T('=');
+
+		switch (Field.Type)
+		{
+		case FIELD_INT:   IntToStr(&Tmp, Field.Int); *InOut += Tmp; break;
+		case FIELD_UINT:  UintToStr(&Tmp, Field.Uint); *InOut += Tmp; break;
+		case FIELD_FLOAT: DoubleToStr(&Tmp, Field.Float); *InOut += Tmp; break;
+		case FIELD_BOOL:  *InOut += Field.Bool ? _T("true") : _T("false"); break;
+		case FIELD_VEC3:
+			for (uint i = 0; i < 3; i++)
+			{
+				if (i > 0)
+					*InOut += _T(',');
+				FloatToStr(&Tmp, Field.Vec3[i]);
+				*InOut += Tmp;
+			}
+			break;
+		case FIELD_STRING:
+			AppendJsonString(InOut, Field.String, Field.StringLength);
+			break;
+		}
+	}
+}
+
+void LogFields::FormatJson(tstring *InOut) const
+{
+	size_t Offset = 0;
+	FIELD Field;
+	tstring Tmp;
+	bool First = true;
+	while (GetNextField(&Offset, &Field))
+	{
+		if (!First)
+			*InOut += _T(',');
+		First = false;
+
+		*InOut += _T('"');
+		for (size_t i = 0; i < Field.KeyLength; i++)
+			*InOut += (tchar)Field.Key[i];
+		*InOut += _T("\":");
+
+		switch (Field.Type)
+		{
+		case FIELD_INT:  IntToStr(&Tmp, Field.Int); *InOut += Tmp; break;
+		case FIELD_UINT: UintToStr(&Tmp, Field.Uint); *InOut += Tmp; break;
+		case FIELD_FLOAT:
+			// JSON has no representation for infinity and NaN
+			if (is_finite(Field.Float))
+			{
+				DoubleToStr(&Tmp, Field.Float, 'g', 17);
+				*InOut += Tmp;
+			}
+			else
+				*InOut += _T("null");
+			break;
+		case FIELD_BOOL: *InOut += Field.Bool ? _T("true") : _T("false"); break;
+		case FIELD_VEC3:
+			*InOut += _T('[');
+			for (uint i = 0; i < 3; i++)
+			{
+				if (i > 0)
+					*InOut += _T(',');
+				if (is_finite(Field.Vec3[i]))
+				{
+					FloatToStr(&Tmp, Field.Vec3[i], 'g', 9);
+					*InOut += Tmp;
+				}
+				else
+					*InOut += _T("null");
+			}
+			*InOut += _T(']');
+			break;
+		case FIELD_STRING:
+			AppendJsonString(InOut, Field.String, Field.StringLength);
+			break;
+		}
+	}
+}
+
+LogFields & BeginLogFields()
+{
+	static thread_local LogFields Fields;
+	Fields.Clear();
+	return Fields;
+}
+
 //HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
 // Klasa Log
 
@@ -56,24 +338,39 @@ public:
 	ILog *impl;
 	tstring m_PrefixFormat;
 	TYPE_PREFIX_MAPPING_VECTOR m_TypePrefixMapping;
+	// Own queue and thread of this log, NULL if it is logged directly. Owned by the logger.
+	LogWorker *m_Worker;
 
 	// dla loggera
-	void Log(uint32 Type, const tstring &Message, const PREFIX_INFO &PrefixInfo);
+	// Fields can be NULL
+	void Log(uint32 Type, const tstring &Message, const PREFIX_INFO &PrefixInfo, const LogFields *Fields);
+	// Builds prefix and type prefix from m_PrefixFormat and m_TypePrefixMapping.
+	// Called under the logger mutex, also for logs with their own worker thread.
+	void FormatPrefix(tstring *OutPrefix, tstring *OutTypePrefix, uint32 Type, const PREFIX_INFO &PrefixInfo);
+	// Fields can be NULL
+	void Deliver(uint32 Type, const tstring &Prefix, const tstring &TypePrefix, const tstring &Message, const LogFields *Fields);
 };
 
-void ILog::ILog_pimpl::Log(uint32 Type, const tstring &Message, const PREFIX_INFO &PrefixInfo)
+void ILog::ILog_pimpl::Log(uint32 Type, const tstring &Message, const PREFIX_INFO &PrefixInfo, const LogFields *Fields)
+{
+	tstring Prefix, TypePrefix;
+	FormatPrefix(&Prefix, &TypePrefix, Type, PrefixInfo);
+	Deliver(Type, Prefix, TypePrefix, Message, Fields);
+}
+
+void ILog::ILog_pimpl::FormatPrefix(tstring *OutPrefix, tstring *OutTypePrefix, uint32 Type, const PREFIX_INFO &PrefixInfo)
 {
 	// Uoenie prefiksu
-	tstring Prefix1, Prefix2;
+	tstring Prefix1;
 	Replace(&Prefix1, m_PrefixFormat, _T("%D"), PrefixInfo.Date);
-	Replace(&Prefix2, Prefix1, _T("%T"), PrefixInfo.Time);
-	Replace(&Prefix1, Prefix2, _T("%1"), PrefixInfo.CustomPrefixInfo[0]);
-	Replace(&Prefix2, Prefix1, _T("%2"), PrefixInfo.CustomPrefixInfo[1]);
-	Replace(&Prefix1, Prefix2, _T("%3"), PrefixInfo.CustomPrefixInfo[2]);
-	Replace(&Prefix2, Prefix1, _T("%%"), _T("%"));
+	Replace(OutPrefix, Prefix1, _T("%T"), PrefixInfo.Time);
+	Replace(&Prefix1, *OutPrefix, _T("%1"), PrefixInfo.CustomPrefixInfo[0]);
+	Replace(OutPrefix, Prefix1, _T("%2"), PrefixInfo.CustomPrefixInfo[1]);
+	Replace(&Prefix1, *OutPrefix, _T("%3"), PrefixInfo.CustomPrefixInfo[2]);
+	Replace(OutPrefix, Prefix1, _T("%%"), _T("%"));
 
 	// Uoenie prefiksu typu
-	tstring TypePrefix;
+	OutTypePrefix->clear();
 	for (
 		TYPE_PREFIX_MAPPING_VECTOR::const_iterator cit = m_TypePrefixMapping.begin();
 		cit != m_TypePrefixMapping.end();
@@ -81,25 +378,45 @@ void ILog::ILog_pimpl::Log(uint32 Type, const tstring &Message, const PREFIX_INF
 	{
 		if (Type & cit->first)
 		{
-			TypePrefix = cit->second;
+			*OutTypePrefix = cit->second;
 			break;
 		}
 	}
+}
 
+void ILog::ILog_pimpl::Deliver(uint32 Type, const tstring &Prefix, const tstring &TypePrefix, const tstring &Message, const LogFields *Fields)
+{
 	// Przesanie do zalogowania
-	impl->OnLog(Type, Prefix2, TypePrefix, Message);
+	if (Fields == NULL)
+		impl->OnLog(Type, Prefix, TypePrefix, Message);
+	else
+		impl->OnLogFields(Type, Prefix, TypePrefix, Message, *Fields);
 }
 
 ILog::ILog() :
 	pimpl(new ILog_pimpl())
 {
 	pimpl->impl = this;
+	pimpl->m_Worker = NULL;
 }
 
 ILog::~ILog()
 {
 }
 
+void ILog::OnLogFields(uint32 Type, const tstring &Prefix, const tstring &TypePrefix, const tstring &Message, const LogFields &Fields)
+{
+	if (Fields.IsEmpty())
+		OnLog(Type, Prefix, TypePrefix, Message);
+	else
+	{
+		tstring s = Message;
+		s += _T(' ');
+		Fields.FormatText(&s);
+		OnLog(Type, Prefix, TypePrefix, s);
+	}
+}
+
 void ILog::AddTypePrefixMapping(uint32 Mask, const tstring &Prefix)
 {
 	pimpl->m_TypePrefixMapping.push_back(std::make_pair(Mask, Prefix));
@@ -110,6 +427,136 @@ void ILog::SetPrefixFormat(const tstring &PrefixFormat)
 	pimpl->m_PrefixFormat = PrefixFormat;
 }
 
+//HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
+// Klasa LogWorker
+
+// Queue and thread of a single log registered by
+// Logger::AddLogMapping(Mask, Log, MaxQueueSize, Policy)
+class LogWorker
+{
+	DECLARE_NO_COPY_CLASS(LogWorker)
+
+public:
+	// Message with its prefix already formatted, so the thread doesn't touch
+	// settings of the log, which may be changed meanwhile.
+	struct ITEM
+	{
+		uint32 Type;
+		tstring Prefix;
+		tstring TypePrefix;
+		tstring Message;
+		bool HasFields;
+		LogFields Fields;
+	};
+
+	LogWorker(ILog *Log, uint MaxQueueSize, LOG_QUEUE_FULL_POLICY Policy);
+	// Logs all messages left in the queue and waits for the thread
+	~LogWorker();
+
+	// Takes content of Item. With LOG_QUEUE_BLOCK it can wait, so it must not be called under the logger mutex.
+	void Push(ITEM &Item);
+	uint64 GetDroppedCount();
+
+private:
+	class WorkerThread : public Thread
+	{
+	private:
+		LogWorker *m_Worker;
+	protected:
+		virtual void Run() { m_Worker->ThreadFunc(); }
+	public:
+		WorkerThread(LogWorker *Worker) : m_Worker(Worker) { }
+	};
+
+	ILog *m_Log;
+	uint m_MaxQueueSize;
+	LOG_QUEUE_FULL_POLICY m_Policy;
+	Mutex m_Mutex;
+	Cond m_NotEmptyOrExit;
+	Cond m_NotFull;
+	std::deque<ITEM> m_Queue;
+	bool m_End;
+	uint64 m_Dropped;
+	scoped_ptr<WorkerThread> m_Thread;
+
+	void ThreadFunc();
+};
+
+LogWorker::LogWorker(ILog *Log, uint MaxQueueSize, LOG_QUEUE_FULL_POLICY Policy) :
+	m_Log(Log),
+	m_MaxQueueSize(std::max(MaxQueueSize, 1u)),
+	m_Policy(Policy),
+	m_Mutex(0),
+	m_End(false),
+	m_Dropped(0)
+{
+	m_Thread.reset(new WorkerThread(this));
+	m_Thread->Start();
+}
+
+LogWorker::~LogWorker()
+{
+	{
+		MUTEX_LOCK(m_Mutex);
+		m_End = true;
+		m_NotEmptyOrExit.Signal();
+	}
+	m_Thread->Join();
+}
+
+void LogWorker::Push(ITEM &Item)
+{
+	MUTEX_LOCK(m_Mutex);
+
+	if (m_Queue.size() >= m_MaxQueueSize)
+	{
+		if (m_Policy == LOG_QUEUE_DROP)
+		{
+			m_Dropped++;
+			return;
+		}
+		while (m_Queue.size() >= m_MaxQueueSize)
+			m_NotFull.Wait(&m_Mutex);
+	}
+
+	m_Queue.push_back(ITEM());
+	std::swap(m_Queue.back(), Item);
+	m_NotEmptyOrExit.Signal();
+}
+
+uint64 LogWorker::GetDroppedCount()
+{
+	MUTEX_LOCK(m_Mutex);
+	return m_Dropped;
+}
+
+void LogWorker::ThreadFunc()
+{
+	ITEM Item;
+	for (;;)
+	{
+		try
+		{
+			{
+				MUTEX_LOCK(m_Mutex);
+				while (m_Queue.empty() && !m_End)
+					m_NotEmptyOrExit.Wait(&m_Mutex);
+				// Finish only when everything was logged
+				if (m_Queue.empty())
+					break;
+				std::swap(Item, m_Queue.front());
+				m_Queue.pop_front();
+				m_NotFull.Signal();
+			}
+			m_Log->pimpl->Deliver(Item.Type, Item.Prefix, Item.TypePrefix, Item.Message, Item.HasFields ? &Item.Fields : NULL);
+		}
+		catch (...)
+		{
+			// Log that failed must not take the thread down
+		}
+	}
+}
+
 //HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
 // Klasa Logger
 
@@ -129,15 +576,28 @@ public:
 		uint32 Type;
 		// Tre custom prefix info lub komunikatu
 		tstring Message;
+		// Only for a message with structured fields
+		bool HasFields;
+		LogFields Fields;
 	};
 
 	typedef std::vector< std::pair<uint32, ILog*> > LOG_MAPPING_VECTOR;
 
 	Mutex m_Mutex;
 	LOG_MAPPING_VECTOR m_LogMapping;
+	// Logi z wasn kolejk i wtkiem, razem z ich workerami (do usunicia)
+	std::vector< std::pair<ILog*, LogWorker*> > m_Workers;
 	tstring m_CustomPrefixInfo[3];
 
-	Logger_pimpl() : m_Mutex(Mutex::FLAG_RECURSIVE) { }
+	// ----- Suppression summary -----
+	// Protects all the fields below. m_SummaryInterval is atomic only for the quick check without locking.
+	Mutex m_SummaryMutex;
+	uint32 m_SummaryType;
+	// 0 = disabled
+	std::atomic<uint> m_SummaryInterval;
+	time_t m_LastSummaryTime;
+
+	Logger_pimpl() : m_Mutex(Mutex::FLAG_RECURSIVE), m_SummaryMutex(0), m_SummaryType(0), m_SummaryInterval(0), m_LastSummaryTime(0) { }
 
 	bool m_UseQueue;
 	// ----- Uywane tylko jeli uywane jest kolejkowanie, std wskaniki -----
@@ -158,10 +618,18 @@ public:
 	// Uchwyt do wtku, co by si dao poczeka na jego zakoczenie
 	scoped_ptr<LoggerThread> m_Thread;
 
-	void Log(uint32 Type, const tstring &Message);
+	// Fields can be NULL
+	void Log(uint32 Type, const tstring &Message, const LogFields *Fields);
 	void SetCustomPrefixInfo(int Index, const tstring &Info);
 	// Funkcja do wtku
 	void ThreadFunc();
+	// Logs suppression summary if enabled and the interval elapsed
+	void CheckSuppressionSummary(Logger *Owner);
+	// Gives the log its own queue and thread, unless it already has them
+	void CreateWorker(ILog *Log, uint MaxQueueSize, LOG_QUEUE_FULL_POLICY Policy);
+	uint64 GetDroppedCount(ILog *Log);
+	// Logs all queued messages and finishes worker threads of all logs
+	void DestroyWorkers();
 };
 
 // Zrobione brzydko, bo to jest dorabiane ju po sprawie
@@ -177,38 +645,70 @@ public:
 	LoggerThread(Logger_pimpl *Pimpl) : m_Pimpl(Pimpl) { }
 };
 
-void Logger_pimpl::Log(uint32 Type, const tstring &Message)
+void Logger_pimpl::Log(uint32 Type, const tstring &Message, const LogFields *Fields)
 {
-	MUTEX_LOCK(m_Mutex);
+	typedef std::vector< std::pair<LogWorker*, LogWorker::ITEM> > PENDING_VECTOR;
+	// Reused, so logging doesn't allocate the vector on every call. Taken out for the time
+	// of the call, because a log can call the logger again from its OnLog.
+	static thread_local PENDING_VECTOR PendingBuffer;
 
-	PREFIX_INFO PrefixInfo;
-	bool PrefixGenerated = false;
+	// Messages for logs with own queue, passed to them after the mutex is released,
+	// because a full queue with LOG_QUEUE_BLOCK would stop all other logging.
+	PENDING_VECTOR Pending;
+	Pending.swap(PendingBuffer);
 
-	// Znajd odpwiednie loggery
-	for (
-		Logger_pimpl::LOG_MAPPING_VECTOR::const_iterator cit = m_LogMapping.begin();
-		cit != m_LogMapping.end();
-		++cit)
 	{
-		// Jeli maska pasuje
-		if (Type & cit->first)
+		MUTEX_LOCK(m_Mutex);
+
+		PREFIX_INFO PrefixInfo;
+		bool PrefixGenerated = false;
+
+		// Znajd odpwiednie loggery
+		for (
+			Logger_pimpl::LOG_MAPPING_VECTOR::const_iterator cit = m_LogMapping.begin();
+			cit != m_LogMapping.end();
+			++cit)
 		{
-			// Jeli jeszcze nie by wygenerowany, wygeneruj prefiks
-			if (!PrefixGenerated)
+			// Jeli maska pasuje
+			if (Type & cit->first)
 			{
-				TMSTRUCT nowTime = TMSTRUCT(Now());
-				DateToStr(&PrefixInfo.Date, nowTime, _T("Y-N-D"));
-				DateToStr(&PrefixInfo.Time, nowTime, _T("H:M:S"));
-				PrefixInfo.CustomPrefixInfo[0] = m_CustomPrefixInfo[0];
-				PrefixInfo.CustomPrefixInfo[1] = m_CustomPrefixInfo[1];
-				PrefixInfo.CustomPrefixInfo[2] = m_CustomPrefixInfo[2];
-				PrefixGenerated = true;
+				// Jeli jeszcze nie by wygenerowany, wygeneruj prefiks
+				if (!PrefixGenerated)
+				{
+					TMSTRUCT nowTime = TMSTRUCT(Now());
+					DateToStr(&PrefixInfo.Date, nowTime, _T("Y-N-D"));
+					DateToStr(&PrefixInfo.Time, nowTime, _T("H:M:S"));
+					PrefixInfo.CustomPrefixInfo[0] = m_CustomPrefixInfo[0];
+					PrefixInfo.CustomPrefixInfo[1] = m_CustomPrefixInfo[1];
+					PrefixInfo.CustomPrefixInfo[2] = m_CustomPrefixInfo[2];
+					PrefixGenerated = true;
+				}
+
+				// Przelij do zalogowania - bezporednio albo do kolejki logu
+				ILog::ILog_pimpl *LogPimpl = cit->second->pimpl.get();
+				if (LogPimpl->m_Worker != NULL)
+				{
+					Pending.push_back(std::make_pair(LogPimpl->m_Worker, LogWorker::ITEM()));
+					LogWorker::ITEM &Item = Pending.back().second;
+					LogPimpl->FormatPrefix(&Item.Prefix, &Item.TypePrefix, Type, PrefixInfo);
+					Item.Type = Type;
+					Item.Message = Message;
+					Item.HasFields = (Fields != NULL);
+					if (Fields != NULL)
+						Item.Fields = *Fields;
+				}
+				else
+					LogPimpl->Log(Type, Message, PrefixInfo, Fields);
 			}
-
-			// Przelij do zalogowania
-			cit->second->pimpl->Log(Type, Message, PrefixInfo);
 		}
 	}
+
+	// Workers live until the logger is destroyed, so they can be used without the mutex
+	for (size_t i = 0; i < Pending.size(); i++)
+		Pending[i].first->Push(Pending[i].second);
+
+	Pending.clear();
+	Pending.swap(PendingBuffer);
 }
 
 void Logger_pimpl::SetCustomPrefixInfo(int Index, const tstring &Info)
@@ -218,6 +718,48 @@ void Logger_pimpl::SetCustomPrefixInfo(int Index, const tstring &Info)
 	m_CustomPrefixInfo[Index] = Info;
 }
 
+void Logger_pimpl::CheckSuppressionSummary(Logger *Owner)
+{
+	if (m_SummaryInterval.load(std::memory_order_relaxed) == 0 || !g_LogSitesSuppressed.load(std::memory_order_relaxed))
+		return;
+
+	{
+		MUTEX_LOCK(m_SummaryMutex);
+		time_t Now = GetTimeNow();
+		uint Interval = m_SummaryInterval.load(std::memory_order_relaxed);
+		if (Interval == 0 || Now - m_LastSummaryTime < (time_t)Interval)
+			return;
+		m_LastSummaryTime = Now;
+	}
+
+	Owner->LogSuppressionSummary();
+}
+
+void Logger_pimpl::CreateWorker(ILog *Log, uint MaxQueueSize, LOG_QUEUE_FULL_POLICY Policy)
+{
+	if (Log->pimpl->m_Worker != NULL)
+		return;
+	Log->pimpl->m_Worker = new LogWorker(Log, MaxQueueSize, Policy);
+	m_Workers.push_back(std::make_pair(Log, Log->pimpl->m_Worker));
+}
+
+uint64 Logger_pimpl::GetDroppedCount(ILog *Log)
+{
+	if (Log->pimpl->m_Worker == NULL)
+		return 0;
+	return Log->pimpl->m_Worker->GetDroppedCount();
+}
+
+void Logger_pimpl::DestroyWorkers()
+{
+	for (size_t i = 0; i < m_Workers.size(); i++)
+	{
+		delete m_Workers[i].second;
+		m_Workers[i].first->pimpl->m_Worker = NULL;
+	}
+	m_Workers.clear();
+}
+
 void Logger_pimpl::ThreadFunc()
 {
 	QUEUE_ITEM QueueItem;
@@ -243,7 +785,7 @@ void Logger_pimpl::ThreadFunc()
 			}
 			// Zrb co mwi item (on tam sobie ju zablokuje co trzeba)
 			if (QueueItem.What == MAXUINT32)
-				Log(QueueItem.Type, QueueItem.Message);
+				Log(QueueItem.Type, QueueItem.Message, QueueItem.HasFields ? &QueueItem.Fields : NULL);
 			else
 				SetCustomPrefixInfo(QueueItem.What, QueueItem.Message);
 		}
@@ -286,6 +828,9 @@ Logger::~Logger()
 		}
 		pimpl->m_Thread->Join();
 	}
+
+	// Dopiero teraz, bo wtek kolejki loggera mg jeszcze co do nich wrzuca
+	pimpl->DestroyWorkers();
 }
 
 void Logger::AddLogMapping(uint32 Mask, ILog *Log)
@@ -293,6 +838,19 @@ void Logger::AddLogMapping(uint32 Mask, ILog *Log)
 	pimpl->m_LogMapping.push_back(std::make_pair(Mask, Log));
 }
 
+void Logger::AddLogMapping(uint32 Mask, ILog *Log, uint MaxQueueSize, LOG_QUEUE_FULL_POLICY Policy)
+{
+	MUTEX_LOCK(pimpl->m_Mutex);
+
+	pimpl->CreateWorker(Log, MaxQueueSize, Policy);
+	pimpl->m_LogMapping.push_back(std::make_pair(Mask, Log));
+}
+
+uint64 Logger::GetDroppedMessageCount(ILog *Log)
+{
+	return pimpl->GetDroppedCount(Log);
+}
+
 void Logger::AddTypePrefixMapping(uint32 Mask, const tstring &Prefix)
 {
 	for (
@@ -315,6 +873,43 @@ void Logger::SetPrefixFormat(const tstring &PrefixFormat)
 	}
 }
 
+void Logger::SetSuppressionSummary(uint32 Type, uint IntervalSeconds)
+{
+	MUTEX_LOCK(pimpl->m_SummaryMutex);
+	pimpl->m_SummaryType = Type;
+	pimpl->m_SummaryInterval.store(IntervalSeconds, std::memory_order_relaxed);
+	pimpl->m_LastSummaryTime = GetTimeNow();
+}
+
+void Logger::LogSuppressionSummary()
+{
+	tstring Details;
+	uint64 Sum = 0;
+	g_LogSitesSuppressed.store(false, std::memory_order_relaxed);
+	{
+		LOG_SITE_REGISTRY &Registry = GetLogSiteRegistry();
+		MUTEX_LOCK(Registry.m_Mutex);
+		for (size_t i = 0; i < Registry.m_Sites.size(); i++)
+		{
+			LogSite *Site = Registry.m_Sites[i];
+			uint64 Count = Site->FetchSuppressedCount();
+			if (Count > 0)
+			{
+				Details += Format(_T("\n  #(#): #")) % Site->GetFile() % Site->GetLine() % Count;
+				Sum += Count;
+			}
+		}
+	}
+
+	uint32 Type;
+	{
+		MUTEX_LOCK(pimpl->m_SummaryMutex);
+		Type = pimpl->m_SummaryType;
+	}
+	if (Sum > 0)
+		Log(Type, tstring(Format(_T("Suppressed # log messages:")) % Sum) + Details);
+}
+
 void Logger::SetCustomPrefixInfo(int Index, const tstring &Info)
 {
 	assert(Index >= 0 && Index < 3);
@@ -337,6 +932,8 @@ void Logger::SetCustomPrefixInfo(int Index, const tstring &Info)
 
 void Logger::Log(uint32 Type, const tstring &Message)
 {
+	pimpl->CheckSuppressionSummary(this);
+
 	if (pimpl->m_UseQueue)
 	{
 		MUTEX_LOCK(*pimpl->m_QueueMutex.get());
@@ -347,41 +944,174 @@ void Logger::Log(uint32 Type, const tstring &Message)
 		QueueItem.What = MAXUINT32;
 		QueueItem.Type = Type;
 		QueueItem.Message = Message;
+		QueueItem.HasFields = false;
 		pimpl->m_Queue->push_back(QueueItem);
 		pimpl->m_QueueNotEmptyOrExit->Signal();
 	}
 	else
-		pimpl->Log(Type, Message);
+		pimpl->Log(Type, Message, NULL);
+}
+
+void Logger::Log(uint32 Type, const tstring &Message, const LogFields &Fields)
+{
+	pimpl->CheckSuppressionSummary(this);
+
+	if (pimpl->m_UseQueue)
+	{
+		MUTEX_LOCK(*pimpl->m_QueueMutex.get());
+		while (pimpl->m_Queue->size() == MAX_QUEUE_SIZE)
+			pimpl->m_QueueNotFull->Wait(pimpl->m_QueueMutex.get());
+
+		pimpl->m_Queue->push_back(Logger_pimpl::QUEUE_ITEM());
+		Logger_pimpl::QUEUE_ITEM &QueueItem = pimpl->m_Queue->back();
+		QueueItem.What = MAXUINT32;
+		QueueItem.Type = Type;
+		QueueItem.Message = Message;
+		QueueItem.HasFields = true;
+		QueueItem.Fields = Fields;
+		pimpl->m_QueueNotEmptyOrExit->Signal();
+	}
+	else
+		pimpl->Log(Type, Message, &Fields);
 }
 
 //HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
-// Klasa TextFileLog
+// Klasa LogSite
 
-class TextFileLog::TextFileLog_pimpl
+class LogSite::Pimpl
 {
 public:
-	LOG_FILE_MODE m_Mode;
-	tstring m_FileName;
-	tstring m_EOL;
-	EOLMODE m_EolMode;
-	scoped_ptr<common::FileStream> m_File;
+	Mutex m_Mutex;
+	const tchar *m_File;
+	int m_Line;
+	// Tokens per GetSystemCounter tick, 0 = no rate limiting
+	double m_Rate;
+	float m_Burst;
+	float m_Tokens;
+	// Time of last refill, from GetSystemCounter - monotonic, unlike the wall clock
+	int64 m_LastRefill;
+	float m_SampleProbability;
+	RandomGenerator m_Rand;
+	uint64 m_Suppressed;
+	uint64 m_TotalSuppressed;
+
+	Pimpl() : m_Mutex(0) { }
 };
 
-void TextFileLog::OnLog(uint32 Type, const tstring &Prefix, const tstring &TypePrefix, const tstring &Message)
+LogSite::LogSite(const tchar *File, int Line, float MessagesPerSecond, uint Burst, float SampleProbability) :
+	pimpl(new Pimpl)
 {
-	// Otwarcie
-	if (pimpl->m_Mode == FILE_MODE_REOPEN)
-	{
-		assert(pimpl->m_File.get() == 0);
-		pimpl->m_File.reset(new FileStream(pimpl->m_FileName, common::FM_APPEND, false));
-	}
+	pimpl->m_File = File;
+	pimpl->m_Line = Line;
+	pimpl->m_Rate = (double)MessagesPerSecond / (double)GetSystemCounterFrequency();
+	pimpl->m_Burst = (float)std::max(Burst, 1u);
+	pimpl->m_Tokens = pimpl->m_Burst;
+	pimpl->m_LastRefill = GetSystemCounter();
+	pimpl->m_SampleProbability = SampleProbability;
+	pimpl->m_Suppressed = 0;
+	pimpl->m_TotalSuppressed = 0;
+
+	LOG_SITE_REGISTRY &Registry = GetLogSiteRegistry();
+	MUTEX_LOCK(Registry.m_Mutex);
+	Registry.m_Sites.push_back(this);
+}
 
-    FileStream* const fs = pimpl->m_File.get();
-	assert(fs);
+LogSite::~LogSite()
+{
+	LOG_SITE_REGISTRY &Registry = GetLogSiteRegistry();
+	MUTEX_LOCK(Registry.m_Mutex);
+	std::vector<LogSite*>::iterator it = std::find(Registry.m_Sites.begin(), Registry.m_Sites.end(), this);
+	if (it != Registry.m_Sites.end())
+		Registry.m_Sites.erase(it);
+}
 
-	// Zapisanie
-	tstring s;
-	ReplaceEOL(&s, Prefix, pimpl->m_EolMode);
+bool LogSite::Test()
+{
+	bool Pass = true;
+	{
+		MUTEX_LOCK(pimpl->m_Mutex);
+
+		if (pimpl->m_Rate > 0.0)
+		{
+			int64 Now = GetSystemCounter();
+			pimpl->m_Tokens = (float)std::min((double)pimpl->m_Burst, pimpl->m_Tokens + (double)(Now - pimpl->m_LastRefill) * pimpl->m_Rate);
+			pimpl->m_LastRefill = Now;
+			if (pimpl->m_Tokens >= 1.f)
+				pimpl->m_Tokens -= 1.f;
+			else
+				Pass = false;
+		}
+
+		if (Pass && pimpl->m_SampleProbability < 1.f)
+			Pass = pimpl->m_Rand.RandFloat() < pimpl->m_SampleProbability;
+
+		if (!Pass)
+		{
+			pimpl->m_Suppressed++;
+			pimpl->m_TotalSuppressed++;
+			g_LogSitesSuppressed.store(true, std::memory_order_relaxed);
+		}
+	}
+
+	// During a storm all messages may be suppressed, so the summary has to be triggered also from here.
+	if (!Pass && IsLogger())
+		GetLogger().pimpl->CheckSuppressionSummary(&GetLogger());
+
+	return Pass;
+}
+
+const tchar * LogSite::GetFile() const
+{
+	return pimpl->m_File;
+}
+
+int LogSite::GetLine() const
+{
+	return pimpl->m_Line;
+}
+
+uint64 LogSite::FetchSuppressedCount()
+{
+	MUTEX_LOCK(pimpl->m_Mutex);
+	uint64 R = pimpl->m_Suppressed;
+	pimpl->m_Suppressed = 0;
+	return R;
+}
+
+uint64 LogSite::GetTotalSuppressedCount() const
+{
+	MUTEX_LOCK(pimpl->m_Mutex);
+	return pimpl->m_TotalSuppressed;
+}
+
+//HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
+// Klasa TextFileLog
+
+class TextFileLog::TextFileLog_pimpl
+{
+public:
+	LOG_FILE_MODE m_Mode;
+	tstring m_FileName;
+	tstring m_EOL;
+	EOLMODE m_EolMode;
+	scoped_ptr<common::FileStream> m_File;
+};
+
+void TextFileLog::OnLog(uint32 Type, const tstring &Prefix, const tstring &TypePrefix, const tstring &Message)
+{
+	// Otwarcie
+	if (pimpl->m_Mode == FILE_MODE_REOPEN)
+	{
+		assert(pimpl->m_File.get() == 0);
+		pimpl->m_File.reset(new FileStream(pimpl->m_FileName, common::FM_APPEND, false));
+	}
+
+    FileStream* const fs = pimpl->m_File.get();
+	assert(fs);
+
+	// Zapisanie
+	tstring s;
+	ReplaceEOL(&s, Prefix, pimpl->m_EolMode);
 	fs->WriteStringF(s);
 	ReplaceEOL(&s, TypePrefix, pimpl->m_EolMode);
 	fs->WriteStringF(s);
@@ -445,6 +1175,351 @@ TextFileLog::~TextFileLog()
 {
 }
 
+//HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
+// Klasa RotatingFileLog
+
+class RotatingFileLog::RotatingFileLog_pimpl
+{
+	DECLARE_NO_COPY_CLASS(RotatingFileLog_pimpl)
+
+public:
+	class ArchiverThread : public Thread
+	{
+	private:
+		RotatingFileLog_pimpl *m_Pimpl;
+
+	protected:
+		virtual void Run() { m_Pimpl->ThreadFunc(); }
+
+	public:
+		ArchiverThread(RotatingFileLog_pimpl *Pimpl) : m_Pimpl(Pimpl) { }
+	};
+
+	LOG_FILE_MODE m_Mode;
+	tstring m_FileName;
+	tstring m_EOL;
+	EOLMODE m_EolMode;
+	uint64 m_MaxSize;
+	uint m_MaxSeconds;
+	uint m_MaxArchives;
+	bool m_Compress;
+	scoped_ptr<FileStream> m_File;
+
+	// ----- Used only by the logging thread -----
+
+	// Number of bytes in current segment
+	uint64 m_SegmentSize;
+	// Moment when current segment was started
+	DATETIME m_SegmentStart;
+	// True if no message was written to current segment yet
+	bool m_SegmentEmpty;
+	// Sequence number for the next finished segment
+	uint m_NextSeq;
+
+	// ----- Shared with the background thread, protected by m_QueueMutex -----
+
+	Mutex m_QueueMutex;
+	// Signaled when a segment is queued or the thread has to end.
+	Cond m_QueueNotEmptyOrExit;
+	// Signaled when the queue becomes empty and nothing is being compressed.
+	Cond m_QueueDone;
+	// Sequence numbers of renamed segments waiting for compression
+	std::deque<uint> m_Queue;
+	// True while the background thread compresses a segment
+	bool m_Busy;
+	bool m_ThreadEnd;
+
+	// ----- Used only by the background thread (after construction) -----
+
+	// Sequence numbers of existing archives, oldest first
+	std::deque<uint> m_Archives;
+	scoped_ptr<ArchiverThread> m_Thread;
+
+	RotatingFileLog_pimpl() : m_QueueMutex(0), m_Busy(false), m_ThreadEnd(false) { }
+
+	void GetSegmentName(tstring *Out, uint Seq);
+	void GetArchiveName(tstring *Out, uint Seq);
+	// Finds archives and not yet compressed segments left by previous runs
+	void ScanArchives();
+	void OpenSegment(bool Append, const tstring &StartText);
+	void WriteString(const tstring &s);
+	bool NeedsRotation();
+	void Rotate();
+	// Executed on the background thread
+	void ArchiveSegment(uint Seq);
+	void ThreadFunc();
+};
+
+void RotatingFileLog::RotatingFileLog_pimpl::GetSegmentName(tstring *Out, uint Seq)
+{
+	*Out = m_FileName;
+	*Out += _T('.');
+	*Out += UintToStrR(Seq);
+}
+
+void RotatingFileLog::RotatingFileLog_pimpl::GetArchiveName(tstring *Out, uint Seq)
+{
+	GetSegmentName(Out, Seq);
+	if (m_Compress)
+		*Out += _T(".gz");
+}
+
+void RotatingFileLog::RotatingFileLog_pimpl::ScanArchives()
+{
+	tstring Dir, Name;
+	ExtractFilePath(&Dir, m_FileName);
+	ExtractFileName(&Name, m_FileName);
+	if (Dir.empty())
+		Dir = _T(".");
+	Name += _T('.');
+
+	std::vector<uint> Segments;
+	tstring ItemName, SeqStr;
+	FILE_ITEM_TYPE ItemType;
+	uint Seq;
+	DirLister Lister(Dir);
+	while (Lister.ReadNext(&ItemName, &ItemType))
+	{
+		if (ItemType != IT_FILE || ItemName.length() <= Name.length() || ItemName.compare(0, Name.length(), Name) != 0)
+			continue;
+		SeqStr = ItemName.substr(Name.length());
+		bool IsGz = SeqStr.length() > 3 && SeqStr.compare(SeqStr.length() - 3, 3, _T(".gz")) == 0;
+		if (IsGz)
+			SeqStr.erase(SeqStr.length() - 3);
+		if (StrToUint(&Seq, SeqStr) != 0)
+			continue;
+
+		if (IsGz == m_Compress)
+			m_Archives.push_back(Seq);
+		// Segment renamed but not compressed, e.g. because program was terminated.
+		else if (!IsGz)
+			Segments.push_back(Seq);
+		else
+			continue;
+		m_NextSeq = std::max(m_NextSeq, Seq + 1);
+	}
+
+	std::sort(m_Archives.begin(), m_Archives.end());
+	std::sort(Segments.begin(), Segments.end());
+	m_Queue.insert(m_Queue.end(), Segments.begin(), Segments.end());
+}
+
+void RotatingFileLog::RotatingFileLog_pimpl::OpenSegment(bool Append, const tstring &StartText)
+{
+#ifdef _UNICODE
+	bool WriteBOM = !Append || GetFileItemType(m_FileName) == IT_NONE;
+#endif
+
+	m_File.reset(new FileStream(
+		m_FileName,
+		Append ? common::FM_APPEND : common::FM_WRITE,
+		false));
+
+	m_SegmentSize = Append ? m_File->GetSize() : 0;
+	m_SegmentStart = Now();
+	m_SegmentEmpty = true;
+
+#ifdef _UNICODE
+	if (WriteBOM)
+	{
+		m_File->WriteStringF(BOM_UTF16_LE);
+		m_SegmentSize += 2;
+	}
+#endif
+
+	if (!StartText.empty())
+	{
+		WriteString(StartText);
+		WriteString(m_EOL);
+	}
+
+	if (m_Mode == FILE_MODE_REOPEN)
+		m_File.reset(0);
+}
+
+void RotatingFileLog::RotatingFileLog_pimpl::WriteString(const tstring &s)
+{
+	m_File->WriteStringF(s);
+	m_SegmentSize += s.length() * sizeof(tchar);
+}
+
+bool RotatingFileLog::RotatingFileLog_pimpl::NeedsRotation()
+{
+	if (m_SegmentEmpty)
+		return false;
+	if (m_MaxSize > 0 && m_SegmentSize >= m_MaxSize)
+		return true;
+	if (m_MaxSeconds > 0 && Now() - m_SegmentStart >= TIMESPAN::Seconds(m_MaxSeconds))
+		return true;
+	return false;
+}
+
+void RotatingFileLog::RotatingFileLog_pimpl::Rotate()
+{
+	// Close current segment - it must not be open while renaming
+	m_File.reset(0);
+
+	// Only rename here - compression is left for the background thread
+	tstring SegmentName;
+	GetSegmentName(&SegmentName, m_NextSeq);
+	if (!MoveItem(m_FileName, SegmentName))
+	{
+		// Rename failed (e.g. file locked by other process) - continue the same file
+		// instead of truncating it, report it there and retry after next limit is reached.
+		OpenSegment(true, Format(_T("Log rotation failed: cannot rename \"#\" to \"#\".")) % m_FileName % SegmentName);
+		m_SegmentSize = 0;
+		return;
+	}
+
+	{
+		MUTEX_LOCK(m_QueueMutex);
+		m_Queue.push_back(m_NextSeq);
+		m_QueueNotEmptyOrExit.Signal();
+		m_NextSeq++;
+	}
+
+	OpenSegment(false, tstring());
+}
+
+void RotatingFileLog::RotatingFileLog_pimpl::ArchiveSegment(uint Seq)
+{
+	if (m_Compress)
+	{
+		tstring SegmentName, ArchiveName;
+		GetSegmentName(&SegmentName, Seq);
+		GetArchiveName(&ArchiveName, Seq);
+		try
+		{
+			FileStream Src(SegmentName, FM_READ, false);
+			GzipFileStream Dst(TstringToStringR(ArchiveName), GZFM_WRITE);
+			Dst.CopyFromToEnd(&Src);
+		}
+		catch (...)
+		{
+			// Leave uncompressed segment, so it will be retried on next run.
+			DeleteFile(ArchiveName);
+			throw;
+		}
+		DeleteFile(SegmentName);
+	}
+
+	// Remove oldest archives over the limit
+	m_Archives.push_back(Seq);
+	tstring OldName;
+	while (m_MaxArchives > 0 && m_Archives.size() > m_MaxArchives)
+	{
+		GetArchiveName(&OldName, m_Archives.front());
+		DeleteFile(OldName);
+		m_Archives.pop_front();
+	}
+}
+
+void RotatingFileLog::RotatingFileLog_pimpl::ThreadFunc()
+{
+	uint Seq;
+	for (;;)
+	{
+		{
+			MUTEX_LOCK(m_QueueMutex);
+			while (m_Queue.empty() && !m_ThreadEnd)
+				m_QueueNotEmptyOrExit.Wait(&m_QueueMutex);
+			// Queue must be empty to finish, so no segment is left uncompressed
+			if (m_Queue.empty())
+				break;
+			Seq = m_Queue.front();
+			m_Queue.pop_front();
+			m_Busy = true;
+		}
+
+		try
+		{
+			ArchiveSegment(Seq);
+		}
+		catch (...)
+		{
+			// Exception must not leave the thread
+		}
+
+		{
+			MUTEX_LOCK(m_QueueMutex);
+			m_Busy = false;
+			if (m_Queue.empty())
+				m_QueueDone.Broadcast();
+		}
+	}
+}
+
+void RotatingFileLog::OnLog(uint32 Type, const tstring &Prefix, const tstring &TypePrefix, const tstring &Message)
+{
+	if (pimpl->NeedsRotation())
+		pimpl->Rotate();
+
+	if (pimpl->m_Mode == FILE_MODE_REOPEN)
+	{
+		assert(pimpl->m_File.get() == 0);
+		pimpl->m_File.reset(new FileStream(pimpl->m_FileName, common::FM_APPEND, false));
+	}
+	assert(pimpl->m_File.get());
+
+	tstring s;
+	ReplaceEOL(&s, Prefix, pimpl->m_EolMode);
+	pimpl->WriteString(s);
+	ReplaceEOL(&s, TypePrefix, pimpl->m_EolMode);
+	pimpl->WriteString(s);
+	ReplaceEOL(&s, Message, pimpl->m_EolMode);
+	pimpl->WriteString(s);
+	pimpl->WriteString(pimpl->m_EOL);
+	pimpl->m_SegmentEmpty = false;
+
+	if (pimpl->m_Mode == FILE_MODE_FLUSH)
+		pimpl->m_File->Flush();
+	else if (pimpl->m_Mode == FILE_MODE_REOPEN)
+		pimpl->m_File.reset(0);
+}
+
+RotatingFileLog::RotatingFileLog(const tstring &FileName, LOG_FILE_MODE Mode, EOLMODE EolMode, uint64 MaxSize, uint MaxSeconds, uint MaxArchives, bool Compress, bool Append, const tstring &StartText) :
+	pimpl(new RotatingFileLog_pimpl())
+{
+	pimpl->m_Mode = Mode;
+	pimpl->m_FileName = FileName;
+	EolModeToStr(&pimpl->m_EOL, EolMode);
+	pimpl->m_EolMode = EolMode;
+	pimpl->m_MaxSize = MaxSize;
+	pimpl->m_MaxSeconds = MaxSeconds;
+	pimpl->m_MaxArchives = MaxArchives;
+	pimpl->m_Compress = Compress;
+	pimpl->m_NextSeq = 1;
+
+	pimpl->ScanArchives();
+	pimpl->OpenSegment(Append, StartText);
+
+	pimpl->m_Thread.reset(new RotatingFileLog_pimpl::ArchiverThread(pimpl.get()));
+	pimpl->m_Thread->Start();
+}
+
+RotatingFileLog::~RotatingFileLog()
+{
+	pimpl->m_File.reset(0);
+	{
+		MUTEX_LOCK(pimpl->m_QueueMutex);
+		pimpl->m_ThreadEnd = true;
+		pimpl->m_QueueNotEmptyOrExit.Signal();
+	}
+	pimpl->m_Thread->Join();
+}
+
+void RotatingFileLog::Rotate()
+{
+	pimpl->Rotate();
+}
+
+void RotatingFileLog::WaitForArchives()
+{
+	MUTEX_LOCK(pimpl->m_QueueMutex);
+	while (!pimpl->m_Queue.empty() || pimpl->m_Busy)
+		pimpl->m_QueueDone.Wait(&pimpl->m_QueueMutex);
+}
+
 //HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
 // Klasa HtmlFileLog
 
@@ -585,6 +1660,440 @@ void HtmlFileLog::AddStyleMapping(uint32 Mask, const STYLE &Style)
 }
 
 
+//HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
+// Klasa MappedFileLog
+
+const char * const MAPPED_LOG_SIGNATURE = "CLMFLOG1";
+const uint32 MAPPED_LOG_RECORD_MAGIC = 0x52474F4Cu;
+
+struct MAPPED_LOG_FILE_HEADER
+{
+	// MAPPED_LOG_SIGNATURE, without terminating zero
+	char Signature[8];
+	// sizeof(tchar) used to write the messages
+	uint32 CharSize;
+	uint32 Reserved;
+};
+
+struct MAPPED_LOG_RECORD_HEADER
+{
+	// MAPPED_LOG_RECORD_MAGIC
+	uint32 Magic;
+	// Length of the text in bytes, without padding to multiply of 4 bytes
+	uint32 Length;
+	uint32 Type;
+	// CRC32 of the text
+	uint32 Checksum;
+};
+
+// Returns true if record header looks valid and the record fits in Remaining bytes
+bool IsMappedLogRecordHeaderValid(const MAPPED_LOG_RECORD_HEADER &Header, uint64 Remaining)
+{
+	return
+		Header.Magic == MAPPED_LOG_RECORD_MAGIC &&
+		sizeof(MAPPED_LOG_RECORD_HEADER) + AlignUp<uint64>(Header.Length, 4) <= Remaining;
+}
+
+class MappedFileLog::MappedFileLog_pimpl
+{
+public:
+	tstring m_FileName;
+	uint m_ChunkSize;
+#ifdef _WIN32
+	HANDLE m_File;
+	HANDLE m_Mapping;
+#else
+	int m_File;
+#endif
+	uint8 *m_Data;
+	uint64 m_MappedSize;
+	// Position just after the last record
+	uint64 m_Pos;
+
+	// Returns current size of the file
+	uint64 Open(bool Append);
+	// Extends the file to Size bytes and maps it whole.
+	// In case of error throws and leaves the previous mapping untouched.
+	void Map(uint64 Size);
+	void Unmap();
+	// Truncates the file to m_Pos and closes it. Throws if truncation failed - the file is closed anyway.
+	void Close();
+	// Sets m_Pos after the last valid record
+	void FindEnd(uint64 FileSize);
+};
+
+#ifdef _WIN32
+
+uint64 MappedFileLog::MappedFileLog_pimpl::Open(bool Append)
+{
+	m_Mapping = NULL;
+	m_File = CreateFile(m_FileName.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, 0, Append ? OPEN_ALWAYS : CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+	if (m_File == INVALID_HANDLE_VALUE)
+		throw Win32Error(_T("Cannot open file: ") + m_FileName, __TFILE__, __LINE__);
+
+	LARGE_INTEGER Size;
+	if (!GetFileSizeEx(m_File, &Size))
+		throw Win32Error(_T("Cannot get file size: ") + m_FileName, __TFILE__, __LINE__);
+	return (uint64)Size.QuadPart;
+}
+
+void MappedFileLog::MappedFileLog_pimpl::Map(uint64 Size)
+{
+	// Mapping larger than the file extends the file
+	HANDLE Mapping = CreateFileMapping(m_File, NULL, PAGE_READWRITE, (DWORD)(Size >> 32), (DWORD)Size, NULL);
+	if (Mapping == NULL)
+		throw Win32Error(_T("Cannot create file mapping: ") + m_FileName, __TFILE__, __LINE__);
+	uint8 *Data = (uint8*)MapViewOfFile(Mapping, FILE_MAP_WRITE, 0, 0, (SIZE_T)Size);
+	if (Data == NULL)
+	{
+		DWORD ErrorCode = GetLastError();
+		CloseHandle(Mapping);
+		SetLastError(ErrorCode);
+		throw Win32Error(_T("Cannot map view of file: ") + m_FileName, __TFILE__, __LINE__);
+	}
+
+	Unmap();
+	m_Mapping = Mapping;
+	m_Data = Data;
+	m_MappedSize = Size;
+}
+
+void MappedFileLog::MappedFileLog_pimpl::Unmap()
+{
+	if (m_Data != NULL)
+	{
+		UnmapViewOfFile(m_Data);
+		m_Data = NULL;
+	}
+	if (m_Mapping != NULL)
+	{
+		CloseHandle(m_Mapping);
+		m_Mapping = NULL;
+	}
+	m_MappedSize = 0;
+}
+
+void MappedFileLog::MappedFileLog_pimpl::Close()
+{
+	Unmap();
+	LARGE_INTEGER Pos;
+	Pos.QuadPart = (LONGLONG)m_Pos;
+	bool Truncated = SetFilePointerEx(m_File, Pos, NULL, FILE_BEGIN) && SetEndOfFile(m_File);
+	DWORD ErrorCode = GetLastError();
+	CloseHandle(m_File);
+	if (!Truncated)
+	{
+		SetLastError(ErrorCode);
+		throw Win32Error(_T("Cannot truncate file: ") + m_FileName, __TFILE__, __LINE__);
+	}
+}
+
+void MappedFileLog::Flush()
+{
+	FlushViewOfFile(pimpl->m_Data, (SIZE_T)pimpl->m_Pos);
+	FlushFileBuffers(pimpl->m_File);
+}
+
+#else
+
+uint64 MappedFileLog::MappedFileLog_pimpl::Open(bool Append)
+{
+	m_File = open(m_FileName.c_str(), O_RDWR | O_CREAT | (Append ? 0 : O_TRUNC), 0644);
+	if (m_File < 0)
+		throw ErrnoError(_T("Cannot open file: ") + m_FileName, __TFILE__, __LINE__);
+
+	off_t Size = lseek(m_File, 0, SEEK_END);
+	if (Size < 0)
+		throw ErrnoError(_T("Cannot get file size: ") + m_FileName, __TFILE__, __LINE__);
+	return (uint64)Size;
+}
+
+void MappedFileLog::MappedFileLog_pimpl::Map(uint64 Size)
+{
+	// Real allocation, so writing to the mapping cannot end with SIGBUS when the disk is full.
+	// If not supported by the file system, extend the file just like that.
+	if (posix_fallocate(m_File, 0, (off_t)Size) != 0 && ftruncate(m_File, (off_t)Size) != 0)
+		throw ErrnoError(Format(_T("Cannot extend file \"#\" to # bytes.")) % m_FileName % Size, __TFILE__, __LINE__);
+
+	void *Data = mmap(NULL, (size_t)Size, PROT_READ | PROT_WRITE, MAP_SHARED, m_File, 0);
+	if (Data == MAP_FAILED)
+		throw ErrnoError(_T("Cannot map file: ") + m_FileName, __TFILE__, __LINE__);
+
+	Unmap();
+	m_Data = (uint8*)Data;
+	m_MappedSize = Size;
+}
+
+void MappedFileLog::MappedFileLog_pimpl::Unmap()
+{
+	if (m_Data != NULL)
+	{
+		munmap(m_Data, (size_t)m_MappedSize);
+		m_Data = NULL;
+	}
+	m_MappedSize = 0;
+}
+
+void MappedFileLog::MappedFileLog_pimpl::Close()
+{
+	Unmap();
+	int R = ftruncate(m_File, (off_t)m_Pos);
+	int ErrorCode = errno;
+	close(m_File);
+	if (R != 0)
+		throw ErrnoError(ErrorCode, _T("Cannot truncate file: ") + m_FileName, __TFILE__, __LINE__);
+}
+
+void MappedFileLog::Flush()
+{
+	if (msync(pimpl->m_Data, (size_t)pimpl->m_Pos, MS_SYNC) != 0)
+		throw ErrnoError(_T("Cannot flush mapped file: ") + pimpl->m_FileName, __TFILE__, __LINE__);
+}
+
+#endif
+
+void MappedFileLog::MappedFileLog_pimpl::FindEnd(uint64 FileSize)
+{
+	m_Pos = sizeof(MAPPED_LOG_FILE_HEADER);
+	while (m_Pos + sizeof(MAPPED_LOG_RECORD_HEADER) <= FileSize)
+	{
+		const MAPPED_LOG_RECORD_HEADER *Header = (const MAPPED_LOG_RECORD_HEADER*)(m_Data + m_Pos);
+		if (!IsMappedLogRecordHeaderValid(*Header, FileSize - m_Pos))
+			break;
+		if (CRC32_Calc::Calc(Header + 1, Header->Length) != Header->Checksum)
+			break;
+		m_Pos += sizeof(MAPPED_LOG_RECORD_HEADER) + AlignUp<uint64>(Header->Length, 4);
+	}
+
+	// Clear remains of a record broken by a crash, so new records don't mix with them.
+	memset(m_Data + m_Pos, 0, (size_t)(FileSize - m_Pos));
+}
+
+void MappedFileLog::OnLog(uint32 Type, const tstring &Prefix, const tstring &TypePrefix, const tstring &Message)
+{
+	tstring Text = Prefix;
+	Text += TypePrefix;
+	Text += Message;
+
+	uint32 Length = (uint32)(Text.length() * sizeof(tchar));
+	uint64 RecordSize = sizeof(MAPPED_LOG_RECORD_HEADER) + AlignUp<uint64>(Length, 4);
+	// If extending fails, the exception goes up to the logger and the previous mapping stays valid for next records
+	if (pimpl->m_Pos + RecordSize > pimpl->m_MappedSize)
+		pimpl->Map(AlignUp<uint64>(pimpl->m_Pos + RecordSize, pimpl->m_ChunkSize));
+	assert(pimpl->m_Data != NULL);
+
+	MAPPED_LOG_RECORD_HEADER *Header = (MAPPED_LOG_RECORD_HEADER*)(pimpl->m_Data + pimpl->m_Pos);
+	if (Length > 0)
+		common_memcpy(Header + 1, Text.data(), Length);
+	Header->Length = Length;
+	Header->Type = Type;
+	Header->Checksum = CRC32_Calc::Calc(Text.data(), Length);
+	// Magic at the end - record is valid only when it was written completely.
+	// If not, the checksum also won't match.
+	Header->Magic = MAPPED_LOG_RECORD_MAGIC;
+
+	pimpl->m_Pos += RecordSize;
+}
+
+MappedFileLog::MappedFileLog(const tstring &FileName, bool Append, uint ChunkSize) :
+	pimpl(new MappedFileLog_pimpl())
+{
+	pimpl->m_FileName = FileName;
+	pimpl->m_ChunkSize = AlignUp<uint>(std::max(ChunkSize, 4096u), 4096u);
+	pimpl->m_Data = NULL;
+	pimpl->m_MappedSize = 0;
+	pimpl->m_Pos = 0;
+
+	uint64 FileSize = pimpl->Open(Append);
+	// Close truncates the file to m_Pos, so in case of error it stays untouched
+	pimpl->m_Pos = FileSize;
+	try
+	{
+		pimpl->Map(std::max<uint64>(AlignUp<uint64>(FileSize, pimpl->m_ChunkSize), pimpl->m_ChunkSize));
+
+		MAPPED_LOG_FILE_HEADER *FileHeader = (MAPPED_LOG_FILE_HEADER*)pimpl->m_Data;
+		if (FileSize == 0)
+		{
+			common_memcpy(FileHeader->Signature, MAPPED_LOG_SIGNATURE, sizeof(FileHeader->Signature));
+			FileHeader->CharSize = sizeof(tchar);
+			FileHeader->Reserved = 0;
+			pimpl->m_Pos = sizeof(MAPPED_LOG_FILE_HEADER);
+		}
+		else
+		{
+			if (FileSize < sizeof(MAPPED_LOG_FILE_HEADER) ||
+				memcmp(FileHeader->Signature, MAPPED_LOG_SIGNATURE, sizeof(FileHeader->Signature)) != 0 ||
+				FileHeader->CharSize != sizeof(tchar))
+			{
+				throw Error(_T("Cannot append to file - not a valid MappedFileLog file: ") + FileName, __TFILE__, __LINE__);
+			}
+			pimpl->FindEnd(FileSize);
+		}
+	}
+	catch (...)
+	{
+		// Original error is more important than failed truncation
+		try { pimpl->Close(); } catch (...) { }
+		throw;
+	}
+}
+
+MappedFileLog::~MappedFileLog()
+{
+	try
+	{
+		pimpl->Close();
+	}
+	catch (...)
+	{
+		// Zeroes left at the end of the file are skipped by FindEnd and Recover
+		assert(0 && "Exception caught in MappedFileLog::~MappedFileLog while truncating the file.");
+	}
+}
+
+uint MappedFileLog::Recover(const tstring &FileName, Stream *Out, EOLMODE EolMode)
+{
+	FileStream File(FileName, FM_READ, false);
+	uint64 FileSize = File.GetSize();
+
+	MAPPED_LOG_FILE_HEADER FileHeader;
+	if (File.Read(&FileHeader, sizeof(FileHeader)) != sizeof(FileHeader) ||
+		memcmp(FileHeader.Signature, MAPPED_LOG_SIGNATURE, sizeof(FileHeader.Signature)) != 0 ||
+		FileHeader.CharSize != sizeof(tchar))
+	{
+		throw Error(_T("Not a valid MappedFileLog file: ") + FileName, __TFILE__, __LINE__);
+	}
+
+	tstring EOL, Text, s;
+	EolModeToStr(&EOL, EolMode);
+	std::vector<uint8> Buf;
+	MAPPED_LOG_RECORD_HEADER Header;
+	uint64 Pos = sizeof(MAPPED_LOG_FILE_HEADER);
+	uint Count = 0;
+	while (Pos + sizeof(MAPPED_LOG_RECORD_HEADER) <= FileSize)
+	{
+		File.MustRead(&Header, sizeof(Header));
+		if (!IsMappedLogRecordHeaderValid(Header, FileSize - Pos))
+			break;
+
+		size_t PaddedLength = (size_t)AlignUp<uint64>(Header.Length, 4);
+		Buf.resize(PaddedLength + 1);
+		if (PaddedLength > 0)
+			File.MustRead(&Buf[0], PaddedLength);
+		if (CRC32_Calc::Calc(&Buf[0], Header.Length) != Header.Checksum)
+			break;
+
+		Text.assign((const tchar*)&Buf[0], Header.Length / sizeof(tchar));
+		ReplaceEOL(&s, Text, EolMode);
+		Out->WriteStringF(s);
+		Out->WriteStringF(EOL);
+
+		Pos += sizeof(MAPPED_LOG_RECORD_HEADER) + PaddedLength;
+		Count++;
+	}
+	return Count;
+}
+
+
+//HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
+// Klasa StructuredFileLog
+
+class StructuredFileLog::Pimpl
+{
+public:
+	STRUCTURED_LOG_FORMAT m_Format;
+	LOG_FILE_MODE m_Mode;
+	scoped_ptr<FileStream> m_File;
+	// Reused between messages to avoid allocations
+	tstring m_Line;
+	std::vector<uint8> m_Record;
+
+	// Fields can be NULL
+	void Write(uint32 Type, const tstring &Prefix, const tstring &TypePrefix, const tstring &Message, const LogFields *Fields);
+	void AppendRecordData(const void *Data, size_t Size);
+};
+
+void StructuredFileLog::Pimpl::AppendRecordData(const void *Data, size_t Size)
+{
+	size_t Pos = m_Record.size();
+	m_Record.resize(Pos + Size);
+	if (Size > 0)
+		common_memcpy(&m_Record[Pos], Data, Size);
+}
+
+void StructuredFileLog::Pimpl::Write(uint32 Type, const tstring &Prefix, const tstring &TypePrefix, const tstring &Message, const LogFields *Fields)
+{
+	if (m_Format == STRUCTURED_LOG_JSON_LINES)
+	{
+		m_Line = _T("{\"type\":");
+		m_Line += UintToStrR(Type);
+		if (!Prefix.empty() || !TypePrefix.empty())
+		{
+			m_Line += _T(",\"prefix\":");
+			tstring FullPrefix = Prefix + TypePrefix;
+			AppendJsonString(&m_Line, FullPrefix.data(), FullPrefix.length());
+		}
+		m_Line += _T(",\"msg\":");
+		AppendJsonString(&m_Line, Message.data(), Message.length());
+		if (Fields != NULL && !Fields->IsEmpty())
+		{
+			m_Line += _T(',');
+			Fields->FormatJson(&m_Line);
+		}
+		m_Line += _T("}\n");
+		m_File->WriteStringF(m_Line);
+	}
+	else
+	{
+		uint32 PrefixLength = (uint32)(Prefix.length() + TypePrefix.length());
+		uint32 MessageLength = (uint32)Message.length();
+
+		// Place for size, filled at the end
+		m_Record.resize(sizeof(uint32));
+		AppendRecordData(&Type, sizeof(Type));
+		AppendRecordData(&PrefixLength, sizeof(PrefixLength));
+		AppendRecordData(Prefix.data(), Prefix.length() * sizeof(tchar));
+		AppendRecordData(TypePrefix.data(), TypePrefix.length() * sizeof(tchar));
+		AppendRecordData(&MessageLength, sizeof(MessageLength));
+		AppendRecordData(Message.data(), Message.length() * sizeof(tchar));
+		if (Fields != NULL)
+			AppendRecordData(Fields->GetData(), Fields->GetDataSize());
+
+		uint32 Size = (uint32)(m_Record.size() - sizeof(uint32));
+		common_memcpy(&m_Record[0], &Size, sizeof(Size));
+		m_File->Write(&m_Record[0], m_Record.size());
+	}
+
+	if (m_Mode != FILE_MODE_NORMAL)
+		m_File->Flush();
+}
+
+void StructuredFileLog::OnLog(uint32 Type, const tstring &Prefix, const tstring &TypePrefix, const tstring &Message)
+{
+	pimpl->Write(Type, Prefix, TypePrefix, Message, NULL);
+}
+
+void StructuredFileLog::OnLogFields(uint32 Type, const tstring &Prefix, const tstring &TypePrefix, const tstring &Message, const LogFields &Fields)
+{
+	pimpl->Write(Type, Prefix, TypePrefix, Message, &Fields);
+}
+
+StructuredFileLog::StructuredFileLog(const tstring &FileName, STRUCTURED_LOG_FORMAT Format, LOG_FILE_MODE Mode, bool Append) :
+	pimpl(new Pimpl())
+{
+	pimpl->m_Format = Format;
+	pimpl->m_Mode = Mode;
+	pimpl->m_File.reset(new FileStream(
+		FileName,
+		Append ? common::FM_APPEND : common::FM_WRITE,
+		false));
+}
+
+StructuredFileLog::~StructuredFileLog()
+{
+}
+
+
 //HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
 // Klasa OstreamLog
 
@@ -30,10 +30,23 @@ Dokumentacja: \ref Module_Logger \n
 Nagwek: Logger.hpp */
 //@{
 
+class Stream;
+class LogFields;
 /// \internal
 class ILog;
 /// \internal
 class Logger_pimpl;
+/// \internal
+class LogWorker;
+
+/// What to do with a message when queue of a log with its own worker thread is full
+enum LOG_QUEUE_FULL_POLICY
+{
+	/// Wait until there is place in the queue
+	LOG_QUEUE_BLOCK,
+	/// Drop the message
+	LOG_QUEUE_DROP,
+};
 
 /// Logger - klasa gwna systemu logujcego.
 class Logger
@@ -41,6 +54,7 @@ class Logger
 	friend void CreateLogger(bool);
 	friend void DestroyLogger();
 	friend class ILog;
+	friend class LogSite;
 
 private:
 	scoped_ptr<Logger_pimpl> pimpl;
@@ -54,10 +68,19 @@ public:
 	//@{
 	/// Rejestruje log w loggerze mapujc do niego okrelone typy komunikatw.
 	void AddLogMapping(uint32 Mask, ILog *Log);
+	/// Registers log with its own queue and worker thread, so it doesn't delay other logs.
+	/** Messages for this log are put into its own queue of up to MaxQueueSize
+	messages and logged by its own thread. Policy tells what to do when the queue
+	is full. Time in the prefix is the time of the Log call, not of writing. */
+	void AddLogMapping(uint32 Mask, ILog *Log, uint MaxQueueSize, LOG_QUEUE_FULL_POLICY Policy);
 	/// Ustawia mapowanie prefiksw typu dla wszystkich zarejestrowanych logw.
 	void AddTypePrefixMapping(uint32 Mask, const tstring &Prefix);
 	/// Ustawia format prefiksu dla wszystkich zarejestrowanych logw.
 	void SetPrefixFormat(const tstring &PrefixFormat);
+	/// Enables periodic summary of messages suppressed by LOG_RATE_LIMITED and LOG_SAMPLED.
+	/** Summary is logged as message of given Type, not more often than every
+	IntervalSeconds and only if some messages were suppressed. 0 disables it. */
+	void SetSuppressionSummary(uint32 Type, uint IntervalSeconds);
 	//@}
 
 	/** \name Uywanie loggera.
@@ -67,13 +90,66 @@ public:
 	void SetCustomPrefixInfo(int Index, const tstring &Info);
 	//// Loguje komunikat - najwaniejsza funkcja!
 	void Log(uint32 Type, const tstring &Message);
+	/// Logs a message with structured fields attached.
+	/** Fields are copied, so the object can be reused just after the call. */
+	void Log(uint32 Type, const tstring &Message, const LogFields &Fields);
+	/// Returns number of messages dropped because queue of given log was full.
+	/** Only for logs registered with their own queue and LOG_QUEUE_DROP policy. */
+	uint64 GetDroppedMessageCount(ILog *Log);
+	/// Logs summary of messages suppressed since the last summary, if there are any.
+	/** Called automatically when enabled with SetSuppressionSummary, but can be also called manually, e.g. before exit. */
+	void LogSuppressionSummary();
 	//@}
 };
 
+/// Call site of a log message with rate limiting and probabilistic sampling.
+/**
+Don't use directly - use macros LOG_RATE_LIMITED and LOG_SAMPLED, which create
+one static object of this class per call site.
+
+Rate limiting is a token bucket: the bucket holds up to Burst tokens and is
+refilled with MessagesPerSecond tokens per second. Each logged message takes one
+token. Messages that find the bucket empty are suppressed.
+
+Sampling logs each message (which passed the rate limit) with given probability.
+
+Suppressed messages are only counted. See Logger::SetSuppressionSummary.
+Thread-safe.
+*/
+class LogSite
+{
+	DECLARE_NO_COPY_CLASS(LogSite)
+
+private:
+	/// \internal
+	class Pimpl;
+	scoped_ptr<Pimpl> pimpl;
+
+public:
+	/**
+	\param File, Line Identify the call site in the suppression summary. File must be a static string.
+	\param MessagesPerSecond 0 means no rate limiting.
+	\param SampleProbability In range 0..1. 1 means no sampling.
+	*/
+	LogSite(const tchar *File, int Line, float MessagesPerSecond, uint Burst, float SampleProbability = 1.f);
+	~LogSite();
+
+	/// Returns true if message from this site should be logged now, false if it should be suppressed.
+	bool Test();
+
+	const tchar * GetFile() const;
+	int GetLine() const;
+	/// Returns number of messages suppressed since the last call and resets it.
+	uint64 FetchSuppressedCount();
+	/// Returns number of all messages suppressed by this site.
+	uint64 GetTotalSuppressedCount() const;
+};
+
 /// Abstrakcyjna kasa bazowa wszelkich logw.
 class ILog
 {
 	friend class Logger_pimpl;
+	friend class LogWorker;
 
 private:
 	/// \internal
@@ -83,6 +159,10 @@ private:
 protected:
 	/// Ma zalogowa podany komunikat tam gdzie trzeba
 	virtual void OnLog(uint32 Type, const tstring &Prefix, const tstring &TypePrefix, const tstring &Message) = 0;
+	/// Logs message with structured fields.
+	/** Default implementation appends fields to the message as text (see LogFields::FormatText) and calls OnLog.
+	Overwrite to store them in some other way. */
+	virtual void OnLogFields(uint32 Type, const tstring &Prefix, const tstring &TypePrefix, const tstring &Message, const LogFields &Fields);
 
 public:
 	ILog();
@@ -97,6 +177,106 @@ public:
 	//@}
 };
 
+/// Set of typed key-value fields attached to a log message (structured logging).
+/**
+Fields are encoded into a compact binary buffer. Clear keeps its memory, so
+once the buffer grew large enough, adding fields doesn't allocate. To use the
+buffer owned by current thread, call BeginLogFields.
+
+Keys should be short ASCII identifiers, up to 255 characters.
+
+Encoding of a single field: uint8 type (FIELD_TYPE), uint8 key length, key
+characters, value. Values are: int64 for FIELD_INT, uint64 for FIELD_UINT,
+double for FIELD_FLOAT, uint8 for FIELD_BOOL, 3 x float for FIELD_VEC3, uint32
+length in characters followed by the tchar characters for FIELD_STRING.
+*/
+class LogFields
+{
+public:
+	enum FIELD_TYPE
+	{
+		FIELD_INT,
+		FIELD_UINT,
+		FIELD_FLOAT,
+		FIELD_BOOL,
+		FIELD_VEC3,
+		FIELD_STRING,
+	};
+
+	/// Single field decoded by GetNextField.
+	struct FIELD
+	{
+		FIELD_TYPE Type;
+		/// Not null-terminated.
+		const char *Key;
+		size_t KeyLength;
+		union
+		{
+			int64 Int;
+			uint64 Uint;
+			double Float;
+			bool Bool;
+			float Vec3[3];
+		};
+		/// Only for FIELD_STRING. Not null-terminated.
+		const tchar *String;
+		size_t StringLength;
+	};
+
+	LogFields() { }
+
+	void Clear() { m_Data.clear(); }
+	bool IsEmpty() const { return m_Data.empty(); }
+
+	/** \name Adding fields */
+	//@{
+	LogFields & Add(const char *Key, int Value) { return AddInt(Key, Value); }
+	LogFields & Add(const char *Key, uint Value) { return AddUint(Key, Value); }
+	LogFields & Add(const char *Key, long Value) { return AddInt(Key, Value); }
+	LogFields & Add(const char *Key, unsigned long Value) { return AddUint(Key, Value); }
+	LogFields & Add(const char *Key, int64 Value) { return AddInt(Key, Value); }
+	LogFields & Add(const char *Key, uint64 Value) { return AddUint(Key, Value); }
+	LogFields & Add(const char *Key, float Value) { return AddFloat(Key, Value); }
+	LogFields & Add(const char *Key, double Value) { return AddFloat(Key, Value); }
+	LogFields & Add(const char *Key, bool Value);
+	LogFields & Add(const char *Key, const tchar *Value);
+	LogFields & Add(const char *Key, const tstring &Value);
+	LogFields & AddInt(const char *Key, int64 Value);
+	LogFields & AddUint(const char *Key, uint64 Value);
+	LogFields & AddFloat(const char *Key, double Value);
+	LogFields & AddVec3(const char *Key, float x, float y, float z);
+	/// For VEC3 or any other type with members x, y, z.
+	template <typename VEC3_T> LogFields & AddVec3(const char *Key, const VEC3_T &v) { return AddVec3(Key, v.x, v.y, v.z); }
+	LogFields & AddString(const char *Key, const tchar *Value, size_t Length);
+	//@}
+
+	/** \name Reading fields */
+	//@{
+	/// Encoded data.
+	const void * GetData() const { return m_Data.empty() ? NULL : &m_Data[0]; }
+	size_t GetDataSize() const { return m_Data.size(); }
+	/// Sets encoded data, e.g. read back from a binary log.
+	void SetData(const void *Data, size_t Size);
+	/// Decodes next field.
+	/** Start with InOutOffset = 0. Returns false when there are no more fields. */
+	bool GetNextField(size_t *InOutOffset, FIELD *OutField) const;
+	/// Appends fields in format: key=value key2="string value"
+	void FormatText(tstring *InOut) const;
+	/// Appends fields as JSON object members: "key":value,"key2":"string value"
+	void FormatJson(tstring *InOut) const;
+	//@}
+
+private:
+	std::vector<uint8> m_Data;
+
+	void WriteHeader(FIELD_TYPE Type, const char *Key);
+	void WriteData(const void *Data, size_t Size);
+};
+
+/// Returns LogFields object owned by current thread, cleared.
+/** Reusing it avoids memory allocation. Don't keep the reference after logging the message. */
+LogFields & BeginLogFields();
+
 /// Tworzy logger
 void CreateLogger(bool UseQueue);
 /// Usuwa logger
@@ -137,6 +317,47 @@ public:
 	virtual ~TextFileLog();
 };
 
+/// Log to a TXT file with rotation by size or time and background gzip compression of finished segments.
+/**
+Current segment is always written to FileName. When it grows over MaxSize bytes
+or becomes older than MaxSeconds, it is closed, renamed to "FileName.N" (N is
+a sequence number increasing through the whole life of the log, also across
+program runs) and a new segment is started.
+
+Renamed segments are compressed to "FileName.N.gz" by a separate background
+thread, so the thread calling OnLog (the logging thread) only renames a file
+and never waits for zlib. Only MaxArchives newest archives are kept - older ones
+are deleted by the background thread.
+*/
+class RotatingFileLog : public ILog
+{
+private:
+	/// \internal
+	class RotatingFileLog_pimpl;
+	scoped_ptr<RotatingFileLog_pimpl> pimpl;
+
+protected:
+	virtual void OnLog(uint32 Type, const tstring &Prefix, const tstring &TypePrefix, const tstring &Message);
+
+public:
+	/**
+	\param MaxSize Maximum size of a single segment, in bytes. 0 means no limit.
+	\param MaxSeconds Maximum time a single segment stays open, in seconds. 0 means no limit.
+	\param MaxArchives Number of archived segments to keep. 0 means no limit.
+	\param Compress If false, finished segments are only renamed, not compressed.
+	*/
+	RotatingFileLog(const tstring &FileName, LOG_FILE_MODE Mode, EOLMODE EolMode, uint64 MaxSize, uint MaxSeconds, uint MaxArchives, bool Compress = true, bool Append = false, const tstring &StartText = _T(""));
+	/// Waits until all pending segments are compressed.
+	virtual ~RotatingFileLog();
+
+	/// Finishes current segment and starts a new one, regardless of limits.
+	/** Not thread-safe with respect to logging - call it through the same thread that logs,
+	or when no messages are logged. */
+	void Rotate();
+	/// Blocks until the background thread compresses all finished segments.
+	void WaitForArchives();
+};
+
 /// Log do pliku HTML
 class HtmlFileLog : public ILog
 {
@@ -170,6 +391,79 @@ public:
 	//@}
 };
 
+/// Log to a file mapped into memory, which survives crash of the process.
+/**
+File space is preallocated and mapped into memory, so logging a message is just
+a memory copy - there is no system call per message. Pages of the mapping belong
+to the operating system, so everything logged survives crash of the process.
+To survive also crash of the whole system or power loss, call Flush.
+
+Each message is stored as a binary record with a header containing its length,
+type and checksum. After a crash, valid records can be found by scanning the file
+from its beginning up to the first record with invalid header or checksum -
+see Recover. Reopening the log with Append = true also continues after the last
+valid record.
+
+When preallocated space is full, the file is extended by another ChunkSize bytes
+and mapped again. When the log is closed normally, the file is truncated to the
+size actually used.
+*/
+class MappedFileLog : public ILog
+{
+private:
+	/// \internal
+	class MappedFileLog_pimpl;
+	scoped_ptr<MappedFileLog_pimpl> pimpl;
+
+protected:
+	virtual void OnLog(uint32 Type, const tstring &Prefix, const tstring &TypePrefix, const tstring &Message);
+
+public:
+	MappedFileLog(const tstring &FileName, bool Append = false, uint ChunkSize = 4*1024*1024);
+	virtual ~MappedFileLog();
+
+	/// Writes modified pages to disk and waits for it.
+	void Flush();
+
+	/// Reads all valid records from a log file created by MappedFileLog and writes them to a stream as text.
+	/** Can be used on a file left after a crash.
+	\return Number of records read. */
+	static uint Recover(const tstring &FileName, Stream *Out, EOLMODE EolMode);
+};
+
+/// Format of StructuredFileLog
+enum STRUCTURED_LOG_FORMAT
+{
+	/// One JSON object per line: {"type":1,"prefix":"...","msg":"...","key":value,...}
+	STRUCTURED_LOG_JSON_LINES,
+	/// Binary records, see StructuredFileLog.
+	STRUCTURED_LOG_BINARY,
+};
+
+/// Log to a file in a machine-readable format, including structured fields.
+/**
+Binary record: uint32 size of the rest of the record in bytes, uint32 type,
+uint32 prefix length, prefix characters, uint32 message length, message
+characters, fields encoded as in LogFields up to the end of the record. Lengths
+are in characters (tchar).
+*/
+class StructuredFileLog : public ILog
+{
+private:
+	/// \internal
+	class Pimpl;
+	scoped_ptr<Pimpl> pimpl;
+
+protected:
+	virtual void OnLog(uint32 Type, const tstring &Prefix, const tstring &TypePrefix, const tstring &Message);
+	virtual void OnLogFields(uint32 Type, const tstring &Prefix, const tstring &TypePrefix, const tstring &Message, const LogFields &Fields);
+
+public:
+	/** FILE_MODE_REOPEN is treated as FILE_MODE_FLUSH. */
+	StructuredFileLog(const tstring &FileName, STRUCTURED_LOG_FORMAT Format, LOG_FILE_MODE Mode, bool Append = false);
+	virtual ~StructuredFileLog();
+};
+
 /// Log zapisujcy do strumienia wyjciowego biblioteki standardowej C++ - std::ostream.
 class OstreamLog : public ILog
 {
@@ -198,6 +492,14 @@ public:
 //@{
 /// Skrt do atwego zalogowania acucha
 #define LOG(Type, s) { if (common::IsLogger()) common::GetLogger().Log((Type), (s)); else assert(0 && "LOG macro: Logger not initialized."); }
+/// Logs a message with structured fields. Example: LOG_FIELDS(1, _T("Hit"), common::BeginLogFields().Add("damage", 10).AddVec3("pos", Pos))
+#define LOG_FIELDS(Type, s, Fields) { if (common::IsLogger()) common::GetLogger().Log((Type), (s), (Fields)); else assert(0 && "LOG_FIELDS macro: Logger not initialized."); }
+/// Logs a message, but not more than Burst at once and MessagesPerSecond on average from this call site.
+/** Expression s is not evaluated when the message is suppressed. */
+#define LOG_RATE_LIMITED(Type, s, MessagesPerSecond, Burst) { static common::LogSite log_site_(__TFILE__, __LINE__, (MessagesPerSecond), (Burst)); if (common::IsLogger()) { if (log_site_.Test()) common::GetLogger().Log((Type), (s)); } else assert(0 && "LOG_RATE_LIMITED macro: Logger not initialized."); }
+/// Logs only randomly chosen messages from this call site, each with probability Probability (0..1).
+/** Expression s is not evaluated when the message is suppressed. */
+#define LOG_SAMPLED(Type, s, Probability) { static common::LogSite log_site_(__TFILE__, __LINE__, 0.f, 0, (Probability)); if (common::IsLogger()) { if (log_site_.Test()) common::GetLogger().Log((Type), (s)); } else assert(0 && "LOG_SAMPLED macro: Logger not initialized."); }
 //@}
 
 #endif
@@ -9,20 +9,235 @@ Documentation: \ref Module_Profiler \n
 Module components: \ref code_profiler
 */
 #include "Base.hpp"
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <time.h> // dla clock_gettime, timer_create
+	#include <signal.h>
+	#include <errno.h>
+	#include <execinfo.h> // dla backtrace
+	#include <ucontext.h>
+	#include <dlfcn.h> // dla dladdr
+	#include <cxxabi.h>
+#endif
+#ifdef __linux__
+	#include <linux/perf_event.h>
+	#include <sys/syscall.h>
+	#include <sys/ioctl.h>
+	#include <unistd.h>
+#endif
+#include <map>
+#include <queue>
+#include <deque>
+#include <algorithm>
+#include "Error.hpp"
+#include "Stream.hpp"
 #include "Profiler.hpp"
+#include <atomic>
 
 
 namespace common
 {
 
+//HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
+// Klasa HardwareCounters
+
+void PROFILER_COUNTERS::Add(const PROFILER_COUNTERS &Begin, const PROFILER_COUNTERS &End)
+{
+	Cycles += End.Cycles - Begin.Cycles;
+	Instructions += End.Instructions - Begin.Instructions;
+	CacheReferences += End.CacheReferences - Begin.CacheReferences;
+	CacheMisses += End.CacheMisses - Begin.CacheMisses;
+	Branches += End.Branches - Begin.Branches;
+	BranchMisses += End.BranchMisses - Begin.BranchMisses;
+}
+
+// Ustawiane tylko w testach
+static bool g_HardwareCountersUnavailable = false;
+
+void _SetHardwareCountersUnavailable(bool Unavailable)
+{
+	g_HardwareCountersUnavailable = Unavailable;
+}
+
+#ifdef __linux__
+
+class HardwareCounters_pimpl
+{
+public:
+	static const uint COUNTER_COUNT = 6;
+
+	// File descriptors of the events, first is the group leader, -1 if not opened
+	int m_Fds[COUNTER_COUNT];
+	// Index of each opened event in the group read result
+	uint m_ReadIndex[COUNTER_COUNT];
+	uint m_OpenedCount;
+
+	HardwareCounters_pimpl();
+	~HardwareCounters_pimpl();
+};
+
+HardwareCounters_pimpl::HardwareCounters_pimpl() :
+	m_OpenedCount(0)
+{
+	// In order of PROFILER_COUNTERS fields
+	static const uint64 Configs[COUNTER_COUNT] = {
+		PERF_COUNT_HW_CPU_CYCLES,
+		PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_CACHE_REFERENCES,
+		PERF_COUNT_HW_CACHE_MISSES,
+		PERF_COUNT_HW_BRANCH_INSTRUCTIONS,
+		PERF_COUNT_HW_BRANCH_MISSES,
+	};
+
+	for (uint i = 0; i < COUNTER_COUNT; i++)
+	{
+		m_Fds[i] = -1;
+		// Without the leader there is no group
+		if (g_HardwareCountersUnavailable || (i > 0 && m_Fds[0] == -1))
+			continue;
+
+		struct perf_event_attr Attr;
+		memset(&Attr, 0, sizeof(Attr));
+		Attr.size = sizeof(Attr);
+		Attr.type = PERF_TYPE_HARDWARE;
+		Attr.config = Configs[i];
+		Attr.disabled = (i == 0 ? 1 : 0);
+		// User space only, allowed with perf_event_paranoid <= 2
+		Attr.exclude_kernel = 1;
+		Attr.exclude_hv = 1;
+		Attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		// Calling thread, any CPU
+		m_Fds[i] = (int)syscall(__NR_perf_event_open, &Attr, 0, -1, m_Fds[0], 0);
+		if (m_Fds[i] != -1)
+			m_ReadIndex[i] = m_OpenedCount++;
+	}
+
+	if (m_Fds[0] != -1)
+		ioctl(m_Fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+HardwareCounters_pimpl::~HardwareCounters_pimpl()
+{
+	for (uint i = COUNTER_COUNT; i-- > 0; )
+	{
+		if (m_Fds[i] != -1)
+			close(m_Fds[i]);
+	}
+}
+
+HardwareCounters::HardwareCounters() :
+	pimpl(new HardwareCounters_pimpl)
+{
+}
+
+HardwareCounters::~HardwareCounters()
+{
+}
+
+bool HardwareCounters::IsAvailable() const
+{
+	return pimpl->m_Fds[0] != -1;
+}
+
+void HardwareCounters::Read(PROFILER_COUNTERS *Out)
+{
+	Out->Clear();
+	if (pimpl->m_Fds[0] == -1)
+		return;
+
+	// nr, time_enabled, time_running, values
+	uint64 Data[3 + HardwareCounters_pimpl::COUNTER_COUNT];
+	ssize_t Size = read(pimpl->m_Fds[0], Data, sizeof(Data));
+	if (Size < (ssize_t)(3 * sizeof(uint64)) || Data[0] != pimpl->m_OpenedCount || Data[2] == 0)
+		return;
+
+	uint64 Values[HardwareCounters_pimpl::COUNTER_COUNT] = { 0 };
+	for (uint i = 0; i < HardwareCounters_pimpl::COUNTER_COUNT; i++)
+	{
+		if (pimpl->m_Fds[i] == -1)
+			continue;
+		uint64 Value = Data[3 + pimpl->m_ReadIndex[i]];
+		// Group was multiplexed with other events - estimate
+		if (Data[2] < Data[1])
+			Value = (uint64)((double)Value * (double)Data[1] / (double)Data[2]);
+		Values[i] = Value;
+	}
+	Out->Cycles = Values[0];
+	Out->Instructions = Values[1];
+	Out->CacheReferences = Values[2];
+	Out->CacheMisses = Values[3];
+	Out->Branches = Values[4];
+	Out->BranchMisses = Values[5];
+}
+
+#else
+
+class HardwareCounters_pimpl
+{
+};
+
+HardwareCounters::HardwareCounters() :
+	pimpl(new HardwareCounters_pimpl)
+{
+}
+
+HardwareCounters::~HardwareCounters()
+{
+}
+
+bool HardwareCounters::IsAvailable() const
+{
+	return false;
+}
+
+void HardwareCounters::Read(PROFILER_COUNTERS *Out)
+{
+	Out->Clear();
+}
+
+#endif
+
+
 //HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
 // Klasa ProfilerItem
 
 ProfilerItem::ProfilerItem(const tstring &Name) :
     m_Time(GameTime::ZERO),
     m_Count(0),
+    m_CounterCount(0),
+    m_AllocationCount(0),
     m_strName(Name)
 {
+	m_Allocations.Clear();
+	m_StartAllocations.Clear();
+}
+
+void ProfilerItem::Start(HardwareCounters *Counters)
+{
+	if (Counters != NULL)
+		Counters->Read(&m_StartCounters);
+	m_StartAllocations = GetThreadAllocationCounters();
+	m_StartTime = GetCurrentGameTime();
+}
+
+void ProfilerItem::Stop(HardwareCounters *Counters)
+{
+	m_Time += GetCurrentGameTime() - m_StartTime;
+	m_Count++;
+	if (Counters != NULL)
+	{
+		PROFILER_COUNTERS EndCounters;
+		Counters->Read(&EndCounters);
+		m_Counters.Add(m_StartCounters, EndCounters);
+		m_CounterCount++;
+	}
+	if (IsAllocationTrackingEnabled())
+	{
+		m_Allocations.Add(m_StartAllocations, GetThreadAllocationCounters());
+		m_AllocationCount++;
+	}
 }
 
 ProfilerItem* ProfilerItem::Begin(const tstring &Name)
@@ -42,7 +257,9 @@ void ProfilerItem::FormatString(tstring *S, unsigned dwLevel, PROFILER_UNITS uni
 {
 	if (dwLevel > 0)
 	{
-		DuplicateString(S, _T("  "), (size_t)dwLevel-1);
+		tstring Indent;
+		DuplicateString(&Indent, _T("  "), (size_t)dwLevel-1);
+		*S += Indent;
 		*S += m_strName;
 		*S += _T(" : ");
 
@@ -57,7 +274,30 @@ void ProfilerItem::FormatString(tstring *S, unsigned dwLevel, PROFILER_UNITS uni
 			*S += _T(" s (");
 		}
 		*S += UintToStrR(GetCount());
-		*S += _T(")\n");
+		*S += _T(")");
+		if (HasCounters())
+		{
+			*S += _T(" IPC ");
+			*S += DoubleToStrR(m_Counters.GetIpc());
+			*S += _T(", cache miss ");
+			*S += DoubleToStrR(m_Counters.GetCacheMissRate()*100.);
+			*S += _T("%, branch miss ");
+			*S += DoubleToStrR(m_Counters.GetBranchMissRate()*100.);
+			*S += _T("%");
+		}
+		if (HasAllocations())
+		{
+			// rednio na przebieg
+			double Runs = (double)m_AllocationCount;
+			*S += _T(" alloc ");
+			*S += DoubleToStrR((double)m_Allocations.HeapAllocCount / Runs);
+			*S += _T(" x ");
+			*S += DoubleToStrR((double)m_Allocations.HeapAllocBytes / Runs);
+			*S += _T(" B, freelist ");
+			*S += DoubleToStrR((double)m_Allocations.FreeListAllocCount / Runs);
+			*S += _T(" x");
+		}
+		*S += _T("\n");
 	}
 
 	for (size_t i = 0; i < GetItemCount(); i++)
@@ -81,7 +321,7 @@ Profiler::Profiler(const tstring &Name) : m_DefaultItem(Name)
 void Profiler::Begin(const tstring &Name)
 {
 	ProfilerItem* pItem = ( m_ItemStack.top() )->Begin(Name);
-	pItem->Start();
+	pItem->Start(m_Counters.get());
 	m_ItemStack.push(pItem);
 }
 
@@ -90,7 +330,7 @@ void Profiler::End()
 	if (m_ItemStack.size() > 1)
 	{
 		ProfilerItem* pItem = m_ItemStack.top();
-		pItem->Stop();
+		pItem->Stop(m_Counters.get());
 		m_ItemStack.pop();
 	}
 	else
@@ -104,6 +344,18 @@ void Profiler::FormatString(tstring *S, PROFILER_UNITS units)
 	GetRootItem()->FormatString(S, 0, units);
 }
 
+bool Profiler::EnableHardwareCounters(bool Enable)
+{
+	m_Counters.reset();
+	if (Enable)
+	{
+		m_Counters.reset(new HardwareCounters);
+		if (!m_Counters->IsAvailable())
+			m_Counters.reset();
+	}
+	return AreHardwareCountersEnabled();
+}
+
 
 //HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
 // Klasa Profile
@@ -120,4 +372,1316 @@ Profile::~Profile()
 }
 
 
+//HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
+// Klasa LatencyHistogram
+
+void LatencyHistogram::Clear()
+{
+	common_memzero(m_Buckets, sizeof(m_Buckets));
+	m_Count = 0;
+	m_Min = 0;
+	m_Max = 0;
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram &Other)
+{
+	if (Other.m_Count == 0)
+		return;
+	for (uint i = 0; i < BUCKET_COUNT; i++)
+		m_Buckets[i] += Other.m_Buckets[i];
+	if (m_Count == 0)
+	{
+		m_Min = Other.m_Min;
+		m_Max = Other.m_Max;
+	}
+	else
+	{
+		m_Min = std::min(m_Min, Other.m_Min);
+		m_Max = std::max(m_Max, Other.m_Max);
+	}
+	m_Count += Other.m_Count;
+}
+
+uint64 LatencyHistogram::BucketToValue(uint Bucket)
+{
+	if (Bucket < 2*SUB_BUCKET_COUNT)
+		return Bucket;
+	uint Shift = Bucket / SUB_BUCKET_COUNT - 1;
+	return (uint64)(Bucket - Shift * SUB_BUCKET_COUNT) << Shift;
+}
+
+GameTime LatencyHistogram::GetPercentile(double Percent) const
+{
+	if (m_Count == 0)
+		return GameTime::ZERO;
+
+	uint64 Target = (uint64)ceil(Percent / 100.0 * (double)m_Count);
+	Target = minmax<uint64>(1, Target, m_Count);
+
+	uint64 Sum = 0;
+	for (uint i = 0; i < BUCKET_COUNT; i++)
+	{
+		Sum += m_Buckets[i];
+		if (Sum >= Target)
+		{
+			// Najwysza warto naleca do tego kubeka
+			int64 v = (int64)(BucketToValue(i+1) - 1);
+			return GameTime(minmax(m_Min, v, m_Max));
+		}
+	}
+	return GameTime(m_Max);
+}
+
+
+//HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
+// FlatProfiler
+
+FLAT_PROFILER_ENTRY::FLAT_PROFILER_ENTRY(const FLAT_PROFILER_ENTRY &Other) :
+	SumTime(Other.SumTime),
+	Count(Other.Count),
+	Histogram(Other.Histogram.is_null() ? NULL : new LatencyHistogram(*Other.Histogram))
+{
+}
+
+FLAT_PROFILER_ENTRY & FLAT_PROFILER_ENTRY::operator = (const FLAT_PROFILER_ENTRY &Other)
+{
+	if (&Other != this)
+	{
+		SumTime = Other.SumTime;
+		Count = Other.Count;
+		Histogram.reset(Other.Histogram.is_null() ? NULL : new LatencyHistogram(*Other.Histogram));
+	}
+	return *this;
+}
+
+void FLAT_PROFILER_ENTRY::Merge(const FLAT_PROFILER_ENTRY &Other)
+{
+	SumTime += Other.SumTime;
+	Count += Other.Count;
+	if (!Other.Histogram.is_null())
+	{
+		EnableHistogram();
+		Histogram->Merge(*Other.Histogram);
+	}
+}
+
+void FormatFlatProfilerEntry(tstring *out, const tstring &keyStr, const FLAT_PROFILER_ENTRY &entry, PROFILER_UNITS units)
+{
+	double Scale = (units == PROFILER_UNITS_MILLISECONDS) ? 1000. : 1.;
+	const tchar *UnitStr = (units == PROFILER_UNITS_MILLISECONDS) ? _T(" ms") : _T(" s");
+
+	*out += keyStr;
+	*out += _T(" : ");
+	*out += DoubleToStrR(entry.GetAvgTime().ToSeconds_d()*Scale);
+	*out += UnitStr;
+	*out += _T(" (");
+	*out += UintToStrR(entry.Count);
+	if (entry.Histogram.is_null())
+	{
+		*out += _T(")\n");
+		return;
+	}
+
+	const LatencyHistogram &H = *entry.Histogram;
+	*out += _T(") min ");
+	*out += DoubleToStrR(H.GetMin().ToSeconds_d()*Scale);
+	*out += _T(" p50 ");
+	*out += DoubleToStrR(H.GetPercentile(50.0).ToSeconds_d()*Scale);
+	*out += _T(" p99 ");
+	*out += DoubleToStrR(H.GetPercentile(99.0).ToSeconds_d()*Scale);
+	*out += _T(" p99.9 ");
+	*out += DoubleToStrR(H.GetPercentile(99.9).ToSeconds_d()*Scale);
+	*out += _T(" max ");
+	*out += DoubleToStrR(H.GetMax().ToSeconds_d()*Scale);
+	*out += _T("\n");
+}
+
+
+//HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
+// Numer wtku dla ShardedFlatProfiler i TraceRecorder
+
+struct PROFILER_THREAD_INDEX_POOL
+{
+	Mutex m_Mutex;
+	uint m_Count;
+	// Numbers released by finished threads, smallest on top
+	std::priority_queue< uint, std::vector<uint>, std::greater<uint> > m_Free;
+	uint64 m_NextSerial;
+
+	PROFILER_THREAD_INDEX_POOL() : m_Mutex(0), m_Count(0), m_NextSerial(0) { }
+};
+
+static PROFILER_THREAD_INDEX_POOL & GetProfilerThreadIndexPool()
+{
+	static PROFILER_THREAD_INDEX_POOL Pool;
+	return Pool;
+}
+
+// Identity of the calling thread. Index is returned to the pool when the thread ends.
+struct PROFILER_THREAD_ID
+{
+	uint Index;
+	// Unique for each thread, never reused
+	uint64 Serial;
+
+	PROFILER_THREAD_ID();
+	~PROFILER_THREAD_ID();
+};
+
+PROFILER_THREAD_ID::PROFILER_THREAD_ID()
+{
+	PROFILER_THREAD_INDEX_POOL &Pool = GetProfilerThreadIndexPool();
+	MUTEX_LOCK(Pool.m_Mutex);
+	if (Pool.m_Free.empty())
+		Index = Pool.m_Count++;
+	else
+	{
+		Index = Pool.m_Free.top();
+		Pool.m_Free.pop();
+	}
+	Serial = Pool.m_NextSerial++;
+}
+
+PROFILER_THREAD_ID::~PROFILER_THREAD_ID()
+{
+	PROFILER_THREAD_INDEX_POOL &Pool = GetProfilerThreadIndexPool();
+	MUTEX_LOCK(Pool.m_Mutex);
+	Pool.m_Free.push(Index);
+}
+
+static const PROFILER_THREAD_ID & GetProfilerThreadId()
+{
+	static thread_local PROFILER_THREAD_ID Id;
+	return Id;
+}
+
+uint GetProfilerThreadIndex()
+{
+	return GetProfilerThreadId().Index;
+}
+
+
+//HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
+// Klasa TraceRecorder
+
+// Written by the owning thread and read by export at the same time, hence atomic.
+// Relaxed access compiles to plain loads and stores.
+struct TRACE_EVENT
+{
+	std::atomic<int64> Ticks;
+	// NULL dla zdarzenia koca
+	std::atomic<const tchar*> Name;
+};
+
+// Ring buffer of a single thread. Only the owning thread adds events, without locking.
+// Export copies them and then drops the ones that could be overwritten meanwhile.
+struct TRACE_THREAD_BUFFER
+{
+	uint64 m_ThreadSerial;
+	scoped_ptr<TRACE_EVENT, DeleteArrayPolicy> m_Events;
+	size_t m_Capacity;
+	// Number of all events added so far. Event N is at index N % m_Capacity.
+	std::atomic<uint64> m_Written;
+	// Events with lower numbers were removed by Clear
+	std::atomic<uint64> m_ClearedUntil;
+	// Index where next event goes. Only for the owning thread.
+	size_t m_Next;
+	// For each Begin not ended yet, whether it was recorded. Only for the owning thread.
+	std::vector<bool> m_OpenScopes;
+	Mutex m_NameMutex;
+	tstring m_Name;
+
+	TRACE_THREAD_BUFFER(uint Capacity, uint64 ThreadSerial);
+	void Add(int64 Ticks, const tchar *Name);
+};
+
+TRACE_THREAD_BUFFER::TRACE_THREAD_BUFFER(uint Capacity, uint64 ThreadSerial) :
+	m_ThreadSerial(ThreadSerial),
+	m_Events(new TRACE_EVENT[Capacity]),
+	m_Capacity(Capacity),
+	m_Written(0),
+	m_ClearedUntil(0),
+	m_Next(0),
+	m_NameMutex(0)
+{
+}
+
+void TRACE_THREAD_BUFFER::Add(int64 Ticks, const tchar *Name)
+{
+	uint64 Number = m_Written.load(std::memory_order_relaxed);
+	// Export which sees the new content of the slot must also see that it's being reused (seqlock)
+	std::atomic_thread_fence(std::memory_order_release);
+	TRACE_EVENT &Event = m_Events[m_Next];
+	Event.Ticks.store(Ticks, std::memory_order_relaxed);
+	Event.Name.store(Name, std::memory_order_relaxed);
+	m_Written.store(Number + 1, std::memory_order_release);
+	if (++m_Next == m_Capacity)
+		m_Next = 0;
+}
+
+struct TRACE_EVENT_COPY
+{
+	int64 Ticks;
+	const tchar *Name;
+};
+
+class TraceRecorder_pimpl
+{
+public:
+	uint m_EventsPerThread;
+	int64 m_StartTicks;
+	std::atomic<bool> m_Enabled;
+	// Indexed by GetProfilerThreadIndex, created by the thread itself on its first event
+	std::atomic<TRACE_THREAD_BUFFER*> m_Buffers[TraceRecorder::MAX_THREADS];
+	// Buffers of finished threads, whose index was taken by another thread. Oldest first.
+	std::deque<TRACE_THREAD_BUFFER*> m_Retired;
+	// Protects m_Retired and guards buffers from being freed during export and Clear.
+	// Not used when adding events.
+	Mutex m_Mutex;
+
+	TraceRecorder_pimpl() : m_Mutex(0) { }
+	// Returns buffer of the calling thread or NULL if there are too many threads.
+	// With Create = false returns NULL also if the thread has no buffer yet.
+	TRACE_THREAD_BUFFER * GetBuffer(bool Create);
+	// Appends events of one thread in JSON format
+	void FormatThread(tstring *Out, TRACE_THREAD_BUFFER *Buffer, int64 FromTicks, int64 ToTicks, int64 NowTicks);
+	// Appends complete event clipped to the window, if it is inside
+	void FormatEvent(tstring *Out, const tstring &Tid, const tchar *Name, int64 BeginTicks, int64 EndTicks, int64 FromTicks, int64 ToTicks);
+	// Appends time in microseconds
+	void FormatTime(tstring *Out, int64 Ticks);
+};
+
+TRACE_THREAD_BUFFER * TraceRecorder_pimpl::GetBuffer(bool Create)
+{
+	const PROFILER_THREAD_ID &Id = GetProfilerThreadId();
+	if (Id.Index >= TraceRecorder::MAX_THREADS)
+		return NULL;
+
+	TRACE_THREAD_BUFFER *Buffer = m_Buffers[Id.Index].load(std::memory_order_acquire);
+	if (Buffer != NULL && Buffer->m_ThreadSerial == Id.Serial)
+		return Buffer;
+	if (!Create)
+		return NULL;
+
+	// First event of this thread. Buffer left in the slot belongs to a finished thread,
+	// which had the same index - keep its events for export.
+	TRACE_THREAD_BUFFER *NewBuffer = new TRACE_THREAD_BUFFER(m_EventsPerThread, Id.Serial);
+	MUTEX_LOCK(m_Mutex);
+	if (Buffer != NULL)
+	{
+		m_Retired.push_back(Buffer);
+		if (m_Retired.size() > TraceRecorder::MAX_THREADS)
+		{
+			delete m_Retired.front();
+			m_Retired.pop_front();
+		}
+	}
+	m_Buffers[Id.Index].store(NewBuffer, std::memory_order_release);
+	return NewBuffer;
+}
+
+void TraceRecorder_pimpl::FormatTime(tstring *Out, int64 Ticks)
+{
+	// Mikrosekundy z dokadnoci do nanosekund
+	uint64 Ns = (uint64)((double)std::max<int64>(Ticks, 0) * 1e9 / (double)GetProfilerTickFrequency());
+	tstring Frac;
+	UintToStr2<uint64>(&Frac, Ns % 1000, 3);
+	*Out += UintToStrR<uint64>(Ns / 1000);
+	*Out += _T('.');
+	*Out += Frac;
+}
+
+void TraceRecorder_pimpl::FormatThread(tstring *Out, TRACE_THREAD_BUFFER *Buffer, int64 FromTicks, int64 ToTicks, int64 NowTicks)
+{
+	// Kopia, eby nie blokowa wtku na czas formatowania
+	uint64 Capacity = Buffer->m_Capacity;
+	uint64 End = Buffer->m_Written.load(std::memory_order_acquire);
+	uint64 Begin = std::max(End > Capacity ? End - Capacity : 0, Buffer->m_ClearedUntil.load(std::memory_order_relaxed));
+	std::vector<TRACE_EVENT_COPY> Events((size_t)(End - Begin));
+	for (uint64 i = Begin; i < End; i++)
+	{
+		const TRACE_EVENT &Event = Buffer->m_Events[(size_t)(i % Capacity)];
+		Events[(size_t)(i - Begin)].Ticks = Event.Ticks.load(std::memory_order_relaxed);
+		Events[(size_t)(i - Begin)].Name = Event.Name.load(std::memory_order_relaxed);
+	}
+	// Slot of event number Written may be being overwritten now, together with all before it
+	std::atomic_thread_fence(std::memory_order_acquire);
+	uint64 Written = Buffer->m_Written.load(std::memory_order_relaxed);
+	if (Written >= Capacity && Written - Capacity + 1 > Begin)
+		Events.erase(Events.begin(), Events.begin() + (size_t)std::min(Written - Capacity + 1 - Begin, End - Begin));
+
+	tstring ThreadName;
+	{
+		MUTEX_LOCK(Buffer->m_NameMutex);
+		ThreadName = Buffer->m_Name;
+	}
+
+	tstring Tid = UintToStrR<uint64>(Buffer->m_ThreadSerial);
+	if (!ThreadName.empty())
+	{
+		*Out += _T(",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":");
+		*Out += Tid;
+		*Out += _T(",\"args\":{\"name\":");
+		AppendJsonString(Out, ThreadName);
+		*Out += _T("}}");
+	}
+
+	// Begin and end are paired into complete ("X") events. End without begin means
+	// the begin was overwritten in the ring buffer - skip it.
+	std::vector<const TRACE_EVENT_COPY*> Stack;
+	for (size_t i = 0; i < Events.size(); i++)
+	{
+		if (Events[i].Name != NULL)
+			Stack.push_back(&Events[i]);
+		else if (!Stack.empty())
+		{
+			FormatEvent(Out, Tid, Stack.back()->Name, Stack.back()->Ticks, Events[i].Ticks, FromTicks, ToTicks);
+			Stack.pop_back();
+		}
+	}
+	// Begin without end - still running
+	for (size_t i = Stack.size(); i--; )
+		FormatEvent(Out, Tid, Stack[i]->Name, Stack[i]->Ticks, NowTicks, FromTicks, ToTicks);
+}
+
+void TraceRecorder_pimpl::FormatEvent(tstring *Out, const tstring &Tid, const tchar *Name, int64 BeginTicks, int64 EndTicks, int64 FromTicks, int64 ToTicks)
+{
+	int64 From = std::max(BeginTicks, FromTicks);
+	int64 To = std::min(EndTicks, ToTicks);
+	if (From > To)
+		return;
+
+	*Out += _T(",\n{\"name\":");
+	AppendJsonString(Out, Name, common_strlen(Name));
+	*Out += _T(",\"ph\":\"X\",\"pid\":1,\"tid\":");
+	*Out += Tid;
+	*Out += _T(",\"ts\":");
+	FormatTime(Out, From - m_StartTicks);
+	*Out += _T(",\"dur\":");
+	FormatTime(Out, To - From);
+	*Out += _T('}');
+}
+
+TraceRecorder::TraceRecorder(uint EventsPerThread) :
+	pimpl(new TraceRecorder_pimpl)
+{
+	pimpl->m_EventsPerThread = std::max(EventsPerThread, 1u);
+	pimpl->m_StartTicks = GetProfilerTicks();
+	pimpl->m_Enabled = true;
+	for (uint i = 0; i < MAX_THREADS; i++)
+		pimpl->m_Buffers[i] = NULL;
+}
+
+TraceRecorder::~TraceRecorder()
+{
+	for (uint i = 0; i < MAX_THREADS; i++)
+		delete pimpl->m_Buffers[i].load();
+	for (size_t i = 0; i < pimpl->m_Retired.size(); i++)
+		delete pimpl->m_Retired[i];
+}
+
+void TraceRecorder::SetEnabled(bool Enabled)
+{
+	pimpl->m_Enabled = Enabled;
+}
+
+bool TraceRecorder::IsEnabled() const
+{
+	return pimpl->m_Enabled;
+}
+
+void TraceRecorder::Begin(const tchar *Name)
+{
+	bool Enabled = pimpl->m_Enabled.load(std::memory_order_relaxed);
+	// Disabled Begin is remembered only by a thread that may have recorded Begin open,
+	// so that its End doesn't close the recorded one.
+	TRACE_THREAD_BUFFER *Buffer = pimpl->GetBuffer(Enabled);
+	if (Buffer == NULL)
+		return;
+	Buffer->m_OpenScopes.push_back(Enabled);
+	if (Enabled)
+		Buffer->Add(GetProfilerTicks(), Name);
+}
+
+void TraceRecorder::End()
+{
+	// Independent of IsEnabled - ends event exactly when its Begin was recorded
+	TRACE_THREAD_BUFFER *Buffer = pimpl->GetBuffer(false);
+	if (Buffer == NULL || Buffer->m_OpenScopes.empty())
+		return;
+	bool Recorded = Buffer->m_OpenScopes.back();
+	Buffer->m_OpenScopes.pop_back();
+	if (Recorded)
+		Buffer->Add(GetProfilerTicks(), NULL);
+}
+
+void TraceRecorder::SetThreadName(const tstring &Name)
+{
+	TRACE_THREAD_BUFFER *Buffer = pimpl->GetBuffer(true);
+	if (Buffer != NULL)
+	{
+		MUTEX_LOCK(Buffer->m_NameMutex);
+		Buffer->m_Name = Name;
+	}
+}
+
+void TraceRecorder::Clear()
+{
+	MUTEX_LOCK(pimpl->m_Mutex);
+	for (uint i = 0; i < MAX_THREADS; i++)
+	{
+		TRACE_THREAD_BUFFER *Buffer = pimpl->m_Buffers[i].load(std::memory_order_acquire);
+		if (Buffer != NULL)
+			Buffer->m_ClearedUntil.store(Buffer->m_Written.load(std::memory_order_acquire), std::memory_order_relaxed);
+	}
+	for (size_t i = 0; i < pimpl->m_Retired.size(); i++)
+		delete pimpl->m_Retired[i];
+	pimpl->m_Retired.clear();
+}
+
+void TraceRecorder::ExportChromeTrace(Stream *Out, int64 FromTicks, int64 ToTicks)
+{
+	int64 NowTicks = GetProfilerTicks();
+
+	tstring Json = _T("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	Json += _T("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"CommonLib\"}}");
+	{
+		MUTEX_LOCK(pimpl->m_Mutex);
+		for (size_t i = 0; i < pimpl->m_Retired.size(); i++)
+			pimpl->FormatThread(&Json, pimpl->m_Retired[i], FromTicks, ToTicks, NowTicks);
+		for (uint i = 0; i < MAX_THREADS; i++)
+		{
+			TRACE_THREAD_BUFFER *Buffer = pimpl->m_Buffers[i].load(std::memory_order_acquire);
+			if (Buffer != NULL)
+				pimpl->FormatThread(&Json, Buffer, FromTicks, ToTicks, NowTicks);
+		}
+	}
+	Json += _T("\n]}\n");
+
+#ifdef _UNICODE
+	string Utf8;
+	ConvertUnicodeToChars(&Utf8, Json, CP_UTF8);
+	Out->Write(Utf8.data(), Utf8.length());
+#else
+	Out->Write(Json.data(), Json.length());
+#endif
+}
+
+
+//HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
+// Klasa ProfilerScope
+
+struct PROFILER_SCOPE_REGISTRY
+{
+	Mutex m_Mutex;
+	std::vector<const tchar*> m_Names;
+
+	PROFILER_SCOPE_REGISTRY() : m_Mutex(0) { }
+};
+
+static PROFILER_SCOPE_REGISTRY & GetProfilerScopeRegistry()
+{
+	static PROFILER_SCOPE_REGISTRY Registry;
+	return Registry;
+}
+
+ProfilerScope::ProfilerScope(const tchar *Name) :
+	m_Name(Name)
+{
+	PROFILER_SCOPE_REGISTRY &Registry = GetProfilerScopeRegistry();
+	MUTEX_LOCK(Registry.m_Mutex);
+	m_Id = (uint)Registry.m_Names.size();
+	Registry.m_Names.push_back(Name);
+}
+
+uint ProfilerScope::GetScopeCount()
+{
+	PROFILER_SCOPE_REGISTRY &Registry = GetProfilerScopeRegistry();
+	MUTEX_LOCK(Registry.m_Mutex);
+	return (uint)Registry.m_Names.size();
+}
+
+const tchar * ProfilerScope::GetScopeName(uint Id)
+{
+	PROFILER_SCOPE_REGISTRY &Registry = GetProfilerScopeRegistry();
+	MUTEX_LOCK(Registry.m_Mutex);
+	return Id < Registry.m_Names.size() ? Registry.m_Names[Id] : _T("");
+}
+
+
+//HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
+// Klasa FastProfiler
+
+thread_local PROFILER_SCOPE_STACK g_ProfilerScopeStack;
+
+FastProfiler::FastProfiler()
+{
+	Reset();
+}
+
+void FastProfiler::Reset()
+{
+	m_Nodes.clear();
+	m_ChildTable.assign(64, 0u);
+	AddChild(MAXUINT32, MAXUINT32);
+	m_Current = 0;
+}
+
+uint FastProfiler::AddChild(uint Parent, uint ScopeId)
+{
+	uint Index = (uint)m_Nodes.size();
+	m_Nodes.push_back(NODE());
+	NODE &Node = m_Nodes.back();
+	Node.ScopeId = ScopeId;
+	Node.Parent = Parent;
+	Node.FirstChild = 0;
+	Node.LastChild = 0;
+	Node.NextSibling = 0;
+	Node.StartTicks = 0;
+	Node.Ticks = 0;
+	Node.Count = 0;
+
+	if (Parent != MAXUINT32)
+	{
+		NODE &ParentNode = m_Nodes[Parent];
+		if (ParentNode.LastChild == 0)
+			ParentNode.FirstChild = Index;
+		else
+			m_Nodes[ParentNode.LastChild].NextSibling = Index;
+		ParentNode.LastChild = Index;
+
+		if (m_Nodes.size() * 2 > m_ChildTable.size())
+		{
+			m_ChildTable.assign(m_ChildTable.size() * 2, 0u);
+			for (uint i = 1; i < Index; i++)
+				InsertChild(i);
+		}
+		InsertChild(Index);
+	}
+	return Index;
+}
+
+void FastProfiler::InsertChild(uint Index)
+{
+	uint Mask = (uint)m_ChildTable.size() - 1;
+	uint Slot = HashChild(m_Nodes[Index].Parent, m_Nodes[Index].ScopeId) & Mask;
+	while (m_ChildTable[Slot] != 0)
+		Slot = (Slot + 1) & Mask;
+	m_ChildTable[Slot] = Index;
+}
+
+void FastProfiler::GetNodeStats(NODE_STATS *Out, uint Index) const
+{
+	const NODE &Node = m_Nodes[Index];
+	Out->ScopeId = Node.ScopeId;
+	Out->Parent = Node.Parent;
+	Out->FirstChild = Node.FirstChild;
+	Out->NextSibling = Node.NextSibling;
+	Out->Count = Node.Count;
+	Out->TotalSeconds = (double)Node.Ticks / (double)GetProfilerTickFrequency();
+	Out->TotalTicks = Node.Ticks;
+}
+
+void FastProfiler::FormatString(tstring *S, PROFILER_UNITS units)
+{
+	S->clear();
+	FormatNode(S, 0, 0, units);
+}
+
+void FastProfiler::FormatNode(tstring *S, uint Index, uint Level, PROFILER_UNITS units)
+{
+	const NODE &Node = m_Nodes[Index];
+
+	if (Level > 0)
+	{
+		double AvgSeconds = Node.Count == 0 ? 0.0 :
+			(double)Node.Ticks / (double)Node.Count / (double)GetProfilerTickFrequency();
+
+		tstring Indent;
+		DuplicateString(&Indent, _T("  "), (size_t)Level-1);
+		*S += Indent;
+		*S += ProfilerScope::GetScopeName(Node.ScopeId);
+		*S += _T(" : ");
+
+		if (units == PROFILER_UNITS_MILLISECONDS)
+		{
+			*S += DoubleToStrR(AvgSeconds*1000.);
+			*S += _T(" ms (");
+		}
+		else // PROFILER_UNITS_SECONDS
+		{
+			*S += DoubleToStrR(AvgSeconds);
+			*S += _T(" s (");
+		}
+		*S += UintToStrR(Node.Count);
+		*S += _T(")\n");
+	}
+
+	for (uint Child = Node.FirstChild; Child != 0; Child = m_Nodes[Child].NextSibling)
+		FormatNode(S, Child, Level+1, units);
+}
+
+
+//HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
+// Klasa FrameProfiler
+
+static void AppendSeconds(tstring *S, double Seconds, PROFILER_UNITS units)
+{
+	if (units == PROFILER_UNITS_MILLISECONDS)
+	{
+		*S += DoubleToStrR(Seconds*1000.);
+		*S += _T(" ms");
+	}
+	else // PROFILER_UNITS_SECONDS
+	{
+		*S += DoubleToStrR(Seconds);
+		*S += _T(" s");
+	}
+}
+
+FrameProfiler::FrameProfiler(uint FrameCount, double BudgetSeconds) :
+	m_BudgetTicks((int64)(BudgetSeconds * (double)GetProfilerTickFrequency())),
+	m_Frames(std::max(FrameCount, 1u))
+{
+	Reset();
+}
+
+void FrameProfiler::Reset()
+{
+	FastProfiler::Reset();
+	for (size_t i = 0; i < m_Frames.size(); i++)
+		m_Frames[i].Nodes.clear();
+	m_NextFrame = 0;
+	m_RecordedCount = 0;
+	m_FrameNumber = 0;
+	m_FrameStartTicks = GetProfilerTicks();
+	m_FrameStartAllocations = GetThreadAllocationCounters();
+	m_LastTotals.clear();
+}
+
+void FrameProfiler::BeginFrame()
+{
+	m_FrameStartAllocations = GetThreadAllocationCounters();
+	m_FrameStartTicks = GetProfilerTicks();
+}
+
+bool FrameProfiler::EndFrame()
+{
+	FRAME &Frame = m_Frames[m_NextFrame];
+	Frame.Number = m_FrameNumber++;
+	Frame.Ticks = GetProfilerTicks() - m_FrameStartTicks;
+	Frame.Allocations.Clear();
+	if (IsAllocationTrackingEnabled())
+		Frame.Allocations.Add(m_FrameStartAllocations, GetThreadAllocationCounters());
+
+	// Czas kadego wza w tej klatce to przyrost jego sumy od poprzedniej klatki
+	uint NodeCount = GetNodeCount();
+	Frame.Nodes.resize(NodeCount);
+	m_LastTotals.resize(NodeCount);
+	NODE_STATS Stats;
+	for (uint i = 0; i < NodeCount; i++)
+	{
+		GetNodeStats(&Stats, i);
+		Frame.Nodes[i].Ticks = Stats.TotalTicks - m_LastTotals[i].Ticks;
+		Frame.Nodes[i].Count = Stats.Count - m_LastTotals[i].Count;
+		m_LastTotals[i].Ticks = Stats.TotalTicks;
+		m_LastTotals[i].Count = Stats.Count;
+	}
+
+	m_NextFrame = (m_NextFrame + 1) % (uint)m_Frames.size();
+	if (m_RecordedCount < m_Frames.size())
+		m_RecordedCount++;
+
+	return Frame.Ticks > m_BudgetTicks;
+}
+
+double FrameProfiler::GetFrameSeconds(uint Index) const
+{
+	return (double)GetFrame(Index).Ticks / (double)GetProfilerTickFrequency();
+}
+
+bool FrameProfiler::IsFrameOverBudget(uint Index) const
+{
+	return GetFrame(Index).Ticks > m_BudgetTicks;
+}
+
+uint FrameProfiler::GetOverBudgetFrameCount() const
+{
+	uint Count = 0;
+	for (uint i = 0; i < m_RecordedCount; i++)
+	{
+		if (IsFrameOverBudget(i))
+			Count++;
+	}
+	return Count;
+}
+
+void FrameProfiler::GetScopeStats(SCOPE_STATS *Out, uint Node) const
+{
+	int64 Min = MAXINT64, Max = 0, Sum = 0;
+	uint Count = 0;
+	for (uint i = 0; i < m_RecordedCount; i++)
+	{
+		const FRAME &Frame = GetFrame(i);
+		if (Node < Frame.Nodes.size() && Frame.Nodes[Node].Count > 0)
+		{
+			int64 Ticks = Frame.Nodes[Node].Ticks;
+			Min = std::min(Min, Ticks);
+			Max = std::max(Max, Ticks);
+			Sum += Ticks;
+			Count++;
+		}
+	}
+
+	double Freq = (double)GetProfilerTickFrequency();
+	Out->FrameCount = Count;
+	Out->MinSeconds = Count > 0 ? (double)Min / Freq : 0.0;
+	Out->AvgSeconds = Count > 0 ? (double)Sum / (double)Count / Freq : 0.0;
+	Out->MaxSeconds = (double)Max / Freq;
+}
+
+void FrameProfiler::FormatString(tstring *S, PROFILER_UNITS units)
+{
+	S->clear();
+	if (m_RecordedCount == 0)
+		return;
+
+	double Min = GetFrameSeconds(0), Max = Min, Sum = 0.0;
+	for (uint i = 0; i < m_RecordedCount; i++)
+	{
+		double Seconds = GetFrameSeconds(i);
+		Min = std::min(Min, Seconds);
+		Max = std::max(Max, Seconds);
+		Sum += Seconds;
+	}
+
+	*S += _T("Frames : ");
+	AppendSeconds(S, Min, units);
+	*S += _T(" / ");
+	AppendSeconds(S, Sum / (double)m_RecordedCount, units);
+	*S += _T(" / ");
+	AppendSeconds(S, Max, units);
+	*S += _T(" (");
+	*S += UintToStrR(m_RecordedCount);
+	*S += _T("), over budget: ");
+	*S += UintToStrR(GetOverBudgetFrameCount());
+	*S += _T('\n');
+
+	if (IsAllocationTrackingEnabled())
+	{
+		uint64 MinCount = MAXUINT64, MaxCount = 0, SumCount = 0, SumBytes = 0;
+		for (uint i = 0; i < m_RecordedCount; i++)
+		{
+			const ALLOCATION_COUNTERS &Allocations = GetFrameAllocations(i);
+			MinCount = std::min(MinCount, Allocations.HeapAllocCount);
+			MaxCount = std::max(MaxCount, Allocations.HeapAllocCount);
+			SumCount += Allocations.HeapAllocCount;
+			SumBytes += Allocations.HeapAllocBytes;
+		}
+		*S += _T("Allocations : ");
+		*S += UintToStrR(MinCount);
+		*S += _T(" / ");
+		*S += DoubleToStrR((double)SumCount / (double)m_RecordedCount);
+		*S += _T(" / ");
+		*S += UintToStrR(MaxCount);
+		*S += _T(" per frame, ");
+		*S += DoubleToStrR((double)SumBytes / (double)m_RecordedCount);
+		*S += _T(" B per frame\n");
+	}
+
+	NODE_STATS Root;
+	GetNodeStats(&Root, 0);
+	for (uint Child = Root.FirstChild; Child != 0; )
+	{
+		FormatNode(S, Child, 1, units);
+		NODE_STATS Stats;
+		GetNodeStats(&Stats, Child);
+		Child = Stats.NextSibling;
+	}
+
+	for (uint i = 0; i < m_RecordedCount; i++)
+	{
+		if (IsFrameOverBudget(i))
+		{
+			*S += _T("Over budget: frame ");
+			*S += UintToStrR(GetFrame(i).Number);
+			*S += _T(" : ");
+			AppendSeconds(S, GetFrameSeconds(i), units);
+			*S += _T('\n');
+		}
+	}
+}
+
+void FrameProfiler::FormatNode(tstring *S, uint Index, uint Level, PROFILER_UNITS units)
+{
+	NODE_STATS Node;
+	GetNodeStats(&Node, Index);
+	SCOPE_STATS Stats;
+	GetScopeStats(&Stats, Index);
+
+	tstring Indent;
+	DuplicateString(&Indent, _T("  "), (size_t)Level);
+	*S += Indent;
+	*S += ProfilerScope::GetScopeName(Node.ScopeId);
+	*S += _T(" : ");
+	AppendSeconds(S, Stats.MinSeconds, units);
+	*S += _T(" / ");
+	AppendSeconds(S, Stats.AvgSeconds, units);
+	*S += _T(" / ");
+	AppendSeconds(S, Stats.MaxSeconds, units);
+	*S += _T(" (");
+	*S += UintToStrR(Stats.FrameCount);
+	*S += _T(")\n");
+
+	for (uint Child = Node.FirstChild; Child != 0; )
+	{
+		FormatNode(S, Child, Level+1, units);
+		NODE_STATS ChildStats;
+		GetNodeStats(&ChildStats, Child);
+		Child = ChildStats.NextSibling;
+	}
+}
+
+
+//HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
+// Klasa SamplingProfiler
+
+#ifdef _WIN32
+
+class SamplingProfiler_pimpl
+{
+};
+
+SamplingProfiler::SamplingProfiler() :
+	pimpl(new SamplingProfiler_pimpl)
+{
+}
+
+SamplingProfiler::~SamplingProfiler()
+{
+}
+
+void SamplingProfiler::Start(uint FrequencyHz)
+{
+	throw Error(_T("SamplingProfiler is not supported on this platform."), __TFILE__, __LINE__);
+}
+
+void SamplingProfiler::Stop()
+{
+}
+
+bool SamplingProfiler::IsRunning() const
+{
+	return false;
+}
+
+uint64 SamplingProfiler::GetSampleCount()
+{
+	return 0;
+}
+
+uint64 SamplingProfiler::GetDroppedSampleCount()
+{
+	return 0;
+}
+
+void SamplingProfiler::Clear()
+{
+}
+
+void SamplingProfiler::ExportFoldedStacks(Stream *Out)
+{
+}
+
+#else
+
+struct PROFILER_SAMPLE
+{
+	static const uint MAX_FRAMES = 64;
+	// Interrupted instruction, frames before it belong to the signal handler
+	const void *Pc;
+	uint ScopeCount;
+	uint FrameCount;
+	const tchar *Scopes[PROFILER_SCOPE_STACK::MAX_DEPTH];
+	void *Frames[MAX_FRAMES];
+};
+
+// Filled by the signal handler, emptied by the drain thread
+struct PROFILER_SAMPLE_BUFFER
+{
+	static const uint CAPACITY = 2048;
+	// Number of reserved samples, can exceed CAPACITY
+	std::atomic<uint> m_Next;
+	// Number of signal handlers currently writing to this buffer
+	std::atomic<uint> m_Writers;
+	PROFILER_SAMPLE m_Samples[CAPACITY];
+
+	PROFILER_SAMPLE_BUFFER() : m_Next(0), m_Writers(0) { }
+};
+
+class SamplingProfiler_pimpl
+{
+public:
+	// Stack key: scope names from the outermost, NULL, then frames from the innermost
+	typedef std::map<std::vector<const void*>, uint64> STACK_MAP;
+
+	class DrainThread : public Thread
+	{
+	private:
+		SamplingProfiler_pimpl *m_Pimpl;
+	protected:
+		virtual void Run() { m_Pimpl->DrainThreadFunc(); }
+	public:
+		DrainThread(SamplingProfiler_pimpl *Pimpl) : m_Pimpl(Pimpl) { }
+	};
+
+	PROFILER_SAMPLE_BUFFER m_Buffers[2];
+	std::atomic<PROFILER_SAMPLE_BUFFER*> m_ActiveBuffer;
+	std::atomic<uint64> m_DroppedCount;
+	bool m_Running;
+	timer_t m_Timer;
+	struct sigaction m_OldAction;
+
+	// Protects m_Stacks, m_SampleCount, m_End
+	Mutex m_Mutex;
+	Cond m_EndCond;
+	bool m_End;
+	STACK_MAP m_Stacks;
+	uint64 m_SampleCount;
+	scoped_ptr<DrainThread> m_Thread;
+
+	SamplingProfiler_pimpl();
+	// Called from the signal handler
+	void TakeSample(const void *Pc);
+	void DrainThreadFunc();
+	// Moves samples from the active buffer to m_Stacks
+	void Drain();
+};
+
+// Sampler receiving signals, NULL if none is running
+static std::atomic<SamplingProfiler_pimpl*> g_ActiveSampler(NULL);
+// Number of signal handlers being executed now, Stop waits for them
+static std::atomic<uint> g_SamplingHandlersRunning(0);
+
+// Returns address of the instruction interrupted by the signal or NULL if unknown
+static const void * GetSignalPc(void *Context)
+{
+#if defined(__x86_64__)
+	return (const void*)((ucontext_t*)Context)->uc_mcontext.gregs[REG_RIP];
+#elif defined(__i386__)
+	return (const void*)((ucontext_t*)Context)->uc_mcontext.gregs[REG_EIP];
+#elif defined(__aarch64__)
+	return (const void*)((ucontext_t*)Context)->uc_mcontext.pc;
+#else
+	return NULL;
+#endif
+}
+
+static void SamplingProfilerSignalHandler(int Signal, siginfo_t *Info, void *Context)
+{
+	int SavedErrno = errno;
+	g_SamplingHandlersRunning++;
+	SamplingProfiler_pimpl *Sampler = g_ActiveSampler.load();
+	if (Sampler != NULL)
+		Sampler->TakeSample(GetSignalPc(Context));
+	g_SamplingHandlersRunning--;
+	errno = SavedErrno;
+}
+
+SamplingProfiler_pimpl::SamplingProfiler_pimpl() :
+	m_ActiveBuffer(&m_Buffers[0]),
+	m_DroppedCount(0),
+	m_Running(false),
+	m_Mutex(0),
+	m_End(false),
+	m_SampleCount(0)
+{
+}
+
+void SamplingProfiler_pimpl::TakeSample(const void *Pc)
+{
+	// Register as a writer of the buffer which is still active after that,
+	// so the drain thread doesn't read it while the sample is written
+	PROFILER_SAMPLE_BUFFER *Buffer;
+	for (;;)
+	{
+		Buffer = m_ActiveBuffer.load();
+		Buffer->m_Writers++;
+		if (m_ActiveBuffer.load() == Buffer)
+			break;
+		Buffer->m_Writers--;
+	}
+
+	uint Index = Buffer->m_Next++;
+	if (Index < PROFILER_SAMPLE_BUFFER::CAPACITY)
+	{
+		PROFILER_SAMPLE &Sample = Buffer->m_Samples[Index];
+		Sample.Pc = Pc;
+		// The thread may be interrupted between writing name and incrementing Depth,
+		// but the name is written first, so it is always valid
+		const PROFILER_SCOPE_STACK &Stack = g_ProfilerScopeStack;
+		uint Depth = Stack.Depth;
+		std::atomic_signal_fence(std::memory_order_acquire);
+		Sample.ScopeCount = std::min<uint>(Depth, PROFILER_SCOPE_STACK::MAX_DEPTH);
+		for (uint i = 0; i < Sample.ScopeCount; i++)
+			Sample.Scopes[i] = Stack.Names[i];
+		// backtrace is not formally async-signal-safe, but it is after the first call,
+		// which Start makes to load libgcc
+		int FrameCount = backtrace(Sample.Frames, PROFILER_SAMPLE::MAX_FRAMES);
+		Sample.FrameCount = (uint)std::max(FrameCount, 0);
+	}
+	else
+		m_DroppedCount++;
+
+	Buffer->m_Writers--;
+}
+
+void SamplingProfiler_pimpl::DrainThreadFunc()
+{
+	for (;;)
+	{
+		{
+			MUTEX_LOCK(m_Mutex);
+			if (!m_End)
+				m_EndCond.TimeoutWait(&m_Mutex, 100);
+			if (m_End)
+				break;
+		}
+		Drain();
+	}
+}
+
+void SamplingProfiler_pimpl::Drain()
+{
+	PROFILER_SAMPLE_BUFFER *Buffer = m_ActiveBuffer.load();
+	PROFILER_SAMPLE_BUFFER *OtherBuffer = (Buffer == &m_Buffers[0] ? &m_Buffers[1] : &m_Buffers[0]);
+	m_ActiveBuffer = OtherBuffer;
+	while (Buffer->m_Writers.load() > 0)
+		Wait(0);
+
+	uint Count = std::min<uint>(Buffer->m_Next.load(), PROFILER_SAMPLE_BUFFER::CAPACITY);
+	std::vector<const void*> Key;
+	MUTEX_LOCK(m_Mutex);
+	for (uint i = 0; i < Count; i++)
+	{
+		const PROFILER_SAMPLE &Sample = Buffer->m_Samples[i];
+		Key.clear();
+		Key.insert(Key.end(), Sample.Scopes, Sample.Scopes + Sample.ScopeCount);
+		Key.push_back(NULL);
+		// Skip frames of the signal handler and trampoline
+		const void * const *FirstFrame = std::find(Sample.Frames, Sample.Frames + Sample.FrameCount, Sample.Pc);
+		if (FirstFrame == Sample.Frames + Sample.FrameCount)
+			FirstFrame = Sample.Frames;
+		Key.insert(Key.end(), FirstFrame, (const void * const *)Sample.Frames + Sample.FrameCount);
+		m_Stacks[Key]++;
+	}
+	m_SampleCount += Count;
+	Buffer->m_Next = 0;
+}
+
+// Appends name of function containing given code address
+static void AppendFrameName(string *Out, const void *Address, std::map<const void*, string> *Cache)
+{
+	std::map<const void*, string>::iterator it = Cache->find(Address);
+	if (it != Cache->end())
+	{
+		*Out += it->second;
+		return;
+	}
+
+	string Name;
+	Dl_info Info;
+	bool Found = (dladdr(Address, &Info) != 0);
+	if (Found && Info.dli_sname != NULL)
+	{
+		int Status;
+		char *Demangled = abi::__cxa_demangle(Info.dli_sname, NULL, NULL, &Status);
+		Name = (Demangled != NULL ? Demangled : Info.dli_sname);
+		free(Demangled);
+	}
+	else if (Found && Info.dli_fname != NULL && Info.dli_fname[0] != '\0')
+	{
+		// Function not exported - module and offset, like addr2line expects
+		const char *FileName = strrchr(Info.dli_fname, '/');
+		Name = (FileName != NULL ? FileName + 1 : Info.dli_fname);
+		Name += "+0x";
+		string Offset;
+		UintToStr(&Offset, (uint64)((const char*)Address - (const char*)Info.dli_fbase), 16);
+		Name += Offset;
+	}
+	else
+	{
+		Name = "0x";
+		string Addr;
+		UintToStr(&Addr, (uint64)(uintptr_t)Address, 16);
+		Name += Addr;
+	}
+	// Semicolon separates frames in the folded format
+	std::replace(Name.begin(), Name.end(), ';', ':');
+
+	(*Cache)[Address] = Name;
+	*Out += Name;
+}
+
+SamplingProfiler::SamplingProfiler() :
+	pimpl(new SamplingProfiler_pimpl)
+{
+}
+
+SamplingProfiler::~SamplingProfiler()
+{
+	Stop();
+}
+
+void SamplingProfiler::Start(uint FrequencyHz)
+{
+	if (pimpl->m_Running)
+		return;
+	SamplingProfiler_pimpl *Expected = NULL;
+	if (!g_ActiveSampler.compare_exchange_strong(Expected, pimpl.get()))
+		throw Error(_T("Another SamplingProfiler is already running."), __TFILE__, __LINE__);
+
+	// Loads libgcc unwinder now and not inside the signal handler
+	void *Dummy[1];
+	backtrace(Dummy, 1);
+
+	struct sigaction Action;
+	memset(&Action, 0, sizeof(Action));
+	Action.sa_sigaction = &SamplingProfilerSignalHandler;
+	Action.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigemptyset(&Action.sa_mask);
+	if (sigaction(SIGPROF, &Action, &pimpl->m_OldAction) != 0)
+	{
+		g_ActiveSampler = NULL;
+		throw Error(_T("SamplingProfiler: sigaction failed."), __TFILE__, __LINE__);
+	}
+
+	struct sigevent Event;
+	memset(&Event, 0, sizeof(Event));
+	Event.sigev_notify = SIGEV_SIGNAL;
+	Event.sigev_signo = SIGPROF;
+	if (timer_create(CLOCK_PROCESS_CPUTIME_ID, &Event, &pimpl->m_Timer) != 0)
+	{
+		sigaction(SIGPROF, &pimpl->m_OldAction, NULL);
+		g_ActiveSampler = NULL;
+		throw Error(_T("SamplingProfiler: timer_create failed."), __TFILE__, __LINE__);
+	}
+
+	pimpl->m_End = false;
+	pimpl->m_Thread.reset(new SamplingProfiler_pimpl::DrainThread(pimpl.get()));
+	pimpl->m_Thread->Start();
+
+	uint64 PeriodNs = 1000000000ull / std::max<uint>(FrequencyHz, 1);
+	struct itimerspec Spec;
+	Spec.it_interval.tv_sec = (time_t)(PeriodNs / 1000000000ull);
+	Spec.it_interval.tv_nsec = (long)(PeriodNs % 1000000000ull);
+	Spec.it_value = Spec.it_interval;
+	timer_settime(pimpl->m_Timer, 0, &Spec, NULL);
+
+	pimpl->m_Running = true;
+}
+
+void SamplingProfiler::Stop()
+{
+	if (!pimpl->m_Running)
+		return;
+
+	timer_delete(pimpl->m_Timer);
+	g_ActiveSampler = NULL;
+	// SIGPROF generated by the timer may be still pending. Ignoring the signal discards it,
+	// so it isn't delivered to the old action - which may be SIG_DFL, terminating the process.
+	struct sigaction IgnoreAction;
+	memset(&IgnoreAction, 0, sizeof(IgnoreAction));
+	IgnoreAction.sa_handler = SIG_IGN;
+	sigemptyset(&IgnoreAction.sa_mask);
+	sigaction(SIGPROF, &IgnoreAction, NULL);
+	// Signal already delivered may still be handled in some thread
+	while (g_SamplingHandlersRunning.load() > 0)
+		Wait(0);
+	sigaction(SIGPROF, &pimpl->m_OldAction, NULL);
+
+	{
+		MUTEX_LOCK(pimpl->m_Mutex);
+		pimpl->m_End = true;
+		pimpl->m_EndCond.Signal();
+	}
+	pimpl->m_Thread->Join();
+	pimpl->m_Thread.reset();
+	pimpl->Drain();
+
+	pimpl->m_Running = false;
+}
+
+bool SamplingProfiler::IsRunning() const
+{
+	return pimpl->m_Running;
+}
+
+uint64 SamplingProfiler::GetSampleCount()
+{
+	MUTEX_LOCK(pimpl->m_Mutex);
+	return pimpl->m_SampleCount;
+}
+
+uint64 SamplingProfiler::GetDroppedSampleCount()
+{
+	return pimpl->m_DroppedCount.load();
+}
+
+void SamplingProfiler::Clear()
+{
+	MUTEX_LOCK(pimpl->m_Mutex);
+	pimpl->m_Stacks.clear();
+	pimpl->m_SampleCount = 0;
+	pimpl->m_DroppedCount = 0;
+}
+
+void SamplingProfiler::ExportFoldedStacks(Stream *Out)
+{
+	std::map<const void*, string> NameCache;
+	// Different addresses in the same functions give the same line
+	std::map<string, uint64> Lines;
+	string Line;
+	MUTEX_LOCK(pimpl->m_Mutex);
+	for (SamplingProfiler_pimpl::STACK_MAP::const_iterator it = pimpl->m_Stacks.begin(); it != pimpl->m_Stacks.end(); ++it)
+	{
+		const std::vector<const void*> &Key = it->first;
+		size_t Separator = std::find(Key.begin(), Key.end(), (const void*)NULL) - Key.begin();
+
+		Line.clear();
+		for (size_t i = 0; i < Separator; i++)
+		{
+			if (!Line.empty())
+				Line += ';';
+			Line += (const tchar*)Key[i];
+		}
+		// Frames from the outermost. Return addresses point after the call,
+		// so one is subtracted for all but the interrupted frame.
+		for (size_t i = Key.size(); i-- > Separator + 1; )
+		{
+			if (!Line.empty())
+				Line += ';';
+			const char *Address = (const char*)Key[i];
+			AppendFrameName(&Line, (i == Separator + 1 ? Address : Address - 1), &NameCache);
+		}
+		if (Line.empty())
+			Line = "[unknown]";
+		Lines[Line] += it->second;
+	}
+
+	for (std::map<string, uint64>::const_iterator it = Lines.begin(); it != Lines.end(); ++it)
+	{
+		Line = it->first;
+		Line += ' ';
+		string CountStr;
+		UintToStr(&CountStr, it->second);
+		Line += CountStr;
+		Line += '\n';
+		Out->Write(Line.data(), Line.length());
+	}
+}
+
+#endif
+
+
 } // namespace common
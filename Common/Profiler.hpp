@@ -16,12 +16,23 @@ Module components: \ref code_profiler
 
 #include <stack> // :(
 #include <map> // :(
+#include <unordered_map>
+#include <atomic>
 #include "DateTime.hpp"
 #include "Threads.hpp"
+#include "FreeList.hpp"
 
 namespace common
 {
 
+class Stream;
+/// \internal
+class TraceRecorder_pimpl;
+/// \internal
+class SamplingProfiler_pimpl;
+/// \internal
+class HardwareCounters_pimpl;
+
 /** \addtogroup code_profiler Profile module
 Documentation: \ref Module_Profiler \n
 Header: Profiler.hpp */
@@ -34,6 +45,54 @@ enum PROFILER_UNITS {
 	PROFILER_UNITS_SECONDS,
 };
 
+/// Values of hardware performance counters
+struct PROFILER_COUNTERS
+{
+	uint64 Cycles;
+	uint64 Instructions;
+	uint64 CacheReferences;
+	uint64 CacheMisses;
+	uint64 Branches;
+	uint64 BranchMisses;
+
+	PROFILER_COUNTERS() { Clear(); }
+	void Clear() { Cycles = Instructions = CacheReferences = CacheMisses = Branches = BranchMisses = 0; }
+	void Add(const PROFILER_COUNTERS &Begin, const PROFILER_COUNTERS &End);
+
+	/// Instructions per cycle, 0 if unknown.
+	double GetIpc() const { return Cycles > 0 ? (double)Instructions / (double)Cycles : 0.0; }
+	/// Part of cache references which missed, 0..1, 0 if unknown.
+	double GetCacheMissRate() const { return CacheReferences > 0 ? (double)CacheMisses / (double)CacheReferences : 0.0; }
+	/// Part of branches which were mispredicted, 0..1, 0 if unknown.
+	double GetBranchMissRate() const { return Branches > 0 ? (double)BranchMisses / (double)Branches : 0.0; }
+};
+
+/// Reads hardware performance counters of the thread which created the object.
+/** Uses perf_event_open on Linux. Counters can be unavailable - on other systems,
+in virtual machine without virtual PMU or when /proc/sys/kernel/perf_event_paranoid
+doesn't allow it. Then IsAvailable returns false and Read returns zeros. Some of the
+counters may be unsupported by the CPU - they are always 0. */
+class HardwareCounters
+{
+	DECLARE_NO_COPY_CLASS(HardwareCounters)
+
+public:
+	HardwareCounters();
+	~HardwareCounters();
+
+	bool IsAvailable() const;
+	/// Returns values counted since creation of the object.
+	void Read(PROFILER_COUNTERS *Out);
+
+private:
+	scoped_ptr<HardwareCounters_pimpl> pimpl;
+};
+
+/// \internal
+/** Makes HardwareCounters created from now on unavailable, as if perf_event_open
+failed - for testing. Don't call while HardwareCounters are created in another thread. */
+void _SetHardwareCountersUnavailable(bool Unavailable);
+
 /// Pozycja danych profilera
 class ProfilerItem
 {
@@ -44,13 +103,23 @@ private:
 	size_t m_Count;
 	// Czas rozpoczcia biecego przebiegu [s]
 	GameTime m_StartTime;
+	// Sumaryczne wartoci licznikw sprztowych
+	PROFILER_COUNTERS m_Counters;
+	PROFILER_COUNTERS m_StartCounters;
+	// Liczba przebiegw zmierzonych licznikami sprztowymi
+	size_t m_CounterCount;
+	// Sumaryczne alokacje, gdy ledzenie alokacji jest wczone
+	ALLOCATION_COUNTERS m_Allocations;
+	ALLOCATION_COUNTERS m_StartAllocations;
+	// Liczba przebiegw ze ledzeniem alokacji
+	size_t m_AllocationCount;
 	tstring m_strName; // Nazwa elementu
 	std::vector<ProfilerItem> m_ItemVector; // Podelementy
 
 	friend class Profiler;
 	ProfilerItem * Begin(const tstring &Name);
-	void Start() { m_StartTime = GetCurrentGameTime(); }
-	void Stop() { m_Time += GetCurrentGameTime() - m_StartTime; m_Count++; }
+	void Start(HardwareCounters *Counters);
+	void Stop(HardwareCounters *Counters);
 
 public:
 	ProfilerItem(const tstring &Name);
@@ -61,6 +130,16 @@ public:
 	GameTime GetAvgTime() { return Empty() ? GameTime::ZERO : (m_Time / (int64)m_Count); }
 	size_t GetItemCount() { return m_ItemVector.size(); }
 	ProfilerItem* GetItem(size_t index) { return &m_ItemVector[index]; }
+	/// Returns true if hardware counters were measured for this item.
+	bool HasCounters() { return m_CounterCount > 0; }
+	/// Returns sum of hardware counters over all runs measured with them.
+	const PROFILER_COUNTERS & GetCounters() { return m_Counters; }
+	/// Returns true if allocations were tracked for this item, see EnableAllocationTracking.
+	bool HasAllocations() { return m_AllocationCount > 0; }
+	/// Returns number of runs with allocation tracking enabled.
+	size_t GetAllocationRunCount() { return m_AllocationCount; }
+	/// Returns sum of allocations made by the thread in this item over all tracked runs.
+	const ALLOCATION_COUNTERS & GetAllocations() { return m_Allocations; }
 	void FormatString(tstring *S, unsigned dwLevel, PROFILER_UNITS units);
 };
 
@@ -79,9 +158,17 @@ public:
 	Jednostka to milisekundy. */
 	void FormatString(tstring *S, PROFILER_UNITS units);
 
+	/// Turns on or off reading hardware counters in each Begin and End.
+	/** Counters measure the thread calling this method. Returns false if they
+	are not available - profiler then measures only time. Each Begin and End
+	costs an additional system call. Call it when no item is begun. */
+	bool EnableHardwareCounters(bool Enable);
+	bool AreHardwareCountersEnabled() { return !m_Counters.is_null(); }
+
 private:
 	std::stack<ProfilerItem*> m_ItemStack;
 	ProfilerItem m_DefaultItem;
+	scoped_ptr<HardwareCounters> m_Counters;
 };
 
 /// Klasa, ktrej obiekt moesz dla wygody utworzy zamiast wywoywa Begin i End profilera.
@@ -99,8 +186,419 @@ public:
 	~Profile();
 };
 
+/// Returns current value of fast monotonic clock used by FastProfiler - same as GetSystemCounter.
+inline int64 GetProfilerTicks() { return GetSystemCounter(); }
+/// Returns number of GetProfilerTicks units per second.
+inline int64 GetProfilerTickFrequency() { return GetSystemCounterFrequency(); }
+
+/// Static description of a profiled scope, used by FastProfiler.
+/** Create it as a static object (PROFILE_SCOPE macro does that), so the name is
+registered only once and each entry to the scope uses just its numeric
+identifier. Name must be a string literal or other string that lives until the
+end of the program. Class is thread-safe. */
+class ProfilerScope
+{
+public:
+	explicit ProfilerScope(const tchar *Name);
+
+	uint GetId() const { return m_Id; }
+	const tchar * GetName() const { return m_Name; }
+
+	/// Returns number of all scopes registered so far.
+	static uint GetScopeCount();
+	/// Returns name of scope with given identifier.
+	static const tchar * GetScopeName(uint Id);
+
+private:
+	uint m_Id;
+	const tchar *m_Name;
+};
+
+/// Hierarchical profiler with low overhead, for scopes described by ProfilerScope.
+/** Works like Profiler, but doesn't build or compare any strings while measuring.
+Nodes of the tree are kept in a single array, child is found in a hash table by
+parent node and scope identifier, and time is measured with GetProfilerTicks. \n
+Class is not thread-safe - use separate object in each thread. */
+class FastProfiler
+{
+public:
+	/// Statistics of a single node of the tree
+	struct NODE_STATS
+	{
+		/// Identifier of the scope, MAXUINT32 for the root
+		uint ScopeId;
+		/// Index of parent node, MAXUINT32 for the root
+		uint Parent;
+		/// Index of first child node and of next node with the same parent, 0 if none
+		uint FirstChild;
+		uint NextSibling;
+		/// Number of finished measurements
+		uint64 Count;
+		/// Sum of all measurements
+		double TotalSeconds;
+		/// Sum of all measurements in GetProfilerTicks units
+		int64 TotalTicks;
+	};
+
+	FastProfiler();
+
+	void Begin(const ProfilerScope &Scope);
+	void End();
+	/// Clears all the results. Must not be called inside a measured scope.
+	void Reset();
+	/// Returns identifier of the innermost scope being measured or MAXUINT32 if none.
+	uint GetCurrentScopeId() const { return m_Nodes[m_Current].ScopeId; }
+
+	/// Returns number of nodes of the tree, including the root with index 0.
+	uint GetNodeCount() const { return (uint)m_Nodes.size(); }
+	void GetNodeStats(NODE_STATS *Out, uint Index) const;
+	/// Writes whole tree to string, in the same format as Profiler::FormatString.
+	void FormatString(tstring *S, PROFILER_UNITS units);
+
+private:
+	struct NODE
+	{
+		uint ScopeId;
+		uint Parent;
+		// Children form a list, 0 means none (root is never a child)
+		uint FirstChild;
+		uint LastChild;
+		uint NextSibling;
+		int64 StartTicks;
+		int64 Ticks;
+		uint64 Count;
+	};
+
+	std::vector<NODE> m_Nodes;
+	uint m_Current;
+	// Open addressing hash table of node indices by (Parent, ScopeId), 0 = empty slot.
+	// Size is a power of 2, kept at most half full.
+	std::vector<uint> m_ChildTable;
+
+	static uint HashChild(uint Parent, uint ScopeId) { return (Parent * 0x9E3779B1u) ^ (ScopeId * 0x85EBCA77u); }
+	uint AddChild(uint Parent, uint ScopeId);
+	void InsertChild(uint Index);
+	void FormatNode(tstring *S, uint Index, uint Level, PROFILER_UNITS units);
+};
+
+inline void FastProfiler::Begin(const ProfilerScope &Scope)
+{
+	uint Id = Scope.GetId();
+	uint Mask = (uint)m_ChildTable.size() - 1;
+	uint Slot = HashChild(m_Current, Id) & Mask;
+	uint Child;
+	while ((Child = m_ChildTable[Slot]) != 0 && (m_Nodes[Child].ScopeId != Id || m_Nodes[Child].Parent != m_Current))
+		Slot = (Slot + 1) & Mask;
+	if (Child == 0)
+		Child = AddChild(m_Current, Id);
+	m_Current = Child;
+	m_Nodes[Child].StartTicks = GetProfilerTicks();
+}
+
+inline void FastProfiler::End()
+{
+	if (m_Current == 0)
+		return;
+	NODE &Node = m_Nodes[m_Current];
+	Node.Ticks += GetProfilerTicks() - Node.StartTicks;
+	Node.Count++;
+	m_Current = Node.Parent;
+}
+
+/// \internal
+/** Names of FastProfile scopes active in the current thread, read by SamplingProfiler. */
+struct PROFILER_SCOPE_STACK
+{
+	static const uint MAX_DEPTH = 32;
+	const tchar *Names[MAX_DEPTH];
+	// Can be greater than MAX_DEPTH - names of deeper scopes are not remembered
+	volatile uint Depth;
+};
+/// \internal
+extern thread_local PROFILER_SCOPE_STACK g_ProfilerScopeStack;
+
+/// Measures existence of the object in FastProfiler, like Profile does for Profiler.
+class FastProfile
+{
+private:
+	FastProfiler &m_Profiler;
+public:
+	FastProfile(FastProfiler &profiler, const ProfilerScope &Scope);
+	~FastProfile() { m_Profiler.End(); g_ProfilerScopeStack.Depth--; }
+};
+
+inline FastProfile::FastProfile(FastProfiler &profiler, const ProfilerScope &Scope) :
+	m_Profiler(profiler)
+{
+	PROFILER_SCOPE_STACK &Stack = g_ProfilerScopeStack;
+	if (Stack.Depth < PROFILER_SCOPE_STACK::MAX_DEPTH)
+		Stack.Names[Stack.Depth] = Scope.GetName();
+	// SamplingProfiler signal handler in this thread must see the name when it sees the new Depth
+	std::atomic_signal_fence(std::memory_order_release);
+	Stack.Depth++;
+	m_Profiler.Begin(Scope);
+}
+
+/// Statistical profiler which interrupts the program periodically with SIGPROF signal.
+/** On each interrupt it remembers backtrace of the interrupted thread together
+with names of FastProfile scopes (PROFILE_SCOPE) active in it, so it covers also
+code which is not instrumented. Samples are aggregated by a background thread and
+can be exported as folded stacks for flame graph tools. The timer counts CPU time
+of the whole process, so idle threads are not sampled. \n
+Only one SamplingProfiler can run at a time. Available on Linux - on Windows Start
+throws Error. Function names are found with dladdr, so the program should be
+linked with -rdynamic. */
+class SamplingProfiler
+{
+	DECLARE_NO_COPY_CLASS(SamplingProfiler)
+
+public:
+	SamplingProfiler();
+	/// Stops sampling if it is running.
+	~SamplingProfiler();
+
+	/// Starts sampling given number of times per second of CPU time.
+	/** Overhead is proportional to the frequency. */
+	void Start(uint FrequencyHz = 997);
+	void Stop();
+	bool IsRunning() const;
+
+	/// Returns number of samples collected so far.
+	uint64 GetSampleCount();
+	/// Returns number of samples lost because the buffer was full.
+	uint64 GetDroppedSampleCount();
+	/// Forgets all collected samples.
+	void Clear();
+	/// Writes collected samples as folded stacks, one line per unique stack.
+	/** Line format is <tt>scope;scope;function;function count</tt>, from the
+	outermost to the innermost, in UTF-8. Can be passed to flamegraph.pl or
+	opened in speedscope. */
+	void ExportFoldedStacks(Stream *Out);
+
+private:
+	scoped_ptr<SamplingProfiler_pimpl> pimpl;
+};
+
+/// Log-linear histogram of durations, in the manner of HdrHistogram.
+/** Each power of two is divided into 16 buckets, so percentiles are returned with
+relative error below 1/16. Values are GameTime units, negative ones count as 0.
+Recording a value takes constant time and doesn't allocate memory - the whole
+histogram is a fixed array of BUCKET_COUNT counters (about 8 KB). Histograms
+collected separately can be merged. */
+class LatencyHistogram
+{
+public:
+	static const uint SUB_BUCKET_COUNT = 16;
+	static const uint BUCKET_COUNT = 960;
+
+	LatencyHistogram() { Clear(); }
+
+	void Clear();
+	void Record(GameTime Value);
+	/// Adds all values recorded in other histogram to this one.
+	void Merge(const LatencyHistogram &Other);
+
+	uint64 GetCount() const { return m_Count; }
+	/// Returns GameTime::ZERO if there are no values.
+	GameTime GetMin() const { return m_Count == 0 ? GameTime::ZERO : GameTime(m_Min); }
+	/// Returns GameTime::ZERO if there are no values.
+	GameTime GetMax() const { return m_Count == 0 ? GameTime::ZERO : GameTime(m_Max); }
+	/// Returns value below or equal to which given percent of values are, e.g. 99.9.
+	/** Percent must be in range 0..100. Returns GameTime::ZERO if there are no values. */
+	GameTime GetPercentile(double Percent) const;
+
+private:
+	uint64 m_Buckets[BUCKET_COUNT];
+	uint64 m_Count;
+	int64 m_Min;
+	int64 m_Max;
+
+	static uint ValueToBucket(uint64 Value);
+	// Returns smallest value which falls into given bucket
+	static uint64 BucketToValue(uint Bucket);
+};
+
+inline void LatencyHistogram::Record(GameTime Value)
+{
+	int64 v = std::max<int64>(Value.GetInt8(), 0);
+	m_Buckets[ValueToBucket((uint64)v)]++;
+	if (m_Count == 0)
+		m_Min = m_Max = v;
+	else
+	{
+		m_Min = std::min(m_Min, v);
+		m_Max = std::max(m_Max, v);
+	}
+	m_Count++;
+}
+
+inline uint LatencyHistogram::ValueToBucket(uint64 Value)
+{
+	if (Value < 2*SUB_BUCKET_COUNT)
+		return (uint)Value;
+	uint32 Hi = (uint32)(Value >> 32);
+	uint HighestBit = Hi != 0 ? 32 + log2u(Hi) : log2u((uint32)Value);
+	uint Shift = HighestBit - 4;
+	return Shift * SUB_BUCKET_COUNT + (uint)(Value >> Shift);
+}
+
+/// Results for a single key of FlatProfiler and ShardedFlatProfiler.
+struct FLAT_PROFILER_ENTRY
+{
+	GameTime SumTime;
+	size_t Count;
+	/// NULL unless the profiler was created with histograms turned on.
+	/** Histogram takes about 8 KB, so it is created only when somebody wants percentiles. */
+	scoped_ptr<LatencyHistogram> Histogram;
+
+	FLAT_PROFILER_ENTRY() : SumTime(GameTime::ZERO), Count(0) { }
+	FLAT_PROFILER_ENTRY(const FLAT_PROFILER_ENTRY &Other);
+	FLAT_PROFILER_ENTRY & operator = (const FLAT_PROFILER_ENTRY &Other);
+
+	GameTime GetAvgTime() const { return SumTime / (int64)Count; }
+	/// Creates Histogram if it doesn't exist yet.
+	void EnableHistogram() { if (Histogram.is_null()) Histogram.reset(new LatencyHistogram); }
+	/// Records the sample also in Histogram, if it exists.
+	void AddSample(GameTime timeInterval) { SumTime += timeInterval; Count++; if (!Histogram.is_null()) Histogram->Record(timeInterval); }
+	/// Histogram of Other is merged into this one, created if needed.
+	void Merge(const FLAT_PROFILER_ENTRY &Other);
+};
+
+/// \internal
+/** Appends a line for FlatProfiler::FormatString. */
+void FormatFlatProfilerEntry(tstring *out, const tstring &keyStr, const FLAT_PROFILER_ENTRY &entry, PROFILER_UNITS units);
+
+/// FastProfiler which remembers times of scopes in each of last frames.
+/** Profiler accumulates results forever, so a single slow frame disappears in
+the average. This class keeps times of all scopes in each of the last FrameCount
+frames in a ring and reports minimum, average and maximum over these frames.
+Frames longer than the budget are flagged. Frame can be also a request or any
+other unit of work - just call BeginFrame and EndFrame around it. \n
+Scopes are measured the same way as in FastProfiler, e.g. with PROFILE_SCOPE.
+Class is not thread-safe. */
+class FrameProfiler : public FastProfiler
+{
+public:
+	/// Statistics of a node over the remembered frames
+	struct SCOPE_STATS
+	{
+		/// Number of remembered frames in which the scope was finished
+		uint FrameCount;
+		/// Time of the scope in a single frame, summed over all its runs in that frame
+		double MinSeconds;
+		double AvgSeconds;
+		double MaxSeconds;
+	};
+
+	FrameProfiler(uint FrameCount = 120, double BudgetSeconds = 1.0 / 60.0);
+
+	void BeginFrame();
+	/// Returns true if the frame took longer than the budget.
+	bool EndFrame();
+	/// Clears all the results. Must not be called inside a frame or a measured scope.
+	void Reset();
+
+	/// Returns number of remembered frames, up to FrameCount.
+	uint GetRecordedFrameCount() const { return m_RecordedCount; }
+	/// Index 0 is the oldest remembered frame.
+	double GetFrameSeconds(uint Index) const;
+	bool IsFrameOverBudget(uint Index) const;
+	/// Returns number of remembered frames that exceeded the budget.
+	uint GetOverBudgetFrameCount() const;
+	/// Returns allocations made by the thread during the frame.
+	/** All zeros if allocation tracking was disabled, see EnableAllocationTracking. */
+	const ALLOCATION_COUNTERS & GetFrameAllocations(uint Index) const { return GetFrame(Index).Allocations; }
+	/// Returns statistics of given node (see FastProfiler::GetNodeCount) over remembered frames.
+	void GetScopeStats(SCOPE_STATS *Out, uint Node) const;
+	/// Writes summary of frames, tree of scopes with min / avg / max and list of frames over budget.
+	void FormatString(tstring *S, PROFILER_UNITS units);
+
+private:
+	struct NODE_FRAME
+	{
+		int64 Ticks;
+		uint64 Count;
+	};
+	struct FRAME
+	{
+		uint64 Number;
+		int64 Ticks;
+		ALLOCATION_COUNTERS Allocations;
+		// Indexed by node, may be shorter than number of nodes
+		std::vector<NODE_FRAME> Nodes;
+	};
+
+	int64 m_BudgetTicks;
+	std::vector<FRAME> m_Frames;
+	// Index where next frame goes
+	uint m_NextFrame;
+	uint m_RecordedCount;
+	uint64 m_FrameNumber;
+	int64 m_FrameStartTicks;
+	ALLOCATION_COUNTERS m_FrameStartAllocations;
+	// Totals of all nodes at the end of the previous frame
+	std::vector<NODE_FRAME> m_LastTotals;
+
+	const FRAME & GetFrame(uint Index) const { return m_Frames[(m_NextFrame + m_Frames.size() - m_RecordedCount + Index) % m_Frames.size()]; }
+	void FormatNode(tstring *S, uint Index, uint Level, PROFILER_UNITS units);
+};
+
+/// Records timeline of begin/end events and exports it in Chrome Trace Event format.
+/** Unlike profilers, it doesn't aggregate anything, so it shows single stalls,
+lock waits and how threads interact. Each thread writes its events to its own
+ring buffer, so only the newest EventsPerThread events of each thread are kept.
+Exported JSON can be opened in chrome://tracing or Perfetto UI. \n
+Names must be string literals or other strings that live as long as the recorder.
+Up to MAX_THREADS threads running at the same time are recorded, events from other
+threads are ignored. Adding an event doesn't take any lock. \n
+Class is thread-safe. */
+class TraceRecorder
+{
+	DECLARE_NO_COPY_CLASS(TraceRecorder)
+
+public:
+	static const uint MAX_THREADS = 256;
+
+	TraceRecorder(uint EventsPerThread = 65536);
+	~TraceRecorder();
+
+	/// Recording is enabled by default. When disabled, Begin does nothing.
+	/** End always matches its Begin, so events begun before disabling are still ended
+	and End of Begin called while disabled is not recorded. */
+	void SetEnabled(bool Enabled);
+	bool IsEnabled() const;
+
+	void Begin(const tchar *Name);
+	void End();
+	/// Sets name of the calling thread, shown by the viewer.
+	void SetThreadName(const tstring &Name);
+	/// Forgets all recorded events.
+	void Clear();
+
+	/// Writes events from given time window as Chrome Trace Event JSON, in UTF-8.
+	/** FromTicks and ToTicks are values returned by GetProfilerTicks. Events
+	crossing the window borders are clipped to it. Events not finished yet
+	end at the time of export. */
+	void ExportChromeTrace(Stream *Out, int64 FromTicks = MININT64, int64 ToTicks = MAXINT64);
+
+private:
+	scoped_ptr<TraceRecorder_pimpl> pimpl;
+};
+
+/// Records existence of the object as an event in TraceRecorder.
+class TraceScope
+{
+private:
+	TraceRecorder &m_Recorder;
+public:
+	TraceScope(TraceRecorder &recorder, const tchar *Name) : m_Recorder(recorder) { m_Recorder.Begin(Name); }
+	~TraceScope() { m_Recorder.End(); }
+};
+
 /// Class to measure duration of some code in a flat manner, without any hierarchy.
-/** Samples are aggregated by key and for each key average time is calculated. \n
+/** Samples are aggregated by key and for each key average time is calculated.
+When the profiler is created with histograms = true, also LatencyHistogram of
+each key is kept, which costs about 8 KB per key. \n
 KeyT and KeyTraits are like in std::set or std::map. KeyT must be comparable
 using KeyTraits functor. KeyT must also be convertable to string with
 SthToStr<KeyT> function call. \n
@@ -109,26 +607,27 @@ template < typename KeyT, typename KeyTraits=std::less<KeyT> >
 class FlatProfiler
 {
 public:
-	FlatProfiler() : m_Mutex(0) { }
+	typedef FLAT_PROFILER_ENTRY ENTRY;
+	typedef std::map<KeyT, ENTRY, KeyTraits> MapType;
+
+	/// Pass histograms = true to keep LatencyHistogram for each key.
+	FlatProfiler(bool histograms = false) : m_Mutex(0), m_Histograms(histograms) { }
 	/// Clears all the remembered results.
 	void Clear();
 	/// Registers new sample collected by custom time measurement.
 	void AddSample(const KeyT &key, GameTime timeInterval);
+	/// Returns copy of all the results.
+	/** Entries of snapshots taken from different profilers can be merged with ENTRY::Merge. */
+	void GetSnapshot(MapType *out);
 	/// Returns multiline string with all results in unsorted order.
+	/** Besides average time and number of samples, each line contains minimum,
+	50th, 99th and 99.9th percentile and maximum, if histograms are turned on. */
 	void FormatString(tstring *out, PROFILER_UNITS units);
 
 private:
-	struct ENTRY
-	{
-		GameTime SumTime;
-		size_t Count;
-		ENTRY() : SumTime(GameTime::ZERO), Count(0) { }
-		GameTime GetAvgTime() const { return SumTime / (int64)Count; }
-	};
-	typedef std::map<KeyT, ENTRY, KeyTraits> MapType;
-
 	Mutex m_Mutex;
 	MapType m_Entries;
+	bool m_Histograms;
 };
 
 /// Support RIAA class to collect time sample for FlatProfiler.
@@ -147,6 +646,75 @@ private:
 	GameTime m_StartTime;
 };
 
+/// Returns small number identifying the calling thread: 0, 1, 2... in order of first call.
+/** Number of a finished thread is given to the next new thread, smallest first. */
+uint GetProfilerThreadIndex();
+
+/// Variant of FlatProfiler that doesn't slow down when many threads add samples at the same time.
+/** Each thread accumulates samples in its own shard - a hash table selected by
+GetProfilerThreadIndex, so threads don't wait for each other. Shards are allocated
+in blocks of SHARDS_PER_BLOCK when first needed and merged only on demand, in
+FormatString and GetSnapshot. Only when more than SHARDS_PER_BLOCK * MAX_BLOCKS
+threads run at the same time, some of them share a shard. \n
+Each shard still has a mutex, because it is read by FormatString and GetSnapshot
+while its thread adds samples. Only the owner thread and readers take it, so it
+is not contended while samples are added. \n
+KeyT must be hashable with HashT functor and comparable with operator ==. KeyT must
+also be convertable to string with SthToStr<KeyT> function call. \n
+Class is thread-safe. */
+template < typename KeyT, typename HashT=std::hash<KeyT> >
+class ShardedFlatProfiler
+{
+public:
+	static const uint SHARDS_PER_BLOCK = 64;
+	static const uint MAX_BLOCKS = 64;
+
+	typedef FLAT_PROFILER_ENTRY ENTRY;
+	typedef std::unordered_map<KeyT, ENTRY, HashT> MapType;
+
+	/// Pass histograms = true to keep LatencyHistogram for each key.
+	ShardedFlatProfiler(bool histograms = false);
+	~ShardedFlatProfiler();
+	/// Clears all the remembered results.
+	void Clear();
+	/// Registers new sample collected by custom time measurement.
+	void AddSample(const KeyT &key, GameTime timeInterval);
+	/// Returns results of all threads merged together.
+	void GetSnapshot(MapType *out);
+	/// Returns multiline string with all results in unsorted order.
+	void FormatString(tstring *out, PROFILER_UNITS units);
+
+private:
+	struct SHARD
+	{
+		Mutex m_Mutex;
+		MapType m_Entries;
+		// So that shards of different threads don't share cache lines
+		char m_Padding[64];
+		SHARD() : m_Mutex(0) { }
+	};
+
+	// Arrays of SHARDS_PER_BLOCK shards or NULL, created by the first thread that needs them
+	std::atomic<SHARD*> m_Blocks[MAX_BLOCKS];
+	bool m_Histograms;
+
+	SHARD & GetShard(uint threadIndex);
+};
+
+/// Support RIAA class to collect time sample for ShardedFlatProfiler.
+template < typename KeyT, typename HashT=std::hash<KeyT> >
+class ShardedFlatProfilerSampler
+{
+public:
+	ShardedFlatProfilerSampler(ShardedFlatProfiler<KeyT, HashT> &profiler, const KeyT &key) : m_Profiler(profiler), m_Key(key), m_StartTime(GetCurrentGameTime()) { }
+	~ShardedFlatProfilerSampler() { m_Profiler.AddSample(m_Key, GetCurrentGameTime() - m_StartTime); }
+
+private:
+	ShardedFlatProfiler<KeyT, HashT> &m_Profiler;
+	KeyT m_Key;
+	GameTime m_StartTime;
+};
+
 template <typename KeyT, typename KeyTraits>
 void FlatProfiler<KeyT, KeyTraits>::Clear()
 {
@@ -159,8 +727,16 @@ void FlatProfiler<KeyT, KeyTraits>::AddSample(const KeyT &key, GameTime timeInte
 {
 	MutexLock lock(m_Mutex);
 	ENTRY &entry = m_Entries[key];
-	entry.SumTime += timeInterval;
-	entry.Count++;
+	if (m_Histograms)
+		entry.EnableHistogram();
+	entry.AddSample(timeInterval);
+}
+
+template <typename KeyT, typename KeyTraits>
+void FlatProfiler<KeyT, KeyTraits>::GetSnapshot(MapType *out)
+{
+	MutexLock lock(m_Mutex);
+	*out = m_Entries;
 }
 
 template <typename KeyT, typename KeyTraits>
@@ -169,26 +745,102 @@ void FlatProfiler<KeyT, KeyTraits>::FormatString(tstring *out, PROFILER_UNITS un
 	MutexLock lock(m_Mutex);
 
 	tstring keyStr;
-	for (MapType::iterator it = m_Entries.begin(); it != m_Entries.end(); ++it)
+	for (typename MapType::iterator it = m_Entries.begin(); it != m_Entries.end(); ++it)
 	{
-		const ENTRY &entry = it->second;
-
 		SthToStr<KeyT>(&keyStr, it->first);
-		*out += keyStr;
-		*out += _T(" : ");
+		FormatFlatProfilerEntry(out, keyStr, it->second, units);
+	}
+}
+
+template <typename KeyT, typename HashT>
+ShardedFlatProfiler<KeyT, HashT>::ShardedFlatProfiler(bool histograms) :
+	m_Histograms(histograms)
+{
+	for (uint i = 0; i < MAX_BLOCKS; i++)
+		m_Blocks[i].store(NULL, std::memory_order_relaxed);
+}
+
+template <typename KeyT, typename HashT>
+ShardedFlatProfiler<KeyT, HashT>::~ShardedFlatProfiler()
+{
+	for (uint i = 0; i < MAX_BLOCKS; i++)
+		delete [] m_Blocks[i].load(std::memory_order_relaxed);
+}
+
+template <typename KeyT, typename HashT>
+typename ShardedFlatProfiler<KeyT, HashT>::SHARD & ShardedFlatProfiler<KeyT, HashT>::GetShard(uint threadIndex)
+{
+	threadIndex %= SHARDS_PER_BLOCK * MAX_BLOCKS;
+	std::atomic<SHARD*> &block = m_Blocks[threadIndex / SHARDS_PER_BLOCK];
+	SHARD *shards = block.load(std::memory_order_acquire);
+	if (shards == NULL)
+	{
+		// Two threads can create the block at the same time - the one that loses deletes its copy
+		SHARD *newShards = new SHARD[SHARDS_PER_BLOCK];
+		if (block.compare_exchange_strong(shards, newShards, std::memory_order_acq_rel))
+			shards = newShards;
+		else
+			delete [] newShards;
+	}
+	return shards[threadIndex % SHARDS_PER_BLOCK];
+}
 
-		if (units == PROFILER_UNITS_MILLISECONDS)
+template <typename KeyT, typename HashT>
+void ShardedFlatProfiler<KeyT, HashT>::Clear()
+{
+	for (uint i = 0; i < MAX_BLOCKS; i++)
+	{
+		SHARD *shards = m_Blocks[i].load(std::memory_order_acquire);
+		if (shards == NULL)
+			continue;
+		for (uint j = 0; j < SHARDS_PER_BLOCK; j++)
 		{
-			*out += DoubleToStrR(entry.GetAvgTime().ToSeconds_d()*1000.);
-			*out += _T(" ms (");
+			MutexLock lock(shards[j].m_Mutex);
+			shards[j].m_Entries.clear();
 		}
-		else // PROFILER_UNITS_SECONDS
+	}
+}
+
+template <typename KeyT, typename HashT>
+void ShardedFlatProfiler<KeyT, HashT>::AddSample(const KeyT &key, GameTime timeInterval)
+{
+	SHARD &shard = GetShard(GetProfilerThreadIndex());
+	MutexLock lock(shard.m_Mutex);
+	ENTRY &entry = shard.m_Entries[key];
+	if (m_Histograms)
+		entry.EnableHistogram();
+	entry.AddSample(timeInterval);
+}
+
+template <typename KeyT, typename HashT>
+void ShardedFlatProfiler<KeyT, HashT>::GetSnapshot(MapType *out)
+{
+	out->clear();
+	for (uint i = 0; i < MAX_BLOCKS; i++)
+	{
+		SHARD *shards = m_Blocks[i].load(std::memory_order_acquire);
+		if (shards == NULL)
+			continue;
+		for (uint j = 0; j < SHARDS_PER_BLOCK; j++)
 		{
-			*out += DoubleToStrR(entry.GetAvgTime().ToSeconds_d());
-			*out += _T(" s (");
+			MutexLock lock(shards[j].m_Mutex);
+			for (typename MapType::const_iterator it = shards[j].m_Entries.begin(); it != shards[j].m_Entries.end(); ++it)
+				(*out)[it->first].Merge(it->second);
 		}
-		*out += UintToStrR(entry.Count);
-		*out += _T(")\n");
+	}
+}
+
+template <typename KeyT, typename HashT>
+void ShardedFlatProfiler<KeyT, HashT>::FormatString(tstring *out, PROFILER_UNITS units)
+{
+	MapType entries;
+	GetSnapshot(&entries);
+
+	tstring keyStr;
+	for (typename MapType::const_iterator it = entries.begin(); it != entries.end(); ++it)
+	{
+		SthToStr<KeyT>(&keyStr, it->first);
+		FormatFlatProfilerEntry(out, keyStr, it->second, units);
 	}
 }
 
@@ -203,6 +855,13 @@ void FlatProfiler<KeyT, KeyTraits>::FormatString(tstring *out, PROFILER_UNITS un
 na pocztku guardowanej do profilowania funkcji czy dowolnego bloku { }
 postawi to makro. */
 #define PROFILE_GUARD(profiler,Name)   common::Profile __profile_guard_object(profiler, Name);
+/** Like PROFILE_GUARD, but for FastProfiler. Name must be a string literal -
+it is registered only once, when the scope is entered for the first time. */
+#define PROFILE_SCOPE(profiler,Name) \
+	static const common::ProfilerScope __profile_scope_object(Name); \
+	common::FastProfile __profile_scope_guard_object(profiler, __profile_scope_object);
+/** Records the rest of the block as an event in TraceRecorder. */
+#define TRACE_SCOPE(recorder,Name)   common::TraceScope __trace_scope_object(recorder, Name);
 //@}
 
 #endif
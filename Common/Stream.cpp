@@ -15,6 +15,24 @@ Module components: \ref code_stream
 	#include <typeinfo>
 #endif
 #include <memory.h> // dla memcpy
+// Instrukcje SSE4.2 i PCLMULQDQ - używane tylko po sprawdzeniu procesora
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+	#define COMMON_STREAM_X86
+	#ifdef _MSC_VER
+		#include <intrin.h> // dla __cpuid
+		#define COMMON_TARGET(Features)
+	#else
+		#include <cpuid.h>
+		#define COMMON_TARGET(Features) __attribute__((target(Features)))
+	#endif
+	#include <nmmintrin.h> // SSE4.2
+	#include <wmmintrin.h> // PCLMULQDQ
+	#include <immintrin.h> // SHA, AVX2
+	// SSE2 jest zawsze na x64, na x86 tylko jeśli włączony w kompilatorze
+	#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+		#define COMMON_STREAM_SSE2
+	#endif
+#endif
 #include "Error.hpp"
 #include "Stream.hpp"
 
@@ -33,6 +51,80 @@ const char BASE64_CHARS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxy
 //HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
 // Funkcje globalne wewnętrzne
 
+// Rozszerzenia procesora, sprawdzane raz przy starcie
+class CpuFeatures
+{
+public:
+	bool Ssse3, Sse41, Sse42, Pclmul, Sha, Avx2;
+
+	CpuFeatures();
+};
+
+CpuFeatures::CpuFeatures()
+{
+	Ssse3 = Sse41 = Sse42 = Pclmul = Sha = Avx2 = false;
+#ifdef COMMON_STREAM_X86
+	uint Regs[4], MaxLeaf;
+#ifdef _MSC_VER
+	__cpuid((int*)Regs, 0);
+	MaxLeaf = Regs[0];
+	__cpuid((int*)Regs, 1);
+#else
+	MaxLeaf = __get_cpuid_max(0, NULL);
+	if (MaxLeaf < 1)
+		return;
+	__cpuid(1, Regs[0], Regs[1], Regs[2], Regs[3]);
+#endif
+	Ssse3 = (Regs[2] & (1 << 9)) != 0;
+	Sse41 = (Regs[2] & (1 << 19)) != 0;
+	Sse42 = (Regs[2] & (1 << 20)) != 0;
+	Pclmul = (Regs[2] & (1 << 1)) != 0;
+	// AVX wymaga też, żeby system zapisywał rejestry YMM (OSXSAVE i bity 1, 2 w XCR0)
+	bool OsYmm = false;
+	if ((Regs[2] & (1 << 27)) != 0)
+	{
+#ifdef _MSC_VER
+		OsYmm = (_xgetbv(0) & 6) == 6;
+#else
+		uint XcrLow, XcrHigh;
+		__asm__ ("xgetbv" : "=a"(XcrLow), "=d"(XcrHigh) : "c"(0));
+		OsYmm = (XcrLow & 6) == 6;
+#endif
+	}
+	if (MaxLeaf >= 7)
+	{
+#ifdef _MSC_VER
+		__cpuidex((int*)Regs, 7, 0);
+#else
+		__cpuid_count(7, 0, Regs[0], Regs[1], Regs[2], Regs[3]);
+#endif
+		Sha = (Regs[1] & (1 << 29)) != 0;
+		Avx2 = OsYmm && (Regs[1] & (1 << 5)) != 0;
+	}
+#endif
+}
+
+// Statyczna lokalna - gotowa także przy użyciu z konstruktorów obiektów globalnych z innych plików
+static const CpuFeatures & GetCpu()
+{
+	static const CpuFeatures Cpu;
+	return Cpu;
+}
+
+// Ustawiane tylko w testach
+static bool g_ForceScalarHashes = false;
+static bool g_ForceScalarCoding = false;
+
+void _SetForceScalarHashes(bool Force)
+{
+	g_ForceScalarHashes = Force;
+}
+
+void _SetForceScalarCoding(bool Force)
+{
+	g_ForceScalarCoding = Force;
+}
+
 // 0 = normalny znak Base64
 // 1 = znak '='
 // 2 = znak nieznany (biały lub nie)
@@ -81,6 +173,12 @@ void Stream::Write(const void *Data, size_t Size)
 	throw Error(_T("Stream class doesn't support write."), __TFILE__, __LINE__);
 }
 
+void Stream::WriteV(const IO_BUFFER *Buffers, size_t BufferCount)
+{
+	for (size_t i = 0; i < BufferCount; i++)
+		Write(Buffers[i].Data, Buffers[i].Size);
+}
+
 ////// WriteString 1 (ANSI)
 
 void Stream::WriteString1(const string &s)
@@ -261,6 +359,19 @@ void Stream::MustRead(void *Data, size_t Size)
 		throw Error(Format(_T("Stream read error: #/# bytes read.")) % i % Size, __TFILE__, __LINE__);
 }
 
+size_t Stream::ReadV(const IO_BUFFER *Buffers, size_t BufferCount)
+{
+	size_t ReadSize, Sum = 0;
+	for (size_t i = 0; i < BufferCount; i++)
+	{
+		ReadSize = Read(Buffers[i].Data, Buffers[i].Size);
+		Sum += ReadSize;
+		if (ReadSize < Buffers[i].Size)
+			break;
+	}
+	return Sum;
+}
+
 size_t Stream::Skip(size_t MaxLength)
 {
 	// Implementacja dla klasy Stream nie posiadającej kursora.
@@ -426,18 +537,37 @@ size_t Stream::CopyFrom(Stream *s, size_t Size)
 {
 	if (Size == 0) return 0;
 	// Size - liczba bajtów, jaka została do odczytania
-	scoped_ptr<char, DeleteArrayPolicy> Buf(new char[BUFFER_SIZE]);
+	char Buf[BUFFER_SIZE];
+	const void *ReadSpan;
+	void *WriteSpan;
 	size_t ReqSize, ReadSize, BytesRead = 0;
+	if (DirectCopyFrom(s, Size, &BytesRead))
+		return BytesRead;
 	do
 	{
-		ReadSize = ReqSize = std::min(BUFFER_SIZE, Size);
-		ReadSize = s->Read(Buf.get(), ReadSize);
-		if (ReadSize > 0)
+		// Źródło udostępnia swoją pamięć - zapis prosto z niej
+		if ((ReadSize = s->AcquireReadSpan(&ReadSpan)) > 0)
+		{
+			ReadSize = ReqSize = std::min(ReadSize, Size);
+			Write(ReadSpan, ReadSize);
+			s->ReleaseRead(ReadSize);
+		}
+		// Cel udostępnia swoją pamięć - odczyt prosto do niej
+		else if ((ReqSize = AcquireWriteSpan(&WriteSpan)) > 0)
 		{
-			Write(Buf.get(), ReadSize);
-			Size -= ReadSize;
-			BytesRead += ReadSize;
+			ReqSize = std::min(ReqSize, Size);
+			ReadSize = s->Read(WriteSpan, ReqSize);
+			CommitWrite(ReadSize);
 		}
+		else
+		{
+			ReqSize = std::min(BUFFER_SIZE, Size);
+			ReadSize = s->Read(Buf, ReqSize);
+			if (ReadSize > 0)
+				Write(Buf, ReadSize);
+		}
+		Size -= ReadSize;
+		BytesRead += ReadSize;
 	} while (ReadSize == ReqSize && Size > 0);
 	return BytesRead;
 }
@@ -446,36 +576,100 @@ void Stream::MustCopyFrom(Stream *s, size_t Size)
 {
 	if (Size == 0) return;
 	// Size - liczba bajtów, jaka została do odczytania
-	scoped_ptr<char, DeleteArrayPolicy> Buf(new char[BUFFER_SIZE]);
+	char Buf[BUFFER_SIZE];
+	const void *ReadSpan;
+	void *WriteSpan;
 	size_t ReqSize;
+	if (DirectCopyFrom(s, Size, &ReqSize))
+	{
+		if (ReqSize != Size)
+			throw Error(Format(_T("Stream copy error: #/# bytes copied.")) % ReqSize % Size, __TFILE__, __LINE__);
+		return;
+	}
 	do
 	{
-		ReqSize = std::min(BUFFER_SIZE, Size);
-		s->MustRead(Buf.get(), ReqSize);
-		if (ReqSize > 0)
+		if ((ReqSize = s->AcquireReadSpan(&ReadSpan)) > 0)
 		{
-			Write(Buf.get(), ReqSize);
-			Size -= ReqSize;
+			ReqSize = std::min(ReqSize, Size);
+			Write(ReadSpan, ReqSize);
+			s->ReleaseRead(ReqSize);
 		}
+		else if ((ReqSize = AcquireWriteSpan(&WriteSpan)) > 0)
+		{
+			ReqSize = std::min(ReqSize, Size);
+			s->MustRead(WriteSpan, ReqSize);
+			CommitWrite(ReqSize);
+		}
+		else
+		{
+			ReqSize = std::min(BUFFER_SIZE, Size);
+			s->MustRead(Buf, ReqSize);
+			Write(Buf, ReqSize);
+		}
+		Size -= ReqSize;
 	} while (Size > 0);
 }
 
 size_t Stream::CopyFromToEnd(Stream *s)
 {
-	scoped_ptr<char, DeleteArrayPolicy> Buf(new char[BUFFER_SIZE]);
-	size_t Size = BUFFER_SIZE, bytesProcessed = 0;
+	char Buf[BUFFER_SIZE];
+	const void *ReadSpan;
+	void *WriteSpan;
+	size_t ReqSize, Size, bytesProcessed = 0;
+	if (DirectCopyFrom(s, std::numeric_limits<size_t>::max(), &bytesProcessed))
+		return bytesProcessed;
 	do
 	{
-		Size = s->Read(Buf.get(), Size);
-		if (Size > 0)
+		if ((Size = s->AcquireReadSpan(&ReadSpan)) > 0)
 		{
-			Write(Buf.get(), Size);
-			bytesProcessed += Size;
+			ReqSize = Size;
+			Write(ReadSpan, Size);
+			s->ReleaseRead(Size);
 		}
-	} while (Size == BUFFER_SIZE);
+		else if ((ReqSize = AcquireWriteSpan(&WriteSpan)) > 0)
+		{
+			Size = s->Read(WriteSpan, ReqSize);
+			CommitWrite(Size);
+		}
+		else
+		{
+			ReqSize = BUFFER_SIZE;
+			Size = s->Read(Buf, ReqSize);
+			if (Size > 0)
+				Write(Buf, Size);
+		}
+		bytesProcessed += Size;
+	} while (Size == ReqSize);
 	return bytesProcessed;
 }
 
+bool Stream::DirectCopyFrom(Stream *s, size_t MaxSize, size_t *OutSize)
+{
+	return false;
+}
+
+size_t Stream::AcquireReadSpan(const void **OutData)
+{
+	*OutData = NULL;
+	return 0;
+}
+
+void Stream::ReleaseRead(size_t Size)
+{
+	assert(Size == 0 && "Stream::ReleaseRead: Stream doesn't support AcquireReadSpan.");
+}
+
+size_t Stream::AcquireWriteSpan(void **OutData, size_t MinSize)
+{
+	*OutData = NULL;
+	return 0;
+}
+
+void Stream::CommitWrite(size_t Size)
+{
+	assert(Size == 0 && "Stream::CommitWrite: Stream doesn't support AcquireWriteSpan.");
+}
+
 
 //HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
 // Klasa SeekableStream
@@ -664,7 +858,22 @@ void WCharWriter::WriteString(const wchar_t *s, size_t NumChars)
 bool CharReader::EnsureNewChars()
 {
 	assert(m_BufBeg == m_BufEnd);
-	size_t ReadSize = m_Stream->Read(&m_Buf[0], BUFFER_SIZE);
+	ReleaseBorrowed();
+	// Jeśli strumień udostępnia swoją pamięć, czytaj wprost z niej
+	const void *Span;
+	size_t ReadSize = m_Stream->AcquireReadSpan(&Span);
+	if (ReadSize > 0)
+	{
+		m_Data = (const char*)Span;
+		m_Borrowed = ReadSize;
+	}
+	else
+	{
+		if (m_Buf.empty())
+			m_Buf.resize(BUFFER_SIZE);
+		ReadSize = m_Stream->Read(&m_Buf[0], BUFFER_SIZE);
+		m_Data = &m_Buf[0];
+	}
 	m_BufBeg = 0;
 	m_BufEnd = ReadSize;
 	return (ReadSize > 0);
@@ -689,7 +898,7 @@ size_t CharReader::ReadString(string *Out, size_t MaxLength)
 		Out->resize(Out_i + BlockSize);
 		for (i = 0; i < BlockSize; i++)
 		{
-			(*Out)[Out_i] = m_Buf[m_BufBeg];
+			(*Out)[Out_i] = m_Data[m_BufBeg];
 			Out_i++;
 			m_BufBeg++;
 		}
@@ -717,7 +926,7 @@ void CharReader::MustReadString(string *Out, size_t Length)
 		BlockSize = std::min(m_BufEnd - m_BufBeg, Length);
 		for (i = 0; i < BlockSize; i++)
 		{
-			(*Out)[Out_i] = m_Buf[m_BufBeg];
+			(*Out)[Out_i] = m_Data[m_BufBeg];
 			Out_i++;
 			m_BufBeg++;
 		}
@@ -727,7 +936,7 @@ void CharReader::MustReadString(string *Out, size_t Length)
 
 size_t CharReader::ReadString(char *Out, size_t MaxLength)
 {
-	size_t BlockSize, i, Sum = 0;
+	size_t BlockSize, Sum = 0;
 
 	// MaxLength będzie zmniejszane.
 	// Out będzie przesuwane.
@@ -740,12 +949,9 @@ size_t CharReader::ReadString(char *Out, size_t MaxLength)
 				return Sum;
 		}
 		BlockSize = std::min(m_BufEnd - m_BufBeg, MaxLength);
-		for (i = 0; i < BlockSize; i++)
-		{
-			*Out = m_Buf[m_BufBeg];
-			Out++;
-			m_BufBeg++;
-		}
+		memcpy(Out, &m_Data[m_BufBeg], BlockSize);
+		Out += BlockSize;
+		m_BufBeg += BlockSize;
 		MaxLength -= BlockSize;
 		Sum += BlockSize;
 	}
@@ -769,7 +975,7 @@ void CharReader::MustReadString(char *Out, size_t Length)
 		BlockSize = std::min(m_BufEnd - m_BufBeg, Length);
 		for (i = 0; i < BlockSize; i++)
 		{
-			*Out = m_Buf[m_BufBeg];
+			*Out = m_Data[m_BufBeg];
 			Out++;
 			m_BufBeg++;
 		}
@@ -793,7 +999,7 @@ size_t CharReader::ReadData(void *Out, size_t MaxLength)
 				return Sum;
 		}
 		BlockSize = std::min(m_BufEnd - m_BufBeg, MaxLength);
-		common_memcpy(OutChars, &m_Buf[m_BufBeg], BlockSize);
+		common_memcpy(OutChars, &m_Data[m_BufBeg], BlockSize);
 		OutChars += BlockSize;
 		m_BufBeg += BlockSize;
 		MaxLength -= BlockSize;
@@ -820,7 +1026,7 @@ void CharReader::MustReadData(void *Out, size_t Length)
 		BlockSize = std::min(m_BufEnd - m_BufBeg, Length);
 		for (i = 0; i < BlockSize; i++)
 		{
-			*OutChars = m_Buf[m_BufBeg];
+			*OutChars = m_Data[m_BufBeg];
 			OutChars++;
 			m_BufBeg++;
 		}
@@ -1179,6 +1385,38 @@ void MemoryStream::MustRead(void *Data, size_t Size)
 		throw Error(Format(_T("Cannot read (2) # bytes from memory stream - position out of range (pos: #, size: #)")) % Size % m_Pos % m_Size, __TFILE__, __LINE__);
 }
 
+size_t MemoryStream::AcquireReadSpan(const void **OutData)
+{
+	if (m_Pos < 0 || m_Pos > (ptrdiff_t)m_Size)
+		throw Error(Format(_T("Cannot acquire read span from memory stream - position out of range (pos: #, size: #)")) % m_Pos % m_Size, __TFILE__, __LINE__);
+	*OutData = &m_Data[m_Pos];
+	return m_Size - m_Pos;
+}
+
+void MemoryStream::ReleaseRead(size_t Size)
+{
+	assert(m_Pos + Size <= m_Size);
+	m_Pos += Size;
+}
+
+size_t MemoryStream::AcquireWriteSpan(void **OutData, size_t MinSize)
+{
+	// Strumień się nie rozszerza - jeśli brak miejsca, Write zgłosi błąd
+	if (m_Pos < 0 || m_Pos + MinSize > m_Size)
+	{
+		*OutData = NULL;
+		return 0;
+	}
+	*OutData = &m_Data[m_Pos];
+	return m_Size - m_Pos;
+}
+
+void MemoryStream::CommitWrite(size_t Size)
+{
+	assert(m_Pos + Size <= m_Size);
+	m_Pos += Size;
+}
+
 uint64 MemoryStream::GetSize()
 {
 	return m_Size;
@@ -1260,6 +1498,36 @@ void VectorStream::MustRead(void *Data, size_t Size)
 		throw Error(Format(_T("Cannot read (2) # bytes from VectorStream stream - position out of range (pos: #, size: #)")) % Size % m_Pos % m_Size, __TFILE__, __LINE__);
 }
 
+size_t VectorStream::AcquireReadSpan(const void **OutData)
+{
+	if (m_Pos < 0 || m_Pos > (ptrdiff_t)m_Size)
+		throw Error(Format(_T("Cannot acquire read span from VectorStream stream - position out of range (pos: #, size: #)")) % m_Pos % m_Size, __TFILE__, __LINE__);
+	*OutData = &m_Data[m_Pos];
+	return m_Size - m_Pos;
+}
+
+void VectorStream::ReleaseRead(size_t Size)
+{
+	assert(m_Pos + Size <= m_Size);
+	m_Pos += Size;
+}
+
+size_t VectorStream::AcquireWriteSpan(void **OutData, size_t MinSize)
+{
+	if (m_Capacity < m_Pos + MinSize)
+		Reserve(std::max(m_Pos + MinSize, m_Capacity + m_Capacity / 4));
+	*OutData = &m_Data[m_Pos];
+	return m_Capacity - m_Pos;
+}
+
+void VectorStream::CommitWrite(size_t Size)
+{
+	assert(m_Pos + Size <= m_Capacity);
+	m_Pos += Size;
+	if (m_Size < (size_t)m_Pos)
+		m_Size = m_Pos;
+}
+
 void VectorStream::SetSize(uint64 Size)
 {
     assert(Size <= SIZE_MAX);
@@ -1588,6 +1856,45 @@ size_t BufferingStream::Skip(size_t MaxLength)
 	return Sum;
 }
 
+size_t BufferingStream::AcquireReadSpan(const void **OutData)
+{
+	*OutData = NULL;
+	if (m_ReadBufSize == 0)
+		return 0;
+	if (m_ReadBufBeg == m_ReadBufEnd)
+	{
+		if (!EnsureNewChars())
+			return 0;
+	}
+	*OutData = &m_ReadBuf[m_ReadBufBeg];
+	return m_ReadBufEnd - m_ReadBufBeg;
+}
+
+void BufferingStream::ReleaseRead(size_t Size)
+{
+	assert(m_ReadBufBeg + Size <= m_ReadBufEnd);
+	m_ReadBufBeg += Size;
+}
+
+size_t BufferingStream::AcquireWriteSpan(void **OutData, size_t MinSize)
+{
+	if (MinSize == 0 || MinSize > m_WriteBufSize)
+	{
+		*OutData = NULL;
+		return 0;
+	}
+	if (m_WriteBufSize - m_WriteBufIndex < MinSize)
+		DoFlush();
+	*OutData = &m_WriteBuf[m_WriteBufIndex];
+	return m_WriteBufSize - m_WriteBufIndex;
+}
+
+void BufferingStream::CommitWrite(size_t Size)
+{
+	assert(m_WriteBufIndex + Size <= m_WriteBufSize);
+	m_WriteBufIndex += Size;
+}
+
 
 //HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
 // Klasa MultiWriterStream
@@ -1730,83 +2037,776 @@ Sprawdzona, działa dobrze, zgodnie ze standardem.
 Na podstawie:
   "eXtensible Data Stream 3.0", Mark T. Price
   Appendix B. Reference CRC-32 Implementation
+Przyspieszenie:
+- Programowo: slice-by-16 - 16 bajtów na iterację z 16 tablic, wyliczanych przy starcie.
+- CRC32_STANDARD: instrukcja PCLMULQDQ - zwijanie bloków po 64 bajty, na podstawie:
+  "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction", Intel, 2009
+- CRC32_CASTAGNOLI: instrukcja crc32 z SSE4.2.
+Stan (m_CRC) jest ten sam dla wszystkich wersji, więc można je dowolnie mieszać.
 */
 
-const uint32 CRC32_TABLE[256] = {
-	0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F,
-	0xE963A535, 0x9E6495A3, 0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988,
-	0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91, 0x1DB71064, 0x6AB020F2,
-	0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
-	0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9,
-	0xFA0F3D63, 0x8D080DF5, 0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172,
-	0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B, 0x35B5A8FA, 0x42B2986C,
-	0xDBBBC9D6, 0xACBCF940, 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
-	0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423,
-	0xCFBA9599, 0xB8BDA50F, 0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924,
-	0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D, 0x76DC4190, 0x01DB7106,
-	0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
-	0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D,
-	0x91646C97, 0xE6635C01, 0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E,
-	0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457, 0x65B0D9C6, 0x12B7E950,
-	0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
-	0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2, 0x4ADFA541, 0x3DD895D7,
-	0xA4D1C46D, 0xD3D6F4FB, 0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0,
-	0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9, 0x5005713C, 0x270241AA,
-	0xBE0B1010, 0xC90C2086, 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
-	0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81,
-	0xB7BD5C3B, 0xC0BA6CAD, 0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A,
-	0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683, 0xE3630B12, 0x94643B84,
-	0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
-	0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB,
-	0x196C3671, 0x6E6B06E7, 0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC,
-	0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5, 0xD6D6A3E8, 0xA1D1937E,
-	0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
-	0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60, 0xDF60EFC3, 0xA867DF55,
-	0x316E8EEF, 0x4669BE79, 0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236,
-	0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F, 0xC5BA3BBE, 0xB2BD0B28,
-	0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
-	0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F,
-	0x72076785, 0x05005713, 0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38,
-	0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21, 0x86D3D2D4, 0xF1D4E242,
-	0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
-	0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69,
-	0x616BFFD3, 0x166CCF45, 0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2,
-	0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB, 0xAED16A4A, 0xD9D65ADC,
-	0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
-	0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693,
-	0x54DE5729, 0x23D967BF, 0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94,
-	0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
+// Wielomiany w postaci odwróconej
+const uint32 CRC32_POLYNOMIALS[2] = { 0xEDB88320u, 0x82F63B78u };
+
+class Crc32Impl
+{
+public:
+	// [Typ][Przesunięcie w bajtach][Bajt]
+	uint32 Tables[2][16][256];
+
+	Crc32Impl();
 };
 
-void CRC32_Calc::Write(const void *Data, size_t Size)
+Crc32Impl::Crc32Impl()
+{
+	for (uint Type = 0; Type < 2; Type++)
+	{
+		for (uint i = 0; i < 256; i++)
+		{
+			uint32 Crc = i;
+			for (uint Bit = 0; Bit < 8; Bit++)
+				Crc = (Crc & 1) ? (Crc >> 1) ^ CRC32_POLYNOMIALS[Type] : (Crc >> 1);
+			Tables[Type][0][i] = Crc;
+		}
+		for (uint Slice = 1; Slice < 16; Slice++)
+			for (uint i = 0; i < 256; i++)
+				Tables[Type][Slice][i] = (Tables[Type][Slice-1][i] >> 8) ^ Tables[Type][0][Tables[Type][Slice-1][i] & 0xFF];
+	}
+}
+
+static const Crc32Impl & GetCrc32Impl()
+{
+	static const Crc32Impl Impl;
+	return Impl;
+}
+
+static inline uint32 LoadUint32LE(const uint8 *p)
 {
-	uint32 k;
-	uint8 *DataBytes = (uint8*)Data;
+	return (uint32)p[0] | ((uint32)p[1] << 8) | ((uint32)p[2] << 16) | ((uint32)p[3] << 24);
+}
+
+static uint32 Crc32Software(CRC32_TYPE Type, uint32 Crc, const uint8 *Data, size_t Size)
+{
+	const uint32 (*T)[256] = GetCrc32Impl().Tables[Type];
+	uint32 a, b, c, d;
+	while (Size >= 16)
+	{
+		a = LoadUint32LE(Data) ^ Crc;
+		b = LoadUint32LE(Data + 4);
+		c = LoadUint32LE(Data + 8);
+		d = LoadUint32LE(Data + 12);
+		Crc =
+			T[15][a & 0xFF] ^ T[14][(a >> 8) & 0xFF] ^ T[13][(a >> 16) & 0xFF] ^ T[12][a >> 24] ^
+			T[11][b & 0xFF] ^ T[10][(b >> 8) & 0xFF] ^ T[ 9][(b >> 16) & 0xFF] ^ T[ 8][b >> 24] ^
+			T[ 7][c & 0xFF] ^ T[ 6][(c >> 8) & 0xFF] ^ T[ 5][(c >> 16) & 0xFF] ^ T[ 4][c >> 24] ^
+			T[ 3][d & 0xFF] ^ T[ 2][(d >> 8) & 0xFF] ^ T[ 1][(d >> 16) & 0xFF] ^ T[ 0][d >> 24];
+		Data += 16;
+		Size -= 16;
+	}
 	while (Size > 0)
 	{
-		k = (m_CRC ^ (*DataBytes)) & 0x000000FF;
-		m_CRC = ((m_CRC >> 8) & 0x00FFFFFF) ^ CRC32_TABLE[k];
+		Crc = (Crc >> 8) ^ T[0][(Crc ^ *Data) & 0xFF];
+		Data++;
+		Size--;
+	}
+	return Crc;
+}
 
-		DataBytes++;
+#ifdef COMMON_STREAM_X86
+
+COMMON_TARGET("sse4.2")
+static uint32 Crc32cSse42(uint32 Crc, const uint8 *Data, size_t Size)
+{
+	// Do wyrównania
+	while (Size > 0 && ((size_t)Data & 7) != 0)
+	{
+		Crc = _mm_crc32_u8(Crc, *Data);
+		Data++;
 		Size--;
 	}
+#if defined(_M_X64) || defined(__x86_64__)
+	uint64 Crc64 = Crc;
+	while (Size >= 8)
+	{
+		Crc64 = _mm_crc32_u64(Crc64, *(const uint64*)Data);
+		Data += 8;
+		Size -= 8;
+	}
+	Crc = (uint32)Crc64;
+#endif
+	while (Size >= 4)
+	{
+		Crc = _mm_crc32_u32(Crc, *(const uint32*)Data);
+		Data += 4;
+		Size -= 4;
+	}
+	while (Size > 0)
+	{
+		Crc = _mm_crc32_u8(Crc, *Data);
+		Data++;
+		Size--;
+	}
+	return Crc;
+}
+
+// Size musi być co najmniej 64 i podzielny przez 16
+COMMON_TARGET("pclmul,sse4.1")
+static uint32 Crc32Pclmul(uint32 Crc, const uint8 *Data, size_t Size)
+{
+	// Stałe zwijania i redukcji Barretta dla odwróconego wielomianu 0xEDB88320
+	const __m128i K1K2 = _mm_set_epi64x(0x01C6E41596ll, 0x0154442BD4ll);
+	const __m128i K3K4 = _mm_set_epi64x(0x00CCAA009Ell, 0x01751997D0ll);
+	const __m128i K5K0 = _mm_set_epi64x(0, 0x0163CD6124ll);
+	const __m128i Poly = _mm_set_epi64x(0x01F7011641ll, 0x01DB710641ll);
+	const __m128i Mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+	x1 = _mm_loadu_si128((const __m128i*)(Data + 0x00));
+	x2 = _mm_loadu_si128((const __m128i*)(Data + 0x10));
+	x3 = _mm_loadu_si128((const __m128i*)(Data + 0x20));
+	x4 = _mm_loadu_si128((const __m128i*)(Data + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)Crc));
+	Data += 64;
+	Size -= 64;
+
+	// Równoległe zwijanie czterech bloków po 16 bajtów
+	x0 = K1K2;
+	while (Size >= 64)
+	{
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*)(Data + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i*)(Data + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i*)(Data + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i*)(Data + 0x30)));
+		Data += 64;
+		Size -= 64;
+	}
+
+	// Zwinięcie do 128 bitów
+	x0 = K3K4;
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	// Pozostałe bloki po 16 bajtów
+	while (Size >= 16)
+	{
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i*)Data)), x5);
+		Data += 16;
+		Size -= 16;
+	}
+
+	// Zwinięcie do 64 bitów
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x0 = K5K0;
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, Mask32);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// Redukcja Barretta do 32 bitów
+	x0 = Poly;
+	x2 = _mm_and_si128(x1, Mask32);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, Mask32);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	return (uint32)_mm_extract_epi32(x1, 1);
 }
 
-uint CRC32_Calc::Calc(const void *Data, size_t DataLength)
+#endif
+
+// Dopisuje dane do stanu sumy - wybiera najszybszą wersję dostępną na tym procesorze
+static uint32 Crc32Update(CRC32_TYPE Type, uint32 Crc, const void *Data, size_t Size)
 {
-	uint32 crc = 0xFFFFFFFF; // preconditioning sets non zero value
-	
-	// loop through the buffer and calculate CRC
-	for(size_t i = 0; i < DataLength; ++i)
+	const uint8 *DataBytes = (const uint8*)Data;
+#ifdef COMMON_STREAM_X86
+	const CpuFeatures &Cpu = GetCpu();
+	if (Type == CRC32_CASTAGNOLI)
+	{
+		if (Cpu.Sse42 && !g_ForceScalarHashes)
+			return Crc32cSse42(Crc, DataBytes, Size);
+	}
+	// _mm_extract_epi32 potrzebuje też SSE4.1
+	else if (Cpu.Pclmul && Cpu.Sse41 && Size >= 64 && !g_ForceScalarHashes)
+	{
+		size_t BlockSize = Size & ~(size_t)15;
+		Crc = Crc32Pclmul(Crc, DataBytes, BlockSize);
+		DataBytes += BlockSize;
+		Size -= BlockSize;
+	}
+#endif
+	return Crc32Software(Type, Crc, DataBytes, Size);
+}
+
+void CRC32_Calc::Write(const void *Data, size_t Size)
+{
+	m_CRC = Crc32Update(m_Type, m_CRC, Data, Size);
+}
+
+uint CRC32_Calc::Calc(const void *Data, size_t DataLength, CRC32_TYPE Type)
+{
+	// preconditioning sets non zero value, postconditioning
+	return ~Crc32Update(Type, 0xFFFFFFFFu, Data, DataLength);
+}
+
+
+//HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
+// Klasa XXH3_Calc
+
+/*
+XXH3 - na podstawie xxHash 0.8, Yann Collet, licencja BSD 2-Clause.
+Sprawdzona na zgodność wyników z oryginalną biblioteką.
+Wersja strumieniowa zachowuje ostatnie 64 bajty przetworzonych danych na końcu m_Buffer,
+bo ostatni pas (stripe) jest zawsze liczony z ostatnich 64 bajtów całych danych.
+*/
+
+const size_t XXH_STRIPE_LEN = 64;
+const size_t XXH_SECRET_CONSUME_RATE = 8;
+const size_t XXH_STRIPES_PER_BLOCK = (XXH3_Calc::SECRET_SIZE - XXH_STRIPE_LEN) / XXH_SECRET_CONSUME_RATE;
+const size_t XXH_BLOCK_LEN = XXH_STRIPE_LEN * XXH_STRIPES_PER_BLOCK;
+const size_t XXH_SECRET_LASTACC_START = 7;
+const size_t XXH_SECRET_MERGEACCS_START = 11;
+const size_t XXH_MIDSIZE_MAX = 240;
+const size_t XXH_MIDSIZE_STARTOFFSET = 3;
+const size_t XXH_MIDSIZE_LASTOFFSET = 17;
+const size_t XXH_SECRET_SIZE_MIN = 136;
+
+const uint32 XXH_PRIME32_1 = 0x9E3779B1u;
+const uint32 XXH_PRIME32_2 = 0x85EBCA77u;
+const uint32 XXH_PRIME32_3 = 0xC2B2AE3Du;
+const uint64 XXH_PRIME64_1 = 0x9E3779B185EBCA87ull;
+const uint64 XXH_PRIME64_2 = 0xC2B2AE3D27D4EB4Full;
+const uint64 XXH_PRIME64_3 = 0x165667B19E3779F9ull;
+const uint64 XXH_PRIME64_4 = 0x85EBCA77C2B2AE63ull;
+const uint64 XXH_PRIME64_5 = 0x27D4EB2F165667C5ull;
+const uint64 XXH_PRIME_MX1 = 0x165667919E3779F9ull;
+const uint64 XXH_PRIME_MX2 = 0x9FB21C651E98DF25ull;
+
+const uint8 XXH_SECRET[XXH3_Calc::SECRET_SIZE] = {
+	0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+	0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+	0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+	0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+	0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+	0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+	0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+	0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+	0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+	0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+	0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+	0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+static inline uint64 XxhRead64(const uint8 *p)
+{
+	return (uint64)LoadUint32LE(p) | ((uint64)LoadUint32LE(p + 4) << 32);
+}
+
+static inline void XxhWrite64(uint8 *p, uint64 v)
+{
+	for (uint i = 0; i < 8; i++, v >>= 8)
+		p[i] = (uint8)v;
+}
+
+static inline uint32 XxhSwap32(uint32 x)
+{
+	return (x << 24) | ((x << 8) & 0x00FF0000u) | ((x >> 8) & 0x0000FF00u) | (x >> 24);
+}
+
+static inline uint64 XxhSwap64(uint64 x)
+{
+	return ((uint64)XxhSwap32((uint32)x) << 32) | XxhSwap32((uint32)(x >> 32));
+}
+
+static inline uint32 XxhRotl32(uint32 x, int r) { return (x << r) | (x >> (32 - r)); }
+static inline uint64 XxhRotl64(uint64 x, int r) { return (x << r) | (x >> (64 - r)); }
+
+static inline HASH128 XxhMul128(uint64 a, uint64 b)
+{
+	HASH128 r;
+#if defined(__SIZEOF_INT128__)
+	unsigned __int128 p = (unsigned __int128)a * b;
+	r.Low = (uint64)p;
+	r.High = (uint64)(p >> 64);
+#elif defined(_M_X64)
+	r.Low = _umul128(a, b, &r.High);
+#else
+	uint64 LoLo = (a & 0xFFFFFFFF) * (b & 0xFFFFFFFF);
+	uint64 HiLo = (a >> 32) * (b & 0xFFFFFFFF);
+	uint64 LoHi = (a & 0xFFFFFFFF) * (b >> 32);
+	uint64 HiHi = (a >> 32) * (b >> 32);
+	uint64 Cross = (LoLo >> 32) + (HiLo & 0xFFFFFFFF) + LoHi;
+	r.High = (HiLo >> 32) + (Cross >> 32) + HiHi;
+	r.Low = (Cross << 32) | (LoLo & 0xFFFFFFFF);
+#endif
+	return r;
+}
+
+static inline uint64 XxhMulFold64(uint64 a, uint64 b)
+{
+	HASH128 r = XxhMul128(a, b);
+	return r.Low ^ r.High;
+}
+
+static inline uint64 Xxh64Avalanche(uint64 h)
+{
+	h ^= h >> 33;
+	h *= XXH_PRIME64_2;
+	h ^= h >> 29;
+	h *= XXH_PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+static inline uint64 Xxh3Avalanche(uint64 h)
+{
+	h ^= h >> 37;
+	h *= XXH_PRIME_MX1;
+	h ^= h >> 32;
+	return h;
+}
+
+static inline uint64 XxhRrmxmx(uint64 h, uint64 Len)
+{
+	h ^= XxhRotl64(h, 49) ^ XxhRotl64(h, 24);
+	h *= XXH_PRIME_MX2;
+	h ^= (h >> 35) + Len;
+	h *= XXH_PRIME_MX2;
+	return h ^ (h >> 28);
+}
+
+static inline uint64 XxhMix16B(const uint8 *Input, const uint8 *Secret, uint64 Seed)
+{
+	return XxhMulFold64(
+		XxhRead64(Input) ^ (XxhRead64(Secret) + Seed),
+		XxhRead64(Input + 8) ^ (XxhRead64(Secret + 8) - Seed));
+}
+
+static inline void XxhMix32B(HASH128 *Acc, const uint8 *Input1, const uint8 *Input2, const uint8 *Secret, uint64 Seed)
+{
+	Acc->Low += XxhMix16B(Input1, Secret, Seed);
+	Acc->Low ^= XxhRead64(Input2) + XxhRead64(Input2 + 8);
+	Acc->High += XxhMix16B(Input2, Secret + 16, Seed);
+	Acc->High ^= XxhRead64(Input1) + XxhRead64(Input1 + 8);
+}
+
+// Dane do 240 bajtów - wersja 64-bitowa
+static uint64 Xxh3Short64(const uint8 *Input, size_t Len, const uint8 *Secret, uint64 Seed)
+{
+	if (Len <= 16)
+	{
+		if (Len > 8)
+		{
+			uint64 BitflipL = (XxhRead64(Secret + 24) ^ XxhRead64(Secret + 32)) + Seed;
+			uint64 BitflipH = (XxhRead64(Secret + 40) ^ XxhRead64(Secret + 48)) - Seed;
+			uint64 InputL = XxhRead64(Input) ^ BitflipL;
+			uint64 InputH = XxhRead64(Input + Len - 8) ^ BitflipH;
+			return Xxh3Avalanche(Len + XxhSwap64(InputL) + InputH + XxhMulFold64(InputL, InputH));
+		}
+		if (Len >= 4)
+		{
+			Seed ^= (uint64)XxhSwap32((uint32)Seed) << 32;
+			uint64 Bitflip = (XxhRead64(Secret + 8) ^ XxhRead64(Secret + 16)) - Seed;
+			uint64 Input64 = LoadUint32LE(Input + Len - 4) + ((uint64)LoadUint32LE(Input) << 32);
+			return XxhRrmxmx(Input64 ^ Bitflip, Len);
+		}
+		if (Len > 0)
+		{
+			uint32 Combined = ((uint32)Input[0] << 16) | ((uint32)Input[Len >> 1] << 24) | (uint32)Input[Len - 1] | ((uint32)Len << 8);
+			uint64 Bitflip = (LoadUint32LE(Secret) ^ LoadUint32LE(Secret + 4)) + Seed;
+			return Xxh64Avalanche((uint64)Combined ^ Bitflip);
+		}
+		return Xxh64Avalanche(Seed ^ (XxhRead64(Secret + 56) ^ XxhRead64(Secret + 64)));
+	}
+
+	uint64 Acc = Len * XXH_PRIME64_1;
+	if (Len <= 128)
+	{
+		if (Len > 32)
+		{
+			if (Len > 64)
+			{
+				if (Len > 96)
+				{
+					Acc += XxhMix16B(Input + 48, Secret + 96, Seed);
+					Acc += XxhMix16B(Input + Len - 64, Secret + 112, Seed);
+				}
+				Acc += XxhMix16B(Input + 32, Secret + 64, Seed);
+				Acc += XxhMix16B(Input + Len - 48, Secret + 80, Seed);
+			}
+			Acc += XxhMix16B(Input + 16, Secret + 32, Seed);
+			Acc += XxhMix16B(Input + Len - 32, Secret + 48, Seed);
+		}
+		Acc += XxhMix16B(Input, Secret, Seed);
+		Acc += XxhMix16B(Input + Len - 16, Secret + 16, Seed);
+		return Xxh3Avalanche(Acc);
+	}
+
+	size_t RoundCount = Len / 16;
+	for (size_t i = 0; i < 8; i++)
+		Acc += XxhMix16B(Input + 16 * i, Secret + 16 * i, Seed);
+	Acc = Xxh3Avalanche(Acc);
+	for (size_t i = 8; i < RoundCount; i++)
+		Acc += XxhMix16B(Input + 16 * i, Secret + 16 * (i - 8) + XXH_MIDSIZE_STARTOFFSET, Seed);
+	Acc += XxhMix16B(Input + Len - 16, Secret + XXH_SECRET_SIZE_MIN - XXH_MIDSIZE_LASTOFFSET, Seed);
+	return Xxh3Avalanche(Acc);
+}
+
+// Dane do 240 bajtów - wersja 128-bitowa
+static HASH128 Xxh3Short128(const uint8 *Input, size_t Len, const uint8 *Secret, uint64 Seed)
+{
+	HASH128 R;
+	if (Len <= 16)
+	{
+		if (Len > 8)
+		{
+			uint64 BitflipL = (XxhRead64(Secret + 32) ^ XxhRead64(Secret + 40)) - Seed;
+			uint64 BitflipH = (XxhRead64(Secret + 48) ^ XxhRead64(Secret + 56)) + Seed;
+			uint64 InputL = XxhRead64(Input);
+			uint64 InputH = XxhRead64(Input + Len - 8);
+			HASH128 M = XxhMul128(InputL ^ InputH ^ BitflipL, XXH_PRIME64_1);
+			M.Low += (uint64)(Len - 1) << 54;
+			InputH ^= BitflipH;
+			M.High += InputH + (uint64)(uint32)InputH * (XXH_PRIME32_2 - 1);
+			M.Low ^= XxhSwap64(M.High);
+			R = XxhMul128(M.Low, XXH_PRIME64_2);
+			R.High += M.High * XXH_PRIME64_2;
+			R.Low = Xxh3Avalanche(R.Low);
+			R.High = Xxh3Avalanche(R.High);
+			return R;
+		}
+		if (Len >= 4)
+		{
+			Seed ^= (uint64)XxhSwap32((uint32)Seed) << 32;
+			uint64 Input64 = LoadUint32LE(Input) + ((uint64)LoadUint32LE(Input + Len - 4) << 32);
+			uint64 Bitflip = (XxhRead64(Secret + 16) ^ XxhRead64(Secret + 24)) + Seed;
+			R = XxhMul128(Input64 ^ Bitflip, XXH_PRIME64_1 + ((uint64)Len << 2));
+			R.High += R.Low << 1;
+			R.Low ^= R.High >> 3;
+			R.Low ^= R.Low >> 35;
+			R.Low *= XXH_PRIME_MX2;
+			R.Low ^= R.Low >> 28;
+			R.High = Xxh3Avalanche(R.High);
+			return R;
+		}
+		if (Len > 0)
+		{
+			uint32 CombinedL = ((uint32)Input[0] << 16) | ((uint32)Input[Len >> 1] << 24) | (uint32)Input[Len - 1] | ((uint32)Len << 8);
+			uint32 CombinedH = XxhRotl32(XxhSwap32(CombinedL), 13);
+			uint64 BitflipL = (LoadUint32LE(Secret) ^ LoadUint32LE(Secret + 4)) + Seed;
+			uint64 BitflipH = (LoadUint32LE(Secret + 8) ^ LoadUint32LE(Secret + 12)) - Seed;
+			R.Low = Xxh64Avalanche((uint64)CombinedL ^ BitflipL);
+			R.High = Xxh64Avalanche((uint64)CombinedH ^ BitflipH);
+			return R;
+		}
+		R.Low = Xxh64Avalanche(Seed ^ XxhRead64(Secret + 64) ^ XxhRead64(Secret + 72));
+		R.High = Xxh64Avalanche(Seed ^ XxhRead64(Secret + 80) ^ XxhRead64(Secret + 88));
+		return R;
+	}
+
+	HASH128 Acc;
+	Acc.Low = Len * XXH_PRIME64_1;
+	Acc.High = 0;
+	if (Len <= 128)
+	{
+		if (Len > 32)
+		{
+			if (Len > 64)
+			{
+				if (Len > 96)
+					XxhMix32B(&Acc, Input + 48, Input + Len - 64, Secret + 96, Seed);
+				XxhMix32B(&Acc, Input + 32, Input + Len - 48, Secret + 64, Seed);
+			}
+			XxhMix32B(&Acc, Input + 16, Input + Len - 32, Secret + 32, Seed);
+		}
+		XxhMix32B(&Acc, Input, Input + Len - 16, Secret, Seed);
+	}
+	else
+	{
+		size_t RoundCount = Len / 32;
+		for (size_t i = 0; i < 4; i++)
+			XxhMix32B(&Acc, Input + 32 * i, Input + 32 * i + 16, Secret + 32 * i, Seed);
+		Acc.Low = Xxh3Avalanche(Acc.Low);
+		Acc.High = Xxh3Avalanche(Acc.High);
+		for (size_t i = 4; i < RoundCount; i++)
+			XxhMix32B(&Acc, Input + 32 * i, Input + 32 * i + 16, Secret + XXH_MIDSIZE_STARTOFFSET + 32 * (i - 4), Seed);
+		XxhMix32B(&Acc, Input + Len - 16, Input + Len - 32, Secret + XXH_SECRET_SIZE_MIN - XXH_MIDSIZE_LASTOFFSET - 16, 0 - Seed);
+	}
+	R.Low = Xxh3Avalanche(Acc.Low + Acc.High);
+	R.High = 0 - Xxh3Avalanche(Acc.Low * XXH_PRIME64_1 + Acc.High * XXH_PRIME64_4 + (Len - Seed) * XXH_PRIME64_2);
+	return R;
+}
+
+#ifdef COMMON_STREAM_SSE2
+
+// Akumulatory trzymane w rejestrach przez cały ciąg pasów
+static inline void Xxh3Accumulate512Sse2(__m128i *Acc, const uint8 *Input, const uint8 *Secret)
+{
+	for (uint i = 0; i < 4; i++)
+	{
+		__m128i DataVec = _mm_loadu_si128((const __m128i*)Input + i);
+		__m128i DataKey = _mm_xor_si128(DataVec, _mm_loadu_si128((const __m128i*)Secret + i));
+		__m128i Product = _mm_mul_epu32(DataKey, _mm_shuffle_epi32(DataKey, _MM_SHUFFLE(0, 3, 0, 1)));
+		__m128i Sum = _mm_add_epi64(Acc[i], _mm_shuffle_epi32(DataVec, _MM_SHUFFLE(1, 0, 3, 2)));
+		Acc[i] = _mm_add_epi64(Product, Sum);
+	}
+}
+
+static inline void Xxh3ScrambleAccSse2(__m128i *Acc, const uint8 *Secret)
+{
+	const __m128i Prime32 = _mm_set1_epi32((int)XXH_PRIME32_1);
+	for (uint i = 0; i < 4; i++)
+	{
+		__m128i A = _mm_xor_si128(Acc[i], _mm_srli_epi64(Acc[i], 47));
+		__m128i DataKey = _mm_xor_si128(A, _mm_loadu_si128((const __m128i*)Secret + i));
+		__m128i ProdL = _mm_mul_epu32(DataKey, Prime32);
+		__m128i ProdH = _mm_mul_epu32(_mm_shuffle_epi32(DataKey, _MM_SHUFFLE(0, 3, 0, 1)), Prime32);
+		Acc[i] = _mm_add_epi64(ProdL, _mm_slli_epi64(ProdH, 32));
+	}
+}
+
+#else
+
+static inline void Xxh3Accumulate512(uint64 *Acc, const uint8 *Input, const uint8 *Secret)
+{
+	for (uint i = 0; i < 8; i++)
+	{
+		uint64 DataVal = XxhRead64(Input + 8 * i);
+		uint64 DataKey = DataVal ^ XxhRead64(Secret + 8 * i);
+		Acc[i ^ 1] += DataVal;
+		Acc[i] += (DataKey & 0xFFFFFFFF) * (DataKey >> 32);
+	}
+}
+
+static inline void Xxh3ScrambleAcc(uint64 *Acc, const uint8 *Secret)
+{
+	for (uint i = 0; i < 8; i++)
+	{
+		uint64 A = Acc[i];
+		A ^= A >> 47;
+		A ^= XxhRead64(Secret + 8 * i);
+		Acc[i] = A * XXH_PRIME32_1;
+	}
+}
+
+#endif
+
+// Przetwarza kolejne pasy po 64 bajty, mieszając akumulatory po każdym pełnym bloku.
+// Jeśli LastStripe != NULL, na końcu przetwarza jeszcze ten ostatni pas danych.
+static void Xxh3ConsumeStripes(uint64 *Acc, size_t *StripesSoFar, const uint8 *Input, size_t StripeCount, const uint8 *Secret, const uint8 *LastStripe = NULL)
+{
+	const uint8 *ScrambleSecret = Secret + XXH3_Calc::SECRET_SIZE - XXH_STRIPE_LEN;
+	const uint8 *LastSecret = ScrambleSecret - XXH_SECRET_LASTACC_START;
+#ifdef COMMON_STREAM_SSE2
+	__m128i AccVec[4];
+	for (uint i = 0; i < 4; i++)
+		AccVec[i] = _mm_loadu_si128((const __m128i*)Acc + i);
+	for (size_t i = 0; i < StripeCount; i++)
+	{
+		Xxh3Accumulate512Sse2(AccVec, Input + i * XXH_STRIPE_LEN, Secret + *StripesSoFar * XXH_SECRET_CONSUME_RATE);
+		if (++*StripesSoFar == XXH_STRIPES_PER_BLOCK)
+		{
+			Xxh3ScrambleAccSse2(AccVec, ScrambleSecret);
+			*StripesSoFar = 0;
+		}
+	}
+	if (LastStripe != NULL)
+		Xxh3Accumulate512Sse2(AccVec, LastStripe, LastSecret);
+	for (uint i = 0; i < 4; i++)
+		_mm_storeu_si128((__m128i*)Acc + i, AccVec[i]);
+#else
+	for (size_t i = 0; i < StripeCount; i++)
+	{
+		Xxh3Accumulate512(Acc, Input + i * XXH_STRIPE_LEN, Secret + *StripesSoFar * XXH_SECRET_CONSUME_RATE);
+		if (++*StripesSoFar == XXH_STRIPES_PER_BLOCK)
+		{
+			Xxh3ScrambleAcc(Acc, ScrambleSecret);
+			*StripesSoFar = 0;
+		}
+	}
+	if (LastStripe != NULL)
+		Xxh3Accumulate512(Acc, LastStripe, LastSecret);
+#endif
+}
+
+static void Xxh3InitAcc(uint64 *Acc)
+{
+	Acc[0] = XXH_PRIME32_3; Acc[1] = XXH_PRIME64_1; Acc[2] = XXH_PRIME64_2; Acc[3] = XXH_PRIME64_3;
+	Acc[4] = XXH_PRIME64_4; Acc[5] = XXH_PRIME32_2; Acc[6] = XXH_PRIME64_5; Acc[7] = XXH_PRIME32_1;
+}
+
+static void Xxh3InitSecret(uint8 *Secret, uint64 Seed)
+{
+	for (size_t i = 0; i < XXH3_Calc::SECRET_SIZE; i += 16)
 	{
-		int k = (crc ^ ((uint8*)(Data))[i]) & 0x000000FF;
-		crc = ((crc >> 8) & 0x00FFFFFF) ^ CRC32_TABLE[k];
+		XxhWrite64(Secret + i, XxhRead64(XXH_SECRET + i) + Seed);
+		XxhWrite64(Secret + i + 8, XxhRead64(XXH_SECRET + i + 8) - Seed);
 	}
+}
+
+// Dane powyżej 240 bajtów - zwraca akumulatory po przetworzeniu wszystkich pasów
+static void Xxh3Long(uint64 *Acc, const uint8 *Input, size_t Len, const uint8 *Secret)
+{
+	size_t StripesSoFar = 0;
+	Xxh3InitAcc(Acc);
+	// Wszystkie pełne pasy poza tym, w którym jest ostatni bajt
+	Xxh3ConsumeStripes(Acc, &StripesSoFar, Input, (Len - 1) / XXH_STRIPE_LEN, Secret, Input + Len - XXH_STRIPE_LEN);
+}
+
+static uint64 Xxh3MergeAccs(const uint64 *Acc, const uint8 *Secret, uint64 Start)
+{
+	uint64 Result = Start;
+	for (uint i = 0; i < 4; i++)
+		Result += XxhMulFold64(Acc[2 * i] ^ XxhRead64(Secret + 16 * i), Acc[2 * i + 1] ^ XxhRead64(Secret + 16 * i + 8));
+	return Xxh3Avalanche(Result);
+}
+
+static uint64 Xxh3Finish64(const uint64 *Acc, const uint8 *Secret, uint64 Len)
+{
+	return Xxh3MergeAccs(Acc, Secret + XXH_SECRET_MERGEACCS_START, Len * XXH_PRIME64_1);
+}
 
-	crc = ~crc; // postconditioning
+static HASH128 Xxh3Finish128(const uint64 *Acc, const uint8 *Secret, uint64 Len)
+{
+	HASH128 R;
+	R.Low = Xxh3MergeAccs(Acc, Secret + XXH_SECRET_MERGEACCS_START, Len * XXH_PRIME64_1);
+	R.High = Xxh3MergeAccs(Acc, Secret + XXH3_Calc::SECRET_SIZE - XXH_STRIPE_LEN - XXH_SECRET_MERGEACCS_START, ~(Len * XXH_PRIME64_2));
+	return R;
+}
 
-	// report results
-	return crc;
+void XXH3_Calc::Reset(uint64 Seed)
+{
+	Xxh3InitAcc(m_Acc);
+	m_TotalLen = 0;
+	m_Seed = Seed;
+	m_StripesSoFar = 0;
+	m_BufferedSize = 0;
+	Xxh3InitSecret(m_Secret, Seed);
+}
+
+void XXH3_Calc::Write(const void *Data, size_t Size)
+{
+	const uint8 *Input = (const uint8*)Data;
+	m_TotalLen += Size;
+	// W buforze zostaje zawsze co najmniej jeden bajt - ostatni pas liczy się dopiero na końcu
+	if (m_BufferedSize + Size <= INTERNAL_BUFFER_SIZE)
+	{
+		memcpy(m_Buffer + m_BufferedSize, Input, Size);
+		m_BufferedSize += Size;
+		return;
+	}
+
+	const size_t BufferStripes = INTERNAL_BUFFER_SIZE / XXH_STRIPE_LEN;
+	if (m_BufferedSize > 0)
+	{
+		size_t LoadSize = INTERNAL_BUFFER_SIZE - m_BufferedSize;
+		memcpy(m_Buffer + m_BufferedSize, Input, LoadSize);
+		Input += LoadSize;
+		Size -= LoadSize;
+		Xxh3ConsumeStripes(m_Acc, &m_StripesSoFar, m_Buffer, BufferStripes, m_Secret);
+		m_BufferedSize = 0;
+	}
+	if (Size > INTERNAL_BUFFER_SIZE)
+	{
+		// Pasy prosto z danych wejściowych, bez kopiowania
+		size_t StripeCount = (Size - 1) / XXH_STRIPE_LEN;
+		Xxh3ConsumeStripes(m_Acc, &m_StripesSoFar, Input, StripeCount, m_Secret);
+		Input += StripeCount * XXH_STRIPE_LEN;
+		Size -= StripeCount * XXH_STRIPE_LEN;
+		memcpy(m_Buffer + INTERNAL_BUFFER_SIZE - XXH_STRIPE_LEN, Input - XXH_STRIPE_LEN, XXH_STRIPE_LEN);
+	}
+	memcpy(m_Buffer, Input, Size);
+	m_BufferedSize = Size;
+}
+
+void XXH3_Calc::Digest(uint64 *OutAcc, const uint8 **OutSecret)
+{
+	uint8 LastStripe[XXH_STRIPE_LEN];
+	size_t StripesSoFar = m_StripesSoFar;
+	memcpy(OutAcc, m_Acc, sizeof(m_Acc));
+	if (m_BufferedSize >= XXH_STRIPE_LEN)
+		Xxh3ConsumeStripes(OutAcc, &StripesSoFar, m_Buffer, (m_BufferedSize - 1) / XXH_STRIPE_LEN, m_Secret,
+			m_Buffer + m_BufferedSize - XXH_STRIPE_LEN);
+	else
+	{
+		// Początek ostatniego pasa jest w zachowanym końcu poprzednich danych
+		size_t CatchupSize = XXH_STRIPE_LEN - m_BufferedSize;
+		memcpy(LastStripe, m_Buffer + INTERNAL_BUFFER_SIZE - CatchupSize, CatchupSize);
+		memcpy(LastStripe + CatchupSize, m_Buffer, m_BufferedSize);
+		Xxh3ConsumeStripes(OutAcc, &StripesSoFar, NULL, 0, m_Secret, LastStripe);
+	}
+	*OutSecret = m_Secret;
+}
+
+uint64 XXH3_Calc::Finish64()
+{
+	if (m_TotalLen <= XXH_MIDSIZE_MAX)
+		return Xxh3Short64(m_Buffer, (size_t)m_TotalLen, XXH_SECRET, m_Seed);
+	uint64 Acc[8];
+	const uint8 *Secret;
+	Digest(Acc, &Secret);
+	return Xxh3Finish64(Acc, Secret, m_TotalLen);
+}
+
+HASH128 XXH3_Calc::Finish128()
+{
+	if (m_TotalLen <= XXH_MIDSIZE_MAX)
+		return Xxh3Short128(m_Buffer, (size_t)m_TotalLen, XXH_SECRET, m_Seed);
+	uint64 Acc[8];
+	const uint8 *Secret;
+	Digest(Acc, &Secret);
+	return Xxh3Finish128(Acc, Secret, m_TotalLen);
+}
+
+uint64 XXH3_Calc::Calc64(const void *Data, size_t DataLength, uint64 Seed)
+{
+	const uint8 *Input = (const uint8*)Data;
+	if (DataLength <= XXH_MIDSIZE_MAX)
+		return Xxh3Short64(Input, DataLength, XXH_SECRET, Seed);
+	uint64 Acc[8];
+	if (Seed == 0)
+	{
+		Xxh3Long(Acc, Input, DataLength, XXH_SECRET);
+		return Xxh3Finish64(Acc, XXH_SECRET, DataLength);
+	}
+	uint8 Secret[SECRET_SIZE];
+	Xxh3InitSecret(Secret, Seed);
+	Xxh3Long(Acc, Input, DataLength, Secret);
+	return Xxh3Finish64(Acc, Secret, DataLength);
+}
+
+HASH128 XXH3_Calc::Calc128(const void *Data, size_t DataLength, uint64 Seed)
+{
+	const uint8 *Input = (const uint8*)Data;
+	if (DataLength <= XXH_MIDSIZE_MAX)
+		return Xxh3Short128(Input, DataLength, XXH_SECRET, Seed);
+	uint64 Acc[8];
+	if (Seed == 0)
+	{
+		Xxh3Long(Acc, Input, DataLength, XXH_SECRET);
+		return Xxh3Finish128(Acc, XXH_SECRET, DataLength);
+	}
+	uint8 Secret[SECRET_SIZE];
+	Xxh3InitSecret(Secret, Seed);
+	Xxh3Long(Acc, Input, DataLength, Secret);
+	return Xxh3Finish128(Acc, Secret, DataLength);
 }
 
 
@@ -1853,62 +2853,90 @@ bool StrToMD5(MD5_SUM *Out, const tstring &s)
 	return ( HexDecoder::Decode(Out->Data, s) == 16 );
 }
 
-#define MD5_GET_UINT32_LE(n,b,i)                \
-{                                               \
-    (n) = ( (uint32) (b)[(i)    ]       )        \
-        | ( (uint32) (b)[(i) + 1] <<  8 )        \
-        | ( (uint32) (b)[(i) + 2] << 16 )        \
-        | ( (uint32) (b)[(i) + 3] << 24 );       \
+// Wspólne dla MD5, SHA-1 i SHA-256 - przetwarzanie danych blokami po 64 bajty.
+// Funkcja bloku przetwarza BlockCount kolejnych bloków.
+typedef void (*HASH_BLOCK_FUNC)(uint32 *State, const uint8 *Data, size_t BlockCount);
+
+static void HashBlocksWrite(uint32 *State, uint8 *Buffer, uint64 *Total, const void *Data, size_t Size, HASH_BLOCK_FUNC BlockFunc)
+{
+	const uint8 *Bytes = (const uint8*)Data;
+	size_t Left = (size_t)(*Total & 63);
+	*Total += Size;
+	if (Left > 0)
+	{
+		size_t Fill = 64 - Left;
+		if (Size < Fill)
+		{
+			memcpy(Buffer + Left, Bytes, Size);
+			return;
+		}
+		memcpy(Buffer + Left, Bytes, Fill);
+		BlockFunc(State, Buffer, 1);
+		Bytes += Fill;
+		Size -= Fill;
+	}
+	// Pełne bloki prosto z danych, bez kopiowania
+	if (Size >= 64)
+	{
+		BlockFunc(State, Bytes, Size / 64);
+		Bytes += Size & ~(size_t)63;
+		Size &= 63;
+	}
+	if (Size > 0)
+		memcpy(Buffer, Bytes, Size);
+}
+
+// Dopisuje bajt 0x80, zera i długość danych w bitach - little endian (MD5) albo big endian (SHA)
+static void HashBlocksFinish(uint32 *State, uint8 *Buffer, uint64 Total, HASH_BLOCK_FUNC BlockFunc, bool BigEndian)
+{
+	size_t Left = (size_t)(Total & 63);
+	uint64 Bits = Total << 3;
+	Buffer[Left++] = 0x80;
+	if (Left > 56)
+	{
+		memset(Buffer + Left, 0, 64 - Left);
+		BlockFunc(State, Buffer, 1);
+		Left = 0;
+	}
+	memset(Buffer + Left, 0, 56 - Left);
+	for (uint i = 0; i < 8; i++)
+		Buffer[BigEndian ? 63 - i : 56 + i] = (uint8)(Bits >> (8 * i));
+	BlockFunc(State, Buffer, 1);
 }
 
-#define MD5_PUT_UINT32_LE(n,b,i)                \
-{                                               \
-    (b)[(i)    ] = (uint8) ( (n)       );       \
-    (b)[(i) + 1] = (uint8) ( (n) >>  8 );       \
-    (b)[(i) + 2] = (uint8) ( (n) >> 16 );       \
-    (b)[(i) + 3] = (uint8) ( (n) >> 24 );       \
+static inline uint32 LoadUint32BE(const uint8 *p)
+{
+	return ((uint32)p[0] << 24) | ((uint32)p[1] << 16) | ((uint32)p[2] << 8) | (uint32)p[3];
 }
 
-uint8 md5_padding[64] =
+static inline void StoreUint32BE(uint8 *p, uint32 v)
 {
- 0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
-};
+	p[0] = (uint8)(v >> 24); p[1] = (uint8)(v >> 16); p[2] = (uint8)(v >> 8); p[3] = (uint8)v;
+}
 
-void MD5_Calc::Process(uint8 data[64])
-{
-    uint32 X[16], A, B, C, D;
-
-    MD5_GET_UINT32_LE( X[0],  data,  0 );
-    MD5_GET_UINT32_LE( X[1],  data,  4 );
-    MD5_GET_UINT32_LE( X[2],  data,  8 );
-    MD5_GET_UINT32_LE( X[3],  data, 12 );
-    MD5_GET_UINT32_LE( X[4],  data, 16 );
-    MD5_GET_UINT32_LE( X[5],  data, 20 );
-    MD5_GET_UINT32_LE( X[6],  data, 24 );
-    MD5_GET_UINT32_LE( X[7],  data, 28 );
-    MD5_GET_UINT32_LE( X[8],  data, 32 );
-    MD5_GET_UINT32_LE( X[9],  data, 36 );
-    MD5_GET_UINT32_LE( X[10], data, 40 );
-    MD5_GET_UINT32_LE( X[11], data, 44 );
-    MD5_GET_UINT32_LE( X[12], data, 48 );
-    MD5_GET_UINT32_LE( X[13], data, 52 );
-    MD5_GET_UINT32_LE( X[14], data, 56 );
-    MD5_GET_UINT32_LE( X[15], data, 60 );
-
-#define S(x,n) (((x) << (n)) | (((x) & 0xFFFFFFFF) >> (32 - (n))))
+// Stan jest w zmiennych lokalnych przez wszystkie bloki. Funkcja G liczona jako suma
+// rozłącznych bitowo składników - dodawania nie czekają na siebie nawzajem.
+static void Md5Blocks(uint32 *State, const uint8 *Data, size_t BlockCount)
+{
+	uint32 X[16], A, B, C, D, AA, BB, CC, DD;
+
+#define S(x,n) (((x) << (n)) | ((x) >> (32 - (n))))
 
 #define P(a,b,c,d,k,s,t)                                \
 {                                                       \
     a += F(b,c,d) + X[k] + t; a = S(a,s) + b;           \
 }
 
-    A = state[0];
-    B = state[1];
-    C = state[2];
-    D = state[3];
+	A = State[0];
+	B = State[1];
+	C = State[2];
+	D = State[3];
+
+	for (; BlockCount > 0; BlockCount--, Data += 64)
+	{
+		for (uint i = 0; i < 16; i++)
+			X[i] = LoadUint32LE(Data + 4 * i);
+		AA = A; BB = B; CC = C; DD = D;
 
 #define F(x,y,z) ((z) ^ ((x) & ((y) ^ (z))))
     P( A, B, C, D,  0,  7, 0xD76AA478 );
@@ -1929,7 +2957,7 @@ void MD5_Calc::Process(uint8 data[64])
     P( B, C, D, A, 15, 22, 0x49B40821 );
 #undef F
 
-#define F(x,y,z) ((y) ^ ((z) & ((x) ^ (y))))
+#define F(x,y,z) (((z) & (x)) + (~(z) & (y)))
     P( A, B, C, D,  1,  5, 0xF61E2562 );
     P( D, A, B, C,  6,  9, 0xC040B340 );
     P( C, D, A, B, 11, 14, 0x265E5A51 );
@@ -1947,7 +2975,7 @@ void MD5_Calc::Process(uint8 data[64])
     P( C, D, A, B,  7, 14, 0x676F02D9 );
     P( B, C, D, A, 12, 20, 0x8D2A4C8A );
 #undef F
-    
+
 #define F(x,y,z) ((x) ^ (y) ^ (z))
     P( A, B, C, D,  5,  4, 0xFFFA3942 );
     P( D, A, B, C,  8, 11, 0x8771F681 );
@@ -1986,102 +3014,377 @@ void MD5_Calc::Process(uint8 data[64])
     P( B, C, D, A,  9, 21, 0xEB86D391 );
 #undef F
 
+		A += AA; B += BB; C += CC; D += DD;
+	}
+
 #undef P
 #undef S
 
-    state[0] += A;
-    state[1] += B;
-    state[2] += C;
-    state[3] += D;
+	State[0] = A;
+	State[1] = B;
+	State[2] = C;
+	State[3] = D;
+}
+
+MD5_Calc::MD5_Calc()
+{
+	Reset();
+}
+
+void MD5_Calc::Write(const void *Buf, size_t BufLen)
+{
+	HashBlocksWrite(m_State, m_Buffer, &m_Total, Buf, BufLen, &Md5Blocks);
+}
+
+void MD5_Calc::Finish(MD5_SUM *Out)
+{
+	HashBlocksFinish(m_State, m_Buffer, m_Total, &Md5Blocks, false);
+	for (uint i = 0; i < 4; i++)
+		for (uint j = 0; j < 4; j++)
+			Out->Data[i * 4 + j] = (uint8)(m_State[i] >> (8 * j));
+}
+
+void MD5_Calc::Reset()
+{
+	m_Total = 0;
+	m_State[0] = 0x67452301;
+	m_State[1] = 0xEFCDAB89;
+	m_State[2] = 0x98BADCFE;
+	m_State[3] = 0x10325476;
+}
+
+void MD5_Calc::Calc(MD5_SUM *Out, const void *Buf, size_t BufLen)
+{
+	MD5_Calc md5;
+	md5.Write(Buf, BufLen);
+	md5.Finish(Out);
+}
+
+
+//HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
+// Struktury SHA1_SUM, SHA256_SUM, klasy SHA1_Calc, SHA256_Calc
+
+/*
+SHA-1 i SHA-256 - FIPS 180-4.
+Sprawdzone na zgodność z wynikami innych implementacji.
+Wersje dla instrukcji SHA (SHA-NI) na podstawie przykładów Intela:
+  "Intel SHA Extensions", Sean Gulley i inni, 2013
+Wybierane przy starcie programu, jeśli procesor ma SHA, SSSE3 i SSE4.1.
+*/
+
+bool SHA1_SUM::operator == (const SHA1_SUM &s) const { return memcmp(Data, s.Data, 20) == 0; }
+bool SHA1_SUM::operator != (const SHA1_SUM &s) const { return memcmp(Data, s.Data, 20) != 0; }
+bool SHA1_SUM::operator <  (const SHA1_SUM &s) const { return memcmp(Data, s.Data, 20) <  0; }
+
+bool SHA256_SUM::operator == (const SHA256_SUM &s) const { return memcmp(Data, s.Data, 32) == 0; }
+bool SHA256_SUM::operator != (const SHA256_SUM &s) const { return memcmp(Data, s.Data, 32) != 0; }
+bool SHA256_SUM::operator <  (const SHA256_SUM &s) const { return memcmp(Data, s.Data, 32) <  0; }
+
+void SHA1ToStr(tstring *Out, const SHA1_SUM &Sum)
+{
+	HexEncoder::Encode(Out, Sum.Data, 20);
 }
 
-MD5_Calc::MD5_Calc()
+bool StrToSHA1(SHA1_SUM *Out, const tstring &s)
 {
-	Reset();
+	return ( HexDecoder::Decode(Out->Data, s) == 20 );
 }
 
-void MD5_Calc::Write(const void *Buf, size_t BufLen)
+void SHA256ToStr(tstring *Out, const SHA256_SUM &Sum)
 {
-	uint8 *ByteBuf = (uint8*)Buf;
-
-	int fill;
-	uint32 left;
-
-	if(BufLen == 0)
-		return;
+	HexEncoder::Encode(Out, Sum.Data, 32);
+}
 
-	left = total[0] & 0x3F;
-	fill = 64 - left;
+bool StrToSHA256(SHA256_SUM *Out, const tstring &s)
+{
+	return ( HexDecoder::Decode(Out->Data, s) == 32 );
+}
 
-	total[0] += (uint32)BufLen;
-	//total[0] &= 0xFFFFFFFF; // WTF is that?
+const uint32 SHA256_K[64] = {
+	0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+	0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+	0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+	0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+	0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+	0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+	0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+	0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2,
+};
 
-	if(total[0] < BufLen)
-		total[1]++;
+static inline uint32 Rotl32(uint32 x, int n) { return (x << n) | (x >> (32 - n)); }
+static inline uint32 Rotr32(uint32 x, int n) { return (x >> n) | (x << (32 - n)); }
 
-	if(left && (int)BufLen >= fill)
+static void Sha1BlocksScalar(uint32 *State, const uint8 *Data, size_t BlockCount)
+{
+	uint32 W[80], A, B, C, D, E, T;
+	for (; BlockCount > 0; BlockCount--, Data += 64)
 	{
-		memcpy((void*)(buffer + left), (void*)ByteBuf, fill);
-		Process(buffer);
-		ByteBuf += fill;
-		BufLen -= fill;
-		left = 0;
+		for (uint i = 0; i < 16; i++)
+			W[i] = LoadUint32BE(Data + 4 * i);
+		for (uint i = 16; i < 80; i++)
+			W[i] = Rotl32(W[i-3] ^ W[i-8] ^ W[i-14] ^ W[i-16], 1);
+
+		A = State[0]; B = State[1]; C = State[2]; D = State[3]; E = State[4];
+#define SHA1_ROUND(F, K) \
+	{ T = Rotl32(A, 5) + (F) + E + K + W[i]; E = D; D = C; C = Rotl32(B, 30); B = A; A = T; }
+		uint i = 0;
+		for (; i < 20; i++) SHA1_ROUND(D ^ (B & (C ^ D)), 0x5A827999)
+		for (; i < 40; i++) SHA1_ROUND(B ^ C ^ D, 0x6ED9EBA1)
+		for (; i < 60; i++) SHA1_ROUND((B & C) | (D & (B | C)), 0x8F1BBCDC)
+		for (; i < 80; i++) SHA1_ROUND(B ^ C ^ D, 0xCA62C1D6)
+#undef SHA1_ROUND
+		State[0] += A; State[1] += B; State[2] += C; State[3] += D; State[4] += E;
 	}
+}
 
-	while(BufLen >= 64)
+static void Sha256BlocksScalar(uint32 *State, const uint8 *Data, size_t BlockCount)
+{
+	uint32 W[64], S[8], T1, T2;
+	for (; BlockCount > 0; BlockCount--, Data += 64)
 	{
-		Process(ByteBuf);
-		ByteBuf += 64;
-		BufLen -= 64;
+		for (uint i = 0; i < 16; i++)
+			W[i] = LoadUint32BE(Data + 4 * i);
+		for (uint i = 16; i < 64; i++)
+			W[i] = W[i-16] + W[i-7] +
+				(Rotr32(W[i-15], 7) ^ Rotr32(W[i-15], 18) ^ (W[i-15] >> 3)) +
+				(Rotr32(W[i-2], 17) ^ Rotr32(W[i-2], 19) ^ (W[i-2] >> 10));
+
+		for (uint i = 0; i < 8; i++)
+			S[i] = State[i];
+		for (uint i = 0; i < 64; i++)
+		{
+			T1 = S[7] + (Rotr32(S[4], 6) ^ Rotr32(S[4], 11) ^ Rotr32(S[4], 25)) +
+				(S[6] ^ (S[4] & (S[5] ^ S[6]))) + SHA256_K[i] + W[i];
+			T2 = (Rotr32(S[0], 2) ^ Rotr32(S[0], 13) ^ Rotr32(S[0], 22)) +
+				((S[0] & S[1]) | (S[2] & (S[0] | S[1])));
+			S[7] = S[6]; S[6] = S[5]; S[5] = S[4]; S[4] = S[3] + T1;
+			S[3] = S[2]; S[2] = S[1]; S[1] = S[0]; S[0] = T1 + T2;
+		}
+		for (uint i = 0; i < 8; i++)
+			State[i] += S[i];
 	}
+}
+
+#ifdef COMMON_STREAM_X86
+
+// Cztery rundy SHA-1 numer G*4..G*4+3. Cur - słowa tych rund, Next, Next2, Prev - pozostałe
+// trzy rejestry wiadomości. Rozszerzanie wiadomości tylko tam, gdzie są jeszcze potrzebne słowa.
+#define SHA1NI_QUAD(G, Ein, Eout, Cur, Next, Next2, Prev) \
+	Ein = _mm_sha1nexte_epu32(Ein, Cur); \
+	Eout = Abcd; \
+	if ((G) >= 3 && (G) <= 18) Next = _mm_sha1msg2_epu32(Next, Cur); \
+	Abcd = _mm_sha1rnds4_epu32(Abcd, Ein, (G) / 5); \
+	if ((G) >= 1 && (G) <= 16) Prev = _mm_sha1msg1_epu32(Prev, Cur); \
+	if ((G) >= 2 && (G) <= 17) Next2 = _mm_xor_si128(Next2, Cur);
+
+COMMON_TARGET("sha,ssse3,sse4.1")
+static void Sha1BlocksShaNi(uint32 *State, const uint8 *Data, size_t BlockCount)
+{
+	const __m128i Mask = _mm_set_epi64x(0x0001020304050607ll, 0x08090A0B0C0D0E0Fll);
+	__m128i Abcd, AbcdSave, E0, E0Save, E1, M0, M1, M2, M3;
+
+	Abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)State), 0x1B);
+	E0 = _mm_set_epi32((int)State[4], 0, 0, 0);
+
+	for (; BlockCount > 0; BlockCount--, Data += 64)
+	{
+		AbcdSave = Abcd;
+		E0Save = E0;
+
+		M0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(Data +  0)), Mask);
+		M1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(Data + 16)), Mask);
+		M2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(Data + 32)), Mask);
+		M3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(Data + 48)), Mask);
+
+		// Rundy 0-3 - E dodawane wprost, bez sha1nexte
+		E0 = _mm_add_epi32(E0, M0);
+		E1 = Abcd;
+		Abcd = _mm_sha1rnds4_epu32(Abcd, E0, 0);
+
+		SHA1NI_QUAD( 1, E1, E0, M1, M2, M3, M0)
+		SHA1NI_QUAD( 2, E0, E1, M2, M3, M0, M1)
+		SHA1NI_QUAD( 3, E1, E0, M3, M0, M1, M2)
+		SHA1NI_QUAD( 4, E0, E1, M0, M1, M2, M3)
+		SHA1NI_QUAD( 5, E1, E0, M1, M2, M3, M0)
+		SHA1NI_QUAD( 6, E0, E1, M2, M3, M0, M1)
+		SHA1NI_QUAD( 7, E1, E0, M3, M0, M1, M2)
+		SHA1NI_QUAD( 8, E0, E1, M0, M1, M2, M3)
+		SHA1NI_QUAD( 9, E1, E0, M1, M2, M3, M0)
+		SHA1NI_QUAD(10, E0, E1, M2, M3, M0, M1)
+		SHA1NI_QUAD(11, E1, E0, M3, M0, M1, M2)
+		SHA1NI_QUAD(12, E0, E1, M0, M1, M2, M3)
+		SHA1NI_QUAD(13, E1, E0, M1, M2, M3, M0)
+		SHA1NI_QUAD(14, E0, E1, M2, M3, M0, M1)
+		SHA1NI_QUAD(15, E1, E0, M3, M0, M1, M2)
+		SHA1NI_QUAD(16, E0, E1, M0, M1, M2, M3)
+		SHA1NI_QUAD(17, E1, E0, M1, M2, M3, M0)
+		SHA1NI_QUAD(18, E0, E1, M2, M3, M0, M1)
+		SHA1NI_QUAD(19, E1, E0, M3, M0, M1, M2)
+
+		E0 = _mm_sha1nexte_epu32(E0, E0Save);
+		Abcd = _mm_add_epi32(Abcd, AbcdSave);
+	}
+
+	_mm_storeu_si128((__m128i*)State, _mm_shuffle_epi32(Abcd, 0x1B));
+	State[4] = (uint32)_mm_extract_epi32(E0, 3);
+}
+
+#undef SHA1NI_QUAD
+
+// Cztery rundy SHA-256 numer G*4..G*4+3, analogicznie jak SHA1NI_QUAD
+#define SHA256NI_QUAD(G, Cur, Next, Prev) \
+	Msg = _mm_add_epi32(Cur, _mm_loadu_si128((const __m128i*)&SHA256_K[4 * (G)])); \
+	State1 = _mm_sha256rnds2_epu32(State1, State0, Msg); \
+	if ((G) >= 3 && (G) <= 14) Next = _mm_sha256msg2_epu32(_mm_add_epi32(Next, _mm_alignr_epi8(Cur, Prev, 4)), Cur); \
+	State0 = _mm_sha256rnds2_epu32(State0, State1, _mm_shuffle_epi32(Msg, 0x0E)); \
+	if ((G) >= 1 && (G) <= 12) Prev = _mm_sha256msg1_epu32(Prev, Cur);
+
+COMMON_TARGET("sha,ssse3,sse4.1")
+static void Sha256BlocksShaNi(uint32 *State, const uint8 *Data, size_t BlockCount)
+{
+	const __m128i Mask = _mm_set_epi64x(0x0C0D0E0F08090A0Bll, 0x0405060700010203ll);
+	__m128i State0, State1, Save0, Save1, Msg, Tmp, M0, M1, M2, M3;
+
+	// Stan w kolejności wymaganej przez sha256rnds2: ABEF i CDGH
+	Tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&State[0]), 0xB1);
+	State1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&State[4]), 0x1B);
+	State0 = _mm_alignr_epi8(Tmp, State1, 8);
+	State1 = _mm_blend_epi16(State1, Tmp, 0xF0);
+
+	for (; BlockCount > 0; BlockCount--, Data += 64)
+	{
+		Save0 = State0;
+		Save1 = State1;
+
+		M0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(Data +  0)), Mask);
+		M1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(Data + 16)), Mask);
+		M2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(Data + 32)), Mask);
+		M3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(Data + 48)), Mask);
+
+		SHA256NI_QUAD( 0, M0, M1, M3)
+		SHA256NI_QUAD( 1, M1, M2, M0)
+		SHA256NI_QUAD( 2, M2, M3, M1)
+		SHA256NI_QUAD( 3, M3, M0, M2)
+		SHA256NI_QUAD( 4, M0, M1, M3)
+		SHA256NI_QUAD( 5, M1, M2, M0)
+		SHA256NI_QUAD( 6, M2, M3, M1)
+		SHA256NI_QUAD( 7, M3, M0, M2)
+		SHA256NI_QUAD( 8, M0, M1, M3)
+		SHA256NI_QUAD( 9, M1, M2, M0)
+		SHA256NI_QUAD(10, M2, M3, M1)
+		SHA256NI_QUAD(11, M3, M0, M2)
+		SHA256NI_QUAD(12, M0, M1, M3)
+		SHA256NI_QUAD(13, M1, M2, M0)
+		SHA256NI_QUAD(14, M2, M3, M1)
+		SHA256NI_QUAD(15, M3, M0, M2)
+
+		State0 = _mm_add_epi32(State0, Save0);
+		State1 = _mm_add_epi32(State1, Save1);
+	}
+
+	Tmp = _mm_shuffle_epi32(State0, 0x1B);
+	State1 = _mm_shuffle_epi32(State1, 0xB1);
+	_mm_storeu_si128((__m128i*)&State[0], _mm_blend_epi16(Tmp, State1, 0xF0));
+	_mm_storeu_si128((__m128i*)&State[4], _mm_alignr_epi8(State1, Tmp, 8));
+}
+
+#undef SHA256NI_QUAD
+
+#endif
 
-	if(BufLen > 0)
-		memcpy((void*)(buffer + left), (void*)ByteBuf, BufLen);
+static HASH_BLOCK_FUNC ChooseSha1Blocks()
+{
+#ifdef COMMON_STREAM_X86
+	const CpuFeatures &Cpu = GetCpu();
+	if (Cpu.Sha && Cpu.Ssse3 && Cpu.Sse41)
+		return &Sha1BlocksShaNi;
+#endif
+	return &Sha1BlocksScalar;
 }
 
-void MD5_Calc::Finish(MD5_SUM *Out)
+static HASH_BLOCK_FUNC ChooseSha256Blocks()
+{
+#ifdef COMMON_STREAM_X86
+	const CpuFeatures &Cpu = GetCpu();
+	if (Cpu.Sha && Cpu.Ssse3 && Cpu.Sse41)
+		return &Sha256BlocksShaNi;
+#endif
+	return &Sha256BlocksScalar;
+}
+
+// Wybór przy pierwszym użyciu - działa także w konstruktorach obiektów globalnych z innych plików
+static HASH_BLOCK_FUNC GetSha1Blocks()
+{
+	static const HASH_BLOCK_FUNC Func = ChooseSha1Blocks();
+	return g_ForceScalarHashes ? &Sha1BlocksScalar : Func;
+}
+
+static HASH_BLOCK_FUNC GetSha256Blocks()
 {
-	uint32 last, padn;
-	uint32 high, low;
-	uint8 msglen[8];
+	static const HASH_BLOCK_FUNC Func = ChooseSha256Blocks();
+	return g_ForceScalarHashes ? &Sha256BlocksScalar : Func;
+}
 
-	high = (total[0] >> 29) | (total[1] <<  3);
-	low  = (total[0] <<  3);
+void SHA1_Calc::Write(const void *Data, size_t Size)
+{
+	HashBlocksWrite(m_State, m_Buffer, &m_Total, Data, Size, GetSha1Blocks());
+}
 
-	MD5_PUT_UINT32_LE(low,  msglen, 0);
-	MD5_PUT_UINT32_LE(high, msglen, 4);
+void SHA1_Calc::Finish(SHA1_SUM *Out)
+{
+	HashBlocksFinish(m_State, m_Buffer, m_Total, GetSha1Blocks(), true);
+	for (uint i = 0; i < 5; i++)
+		StoreUint32BE(Out->Data + 4 * i, m_State[i]);
+}
 
-	last = total[0] & 0x3F;
-	padn = (last < 56) ? (56 - last) : (120 - last);
+void SHA1_Calc::Reset()
+{
+	m_Total = 0;
+	m_State[0] = 0x67452301;
+	m_State[1] = 0xEFCDAB89;
+	m_State[2] = 0x98BADCFE;
+	m_State[3] = 0x10325476;
+	m_State[4] = 0xC3D2E1F0;
+}
 
-	Write(md5_padding, padn);
-	Write(msglen, 8);
+void SHA1_Calc::Calc(SHA1_SUM *Out, const void *Buf, size_t BufLen)
+{
+	SHA1_Calc sha;
+	sha.Write(Buf, BufLen);
+	sha.Finish(Out);
+}
 
-	MD5_PUT_UINT32_LE(state[0], Out->Data,  0);
-	MD5_PUT_UINT32_LE(state[1], Out->Data,  4);
-	MD5_PUT_UINT32_LE(state[2], Out->Data,  8);
-	MD5_PUT_UINT32_LE(state[3], Out->Data, 12);
+void SHA256_Calc::Write(const void *Data, size_t Size)
+{
+	HashBlocksWrite(m_State, m_Buffer, &m_Total, Data, Size, GetSha256Blocks());
 }
 
-void MD5_Calc::Reset()
+void SHA256_Calc::Finish(SHA256_SUM *Out)
 {
-	total[0] = 0;
-	total[1] = 0;
-	state[0] = 0x67452301;
-	state[1] = 0xEFCDAB89;
-	state[2] = 0x98BADCFE;
-	state[3] = 0x10325476;
+	HashBlocksFinish(m_State, m_Buffer, m_Total, GetSha256Blocks(), true);
+	for (uint i = 0; i < 8; i++)
+		StoreUint32BE(Out->Data + 4 * i, m_State[i]);
 }
 
-void MD5_Calc::Calc(MD5_SUM *Out, const void *Buf, size_t BufLen)
+void SHA256_Calc::Reset()
 {
-	MD5_Calc md5;
-	md5.Write(Buf, BufLen);
-	md5.Finish(Out);
+	m_Total = 0;
+	m_State[0] = 0x6A09E667;
+	m_State[1] = 0xBB67AE85;
+	m_State[2] = 0x3C6EF372;
+	m_State[3] = 0xA54FF53A;
+	m_State[4] = 0x510E527F;
+	m_State[5] = 0x9B05688C;
+	m_State[6] = 0x1F83D9AB;
+	m_State[7] = 0x5BE0CD19;
 }
 
-#undef MD5_PUT_UINT32_LE
-#undef MD5_GET_UINT32_LE
+void SHA256_Calc::Calc(SHA256_SUM *Out, const void *Buf, size_t BufLen)
+{
+	SHA256_Calc sha;
+	sha.Write(Buf, BufLen);
+	sha.Finish(Out);
+}
 
 
 //HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
@@ -2918,6 +4221,353 @@ break_2_ALL:
 }
 
 
+//HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
+// Wektorowe kodowanie i dekodowanie Hex i Base64
+
+/*
+Funkcje przetwarzają tylko początkową część danych, którą da się obsłużyć
+całymi wektorami, i zwracają, ile danych wejściowych zużyły - resztę dokańcza
+zwykły kod. Dekodowanie zatrzymuje się przed pierwszym wektorem zawierającym
+nieprawidłowy znak (albo '=' w Base64), żeby błąd zgłosił zwykły kod.
+Base64 na podstawie: Wojciech Muła, Daniel Lemire, "Faster Base64 Encoding and
+Decoding using AVX2 Instructions", 2018.
+*/
+
+#ifdef COMMON_STREAM_X86
+
+// Zamienia 16 bajtów na 32 cyfry szesnastkowe
+#define HEX_ENCODE_16(Out, In, Lut) \
+{ \
+	__m128i V = _mm_loadu_si128((const __m128i*)(In)); \
+	__m128i Hi = _mm_shuffle_epi8(Lut, _mm_and_si128(_mm_srli_epi16(V, 4), _mm_set1_epi8(0x0F))); \
+	__m128i Lo = _mm_shuffle_epi8(Lut, _mm_and_si128(V, _mm_set1_epi8(0x0F))); \
+	_mm_storeu_si128((__m128i*)(Out), _mm_unpacklo_epi8(Hi, Lo)); \
+	_mm_storeu_si128((__m128i*)(Out) + 1, _mm_unpackhi_epi8(Hi, Lo)); \
+}
+
+COMMON_TARGET("ssse3")
+static size_t HexEncodeSsse3(char *Out, const uint8 *In, size_t Length, const char *Digits)
+{
+	const __m128i Lut = _mm_loadu_si128((const __m128i*)Digits);
+	size_t i = 0;
+	for (; i + 16 <= Length; i += 16)
+		HEX_ENCODE_16(Out + i * 2, In + i, Lut)
+	return i;
+}
+
+COMMON_TARGET("avx2")
+static size_t HexEncodeAvx2(char *Out, const uint8 *In, size_t Length, const char *Digits)
+{
+	const __m128i Lut = _mm_loadu_si128((const __m128i*)Digits);
+	const __m256i Lut2 = _mm256_broadcastsi128_si256(Lut);
+	const __m256i Mask = _mm256_set1_epi8(0x0F);
+	size_t i = 0;
+	for (; i + 32 <= Length; i += 32)
+	{
+		__m256i V = _mm256_loadu_si256((const __m256i*)(In + i));
+		__m256i Hi = _mm256_shuffle_epi8(Lut2, _mm256_and_si256(_mm256_srli_epi16(V, 4), Mask));
+		__m256i Lo = _mm256_shuffle_epi8(Lut2, _mm256_and_si256(V, Mask));
+		// unpack działa osobno w każdej połówce - trzeba je przestawić
+		__m256i A = _mm256_unpacklo_epi8(Hi, Lo);
+		__m256i B = _mm256_unpackhi_epi8(Hi, Lo);
+		_mm256_storeu_si256((__m256i*)(Out + i * 2), _mm256_permute2x128_si256(A, B, 0x20));
+		_mm256_storeu_si256((__m256i*)(Out + i * 2 + 32), _mm256_permute2x128_si256(A, B, 0x31));
+	}
+	if (i + 16 <= Length)
+	{
+		HEX_ENCODE_16(Out + i * 2, In + i, Lut)
+		i += 16;
+	}
+	return i;
+}
+
+#undef HEX_ENCODE_16
+
+// Zamienia wektor cyfr szesnastkowych na ich wartości. Valid dostaje 0xFF dla poprawnych znaków.
+COMMON_TARGET("ssse3")
+static inline __m128i HexCharsToNibbles(__m128i Chars, __m128i *Valid)
+{
+	__m128i Digit = _mm_sub_epi8(Chars, _mm_set1_epi8('0'));
+	__m128i Letter = _mm_sub_epi8(_mm_or_si128(Chars, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+	__m128i IsDigit = _mm_cmpeq_epi8(_mm_min_epu8(Digit, _mm_set1_epi8(9)), Digit);
+	__m128i IsLetter = _mm_cmpeq_epi8(_mm_min_epu8(Letter, _mm_set1_epi8(5)), Letter);
+	*Valid = _mm_or_si128(IsDigit, IsLetter);
+	return _mm_or_si128(
+		_mm_and_si128(IsDigit, Digit),
+		_mm_and_si128(IsLetter, _mm_add_epi8(Letter, _mm_set1_epi8(10))));
+}
+
+COMMON_TARGET("avx2")
+static inline __m256i HexCharsToNibbles(__m256i Chars, __m256i *Valid)
+{
+	__m256i Digit = _mm256_sub_epi8(Chars, _mm256_set1_epi8('0'));
+	__m256i Letter = _mm256_sub_epi8(_mm256_or_si256(Chars, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+	__m256i IsDigit = _mm256_cmpeq_epi8(_mm256_min_epu8(Digit, _mm256_set1_epi8(9)), Digit);
+	__m256i IsLetter = _mm256_cmpeq_epi8(_mm256_min_epu8(Letter, _mm256_set1_epi8(5)), Letter);
+	*Valid = _mm256_or_si256(IsDigit, IsLetter);
+	return _mm256_or_si256(
+		_mm256_and_si256(IsDigit, Digit),
+		_mm256_and_si256(IsLetter, _mm256_add_epi8(Letter, _mm256_set1_epi8(10))));
+}
+
+// Zwraca liczbę zużytych znaków - dwa razy więcej niż zapisanych bajtów
+COMMON_TARGET("ssse3")
+static size_t HexDecodeSsse3(uint8 *Out, const char *In, size_t Length)
+{
+	// Para wartości (a, b) -> a * 16 + b
+	const __m128i Mul = _mm_set1_epi16(0x0110);
+	__m128i V0, V1, Valid0, Valid1;
+	size_t i = 0;
+	for (; i + 32 <= Length; i += 32)
+	{
+		V0 = HexCharsToNibbles(_mm_loadu_si128((const __m128i*)(In + i)), &Valid0);
+		V1 = HexCharsToNibbles(_mm_loadu_si128((const __m128i*)(In + i + 16)), &Valid1);
+		if (_mm_movemask_epi8(_mm_and_si128(Valid0, Valid1)) != 0xFFFF)
+			break;
+		_mm_storeu_si128((__m128i*)(Out + i / 2),
+			_mm_packus_epi16(_mm_maddubs_epi16(V0, Mul), _mm_maddubs_epi16(V1, Mul)));
+	}
+	return i;
+}
+
+COMMON_TARGET("avx2")
+static size_t HexDecodeAvx2(uint8 *Out, const char *In, size_t Length)
+{
+	const __m256i Mul = _mm256_set1_epi16(0x0110);
+	__m256i V0, V1, Valid0, Valid1;
+	size_t i = 0;
+	for (; i + 64 <= Length; i += 64)
+	{
+		V0 = HexCharsToNibbles(_mm256_loadu_si256((const __m256i*)(In + i)), &Valid0);
+		V1 = HexCharsToNibbles(_mm256_loadu_si256((const __m256i*)(In + i + 32)), &Valid1);
+		if (_mm256_movemask_epi8(_mm256_and_si256(Valid0, Valid1)) != -1)
+			break;
+		// packus działa osobno w każdej połówce - 0xD8 przywraca kolejność
+		_mm256_storeu_si256((__m256i*)(Out + i / 2), _mm256_permute4x64_epi64(
+			_mm256_packus_epi16(_mm256_maddubs_epi16(V0, Mul), _mm256_maddubs_epi16(V1, Mul)), 0xD8));
+	}
+	return i + HexDecodeSsse3(Out + i / 2, In + i, Length - i);
+}
+
+// Zamienia 12 bajtów (z 16 wczytanych) na 16 indeksów znaków Base64, po jednym w bajcie
+COMMON_TARGET("ssse3")
+static inline __m128i Base64EncodeIndices(__m128i In)
+{
+	In = _mm_shuffle_epi8(In, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+	__m128i T0 = _mm_mulhi_epu16(_mm_and_si128(In, _mm_set1_epi32(0x0FC0FC00)), _mm_set1_epi32(0x04000040));
+	__m128i T1 = _mm_mullo_epi16(_mm_and_si128(In, _mm_set1_epi32(0x003F03F0)), _mm_set1_epi32(0x01000010));
+	return _mm_or_si128(T0, T1);
+}
+
+// Zamienia indeksy 0..63 na znaki Base64 - przesunięcie zależne od zakresu
+COMMON_TARGET("ssse3")
+static inline __m128i Base64IndicesToChars(__m128i Indices)
+{
+	__m128i Range = _mm_subs_epu8(Indices, _mm_set1_epi8(51));
+	Range = _mm_or_si128(Range, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), Indices), _mm_set1_epi8(13)));
+	const __m128i Offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+	return _mm_add_epi8(Indices, _mm_shuffle_epi8(Offsets, Range));
+}
+
+COMMON_TARGET("avx2")
+static inline __m256i Base64EncodeIndices(__m256i In)
+{
+	In = _mm256_shuffle_epi8(In, _mm256_setr_epi8(
+		1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+		1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+	__m256i T0 = _mm256_mulhi_epu16(_mm256_and_si256(In, _mm256_set1_epi32(0x0FC0FC00)), _mm256_set1_epi32(0x04000040));
+	__m256i T1 = _mm256_mullo_epi16(_mm256_and_si256(In, _mm256_set1_epi32(0x003F03F0)), _mm256_set1_epi32(0x01000010));
+	return _mm256_or_si256(T0, T1);
+}
+
+COMMON_TARGET("avx2")
+static inline __m256i Base64IndicesToChars(__m256i Indices)
+{
+	__m256i Range = _mm256_subs_epu8(Indices, _mm256_set1_epi8(51));
+	Range = _mm256_or_si256(Range, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), Indices), _mm256_set1_epi8(13)));
+	const __m256i Offsets = _mm256_setr_epi8(
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+	return _mm256_add_epi8(Indices, _mm256_shuffle_epi8(Offsets, Range));
+}
+
+// Zwraca liczbę zużytych bajtów - wielokrotność 3. Wczytuje 4 bajty za każdą trójką, stąd warunek pętli.
+COMMON_TARGET("ssse3")
+static size_t Base64EncodeSsse3(char *Out, const uint8 *In, size_t Length)
+{
+	size_t i = 0;
+	for (; i + 16 <= Length; i += 12, Out += 16)
+		_mm_storeu_si128((__m128i*)Out, Base64IndicesToChars(Base64EncodeIndices(
+			_mm_loadu_si128((const __m128i*)(In + i)))));
+	return i;
+}
+
+COMMON_TARGET("avx2")
+static size_t Base64EncodeAvx2(char *Out, const uint8 *In, size_t Length)
+{
+	size_t i = 0;
+	for (; i + 28 <= Length; i += 24, Out += 32)
+	{
+		__m256i V = _mm256_inserti128_si256(_mm256_castsi128_si256(
+			_mm_loadu_si128((const __m128i*)(In + i))),
+			_mm_loadu_si128((const __m128i*)(In + i + 12)), 1);
+		_mm256_storeu_si256((__m256i*)Out, Base64IndicesToChars(Base64EncodeIndices(V)));
+	}
+	return i + Base64EncodeSsse3(Out, In + i, Length - i);
+}
+
+// Zamienia 16 znaków Base64 na 12 bajtów na początku wektora. Valid dostaje false, jeśli jest jakiś inny znak.
+COMMON_TARGET("ssse3")
+static inline __m128i Base64DecodeChars(__m128i Chars, bool *Valid)
+{
+	const __m128i LutLo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+		0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+	const __m128i LutHi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+		0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	const __m128i LutRoll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	__m128i HiNibbles = _mm_and_si128(_mm_srli_epi32(Chars, 4), _mm_set1_epi8(0x0F));
+	__m128i LoNibbles = _mm_and_si128(Chars, _mm_set1_epi8(0x0F));
+	__m128i Lo = _mm_shuffle_epi8(LutLo, LoNibbles);
+	__m128i Hi = _mm_shuffle_epi8(LutHi, HiNibbles);
+	*Valid = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(Lo, Hi), _mm_setzero_si128())) == 0xFFFF;
+	__m128i Roll = _mm_shuffle_epi8(LutRoll, _mm_add_epi8(_mm_cmpeq_epi8(Chars, _mm_set1_epi8('/')), HiNibbles));
+	__m128i V = _mm_add_epi8(Chars, Roll);
+	V = _mm_maddubs_epi16(V, _mm_set1_epi32(0x01400140));
+	V = _mm_madd_epi16(V, _mm_set1_epi32(0x00011000));
+	return _mm_shuffle_epi8(V, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+COMMON_TARGET("avx2")
+static inline __m256i Base64DecodeChars(__m256i Chars, bool *Valid)
+{
+	const __m256i LutLo = _mm256_setr_epi8(
+		0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+		0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+	const __m256i LutHi = _mm256_setr_epi8(
+		0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+		0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	const __m256i LutRoll = _mm256_setr_epi8(
+		0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+		0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	__m256i HiNibbles = _mm256_and_si256(_mm256_srli_epi32(Chars, 4), _mm256_set1_epi8(0x0F));
+	__m256i LoNibbles = _mm256_and_si256(Chars, _mm256_set1_epi8(0x0F));
+	__m256i Lo = _mm256_shuffle_epi8(LutLo, LoNibbles);
+	__m256i Hi = _mm256_shuffle_epi8(LutHi, HiNibbles);
+	*Valid = _mm256_testz_si256(Lo, Hi) != 0;
+	__m256i Roll = _mm256_shuffle_epi8(LutRoll, _mm256_add_epi8(_mm256_cmpeq_epi8(Chars, _mm256_set1_epi8('/')), HiNibbles));
+	__m256i V = _mm256_add_epi8(Chars, Roll);
+	V = _mm256_maddubs_epi16(V, _mm256_set1_epi32(0x01400140));
+	V = _mm256_madd_epi16(V, _mm256_set1_epi32(0x00011000));
+	V = _mm256_shuffle_epi8(V, _mm256_setr_epi8(
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+	// 24 bajty wyniku na początek
+	return _mm256_permutevar8x32_epi32(V, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+}
+
+// Zwraca liczbę zużytych znaków - wielokrotność 4. Zapisuje dokładnie 3 bajty na każde 4 znaki.
+COMMON_TARGET("ssse3")
+static size_t Base64DecodeSsse3(uint8 *Out, const char *In, size_t Length)
+{
+	__m128i V;
+	bool Valid;
+	uint32 Last;
+	size_t i = 0;
+	for (; i + 16 <= Length; i += 16, Out += 12)
+	{
+		V = Base64DecodeChars(_mm_loadu_si128((const __m128i*)(In + i)), &Valid);
+		if (!Valid)
+			break;
+		_mm_storel_epi64((__m128i*)Out, V);
+		Last = (uint32)_mm_cvtsi128_si32(_mm_srli_si128(V, 8));
+		memcpy(Out + 8, &Last, 4);
+	}
+	return i;
+}
+
+COMMON_TARGET("avx2")
+static size_t Base64DecodeAvx2(uint8 *Out, const char *In, size_t Length)
+{
+	__m256i V;
+	bool Valid;
+	size_t i = 0;
+	for (; i + 32 <= Length; i += 32, Out += 24)
+	{
+		V = Base64DecodeChars(_mm256_loadu_si256((const __m256i*)(In + i)), &Valid);
+		if (!Valid)
+			break;
+		_mm_storeu_si128((__m128i*)Out, _mm256_castsi256_si128(V));
+		_mm_storel_epi64((__m128i*)(Out + 16), _mm256_extracti128_si256(V, 1));
+	}
+	return i + Base64DecodeSsse3(Out, In + i, Length - i);
+}
+
+#endif
+
+// Zwraca liczbę zakodowanych bajtów. Zapisuje po 2 znaki na bajt.
+static size_t HexEncodeSimd(char *Out, const uint8 *In, size_t Length, const char *Digits)
+{
+#ifdef COMMON_STREAM_X86
+	const CpuFeatures &Cpu = GetCpu();
+	if (g_ForceScalarCoding)
+		return 0;
+	if (Cpu.Avx2)
+		return HexEncodeAvx2(Out, In, Length, Digits);
+	if (Cpu.Ssse3)
+		return HexEncodeSsse3(Out, In, Length, Digits);
+#endif
+	return 0;
+}
+
+// Zwraca liczbę zdekodowanych znaków. Zapisuje po 1 bajcie na 2 znaki.
+static size_t HexDecodeSimd(uint8 *Out, const char *In, size_t Length)
+{
+#ifdef COMMON_STREAM_X86
+	const CpuFeatures &Cpu = GetCpu();
+	if (g_ForceScalarCoding)
+		return 0;
+	if (Cpu.Avx2)
+		return HexDecodeAvx2(Out, In, Length);
+	if (Cpu.Ssse3)
+		return HexDecodeSsse3(Out, In, Length);
+#endif
+	return 0;
+}
+
+// Zwraca liczbę zakodowanych bajtów - wielokrotność 3. Zapisuje po 4 znaki na 3 bajty.
+static size_t Base64EncodeSimd(char *Out, const uint8 *In, size_t Length)
+{
+#ifdef COMMON_STREAM_X86
+	const CpuFeatures &Cpu = GetCpu();
+	if (g_ForceScalarCoding)
+		return 0;
+	if (Cpu.Avx2)
+		return Base64EncodeAvx2(Out, In, Length);
+	if (Cpu.Ssse3)
+		return Base64EncodeSsse3(Out, In, Length);
+#endif
+	return 0;
+}
+
+// Zwraca liczbę zdekodowanych znaków - wielokrotność 4. Zapisuje po 3 bajty na 4 znaki.
+static size_t Base64DecodeSimd(uint8 *Out, const char *In, size_t Length)
+{
+#ifdef COMMON_STREAM_X86
+	const CpuFeatures &Cpu = GetCpu();
+	if (g_ForceScalarCoding)
+		return 0;
+	if (Cpu.Avx2)
+		return Base64DecodeAvx2(Out, In, Length);
+	if (Cpu.Ssse3)
+		return Base64DecodeSsse3(Out, In, Length);
+#endif
+	return 0;
+}
+
+
 //HHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHHH
 // Klasa HexEncoder
 
@@ -2928,32 +4578,43 @@ const wchar_t * const WHEX_DIGITS_U = L"0123456789ABCDEF";
 const wchar_t * const WHEX_DIGITS_L = L"0123456789abcdef";
 #endif
 
+// Borrows a block of at least MinSize bytes from the encoder's destination stream.
+// Flushes the CharWriter first so the order of data is preserved. Returns 0 if not supported.
+static size_t AcquireEncoderOutputSpan(Stream *s, CharWriter *cw, void **OutData, size_t MinSize)
+{
+	if (s->AcquireWriteSpan(OutData, MinSize) == 0)
+		return 0;
+	cw->Flush();
+	return s->AcquireWriteSpan(OutData, MinSize);
+}
+
 void HexEncoder::Write(const void *Data, size_t Size)
 {
 	ERR_TRY;
 
 	const uint8 *Bytes = (const uint8*)Data;
-	uint8 Byte;
 
-	if (m_UpperCase)
+	// Kodowanie bezpośrednio do pamięci strumienia docelowego
+	void *OutData;
+	size_t OutSize, BlockSize;
+	while (Size > 0 && (OutSize = AcquireEncoderOutputSpan(GetStream(), &m_CharWriter, &OutData, 2)) > 0)
 	{
-		for (size_t i = 0; i < Size; i++)
-		{
-			Byte = *Bytes;
-			m_CharWriter.WriteChar(HEX_DIGITS_U[(Byte & 0xF0) >> 4]);
-			m_CharWriter.WriteChar(HEX_DIGITS_U[Byte & 0x0F]);
-			Bytes++;
-		}
+		BlockSize = std::min(Size, OutSize / 2);
+		Encode((char*)OutData, Bytes, BlockSize, m_UpperCase);
+		GetStream()->CommitWrite(BlockSize * 2);
+		Bytes += BlockSize;
+		Size -= BlockSize;
 	}
-	else
+
+	// Kodowanie blokami przez bufor na znaki
+	char Chars[512];
+	while (Size > 0)
 	{
-		for (size_t i = 0; i < Size; i++)
-		{
-			Byte = *Bytes;
-			m_CharWriter.WriteChar(HEX_DIGITS_L[(Byte & 0xF0) >> 4]);
-			m_CharWriter.WriteChar(HEX_DIGITS_L[Byte & 0x0F]);
-			Bytes++;
-		}
+		BlockSize = std::min(Size, sizeof(Chars) / 2);
+		Encode(Chars, Bytes, BlockSize, m_UpperCase);
+		m_CharWriter.WriteData(Chars, BlockSize * 2);
+		Bytes += BlockSize;
+		Size -= BlockSize;
 	}
 
 	ERR_CATCH_FUNC;
@@ -2967,6 +4628,11 @@ void HexEncoder::Encode(char *Out, const void *Data, size_t DataLength, bool Upp
 	const uint8 *InBytes = (const uint8*)Data;
 	uint8 Byte;
 
+	size_t Done = HexEncodeSimd(Out, InBytes, DataLength, UpperCase ? HEX_DIGITS_U : HEX_DIGITS_L);
+	Out += Done * 2;
+	InBytes += Done;
+	DataLength -= Done;
+
 	if (UpperCase)
 	{
 		while (DataLength > 0)
@@ -2993,36 +4659,9 @@ void HexEncoder::Encode(char *Out, const void *Data, size_t DataLength, bool Upp
 
 void HexEncoder::Encode(string *Out, const void *Data, size_t DataLength, bool UpperCase)
 {
-	// DataLength będzie zmniejszane.
-	// InBytes będzie przesuwane.
 	Out->resize(DataLength * 2);
-
-	const uint8 *InBytes = (const uint8*)Data;
-	uint8 Byte;
-	size_t Out_i = 0;
-
-	if (UpperCase)
-	{
-		while (DataLength > 0)
-		{
-			Byte = *InBytes;
-			(*Out)[Out_i] = HEX_DIGITS_U[(Byte & 0xF0) >> 4]; Out_i++;
-			(*Out)[Out_i] = HEX_DIGITS_U[ Byte & 0x0F      ]; Out_i++;
-			InBytes++;
-			DataLength--;
-		}
-	}
-	else
-	{
-		while (DataLength > 0)
-		{
-			Byte = *InBytes;
-			(*Out)[Out_i] = HEX_DIGITS_L[(Byte & 0xF0) >> 4]; Out_i++;
-			(*Out)[Out_i] = HEX_DIGITS_L[ Byte & 0x0F      ]; Out_i++;
-			InBytes++;
-			DataLength--;
-		}
-	}
+	if (DataLength > 0)
+		Encode(&(*Out)[0], Data, DataLength, UpperCase);
 }
 
 #ifdef _WIN32
@@ -3117,26 +4756,23 @@ size_t HexDecoder::Read(void *Out, size_t Size)
 
 	if (m_Tolerance == DECODE_TOLERANCE_NONE)
 	{
+		// Dekodowanie blokami przez bufor na znaki
+		char Chars[512];
+		size_t CharCount, ReadCount, Decoded;
 		while (Size > 0)
 		{
-			// Pierwsza cyfra - może jej nie być jeśli to koniec strumienia
-			if (!m_CharReader.ReadChar(&Ch))
-				break;
-			HexNumber = HexDigitToNumber(Ch);
-			if (HexNumber == 0xFF)
-				throw Error(ERRMSG_DECODE_INVALID_CHAR, __TFILE__, __LINE__);
-			Byte = HexNumber << 4;
-
-			// Druga cyfra
-			HexNumber = HexDigitToNumber(m_CharReader.MustReadChar());
-			if (HexNumber == 0xFF)
+			CharCount = std::min(Size, sizeof(Chars) / 2) * 2;
+			ReadCount = m_CharReader.ReadString(Chars, CharCount);
+			if ((ReadCount & 0x01) != 0)
+				_ThrowBufEndError(__TFILE__, __LINE__);
+			Decoded = Decode(OutBytes, Chars, ReadCount, DECODE_TOLERANCE_NONE);
+			if (Decoded == MAXUINT32)
 				throw Error(ERRMSG_DECODE_INVALID_CHAR, __TFILE__, __LINE__);
-			Byte |= HexNumber;
-
-			*OutBytes = Byte;
-			OutBytes++;
-			Sum++;
-			Size--;
+			OutBytes += Decoded;
+			Sum += Decoded;
+			Size -= Decoded;
+			if (ReadCount < CharCount)
+				break;
 		}
 	}
 	else if (m_Tolerance == DECODE_TOLERANCE_WHITESPACE)
@@ -3298,6 +4934,10 @@ size_t HexDecoder::Decode(void *OutData, const string &s, DECODE_TOLERANCE Toler
 	{
 		if ((s.length() & 0x01) != 0) return SIZE_MAX;
 
+		s_i = HexDecodeSimd(OutBytes, s.data(), s.length());
+		OutBytes += s_i / 2;
+		Sum = s_i / 2;
+
 		while (s_i < s.length())
 		{
 			HexNumber = HexDigitToNumber(s[s_i++]);
@@ -3416,6 +5056,10 @@ size_t HexDecoder::Decode(void *OutData, const char *s, size_t s_Length, DECODE_
 	{
 		if ((s_Length & 0x01) != 0) return MAXUINT32;
 
+		s_i = HexDecodeSimd(OutBytes, s, s_Length);
+		OutBytes += s_i / 2;
+		Sum = s_i / 2;
+
 		while (s_i < s_Length)
 		{
 			HexNumber = HexDigitToNumber(s[s_i++]);
@@ -3809,6 +5453,45 @@ void Base64Encoder::Write(const void *Data, size_t Size)
 
 	uint8 *ByteData = (uint8*)Data;
 
+	// Pełne trójki bajtów kodowane bezpośrednio do pamięci strumienia docelowego.
+	// Najpierw trzeba dopełnić niepełną trójkę z poprzedniego wywołania.
+	void *OutData;
+	size_t OutSize, BlockSize;
+	while (Size > 0 && m_BufIndex > 0)
+	{
+		if (m_BufIndex == 2)
+		{
+			m_CharWriter.WriteChar( BASE64_CHARS[ m_Buf[0] >> 2 ] );
+			m_CharWriter.WriteChar( BASE64_CHARS[ ((m_Buf[0] & 0x3) << 4) | (m_Buf[1] >> 4) ] );
+			m_CharWriter.WriteChar( BASE64_CHARS[ ((m_Buf[1] & 0xF) << 2) | (*ByteData >> 6) ] );
+			m_CharWriter.WriteChar( BASE64_CHARS[ (*ByteData & 0x3F) ] );
+			m_BufIndex = 0;
+		}
+		else
+			m_Buf[m_BufIndex++] = *ByteData;
+		Size--;
+		ByteData++;
+	}
+	while (Size >= 3 && (OutSize = AcquireEncoderOutputSpan(GetStream(), &m_CharWriter, &OutData, 4)) > 0)
+	{
+		BlockSize = std::min(Size / 3, OutSize / 4) * 3;
+		Encode((char*)OutData, ByteData, BlockSize);
+		GetStream()->CommitWrite(BlockSize / 3 * 4);
+		ByteData += BlockSize;
+		Size -= BlockSize;
+	}
+
+	// Pozostałe pełne trójki kodowane blokami przez bufor na znaki
+	char Chars[512];
+	while (Size >= 3)
+	{
+		BlockSize = std::min(Size / 3, sizeof(Chars) / 4) * 3;
+		Encode(Chars, ByteData, BlockSize);
+		m_CharWriter.WriteData(Chars, BlockSize / 3 * 4);
+		ByteData += BlockSize;
+		Size -= BlockSize;
+	}
+
 	// Pętla przetwarza kolejne bajty
 	while (Size > 0)
 	{
@@ -3843,7 +5526,10 @@ size_t Base64Encoder::Encode(char *Out, const void *Data, size_t DataLength)
 	size_t RemainingBytes = DataLength % 3;
 	size_t OutLength = ceil_div<size_t>(DataLength, 3) * 4;
 
-	size_t OutIndex = 0;
+	size_t Done = Base64EncodeSimd(Out, ByteData, BlockCount * 3);
+	ByteData += Done;
+	BlockCount -= Done / 3;
+	size_t OutIndex = Done / 3 * 4;
 
 	while (BlockCount > 0)
 	{
@@ -3877,41 +5563,12 @@ size_t Base64Encoder::Encode(char *Out, const void *Data, size_t DataLength)
 
 size_t Base64Encoder::Encode(string *Out, const void *Data, size_t DataLength)
 {
-	uint8 *ByteData = (uint8*)Data;
-	size_t BlockCount = DataLength / 3;
-	size_t RemainingBytes = DataLength % 3;
 	size_t OutLength = ceil_div<size_t>(DataLength, 3) * 4;
 
 	Out->clear();
 	Out->resize(OutLength);
-	size_t OutIndex = 0;
-
-	while (BlockCount > 0)
-	{
-		(*Out)[OutIndex++] = BASE64_CHARS[ ByteData[0] >> 2 ];
-		(*Out)[OutIndex++] = BASE64_CHARS[ ((ByteData[0] & 0x3) << 4) | (ByteData[1] >> 4) ];
-		(*Out)[OutIndex++] = BASE64_CHARS[ ((ByteData[1] & 0xF) << 2) | (ByteData[2] >> 6) ];
-		(*Out)[OutIndex++] = BASE64_CHARS[ (ByteData[2] & 0x3F) ];
-
-		ByteData += 3;
-		BlockCount--;
-	}
-
-	switch (RemainingBytes)
-	{
-	case 1:
-		(*Out)[OutIndex++] = BASE64_CHARS[ ByteData[0] >> 2 ];
-		(*Out)[OutIndex++] = BASE64_CHARS[ (ByteData[0] & 0x3) << 4 ];
-		(*Out)[OutIndex++] = '=';
-		(*Out)[OutIndex++] = '=';
-		break;
-	case 2:
-		(*Out)[OutIndex++] = BASE64_CHARS[ ByteData[0] >> 2 ];
-		(*Out)[OutIndex++] = BASE64_CHARS[ ((ByteData[0] & 0x3) << 4) | (ByteData[1] >> 4) ];
-		(*Out)[OutIndex++] = BASE64_CHARS[ (ByteData[1] & 0xF) << 2 ];
-		(*Out)[OutIndex++] = '=';
-		break;
-	}
+	if (OutLength > 0)
+		Encode(&(*Out)[0], Data, DataLength);
 
 	return OutLength;
 }
@@ -4083,7 +5740,47 @@ size_t Base64Decoder::Read(void *Out, size_t Size)
 	// Size będzie zmniejszany. OutBytes będzie przesuwany.
 
 	size_t Sum = 0;
-	while (Size > 0)
+	// Najpierw bajty zalegające w buforze
+	while (Size > 0 && m_BufLength > 0)
+	{
+		*OutBytes = m_Buf[--m_BufLength];
+		OutBytes++;
+		Size--;
+		Sum++;
+	}
+
+	// Pełne trójki dekodowane blokami przez bufor na znaki
+	if (m_Tolerance == DECODE_TOLERANCE_NONE)
+	{
+		char Chars[512];
+		size_t CharCount, ReadCount, DecodeCount, Decoded;
+		while (Size >= 3 && !m_Finished)
+		{
+			CharCount = std::min(Size / 3, sizeof(Chars) / 4) * 4;
+			ReadCount = m_CharReader.ReadString(Chars, CharCount);
+			// Czwórka z '=' kończy dane - dalej nie dekoduję
+			DecodeCount = ReadCount;
+			const char *Equal = (const char*)memchr(Chars, '=', ReadCount);
+			if (Equal != NULL)
+			{
+				DecodeCount = ((Equal - Chars) / 4 + 1) * 4;
+				m_Finished = true;
+			}
+			if ((DecodeCount & 3) != 0 || DecodeCount > ReadCount)
+				throw Error(ERRMSG_UNEXPECTED_END, __TFILE__, __LINE__);
+			Decoded = Decode(OutBytes, Chars, DecodeCount, DECODE_TOLERANCE_NONE);
+			if (Decoded == SIZE_MAX)
+				throw Error(ERRMSG_DECODE_INVALID_CHAR, __TFILE__, __LINE__);
+			OutBytes += Decoded;
+			Size -= Decoded;
+			Sum += Decoded;
+			if (ReadCount < CharCount)
+				break;
+		}
+	}
+
+	// Reszta bajt po bajcie
+	while (Size > 0 && !(m_Finished && m_BufLength == 0))
 	{
 		if (!GetNextByte(OutBytes))
 			break;
@@ -4216,6 +5913,10 @@ size_t Base64Decoder::Decode(void *OutData, const string &s, DECODE_TOLERANCE To
 	{
 		if ((s.length() & 3) != 0) return SIZE_MAX;
 
+		s_i = Base64DecodeSimd(OutBytes, s.data(), s.length());
+		OutBytes += s_i / 4 * 3;
+		Sum = s_i / 4 * 3;
+
 		while (s_i < s.length())
 		{
 			Numbers[0] = Base64CharToNumber(s[s_i++]);
@@ -4364,6 +6065,10 @@ size_t Base64Decoder::Decode(void *OutData, const char *s, size_t s_Length, DECO
 	{
 		if ((s_Length & 3) != 0) return SIZE_MAX;
 
+		s_i = Base64DecodeSimd(OutBytes, s, s_Length);
+		OutBytes += s_i / 4 * 3;
+		Sum = s_i / 4 * 3;
+
 		while (s_i < s_Length)
 		{
 			Numbers[0] = Base64CharToNumber(s[s_i++]);
@@ -4627,5 +6332,49 @@ size_t RingBuffer::Skip(size_t MaxLength)
 	return Length;
 }
 
+size_t RingBuffer::AcquireReadSpan(const void **OutData)
+{
+	if (m_Size == 0)
+	{
+		*OutData = NULL;
+		return 0;
+	}
+	// Początek mógł zostać na samym końcu bufora
+	if (m_BegIndex == m_Capacity)
+		m_BegIndex = 0;
+	*OutData = &m_Buf[m_BegIndex];
+	return std::min(m_Size, m_Capacity - m_BegIndex);
+}
+
+void RingBuffer::ReleaseRead(size_t Size)
+{
+	assert(Size <= m_Size && m_BegIndex + Size <= m_Capacity);
+	m_BegIndex += Size;
+	m_Size -= Size;
+}
+
+size_t RingBuffer::AcquireWriteSpan(void **OutData, size_t MinSize)
+{
+	// Koniec mógł zostać na samym końcu bufora
+	if (m_EndIndex == m_Capacity)
+		m_EndIndex = 0;
+	// Wolne miejsce od końca danych do końca bufora albo do początku danych
+	size_t Free = std::min(m_Capacity - m_Size, m_Capacity - m_EndIndex);
+	if (MinSize == 0 || Free < MinSize)
+	{
+		*OutData = NULL;
+		return 0;
+	}
+	*OutData = &m_Buf[m_EndIndex];
+	return Free;
+}
+
+void RingBuffer::CommitWrite(size_t Size)
+{
+	assert(m_Size + Size <= m_Capacity && m_EndIndex + Size <= m_Capacity);
+	m_EndIndex += Size;
+	m_Size += Size;
+}
+
 
 } // namespace common
@@ -35,6 +35,13 @@ enum DECODE_TOLERANCE
 	DECODE_TOLERANCE_ALL,        ///< Wszelkie nieznane znaki bd ignorowane i nie spowoduj bdu
 };
 
+/// Fragment of memory for scatter/gather I/O - see Stream::WriteV, Stream::ReadV
+struct IO_BUFFER
+{
+	void *Data;
+	size_t Size;
+};
+
 
 /// Abstrakcyjna klasa bazowa strumieni danych binarnych
 class Stream
@@ -49,6 +56,9 @@ public:
 	/** (W oryginale: zgasza bd) */
 	virtual void Write(const void *Data, size_t Size);
 	virtual void Flush() { }
+	/// Writes data from multiple buffers, one after another
+	/** (W oryginale: wywouje Write dla kadego bufora) */
+	virtual void WriteV(const IO_BUFFER *Buffers, size_t BufferCount);
 
 	/// Zapisuje dane, sama odczytuje rozmiar przekazanej zmiennej
 	template <typename T>
@@ -107,6 +117,10 @@ public:
 	(Mona j przeadowa, ale nie trzeba - ma swoj wersj oryginaln)
 	*/
 	virtual void MustRead(void *Data, size_t Length);
+	/// Reads data into multiple buffers, filling them one after another
+	/** (W oryginale: wywouje Read dla kolejnych buforw)
+	\return Number of bytes read. Less than the sum of buffer sizes means end of stream. */
+	virtual size_t ReadV(const IO_BUFFER *Buffers, size_t BufferCount);
 	/// Tak samo jak MustRead(), ale sama odczytuje rozmiar przekazanej zmiennej
 	/** Zwraca true, jeli osignito koniec strumienia
 	(W oryginale: zgasza bd)
@@ -157,6 +171,38 @@ public:
 	void MustCopyFrom(Stream *s, size_t Size);
 	/// Odczytuje dane do koca z podanego strumienia
 	size_t CopyFromToEnd(Stream *s);
+	/// Copies data from given stream in a way specific to both streams, e.g. inside the kernel
+	/** Called by CopyFrom, MustCopyFrom and CopyFromToEnd before they copy data through memory.
+	Default implementation returns false.
+	\param[out] OutSize Number of bytes copied. Less than MaxSize means end of source stream.
+	\return false if these streams can't be copied this way - nothing was copied then. */
+	virtual bool DirectCopyFrom(Stream *s, size_t MaxSize, size_t *OutSize);
+	//@}
+
+	/** \name Zero-copy access */
+	//@{
+	/// Borrows a contiguous block of data ready to read directly from the stream's internal memory
+	/** Doesn't move the read position - call ReleaseRead() when done.
+	The pointer stays valid only until the next call to any other method of this stream.
+	(W oryginale: zwraca 0 - strumie nie obsuguje poyczania, trzeba uy Read.)
+	\param[out] OutData Receives pointer to the data.
+	\return Number of bytes available at OutData. 0 means end of data or no support for borrowing.
+	*/
+	virtual size_t AcquireReadSpan(const void **OutData);
+	/// Marks first Size bytes of the block returned by AcquireReadSpan() as consumed
+	/** Size must not exceed the value returned by AcquireReadSpan(). */
+	virtual void ReleaseRead(size_t Size);
+	/// Borrows a contiguous block of the stream's internal memory for writing directly into it
+	/** Data written there becomes part of the stream only after CommitWrite().
+	The pointer stays valid only until the next call to any other method of this stream.
+	(W oryginale: zwraca 0 - strumie nie obsuguje poyczania, trzeba uy Write.)
+	\param[out] OutData Receives pointer to the block.
+	\param MinSize Minimum number of bytes the caller needs.
+	\return Size of the block, not less than MinSize, or 0 if such block cannot be provided.
+	*/
+	virtual size_t AcquireWriteSpan(void **OutData, size_t MinSize = 1);
+	/// Appends first Size bytes of the block returned by AcquireWriteSpan() to the stream
+	virtual void CommitWrite(size_t Size);
 	//@}
 };
 
@@ -317,11 +363,18 @@ class CharReader
 private:
 	Stream *m_Stream;
 	std::vector<char> m_Buf;
+	// Biece dane - m_Buf albo blok poyczony ze strumienia przez AcquireReadSpan
+	const char *m_Data;
+	// Rozmiar poyczonego bloku, ktry trzeba odda przez ReleaseRead, albo 0
+	size_t m_Borrowed;
 	// Miejsce, do ktrego doczytaem z bufora
 	size_t m_BufBeg;
 	// Miejsce, do ktrego bufor jest wypeniony danymi
 	size_t m_BufEnd;
 
+	// Oddaje strumieniowi przeczytan cz poyczonego bloku, jeli jaki jest
+	void ReleaseBorrowed() { if (m_Borrowed > 0) { m_Stream->ReleaseRead(m_BufBeg); m_Borrowed = 0; m_BufBeg = m_BufEnd = 0; } }
+
 	// Wczytuje now porcj danych do strumienia
 	// Wywoywa tylko kiedy bufor si skoczy, tzn. m_BufBeg == m_BufEnd.
 	// Jeli skoczy si strumie i nic nie udao si wczyta, zwraca false.
@@ -329,24 +382,30 @@ private:
 	bool EnsureNewChars();
 
 public:
-	CharReader(Stream *a_Stream) : m_Stream(a_Stream), m_BufBeg(0), m_BufEnd(0) { m_Buf.resize(BUFFER_SIZE); }
+	/** If the stream supports Stream::AcquireReadSpan, reads directly from its memory without copying. */
+	CharReader(Stream *a_Stream) : m_Stream(a_Stream), m_Data(NULL), m_Borrowed(0), m_BufBeg(0), m_BufEnd(0) { }
+	/** If data is borrowed from the stream by AcquireReadSpan, releases only the characters
+	read so far, so the stream can be read further from where the reader ended. */
+	~CharReader() { ReleaseBorrowed(); }
 
 	/// Czy jestemy na kocu danych?
 	bool End() {
-		return (m_BufBeg == m_BufEnd) && m_Stream->End(); // Nic nie zostao w buforze i nic nie zostao w strumieniu.
+		if (m_BufBeg != m_BufEnd) return false;
+		ReleaseBorrowed();
+		return m_Stream->End(); // Nic nie zostao w buforze i nic nie zostao w strumieniu.
 	}
 	/// Jeli mona odczyta nastpny znak, wczytuje go i zwraca true.
 	/** Jeli nie, nie zmienia Out i zwraca false. Oznacza to koniec strumienia. */
-	bool ReadChar(char *Out) { if (m_BufBeg == m_BufEnd) { if (!EnsureNewChars()) return false; } *Out = m_Buf[m_BufBeg++]; return true; }
+	bool ReadChar(char *Out) { if (m_BufBeg == m_BufEnd) { if (!EnsureNewChars()) return false; } *Out = m_Data[m_BufBeg++]; return true; }
 	/// Jeli mona odczyta nastpny znak, wczytuje go.
 	/** Jeli nie, rzuca wyjtek. */
-	char MustReadChar() { if (m_BufBeg == m_BufEnd) { if (!EnsureNewChars()) _ThrowBufEndError(__TFILE__, __LINE__); } return m_Buf[m_BufBeg++]; }
+	char MustReadChar() { if (m_BufBeg == m_BufEnd) { if (!EnsureNewChars()) _ThrowBufEndError(__TFILE__, __LINE__); } return m_Data[m_BufBeg++]; }
 	/// Jeli mona odczyta nastpny znak, podglda go zwracajc przez Out i zwraca true. Nie przesuwa "kursora".
 	/** Jeli nie, nie zmienia Out i zwraca false. Oznacza to koniec strumienia. */
-	bool PeekChar(char *Out) { if (m_BufBeg == m_BufEnd) { if (!EnsureNewChars()) return false; } *Out = m_Buf[m_BufBeg]; return true; }
+	bool PeekChar(char *Out) { if (m_BufBeg == m_BufEnd) { if (!EnsureNewChars()) return false; } *Out = m_Data[m_BufBeg]; return true; }
 	/// Jeli mona odczyta nastpny znak, podglda go zwracajc. Nie przesuwa "kursora".
 	/** Jeli nie, rzuca wyjtek. */
-	char MustPeekChar() { if (m_BufBeg == m_BufEnd) { if (!EnsureNewChars()) _ThrowBufEndError(__TFILE__, __LINE__); } return m_Buf[m_BufBeg]; }
+	char MustPeekChar() { if (m_BufBeg == m_BufEnd) { if (!EnsureNewChars()) _ThrowBufEndError(__TFILE__, __LINE__); } return m_Data[m_BufBeg]; }
 	/// Wczytuje co najwyej MaxLength znakw do podanego stringa.
 	/** StringStream jest czyszczony - nie musi by pusty ani zaalokowany. (???)
 	\return Zwraca liczb odczytanych znakw. Mniej ni dano oznacza koniec strumienia. */
@@ -502,6 +561,10 @@ public:
 	virtual void Write(const void *Data, size_t Size);
 	virtual size_t Read(void *Data, size_t Size);
 	virtual void MustRead(void *Data, size_t Size);
+	virtual size_t AcquireReadSpan(const void **OutData);
+	virtual void ReleaseRead(size_t Size);
+	virtual size_t AcquireWriteSpan(void **OutData, size_t MinSize = 1);
+	virtual void CommitWrite(size_t Size);
 
 	virtual uint64 GetSize();
 	virtual int64 GetPos();
@@ -532,6 +595,10 @@ public:
 	virtual void Write(const void *Data, size_t Size);
 	virtual size_t Read(void *Data, size_t Size);
 	virtual void MustRead(void *Data, size_t Size);
+	virtual size_t AcquireReadSpan(const void **OutData);
+	virtual void ReleaseRead(size_t Size);
+	virtual size_t AcquireWriteSpan(void **OutData, size_t MinSize = 1);
+	virtual void CommitWrite(size_t Size);
 	virtual uint64 GetSize() { return m_Size; }
 	virtual int64 GetPos() { return m_Pos; }
 	virtual void SetPos(int64 pos) { m_Pos = (ptrdiff_t)pos; }
@@ -650,6 +717,12 @@ public:
 	virtual size_t Read(void *Data, size_t MaxLength);
 	virtual bool End();
 	virtual size_t Skip(size_t MaxLength);
+	/** Borrows from the read buffer, so it is available only if readBufSize > 0. */
+	virtual size_t AcquireReadSpan(const void **OutData);
+	virtual void ReleaseRead(size_t Size);
+	/** Borrows from the write buffer, so it is available only if MinSize <= writeBufSize. */
+	virtual size_t AcquireWriteSpan(void **OutData, size_t MinSize = 1);
+	virtual void CommitWrite(size_t Size);
 
 	/// Writes single char/byte
 	void WriteChar(char ch) { if (m_WriteBufIndex == m_WriteBufSize) DoFlush(); m_WriteBuf[m_WriteBufIndex++] = ch; }
@@ -721,17 +794,102 @@ public:
 #endif
 };
 
+/// 128-bit hash value
+struct HASH128
+{
+	uint64 Low;
+	uint64 High;
+
+	bool operator == (const HASH128 &h) const { return Low == h.Low && High == h.High; }
+	bool operator != (const HASH128 &h) const { return Low != h.Low || High != h.High; }
+	bool operator < (const HASH128 &h) const { return High < h.High || (High == h.High && Low < h.Low); }
+};
+
+/// Klasa obliczajca szybki hash 64- lub 128-bitowy z kolejno podawanych blokw danych
+/** Algorithm: XXH3 from xxHash 0.8 by Yann Collet, http://www.xxhash.com/ - results
+are the same as of XXH3_64bits_withSeed and XXH3_128bits_withSeed. Not cryptographic,
+but good quality and many times faster than Hash_Calc, MurmurHash or MD5_Calc - use it
+to compare file contents or as a key of hash table (see common::XXH3_Hasher).
+Bulk data is processed with SSE2 where available.
+
+Strumie tylko do zapisu.
+XXH3_Calc::Finish64() and XXH3_Calc::Finish128() can be called at any time and then more
+data can be written.
+XXH3_Calc::Reset() - rozpoczyna liczenie nowej sumy. */
+class XXH3_Calc : public Stream
+{
+public:
+	/// \internal
+	static const size_t SECRET_SIZE = 192;
+	/// \internal
+	static const size_t INTERNAL_BUFFER_SIZE = 256;
+
+private:
+	uint64 m_Acc[8];
+	uint64 m_TotalLen;
+	uint64 m_Seed;
+	// Number of stripes processed in current block
+	size_t m_StripesSoFar;
+	size_t m_BufferedSize;
+	uint8 m_Secret[SECRET_SIZE];
+	uint8 m_Buffer[INTERNAL_BUFFER_SIZE];
+
+	void Digest(uint64 *OutAcc, const uint8 **OutSecret);
+
+public:
+	XXH3_Calc(uint64 Seed = 0) { Reset(Seed); }
+
+	// ======== Implementacja Stream ========
+	virtual void Write(const void *Data, size_t Size);
+
+	/// Zwraca policzony dotychczas hash 64-bitowy
+	uint64 Finish64();
+	/// Zwraca policzony dotychczas hash 128-bitowy
+	HASH128 Finish128();
+	/// Rozpoczyna liczenie nowej sumy
+	void Reset(uint64 Seed = 0);
+
+	// ======== Statyczne ========
+	/// Po prostu oblicza hash z podanych danych
+	static uint64 Calc64(const void *Data, size_t DataLength, uint64 Seed = 0);
+	static HASH128 Calc128(const void *Data, size_t DataLength, uint64 Seed = 0);
+};
+
+/// Hash functor for hash tables, e.g. std::unordered_map, using XXH3_Calc
+/** Works for string, wstring and any type with no padding bytes, like numbers or pointers. */
+struct XXH3_Hasher
+{
+	size_t operator () (const string &s) const { return (size_t)XXH3_Calc::Calc64(s.data(), s.length()); }
+	size_t operator () (const wstring &s) const { return (size_t)XXH3_Calc::Calc64(s.data(), s.length() * sizeof(wchar_t)); }
+	template <typename T>
+	size_t operator () (const T &v) const { return (size_t)XXH3_Calc::Calc64(&v, sizeof(T)); }
+};
+
+/// Variant of CRC32 checksum
+enum CRC32_TYPE
+{
+	/// Polynomial 0x04C11DB7 - used by zip, gzip, PNG, Ethernet
+	CRC32_STANDARD,
+	/// CRC32C, polynomial 0x1EDC6F41 (Castagnoli) - used by iSCSI, ext4, SSE4.2 crc32 instruction
+	CRC32_CASTAGNOLI,
+};
+
 /// Klasa obliczajca sum CRC32 z kolejno podawanych blokw danych
 /** Strumie tylko do zapisu.
 CRC32_Calc::GetResult() - wyliczon dotychczas sum mona otrzymywa w kadej chwili, a potem dalej dodawa nowe dane.
-CRC32_Calc::Reset() - rozpoczyna liczenie nowej sumy kontrolnej. */
+CRC32_Calc::Reset() - rozpoczyna liczenie nowej sumy kontrolnej.
+
+Uses the fastest method supported by the CPU, chosen at runtime: PCLMULQDQ for
+CRC32_STANDARD, SSE4.2 crc32 instruction for CRC32_CASTAGNOLI, otherwise
+slice-by-16 tables. */
 class CRC32_Calc : public Stream
 {
 private:
 	uint m_CRC;
+	CRC32_TYPE m_Type;
 
 public:
-	CRC32_Calc() { m_CRC = 0xFFFFFFFFu; }
+	CRC32_Calc(CRC32_TYPE Type = CRC32_STANDARD) : m_CRC(0xFFFFFFFFu), m_Type(Type) { }
 
 	// ======== Implementacja Stream ========
 	virtual void Write(const void *Data, size_t Size);
@@ -743,7 +901,7 @@ public:
 
 	// ======== Statyczne ========
 	/// Po prostu oblicza sum kontroln z podanych danych
-	static uint Calc(const void *Data, size_t DataLength);
+	static uint Calc(const void *Data, size_t DataLength, CRC32_TYPE Type = CRC32_STANDARD);
 };
 
 /// Suma MD5
@@ -788,11 +946,9 @@ MD5_Calc::Reset() - rozpoczyna liczenie sumy od nowa. */
 class MD5_Calc : public Stream
 {
 private:
-	uint32 total[2];
-	uint32 state[4];
-	uint8 buffer[64];
-
-	void Process(uint8 data[64]);
+	uint64 m_Total;
+	uint32 m_State[4];
+	uint8 m_Buffer[64];
 
 public:
 	MD5_Calc();
@@ -810,6 +966,104 @@ public:
 	static void Calc(MD5_SUM *Out, const void *Buf, size_t BufLen);
 };
 
+/// Suma SHA-1
+/** Suma ma 160 bitw - 20 bajtw. */
+struct SHA1_SUM
+{
+	uint8 Data[20];
+
+	uint8 & operator [] (size_t i) { return Data[i]; }
+	uint8 operator [] (size_t i) const { return Data[i]; }
+
+	bool operator == (const SHA1_SUM &s) const;
+	bool operator != (const SHA1_SUM &s) const;
+	bool operator < (const SHA1_SUM &s) const;
+};
+
+/// Suma SHA-256
+/** Suma ma 256 bitw - 32 bajty. */
+struct SHA256_SUM
+{
+	uint8 Data[32];
+
+	uint8 & operator [] (size_t i) { return Data[i]; }
+	uint8 operator [] (size_t i) const { return Data[i]; }
+
+	bool operator == (const SHA256_SUM &s) const;
+	bool operator != (const SHA256_SUM &s) const;
+	bool operator < (const SHA256_SUM &s) const;
+};
+
+void SHA1ToStr(tstring *Out, const SHA1_SUM &Sum);
+bool StrToSHA1(SHA1_SUM *Out, const tstring &s);
+void SHA256ToStr(tstring *Out, const SHA256_SUM &Sum);
+bool StrToSHA256(SHA256_SUM *Out, const tstring &s);
+
+/// Klasa obliczajca sum SHA-1 z kolejno podawanych blokw danych
+/** Strumie tylko do zapisu. Uses SHA extensions of the CPU (SHA-NI) when available.
+Prawidowe uycie: SHA1_Calc::Write(), SHA1_Calc::Write() (lub inne funkcje zapisujce), ..., SHA1_Calc::Finish().
+Po wywoaniu Finish nie mona dalej zapisywa danych!
+SHA1_Calc::Reset() - rozpoczyna liczenie sumy od nowa. */
+class SHA1_Calc : public Stream
+{
+private:
+	uint64 m_Total;
+	uint32 m_State[5];
+	uint8 m_Buffer[64];
+
+public:
+	SHA1_Calc() { Reset(); }
+
+	// ======== Implementacja Stream ========
+	virtual void Write(const void *Data, size_t Size);
+
+	/// Koczy obliczenia i zwraca policzon sum
+	void Finish(SHA1_SUM *Out);
+	/// Rozpoczyna liczenie nowej sumy
+	void Reset();
+
+	// ======== Statyczne ========
+	/// Po prostu oblicza sum kontroln z podanych danych
+	static void Calc(SHA1_SUM *Out, const void *Buf, size_t BufLen);
+};
+
+/// Klasa obliczajca sum SHA-256 z kolejno podawanych blokw danych
+/** Strumie tylko do zapisu. Uses SHA extensions of the CPU (SHA-NI) when available.
+Prawidowe uycie: SHA256_Calc::Write(), SHA256_Calc::Write() (lub inne funkcje zapisujce), ..., SHA256_Calc::Finish().
+Po wywoaniu Finish nie mona dalej zapisywa danych!
+SHA256_Calc::Reset() - rozpoczyna liczenie sumy od nowa. */
+class SHA256_Calc : public Stream
+{
+private:
+	uint64 m_Total;
+	uint32 m_State[8];
+	uint8 m_Buffer[64];
+
+public:
+	SHA256_Calc() { Reset(); }
+
+	// ======== Implementacja Stream ========
+	virtual void Write(const void *Data, size_t Size);
+
+	/// Koczy obliczenia i zwraca policzon sum
+	void Finish(SHA256_SUM *Out);
+	/// Rozpoczyna liczenie nowej sumy
+	void Reset();
+
+	// ======== Statyczne ========
+	/// Po prostu oblicza sum kontroln z podanych danych
+	static void Calc(SHA256_SUM *Out, const void *Buf, size_t BufLen);
+};
+
+/// \internal
+/** Makes SHA1_Calc, SHA256_Calc and CRC32_Calc use the portable implementation also
+on a CPU with SHA, SSE4.2 or PCLMULQDQ extensions - for testing. Don't call while
+a sum is calculated in another thread. */
+void _SetForceScalarHashes(bool Force);
+/// \internal
+/** Makes Hex and Base64 encoders and decoders skip their SSSE3/AVX2 versions - for testing. */
+void _SetForceScalarCoding(bool Force);
+
 /// Koduje lub dekoduje zapisywane/odczytywane bajty XOR podany bajt lub cig bajtw.
 /** Mapuje bezporednio bajty na bajty strumienia do ktrego jest podczony,
 nic nie buforuje, wic mona operowa te na strumieniu Stream. */
@@ -1071,6 +1325,12 @@ public:
 	virtual void MustRead(void *Out, size_t Length);
 	virtual bool End();
 	virtual size_t Skip(size_t MaxLength);
+	/** Data may wrap around the end of the buffer, so the block may be shorter than GetSize(). */
+	virtual size_t AcquireReadSpan(const void **OutData);
+	virtual void ReleaseRead(size_t Size);
+	/** Free space may wrap around the end of the buffer, so the block may be shorter than free space. */
+	virtual size_t AcquireWriteSpan(void **OutData, size_t MinSize = 1);
+	virtual void CommitWrite(size_t Size);
 
 private:
 	size_t m_Capacity;
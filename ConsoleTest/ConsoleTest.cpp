@@ -12,6 +12,7 @@
 #include "../Common/ZlibUtils.hpp"
 #include "../Common/Logger.hpp"
 #include "../Common/ObjList.hpp"
+#include "../Common/AsyncStream.hpp"
 
 #ifdef _WIN32
 	#include "../Common/BstrString.hpp"
@@ -20,6 +21,10 @@
 #include <iostream>
 #include <ios>
 #include <queue>
+#ifndef _WIN32
+	#include <sys/resource.h>
+	#include <signal.h>
+#endif
 
 using namespace std;
 using namespace common;
@@ -540,6 +545,22 @@ void TestMath()
     }
 }
 
+class TraceThread : public Thread
+{
+public:
+	TraceThread(TraceRecorder *Recorder) : m_Recorder(Recorder) { }
+
+protected:
+	virtual void Run()
+	{
+		for (uint i = 0; i < 10; i++)
+			TRACE_SCOPE(*m_Recorder, _T("Thread"));
+	}
+
+private:
+	TraceRecorder *m_Recorder;
+};
+
 void TestProfiler()
 {
 	WriteLine(_T("==================== PROFILER ===================="));
@@ -568,11 +589,231 @@ void TestProfiler()
 	tstring Result;
 	g_Profiler.FormatString(&Result, PROFILER_UNITS_MILLISECONDS);
 	tcout << _T("Result:") << endl << Result << endl;
+
+	FastProfiler fastProfiler;
+	for (int i = 0; i < 100; i++)
+	{
+		PROFILE_SCOPE(fastProfiler, _T("Loop"));
+		for (int j = 0; j < 10; j++)
+		{
+			PROFILE_SCOPE(fastProfiler, _T("Inner"));
+		}
+	}
+	fastProfiler.FormatString(&Result, PROFILER_UNITS_MILLISECONDS);
+	tcout << _T("FastProfiler result:") << endl << Result << endl;
+
+	TraceRecorder traceRecorder(1024);
+	traceRecorder.SetThreadName(_T("Main"));
+	{
+		TRACE_SCOPE(traceRecorder, _T("Outer"));
+		// Wyczenie w rodku zdarzenia nie moe zostawi go bez koca
+		traceRecorder.SetEnabled(false);
+		{
+			TRACE_SCOPE(traceRecorder, _T("Disabled"));
+			traceRecorder.SetEnabled(true);
+		}
+		// Wtki kocz si, wic ich numery s uywane ponownie
+		for (uint i = 0; i < 4; i++)
+		{
+			TraceThread thread(&traceRecorder);
+			thread.Start();
+			thread.Join();
+		}
+	}
+	VectorStream traceStream;
+	traceRecorder.ExportChromeTrace(&traceStream);
+	string trace(traceStream.Data(), (size_t)traceStream.GetSize());
+	assert(trace.find("\"Outer\",\"ph\":\"X\"") != string::npos);
+	assert(trace.find("\"Disabled\"") == string::npos);
+	assert(trace.find("\"thread_name\"") != string::npos);
+	size_t threadEvents = 0;
+	for (size_t pos = trace.find("\"Thread\""); pos != string::npos; pos = trace.find("\"Thread\"", pos + 1))
+		threadEvents++;
+	assert(threadEvents == 4 * 10);
+	tcout << _T("TraceRecorder: ") << trace.length() << _T(" bytes of JSON") << endl;
+
+#ifndef _WIN32
+	SamplingProfiler samplingProfiler;
+	// Kolejne uruchomienia - sygna zostawiony po Stop nie moe zabi procesu
+	for (uint i = 0; i < 100; i++)
+	{
+		samplingProfiler.Start(10000);
+		samplingProfiler.Stop();
+	}
+	samplingProfiler.Clear();
+	samplingProfiler.Start(1000);
+	GameTime sampleEnd = GetCurrentGameTime() + MillisecondsToGameTime(300);
+	volatile uint sampledSum = 0;
+	while (GetCurrentGameTime() < sampleEnd)
+	{
+		PROFILE_SCOPE(fastProfiler, _T("Sampled"));
+		for (uint j = 0; j < 10000; j++)
+			sampledSum += j;
+	}
+	samplingProfiler.Stop();
+	assert(!samplingProfiler.IsRunning());
+	assert(samplingProfiler.GetSampleCount() > 0);
+	VectorStream foldedStream;
+	samplingProfiler.ExportFoldedStacks(&foldedStream);
+	string folded(foldedStream.Data(), (size_t)foldedStream.GetSize());
+	assert(folded.find("Sampled;") != string::npos);
+	tcout << _T("SamplingProfiler: ") << samplingProfiler.GetSampleCount() << _T(" samples") << endl;
+#endif
+
+	// Histogram - mae wartoci dokadnie, wiksze z bdem najwyej 1/16
+	{
+		LatencyHistogram smallHistogram;
+		for (int64 v = 1; v <= 20; v++)
+			smallHistogram.Record(GameTime(v));
+		assert(smallHistogram.GetCount() == 20);
+		assert(smallHistogram.GetPercentile(0.0) == GameTime(1ll));
+		assert(smallHistogram.GetPercentile(50.0) == GameTime(10ll));
+		assert(smallHistogram.GetPercentile(100.0) == GameTime(20ll));
+		assert(LatencyHistogram().GetPercentile(50.0) == GameTime::ZERO);
+
+		LatencyHistogram allHistogram, lowHistogram, highHistogram;
+		for (int64 v = 1; v <= 1000; v++)
+		{
+			allHistogram.Record(GameTime(v));
+			(v <= 500 ? lowHistogram : highHistogram).Record(GameTime(v));
+		}
+		assert(allHistogram.GetMin() == GameTime(1ll) && allHistogram.GetMax() == GameTime(1000ll));
+		int64 p50 = allHistogram.GetPercentile(50.0).GetInt8();
+		int64 p99 = allHistogram.GetPercentile(99.0).GetInt8();
+		assert(p50 >= 500 && p50 <= 500 + 500 / 16);
+		assert(p99 >= 990 && p99 <= 1000);
+		assert(allHistogram.GetPercentile(100.0) == GameTime(1000ll));
+
+		LatencyHistogram mergedHistogram;
+		mergedHistogram.Merge(highHistogram);
+		mergedHistogram.Merge(lowHistogram);
+		mergedHistogram.Merge(LatencyHistogram());
+		assert(mergedHistogram.GetCount() == 1000);
+		assert(mergedHistogram.GetMin() == allHistogram.GetMin() && mergedHistogram.GetMax() == allHistogram.GetMax());
+		for (double percent = 0.0; percent <= 100.0; percent += 12.5)
+			assert(mergedHistogram.GetPercentile(percent) == allHistogram.GetPercentile(percent));
+	}
+
+	// FrameProfiler pamita 4 ostatnie ramki, przekroczone ramki to 1 i 4
+	{
+		FrameProfiler frameProfiler(4, 0.005);
+		bool overBudget[6];
+		for (uint i = 0; i < 6; i++)
+		{
+			frameProfiler.BeginFrame();
+			{
+				PROFILE_SCOPE(frameProfiler, _T("Frame work"));
+				if (i == 1 || i == 4)
+					Wait(20);
+			}
+			overBudget[i] = frameProfiler.EndFrame();
+		}
+		assert(!overBudget[0] && overBudget[1] && overBudget[4] && !overBudget[5]);
+		// Zostay ramki 2..5, ramka 1 wypada z piercienia
+		assert(frameProfiler.GetRecordedFrameCount() == 4);
+		assert(frameProfiler.GetOverBudgetFrameCount() == 1);
+		assert(frameProfiler.IsFrameOverBudget(2));
+		assert(frameProfiler.GetFrameSeconds(2) >= 0.02);
+		assert(frameProfiler.GetNodeCount() == 2);
+		FrameProfiler::SCOPE_STATS scopeStats;
+		frameProfiler.GetScopeStats(&scopeStats, 1);
+		assert(scopeStats.FrameCount == 4);
+		assert(scopeStats.MaxSeconds >= 0.02 && scopeStats.MinSeconds < 0.005);
+		frameProfiler.FormatString(&Result, PROFILER_UNITS_MILLISECONDS);
+		tcout << _T("FrameProfiler result:") << endl << Result << endl;
+	}
+
+	// Liczniki sprztowe niedostpne - profiler mierzy tylko czas
+	_SetHardwareCountersUnavailable(true);
+	{
+		HardwareCounters counters;
+		assert(!counters.IsAvailable());
+		PROFILER_COUNTERS values;
+		values.Cycles = values.Instructions = 1;
+		counters.Read(&values);
+		assert(values.Cycles == 0 && values.Instructions == 0 && values.GetIpc() == 0.0);
+
+		Profiler profiler;
+		assert(!profiler.EnableHardwareCounters(true));
+		{
+			PROFILE_GUARD(profiler, _T("Without counters"));
+		}
+		ProfilerItem *item = profiler.GetRootItem()->GetItem(0);
+		assert(item->GetCount() == 1 && !item->HasCounters());
+	}
+	_SetHardwareCountersUnavailable(false);
+	{
+		HardwareCounters counters;
+		Profiler profiler;
+		assert(profiler.EnableHardwareCounters(true) == counters.IsAvailable());
+	}
+
+	// ledzenie alokacji - operatory new i delete nie s tu podmienione, wic liczy si tylko to
+	EnableAllocationTracking(true);
+	{
+		ALLOCATION_COUNTERS before = GetThreadAllocationCounters();
+		TrackedFree(TrackedAlloc(100));
+		TrackedFree(NULL);
+		FreeList<uint64> freeList(4);
+		uint64 *a = freeList.New(), *b = freeList.New();
+		freeList.Delete(a);
+		freeList.Delete(b);
+		ALLOCATION_COUNTERS diff;
+		diff.Clear();
+		diff.Add(before, GetThreadAllocationCounters());
+		assert(diff.HeapAllocCount == 1 && diff.HeapAllocBytes == 100 && diff.HeapFreeCount == 1);
+		assert(diff.FreeListAllocCount == 2 && diff.FreeListAllocBytes == 2 * sizeof(uint64));
+
+		Profiler profiler;
+		{
+			PROFILE_GUARD(profiler, _T("Allocating"));
+			TrackedFree(TrackedAlloc(10));
+		}
+		ProfilerItem *item = profiler.GetRootItem()->GetItem(0);
+		assert(item->HasAllocations() && item->GetAllocationRunCount() == 1);
+		assert(item->GetAllocations().HeapAllocCount == 1 && item->GetAllocations().HeapAllocBytes == 10);
+
+		FrameProfiler frameProfiler(2);
+		frameProfiler.BeginFrame();
+		TrackedFree(TrackedAlloc(24));
+		TrackedFree(TrackedAlloc(8));
+		frameProfiler.EndFrame();
+		assert(frameProfiler.GetFrameAllocations(0).HeapAllocCount == 2);
+		assert(frameProfiler.GetFrameAllocations(0).HeapAllocBytes == 32);
+		assert(frameProfiler.GetFrameAllocations(0).HeapFreeCount == 2);
+	}
+	EnableAllocationTracking(false);
+	{
+		ALLOCATION_COUNTERS before = GetThreadAllocationCounters();
+		TrackedFree(TrackedAlloc(100));
+		assert(GetThreadAllocationCounters().HeapAllocCount == before.HeapAllocCount);
+		assert(GetThreadAllocationCounters().HeapFreeCount == before.HeapFreeCount);
+	}
 }
 
+class ShardedProfilerThread : public Thread
+{
+public:
+	ShardedProfilerThread(ShardedFlatProfiler<tstring> *Profiler) : m_Profiler(Profiler) { }
+
+protected:
+	virtual void Run()
+	{
+		for (uint i = 0; i < 100; i++)
+		{
+			ShardedFlatProfilerSampler<tstring> sampler(*m_Profiler, _T("Outer"));
+			for (uint j = 0; j < 10; j++)
+				ShardedFlatProfilerSampler<tstring> innerSampler(*m_Profiler, _T("Inner"));
+		}
+	}
+
+private:
+	ShardedFlatProfiler<tstring> *m_Profiler;
+};
+
 void TestFlatProfiler()
 {
-	FlatProfiler<tstring> flatProfiler;
+	FlatProfiler<tstring> flatProfiler(true);
 
 	{
 		FlatProfilerSampler<tstring> sampler(flatProfiler, _T("Main"));
@@ -593,6 +834,38 @@ void TestFlatProfiler()
 	flatProfiler.FormatString(&profile, PROFILER_UNITS_MILLISECONDS);
 	WriteLine(_T("FlatProfiler result:"));
 	WriteLine(profile);
+	{
+		FlatProfiler<tstring>::MapType flatSnapshot;
+		flatProfiler.GetSnapshot(&flatSnapshot);
+		assert(flatSnapshot[_T("Wait10")].Count == 10);
+		assert(!flatSnapshot[_T("Wait10")].Histogram.is_null());
+		assert(flatSnapshot[_T("Wait10")].Histogram->GetCount() == 10);
+	}
+
+	// Kilka wtkw naraz, kady trafia do swojej shardy
+	ShardedFlatProfiler<tstring> shardedProfiler;
+	{
+		scoped_ptr<ShardedProfilerThread> threads[4];
+		for (uint i = 0; i < 4; i++)
+			threads[i].reset(new ShardedProfilerThread(&shardedProfiler));
+		for (uint i = 0; i < 4; i++)
+			threads[i]->Start();
+		for (uint i = 0; i < 4; i++)
+			threads[i]->Join();
+	}
+	ShardedFlatProfiler<tstring>::MapType snapshot;
+	shardedProfiler.GetSnapshot(&snapshot);
+	assert(snapshot.size() == 2);
+	assert(snapshot[_T("Outer")].Count == 4 * 100);
+	assert(snapshot[_T("Inner")].Count == 4 * 100 * 10);
+	// Bez histogramw wpis nie zajmuje na nie pamici
+	assert(snapshot[_T("Outer")].Histogram.is_null());
+	shardedProfiler.FormatString(&profile, PROFILER_UNITS_MILLISECONDS);
+	WriteLine(_T("ShardedFlatProfiler result:"));
+	WriteLine(profile);
+	shardedProfiler.Clear();
+	shardedProfiler.GetSnapshot(&snapshot);
+	assert(snapshot.empty());
 }
 
 void TestStream()
@@ -621,6 +894,158 @@ void TestStream()
 				bs.Read(&byte, 1);
 		}
 	}
+
+	char pattern[1000];
+	for (uint i = 0; i < 1000; i++)
+		pattern[i] = (char)(i * 7 + 3);
+	const void *readSpan;
+	void *writeSpan;
+
+	// MemoryStream - poyczanie nie wychodzi poza stay rozmiar
+	{
+		MemoryStream ms(64);
+		assert(ms.AcquireWriteSpan(&writeSpan, 10) == 64);
+		memcpy(writeSpan, pattern, 10);
+		ms.CommitWrite(10);
+		assert(ms.GetPos() == 10);
+		assert(ms.AcquireWriteSpan(&writeSpan, 55) == 0 && writeSpan == NULL);
+		assert(ms.AcquireWriteSpan(&writeSpan, 54) == 54);
+		ms.Rewind();
+		assert(ms.AcquireReadSpan(&readSpan) == 64);
+		assert(memcmp(readSpan, pattern, 10) == 0);
+		ms.ReleaseRead(4);
+		assert(ms.GetPos() == 4);
+		char buf[6];
+		ms.MustRead(buf, 6);
+		assert(memcmp(buf, pattern + 4, 6) == 0);
+		ms.SetPos(64);
+		assert(ms.AcquireReadSpan(&readSpan) == 0);
+	}
+
+	// VectorStream - ronie o 25%, take przy poyczaniu bloku do zapisu
+	{
+		VectorStream vs;
+		size_t capacity = vs.GetCapacity();
+		for (uint i = 0; i < 200; i++)
+		{
+			vs.Write(&pattern[i], 1);
+			if (vs.GetCapacity() != capacity)
+			{
+				assert(vs.GetCapacity() == capacity + capacity / 4);
+				capacity = vs.GetCapacity();
+			}
+		}
+		while (vs.GetSize() < vs.GetCapacity())
+			vs.Write(&pattern[vs.GetSize()], 1);
+		capacity = vs.GetCapacity();
+		size_t spanSize = vs.AcquireWriteSpan(&writeSpan);
+		assert(vs.GetCapacity() == capacity + capacity / 4);
+		assert(spanSize == vs.GetCapacity() - capacity);
+		// Wicej ni 25% - dokadnie tyle, ile trzeba
+		spanSize = vs.AcquireWriteSpan(&writeSpan, 1000 - capacity);
+		assert(vs.GetCapacity() == 1000 && spanSize == 1000 - capacity);
+		memcpy(writeSpan, pattern + capacity, 1000 - capacity);
+		vs.CommitWrite(1000 - capacity);
+		assert(vs.GetSize() == 1000 && vs.GetPos() == 1000);
+
+		vs.SetPos(100);
+		assert(vs.AcquireReadSpan(&readSpan) == 900);
+		assert(memcmp(readSpan, pattern + 100, 900) == 0);
+		vs.ReleaseRead(900);
+		assert(vs.End() && vs.AcquireReadSpan(&readSpan) == 0);
+		assert(memcmp(vs.Data(), pattern, 1000) == 0);
+	}
+
+	// BufferingStream - bloki z jego buforw
+	{
+		VectorStream vs;
+		{
+			BufferingStream bs(&vs, 0, 16);
+			assert(bs.AcquireWriteSpan(&writeSpan, 17) == 0);
+			assert(bs.AcquireWriteSpan(&writeSpan, 10) == 16);
+			memcpy(writeSpan, pattern, 10);
+			bs.CommitWrite(10);
+			assert(vs.GetSize() == 0);
+			// Zostao 6 bajtw, wic najpierw oprnia bufor
+			assert(bs.AcquireWriteSpan(&writeSpan, 10) == 16);
+			assert(vs.GetSize() == 10);
+			memcpy(writeSpan, pattern + 10, 10);
+			bs.CommitWrite(10);
+			assert(bs.AcquireReadSpan(&readSpan) == 0);
+			bs.Flush();
+		}
+		assert(vs.GetSize() == 20 && memcmp(vs.Data(), pattern, 20) == 0);
+
+		vs.Rewind();
+		BufferingStream bs(&vs, 8, 0);
+		assert(bs.AcquireWriteSpan(&writeSpan) == 0);
+		assert(bs.AcquireReadSpan(&readSpan) == 8 && memcmp(readSpan, pattern, 8) == 0);
+		bs.ReleaseRead(3);
+		char buf[20];
+		assert(bs.Read(buf, 5) == 5 && memcmp(buf, pattern + 3, 5) == 0);
+		assert(bs.AcquireReadSpan(&readSpan) == 8 && memcmp(readSpan, pattern + 8, 8) == 0);
+		bs.ReleaseRead(8);
+		assert(bs.AcquireReadSpan(&readSpan) == 4 && memcmp(readSpan, pattern + 16, 4) == 0);
+		bs.ReleaseRead(4);
+		assert(bs.AcquireReadSpan(&readSpan) == 0 && bs.End());
+	}
+
+	// RingBuffer - bloki kocz si na kocu bufora, dalej od pocztku
+	{
+		RingBuffer rb(10);
+		char buf[10];
+		rb.Write("ABCDEFG", 7);
+		rb.MustRead(buf, 5);
+		assert(rb.AcquireWriteSpan(&writeSpan) == 3);
+		assert(rb.AcquireWriteSpan(&writeSpan, 4) == 0);
+		assert(rb.AcquireWriteSpan(&writeSpan, 3) == 3);
+		memcpy(writeSpan, "HIJ", 3);
+		rb.CommitWrite(3);
+		assert(rb.AcquireWriteSpan(&writeSpan) == 5);
+		memcpy(writeSpan, "KLMNO", 5);
+		rb.CommitWrite(5);
+		assert(rb.IsFull() && rb.AcquireWriteSpan(&writeSpan) == 0);
+		assert(rb.AcquireReadSpan(&readSpan) == 5 && memcmp(readSpan, "FGHIJ", 5) == 0);
+		rb.ReleaseRead(5);
+		assert(rb.AcquireReadSpan(&readSpan) == 5 && memcmp(readSpan, "KLMNO", 5) == 0);
+		rb.ReleaseRead(2);
+		assert(rb.GetSize() == 3);
+		rb.MustRead(buf, 3);
+		assert(memcmp(buf, "MNO", 3) == 0);
+		assert(rb.IsEmpty() && rb.AcquireReadSpan(&readSpan) == 0);
+	}
+
+	// Kopiowanie - najpierw z bloku rda (MemoryStream), potem do bloku celu (VectorStream)
+	{
+		MemoryStream src(1000, pattern);
+		string dstData;
+		StringStream dst(&dstData);
+		assert(dst.CopyFrom(&src, 300) == 300);
+		assert(src.GetPos() == 300);
+		dst.MustCopyFrom(&src, 200);
+		assert(dst.CopyFromToEnd(&src) == 500);
+		assert(src.GetPos() == 1000);
+		assert(dst.CopyFrom(&src, 10) == 0);
+		assert(dstData.length() == 1000 && memcmp(dstData.data(), pattern, 1000) == 0);
+		bool thrown = false;
+		try { dst.MustCopyFrom(&src, 1); } catch (Error &) { thrown = true; }
+		assert(thrown);
+	}
+	{
+		string srcData(pattern, 1000);
+		StringStream src(&srcData);
+		VectorStream dst;
+		assert(dst.CopyFrom(&src, 300) == 300);
+		assert(src.GetPos() == 300);
+		dst.MustCopyFrom(&src, 200);
+		assert(dst.CopyFromToEnd(&src) == 500);
+		assert(src.GetPos() == 1000);
+		assert(dst.CopyFrom(&src, 10) == 0);
+		assert(dst.GetSize() == 1000 && dst.GetPos() == 1000 && memcmp(dst.Data(), pattern, 1000) == 0);
+		bool thrown = false;
+		try { dst.MustCopyFrom(&src, 1); } catch (Error &) { thrown = true; }
+		assert(thrown);
+	}
 }
 
 void TestEncoderDecoder()
@@ -672,6 +1097,194 @@ void TestEncoderDecoder()
 	delete [] EncodedData;
 	delete [] DstData;
 	delete [] SrcData;
+
+	WriteLine(_T("==================== Hex, Base64 - SIMD ===================="));
+
+	// Wersja SSSE3/AVX2 (jeli procesor j ma) porwnana z przenon. Dugoci obejmuj
+	// pene bloki wersji SIMD i wszystkie moliwe kocwki.
+	{
+		std::vector<char> Bytes(300), Decoded(300);
+		g_Rand.RandData(&Bytes[0], Bytes.size());
+		string Hex, HexScalar, HexLower, HexLowerScalar, B64, B64Scalar, Bad;
+		for (size_t Length = 0; Length <= 200; Length++)
+		{
+			_SetForceScalarCoding(false);
+			HexEncoder::Encode(&Hex, &Bytes[0], Length);
+			HexEncoder::Encode(&HexLower, &Bytes[0], Length, false);
+			Base64Encoder::Encode(&B64, &Bytes[0], Length);
+			_SetForceScalarCoding(true);
+			HexEncoder::Encode(&HexScalar, &Bytes[0], Length);
+			HexEncoder::Encode(&HexLowerScalar, &Bytes[0], Length, false);
+			Base64Encoder::Encode(&B64Scalar, &Bytes[0], Length);
+			assert( Hex == HexScalar );
+			assert( HexLower == HexLowerScalar );
+			assert( B64 == B64Scalar );
+
+			for (uint Pass = 0; Pass < 2; Pass++)
+			{
+				_SetForceScalarCoding(Pass == 1);
+				assert( HexDecoder::Decode(&Decoded[0], Hex) == Length );
+				assert( memcmp(&Decoded[0], &Bytes[0], Length) == 0 );
+				assert( HexDecoder::Decode(&Decoded[0], HexLower) == Length );
+				assert( memcmp(&Decoded[0], &Bytes[0], Length) == 0 );
+				assert( Base64Decoder::Decode(&Decoded[0], B64) == Length );
+				assert( memcmp(&Decoded[0], &Bytes[0], Length) == 0 );
+
+				// Bdny znak w rnych miejscach - take wewntrz bloku SIMD
+				if (Length > 0)
+				{
+					Bad = Hex;
+					Bad[Length * 13 % Bad.length()] = 'G';
+					assert( HexDecoder::Decode(&Decoded[0], Bad) == SIZE_MAX );
+					Bad = B64;
+					Bad[Length * 13 % Bad.length()] = '!';
+					assert( Base64Decoder::Decode(&Decoded[0], Bad) == SIZE_MAX );
+				}
+			}
+		}
+		_SetForceScalarCoding(false);
+	}
+
+	WriteLine(_T("Hex and Base64 SIMD test succeeded."));
+}
+
+void TestHashes()
+{
+	WriteLine(_T("==================== SHA-1, SHA-256 ===================="));
+
+	tstring Str;
+	SHA1_SUM Sha1, Sha1Scalar;
+	SHA256_SUM Sha256, Sha256Scalar;
+
+	// Wersja z instrukcjami SHA (jeli procesor je ma) i wersja przenona
+	for (uint Pass = 0; Pass < 2; Pass++)
+	{
+		_SetForceScalarHashes(Pass == 1);
+		SHA1_Calc::Calc(&Sha1, "abc", 3);
+		SHA1ToStr(&Str, Sha1);
+		assert( Str == _T("A9993E364706816ABA3E25717850C26C9CD0D89D") );
+		SHA256_Calc::Calc(&Sha256, "abc", 3);
+		SHA256ToStr(&Str, Sha256);
+		assert( Str == _T("BA7816BF8F01CFEA414140DE5DAE2223B00361A396177A9CB410FF61F20015AD") );
+	}
+
+	// Wiele blokw, zapis w dwch czciach niewyrwnanych do bloku
+	const uint MAX_SIZE = 4096;
+	std::vector<char> Data(MAX_SIZE);
+	g_Rand.RandData(&Data[0], MAX_SIZE);
+	for (uint i = 0; i < 100; i++)
+	{
+		uint Size = g_Rand.RandUint(1, MAX_SIZE+1);
+		uint Split = g_Rand.RandUint(0, Size+1);
+
+		_SetForceScalarHashes(false);
+		{
+			SHA1_Calc Calc;
+			Calc.Write(&Data[0], Split);
+			Calc.Write(&Data[0] + Split, Size - Split);
+			Calc.Finish(&Sha1);
+		}
+		SHA256_Calc::Calc(&Sha256, &Data[0], Size);
+
+		_SetForceScalarHashes(true);
+		SHA1_Calc::Calc(&Sha1Scalar, &Data[0], Size);
+		{
+			SHA256_Calc Calc;
+			Calc.Write(&Data[0], Split);
+			Calc.Write(&Data[0] + Split, Size - Split);
+			Calc.Finish(&Sha256Scalar);
+		}
+
+		assert( Sha1 == Sha1Scalar && Sha256 == Sha256Scalar );
+	}
+	_SetForceScalarHashes(false);
+
+	WriteLine(_T("SHA-1 and SHA-256 test succeeded."));
+
+	WriteLine(_T("==================== CRC32, CRC32C ===================="));
+
+	std::vector<char> Pattern(1000);
+	for (size_t i = 0; i < Pattern.size(); i++)
+		Pattern[i] = (char)(i * 7 + 3);
+
+	// Wersja z PCLMULQDQ / SSE4.2 (jeli procesor je ma) i wersja przenona.
+	// PCLMULQDQ liczy dopiero od 64 bajtw, std dusze dane.
+	for (uint Pass = 0; Pass < 2; Pass++)
+	{
+		_SetForceScalarHashes(Pass == 1);
+		assert( CRC32_Calc::Calc("123456789", 9) == 0xCBF43926 );
+		assert( CRC32_Calc::Calc("123456789", 9, CRC32_CASTAGNOLI) == 0xE3069283 );
+		assert( CRC32_Calc::Calc(&Pattern[0], 100) == 0xAA316B09 );
+		assert( CRC32_Calc::Calc(&Pattern[0], 1000) == 0x17BC2A46 );
+		assert( CRC32_Calc::Calc(&Pattern[0], 1000, CRC32_CASTAGNOLI) == 0xDD2EDFF7 );
+	}
+
+	for (uint i = 0; i < 100; i++)
+	{
+		uint Size = g_Rand.RandUint(1, MAX_SIZE+1);
+		uint Split = g_Rand.RandUint(0, Size+1);
+		CRC32_TYPE Type = (i % 2) ? CRC32_CASTAGNOLI : CRC32_STANDARD;
+
+		_SetForceScalarHashes(false);
+		CRC32_Calc Calc(Type);
+		Calc.Write(&Data[0], Split);
+		Calc.Write(&Data[0] + Split, Size - Split);
+
+		_SetForceScalarHashes(true);
+		assert( Calc.GetResult() == CRC32_Calc::Calc(&Data[0], Size, Type) );
+	}
+	_SetForceScalarHashes(false);
+
+	WriteLine(_T("CRC32 and CRC32C test succeeded."));
+
+	WriteLine(_T("==================== XXH3 ===================="));
+
+	// Wyniki oryginalnej biblioteki xxHash 0.8 - po jednej dugoci z kadego przedziau
+	struct XXH3_VECTOR { size_t Length; uint64 Hash; };
+	const XXH3_VECTOR XXH3_VECTORS[] = {
+		{    0, 0x2D06800538D394C2ull },
+		{    1, 0x13E608BC156DEFEDull },
+		{    3, 0xA9088DDA485B481Cull },
+		{    4, 0x6D9253B16C8B1ED3ull },
+		{    8, 0x60539DB630471163ull },
+		{    9, 0xFEFF668361D723A8ull },
+		{   16, 0xB8C859B0F030B585ull },
+		{   17, 0x714A04408E79B80Full },
+		{  128, 0x67425A03650261BFull },
+		{  129, 0xC664BF3311C6ABC4ull },
+		{  240, 0x64556DC6B462A6CFull },
+		{  241, 0x8BEADD3A8874FE17ull },
+		{ 1000, 0x6C4F14BD97BD9E82ull },
+	};
+	Pattern.resize(5000);
+	for (size_t i = 0; i < Pattern.size(); i++)
+		Pattern[i] = (char)(i * 7 + 3);
+	for (size_t i = 0; i < sizeof(XXH3_VECTORS) / sizeof(XXH3_VECTORS[0]); i++)
+	{
+		assert( XXH3_Calc::Calc64(&Pattern[0], XXH3_VECTORS[i].Length) == XXH3_VECTORS[i].Hash );
+		// Wersja strumieniowa, zapis po kawaku
+		XXH3_Calc Calc;
+		for (size_t Pos = 0; Pos < XXH3_VECTORS[i].Length; Pos += 7)
+			Calc.Write(&Pattern[Pos], std::min<size_t>(7, XXH3_VECTORS[i].Length - Pos));
+		assert( Calc.Finish64() == XXH3_VECTORS[i].Hash );
+	}
+	// Kilka blokw po 1024 bajty i ziarno
+	assert( XXH3_Calc::Calc64(&Pattern[0], 5000) == 0x799AADDD7339581Dull );
+	assert( XXH3_Calc::Calc64(&Pattern[0], 100, 0x9E3779B185EBCA87ull) == 0x1D8EDE9832D18891ull );
+	assert( XXH3_Calc::Calc64(&Pattern[0], 1000, 0x9E3779B185EBCA87ull) == 0xFCB772733283814Aull );
+	{
+		XXH3_Calc Calc;
+		Calc.Write(&Pattern[0], 1500);
+		// Finish64 nie koczy liczenia - mona pisa dalej
+		assert( Calc.Finish64() == XXH3_Calc::Calc64(&Pattern[0], 1500) );
+		Calc.Write(&Pattern[1500], 3500);
+		assert( Calc.Finish64() == 0x799AADDD7339581Dull );
+		Calc.Reset(0x9E3779B185EBCA87ull);
+		Calc.Write(&Pattern[0], 1000);
+		assert( Calc.Finish64() == 0xFCB772733283814Aull );
+	}
+
+	WriteLine(_T("XXH3 test succeeded."));
 }
 
 class SmartPtrTestClass
@@ -1138,6 +1751,138 @@ void TestZlibUtils()
 	}
 }
 
+// Strumie rzucajcy bd po przetworzeniu Limit bajtw
+class FailingStream : public common::Stream
+{
+public:
+	size_t m_Limit, m_Pos;
+
+	FailingStream(size_t Limit) : m_Limit(Limit), m_Pos(0) { }
+
+	virtual void Write(const void *Data, size_t Size)
+	{
+		if (m_Pos + Size > m_Limit)
+			throw common::Error(_T("FailingStream: Write failed."), __TFILE__, __LINE__);
+		m_Pos += Size;
+	}
+	virtual size_t Read(void *Data, size_t MaxLength)
+	{
+		if (m_Pos + MaxLength > m_Limit)
+			throw common::Error(_T("FailingStream: Read failed."), __TFILE__, __LINE__);
+		memset(Data, 'x', MaxLength);
+		m_Pos += MaxLength;
+		return MaxLength;
+	}
+};
+
+void TestAsyncStream()
+{
+	WriteLine(_T("==================== AsyncOverlayStream ===================="));
+
+	// Sabo kompresowalne dane, eby przez mae bufory przeszo wiele blokw
+	std::vector<char> Data(100 * 1024);
+	uint Seed = 1;
+	for (size_t i = 0; i < Data.size(); i++)
+	{
+		Seed = Seed * 1103515245 + 12345;
+		Data[i] = (char)('a' + (Seed >> 16) % 26);
+	}
+
+	// Kompresja w ASYNC_WRITE, dekompresja w ASYNC_READ
+	common::VectorStream Compressed;
+	{
+		common::AsyncOverlayStream Async(&Compressed, common::ASYNC_WRITE, 1000, 3);
+		{
+			common::ZlibCompressionStream Zlib(&Async);
+			for (size_t i = 0; i < Data.size(); i += 777)
+				Zlib.Write(&Data[i], std::min<size_t>(777, Data.size() - i));
+		}
+		Async.Close();
+		// Drugie wywoanie nic nie robi
+		Async.Close();
+	}
+	assert( Compressed.GetSize() > 10 * 1000 );
+	Compressed.Rewind();
+	{
+		common::AsyncOverlayStream Async(&Compressed, common::ASYNC_READ, 1000, 3);
+		common::ZlibDecompressionStream Zlib(&Async);
+		std::vector<char> Out(Data.size());
+		for (size_t i = 0; i < Out.size(); i += 1234)
+			Zlib.MustRead(&Out[i], std::min<size_t>(1234, Out.size() - i));
+		assert( Zlib.End() );
+		assert( Out == Data );
+		assert( Async.End() );
+		char Ch;
+		assert( Async.Read(&Ch, 1) == 0 );
+	}
+
+	// Odczyt bezporednio z buforw
+	{
+		common::MemoryStream Mem(Data.size(), &Data[0]);
+		common::AsyncOverlayStream Async(&Mem, common::ASYNC_READ, 1000, 2);
+		assert( Async.Skip(10) == 10 );
+		size_t Pos = 10;
+		const void *Span;
+		size_t SpanSize;
+		while ((SpanSize = Async.AcquireReadSpan(&Span)) > 0)
+		{
+			assert( SpanSize <= 1000 );
+			assert( memcmp(Span, &Data[Pos], SpanSize) == 0 );
+			Async.ReleaseRead(SpanSize);
+			Pos += SpanSize;
+		}
+		assert( Pos == Data.size() );
+
+		bool Thrown = false;
+		try { Async.Write(&Data[0], 1); } catch (common::Error &) { Thrown = true; }
+		assert( Thrown );
+	}
+
+	// Bd zapisu w tle zgoszony dopiero przez Close
+	{
+		FailingStream Failing(100);
+		common::AsyncOverlayStream Async(&Failing, common::ASYNC_WRITE, 1000, 2);
+		Async.Write(&Data[0], 500);
+		bool Thrown = false;
+		try { Async.Close(); } catch (common::Error &) { Thrown = true; }
+		assert( Thrown );
+		// Wtek zakoczony - destruktor nie robi nic
+	}
+
+	// Bd ju rzucony przez Write albo Flush - destruktor nie zgasza go drugi raz
+	{
+		FailingStream Failing(1500);
+		common::AsyncOverlayStream Async(&Failing, common::ASYNC_WRITE, 1000, 2);
+		bool Thrown = false;
+		try
+		{
+			// Zalenie od wtku bd moe wyj ju z Write
+			Async.Write(&Data[0], 3000);
+			Async.Flush();
+		}
+		catch (common::Error &)
+		{
+			Thrown = true;
+		}
+		assert( Thrown );
+		assert( Failing.m_Pos == 1000 );
+	}
+
+	// Bd odczytu w tle - dane sprzed bdu s dostpne, potem wyjtek
+	{
+		FailingStream Failing(2500);
+		common::AsyncOverlayStream Async(&Failing, common::ASYNC_READ, 1000, 3);
+		char Buf[1000];
+		Async.MustRead(Buf, 1000);
+		Async.MustRead(Buf, 1000);
+		bool Thrown = false;
+		try { Async.Read(Buf, 1000); } catch (common::Error &) { Thrown = true; }
+		assert( Thrown );
+	}
+
+	WriteLine(_T("AsyncOverlayStream test succeeded."));
+}
+
 void TestFiles()
 {
 	WriteLine(_T("==================== FILES ===================="));
@@ -1230,6 +1975,461 @@ void TestFiles()
 	}
 }
 
+void TestFileStream()
+{
+	WriteLine(_T("==================== FileStream ===================="));
+
+	const tstring FileName = _T("FileStream.bin");
+
+	// Wicej buforw ni mieci si w jednym wywoaniu (MAX_IOV = 64), take puste
+	const size_t BUFFER_COUNT = 100;
+	std::vector<char> Data;
+	std::vector<common::IO_BUFFER> Buffers(BUFFER_COUNT);
+	for (size_t i = 0; i < BUFFER_COUNT; i++)
+		Buffers[i].Size = i % 10;
+	for (size_t i = 0; i < BUFFER_COUNT; i++)
+		for (size_t j = 0; j < Buffers[i].Size; j++)
+			Data.push_back((char)(Data.size() * 7 + 1));
+	{
+		size_t Offset = 0;
+		for (size_t i = 0; i < BUFFER_COUNT; i++)
+		{
+			Buffers[i].Data = &Data[Offset];
+			Offset += Buffers[i].Size;
+		}
+	}
+
+	{
+		common::FileStream File(FileName, common::FM_WRITE);
+		File.WriteV(&Buffers[0], BUFFER_COUNT);
+		assert( File.GetPos() == (int64)Data.size() );
+		assert( File.GetSize() == Data.size() );
+	}
+	{
+		// Bufory wiksze ni plik - pierwsza porcja 64 buforw nie siga koca,
+		// druga koczy si krtkim odczytem
+		std::vector<char> ReadData(BUFFER_COUNT * 6);
+		std::vector<common::IO_BUFFER> ReadBuffers(BUFFER_COUNT);
+		for (size_t i = 0; i < BUFFER_COUNT; i++)
+		{
+			ReadBuffers[i].Data = &ReadData[i * 6];
+			ReadBuffers[i].Size = 6;
+		}
+		common::FileStream File(FileName, common::FM_READ);
+		assert( File.ReadV(&ReadBuffers[0], BUFFER_COUNT) == Data.size() );
+		assert( memcmp(&ReadData[0], &Data[0], Data.size()) == 0 );
+		assert( File.End() );
+		assert( File.ReadV(&ReadBuffers[0], BUFFER_COUNT) == 0 );
+	}
+
+#ifndef _WIN32
+	// Czciowy zapis - limit rozmiaru pliku przerywa WriteV w rodku bufora
+	{
+		const size_t LIMIT = 100;
+		struct rlimit OldLimit, Limit;
+		getrlimit(RLIMIT_FSIZE, &OldLimit);
+		Limit = OldLimit;
+		Limit.rlim_cur = LIMIT;
+		void (*OldHandler)(int) = signal(SIGXFSZ, SIG_IGN);
+		setrlimit(RLIMIT_FSIZE, &Limit);
+		tstring Msg;
+		{
+			common::FileStream File(FileName, common::FM_WRITE);
+			try
+			{
+				File.WriteV(&Buffers[0], BUFFER_COUNT);
+			}
+			catch (common::Error &e)
+			{
+				e.GetMessage_(&Msg);
+			}
+		}
+		setrlimit(RLIMIT_FSIZE, &OldLimit);
+		signal(SIGXFSZ, OldHandler);
+		assert( Msg.find(Format(_T("# bytes written")) % LIMIT) != tstring::npos );
+
+		common::FileStream File(FileName, common::FM_READ);
+		assert( File.GetSize() == LIMIT );
+		std::vector<char> ReadData(LIMIT);
+		File.MustRead(&ReadData[0], LIMIT);
+		assert( memcmp(&ReadData[0], &Data[0], LIMIT) == 0 );
+	}
+#endif
+
+	// ReadAt, WriteAt i SetPosFromEnd
+	{
+		common::FileStream File(FileName, common::FM_WRITE_PLUS);
+		File.Write(&Data[0], Data.size());
+		File.SetPos(10);
+		char Buf[5];
+		assert( File.ReadAt(20, Buf, 5) == 5 );
+		assert( memcmp(Buf, &Data[20], 5) == 0 );
+		File.WriteAt(30, "XYZ", 3);
+		File.WriteAt(Data.size(), "END", 3);
+#ifndef _WIN32
+		assert( File.GetPos() == 10 );
+#endif
+		assert( File.GetSize() == Data.size() + 3 );
+		// Krtki odczyt na kocu pliku
+		assert( File.ReadAt(Data.size() + 1, Buf, 5) == 2 );
+		assert( memcmp(Buf, "ND", 2) == 0 );
+		File.SetPos(30);
+		File.MustRead(Buf, 3);
+		assert( memcmp(Buf, "XYZ", 3) == 0 );
+
+		File.SetPosFromEnd(-3);
+		assert( File.GetPos() == (int64)Data.size() );
+		File.SetPosFromEnd(-(int64)File.GetSize());
+		assert( File.GetPos() == 0 );
+		bool Thrown = false;
+		try { File.SetPosFromEnd(-(int64)File.GetSize() - 1); } catch (common::Error &) { Thrown = true; }
+		assert( Thrown );
+		// Przesunicie nie mieszczce si w 32 bitach, za kocem pliku
+		const int64 FAR_OFFSET = (int64)5 << 32;
+		File.SetPosFromEnd(FAR_OFFSET);
+		assert( File.GetPos() == (int64)File.GetSize() + FAR_OFFSET );
+		File.SetPosFromEnd(0);
+		assert( File.GetPos() == (int64)File.GetSize() );
+	}
+
+#ifndef _WIN32
+	// Tryb dopisywania - zapis zawsze na kocu, pozycj mona zmienia do odczytu
+	// (na Windows FM_APPEND tylko ustawia pozycj na koniec przy otwarciu)
+	{
+		const uint64 Size = Data.size() + 3;
+		common::FileStream File(FileName, common::FM_APPEND_PLUS);
+		assert( File.GetPos() == (int64)Size );
+		File.Write("abc", 3);
+		assert( File.GetPos() == (int64)Size + 3 );
+		assert( File.GetSize() == Size + 3 );
+
+		char Buf[6];
+		File.SetPos(0);
+		assert( File.GetPos() == 0 );
+		File.MustRead(Buf, 5);
+		assert( memcmp(Buf, &Data[0], 5) == 0 );
+		assert( File.GetPos() == 5 );
+
+		File.Write("def", 3);
+		assert( File.GetSize() == Size + 6 );
+		assert( File.GetPos() == (int64)Size + 6 );
+		File.SetPosFromCurrent(-6);
+		File.MustRead(Buf, 6);
+		assert( memcmp(Buf, "abcdef", 6) == 0 );
+
+		File.SetPos(1);
+		// Pierwsze 12 buforw to 46 bajtw
+		File.WriteV(&Buffers[0], 12);
+		assert( File.GetSize() == Size + 6 + 46 );
+		assert( File.GetPos() == (int64)File.GetSize() );
+		File.SetPosFromEnd(-3);
+		File.MustRead(Buf, 3);
+		assert( memcmp(Buf, &Data[43], 3) == 0 );
+		assert( File.End() );
+	}
+#endif
+
+	// DirectCopyFrom - copy_file_range, sendfile i zwyke kopiowanie przez bufor
+	const tstring FileName2 = _T("FileStream2.bin");
+	for (int Sendfile = 0; Sendfile < 2; Sendfile++)
+	{
+		common::_SetForceSendfile(Sendfile != 0);
+		common::FileStream Src(FileName, common::FM_WRITE_PLUS);
+		Src.Write(&Data[0], Data.size());
+		common::FileStream Dst(FileName2, common::FM_WRITE_PLUS);
+		Dst.Write("0123456789", 10);
+		// Kopiowanie ze rodka do rodka - od pozycji obu plikw
+		Src.SetPos(100);
+		Dst.SetPos(5);
+		Dst.MustCopyFrom(&Src, 200);
+		assert( Src.GetPos() == 300 );
+		assert( Dst.GetPos() == 205 );
+		assert( Dst.GetSize() == 205 );
+		// rdo koczy si wczeniej ni dany rozmiar
+		assert( Dst.CopyFrom(&Src, 1000) == Data.size() - 300 );
+		assert( Src.End() );
+		assert( Dst.GetPos() == (int64)Data.size() - 95 );
+		std::vector<char> Out((size_t)Dst.GetSize());
+		assert( Dst.ReadAt(0, &Out[0], Out.size()) == Data.size() - 95 );
+		assert( memcmp(&Out[0], "01234", 5) == 0 );
+		assert( memcmp(&Out[5], &Data[100], Data.size() - 100) == 0 );
+
+		Src.SetPos(0);
+		Dst.SetPos(0);
+		assert( Dst.CopyFromToEnd(&Src) == Data.size() );
+		assert( Dst.GetPos() == (int64)Data.size() );
+		Out.resize(Data.size());
+		assert( Dst.ReadAt(0, &Out[0], Data.size()) == Data.size() );
+		assert( memcmp(&Out[0], &Data[0], Data.size()) == 0 );
+	}
+	common::_SetForceSendfile(false);
+
+	// Z pliku do strumienia w pamici
+	{
+		common::FileStream Src(FileName, common::FM_READ);
+		std::vector<char> Buf(300);
+		common::MemoryStream Mem(Buf.size(), &Buf[0]);
+		Src.SetPos(50);
+		Mem.SetPos(10);
+		Mem.MustCopyFrom(&Src, 200);
+		assert( Src.GetPos() == 250 );
+		assert( Mem.GetPos() == 210 );
+		assert( memcmp(&Buf[10], &Data[50], 200) == 0 );
+	}
+
+	// Ze strumienia w pamici do pliku
+	{
+		common::MemoryStream Mem(Data.size(), &Data[0]);
+		common::FileStream Dst(FileName2, common::FM_WRITE_PLUS);
+		Mem.SetPos(7);
+		assert( Dst.CopyFromToEnd(&Mem) == Data.size() - 7 );
+		assert( Mem.End() );
+		assert( Dst.GetPos() == (int64)Data.size() - 7 );
+		std::vector<char> Out(Data.size() - 7);
+		assert( Dst.ReadAt(0, &Out[0], Out.size()) == Out.size() );
+		assert( memcmp(&Out[0], &Data[7], Out.size()) == 0 );
+	}
+
+#ifndef _WIN32
+	// Cel w trybie dopisywania - zwyke kopiowanie, dane na kocu
+	{
+		common::FileStream Src(FileName, common::FM_READ);
+		common::FileStream Dst(FileName2, common::FM_APPEND_PLUS);
+		const uint64 Size = Dst.GetSize();
+		Src.SetPos(400);
+		Dst.SetPos(0);
+		assert( Dst.CopyFrom(&Src, 100) == Data.size() - 400 );
+		assert( Src.GetPos() == (int64)Data.size() );
+		assert( Dst.GetSize() == Size + Data.size() - 400 );
+		assert( Dst.GetPos() == (int64)Dst.GetSize() );
+		char Buf[50];
+		assert( Dst.ReadAt(Size, Buf, 50) == 50 );
+		assert( memcmp(Buf, &Data[400], 50) == 0 );
+	}
+	// rdo w trybie dopisywania - pozycja za zapisanymi danymi
+	{
+		common::FileStream Src(FileName2, common::FM_APPEND_PLUS);
+		Src.Write("abc", 3);
+		common::FileStream Dst(FileName, common::FM_WRITE);
+		assert( Dst.CopyFrom(&Src, 10) == 0 );
+		assert( Dst.GetSize() == 0 );
+		Src.SetPosFromEnd(-3);
+		Dst.MustCopyFrom(&Src, 3);
+		assert( Dst.GetSize() == 3 );
+		assert( Src.End() );
+	}
+#endif
+
+	common::MustDeleteFile(FileName2);
+	common::MustDeleteFile(FileName);
+	WriteLine(_T("FileStream test succeeded."));
+}
+
+void TestMappedFileStream()
+{
+	WriteLine(_T("==================== MappedFileStream ===================="));
+
+	const tstring FileName = _T("Mapped.bin");
+	const tstring EmptyFileName = _T("MappedEmpty.bin");
+	uint64 FileSize;
+
+	// Kilka razy wicej ni minimalny przyrost mapowania
+	std::vector<char> Data(300 * 1024);
+	for (size_t i = 0; i < Data.size(); i++)
+		Data[i] = (char)(i * 13 + i / 256);
+	const size_t FirstPart = 200 * 1024;
+
+	{
+		common::MappedFileStream File(FileName, common::FM_WRITE);
+		assert(File.IsWritable() && File.GetSize() == 0 && File.Data() == NULL);
+		// Po kawaku - mapowanie ronie, a plik na dysku razem z nim
+		for (size_t i = 0; i < FirstPart; i += 10000)
+			File.Write(&Data[i], std::min<size_t>(10000, FirstPart - i));
+		assert(File.GetSize() == FirstPart && File.GetPos() == (int64)FirstPart);
+		assert(memcmp(File.Data(), &Data[0], FirstPart) == 0);
+
+		// Po Flush plik na dysku ma prawdziwy rozmiar
+		File.Flush();
+		common::MustGetFileItemInfo(FileName, NULL, &FileSize, NULL);
+		assert(FileSize == FirstPart);
+
+		// Po Flush mapowanie znowu ronie
+		File.Write(&Data[FirstPart], Data.size() - FirstPart);
+		assert(File.GetSize() == Data.size());
+		// Zapis w rodku nie zmienia rozmiaru
+		File.SetPos(100);
+		File.Write("abc", 3);
+		memcpy(&Data[100], "abc", 3);
+		assert(File.GetSize() == Data.size() && File.GetPos() == 103);
+	}
+	// Destruktor przycina plik do danych
+	common::MustGetFileItemInfo(FileName, NULL, &FileSize, NULL);
+	assert(FileSize == Data.size());
+
+	{
+		common::MappedFileStream File(FileName, common::FM_READ);
+		assert(!File.IsWritable() && File.GetSize() == Data.size());
+		std::vector<char> Buf(Data.size());
+		File.MustRead(&Buf[0], Buf.size());
+		assert(Buf == Data);
+		assert(File.End() && File.Read(&Buf[0], 1) == 0);
+
+		bool Thrown = false;
+		try { File.Write("x", 1); } catch (common::Error &) { Thrown = true; }
+		assert(Thrown);
+		Thrown = false;
+		try { File.SetSize(10); } catch (common::Error &) { Thrown = true; }
+		assert(Thrown);
+		// Nieudany zapis niczego nie zmienia
+		assert(File.GetSize() == Data.size() && File.GetPos() == (int64)Data.size());
+	}
+
+	{
+		common::MappedFileStream File(FileName, common::FM_APPEND);
+		assert(File.GetPos() == (int64)Data.size());
+		File.Write("END", 3);
+	}
+	common::MustGetFileItemInfo(FileName, NULL, &FileSize, NULL);
+	assert(FileSize == Data.size() + 3);
+
+	// Pusty plik - nic nie jest zmapowane
+	{
+		common::FileStream File(EmptyFileName, common::FM_WRITE);
+	}
+	{
+		common::MappedFileStream File(EmptyFileName, common::FM_READ);
+		assert(File.GetSize() == 0 && File.Data() == NULL && File.End());
+		const void *Span;
+		assert(File.AcquireReadSpan(&Span) == 0);
+		char Ch;
+		assert(File.Read(&Ch, 1) == 0);
+		assert(File.Skip(10) == 0);
+	}
+	{
+		common::MappedFileStream File(EmptyFileName, common::FM_READ_PLUS);
+		assert(File.Data() == NULL);
+		File.Write("x", 1);
+		assert(File.GetSize() == 1 && File.Data() != NULL && File.Data()[0] == 'x');
+	}
+	common::MustGetFileItemInfo(EmptyFileName, NULL, &FileSize, NULL);
+	assert(FileSize == 1);
+
+	// CharReader poycza cay plik, a oddaje tylko to, co przeczyta
+	{
+		common::MappedFileStream File(FileName, common::FM_READ);
+		{
+			common::CharReader Reader(&File);
+			for (uint i = 0; i < 1000; i++)
+				assert(Reader.MustReadChar() == Data[i]);
+		}
+		assert(File.GetPos() == 1000);
+		char Buf[10];
+		File.MustRead(Buf, 10);
+		assert(memcmp(Buf, &Data[1000], 10) == 0);
+	}
+
+#ifdef _WIN32
+	// LoadUnicodeFromStream poycza cay plik i oddaje go take po odczytaniu
+	{
+		const wstring Text = L"Unicode \x0105\x0119\x0142 text";
+		common::SaveUnicodeToFile(_T("MappedUnicode.txt"), Text, common::FILE_ENCODING_UTF8 | common::FILE_ENCODING_FORCE_BOM);
+		common::MappedFileStream File(_T("MappedUnicode.txt"), common::FM_READ);
+		wstring Loaded;
+		common::FILE_ENCODING Encoding;
+		common::LoadUnicodeFromStream(&File, &Loaded, common::FILE_ENCODING_AUTODETECT, &Encoding);
+		assert(Loaded == Text && Encoding == common::FILE_ENCODING_UTF8);
+		assert(File.End());
+		File.Rewind();
+		common::LoadUnicodeFromStream(&File, &Loaded, common::FILE_ENCODING_UTF8);
+		assert(Loaded == Text);
+	}
+	common::MustDeleteFile(_T("MappedUnicode.txt"));
+#endif
+
+	common::MustDeleteFile(EmptyFileName);
+	common::MustDeleteFile(FileName);
+	WriteLine(_T("MappedFileStream test succeeded."));
+}
+
+void FileIoCallback(common::FILE_IO_REQUEST *Request)
+{
+	*(bool*)Request->UserData = true;
+}
+
+void TestFileIoEngine()
+{
+	WriteLine(_T("==================== FILE IO ENGINE ===================="));
+
+	const uint BLOCK_COUNT = 64, BLOCK_SIZE = 4096;
+	tstring FileName = _T("TEMP_IO");
+	std::vector<char> Data(BLOCK_COUNT * BLOCK_SIZE), ReadData(BLOCK_COUNT * BLOCK_SIZE), TailData(BLOCK_SIZE);
+	for (size_t i = 0; i < Data.size(); i++)
+		Data[i] = (char)(i * 7 + i / 251);
+	// Bloki, odczyt za kocem pliku, zapis do pliku otwartego do odczytu
+	std::vector<common::FILE_IO_REQUEST> Requests(BLOCK_COUNT + 2);
+	bool Called[BLOCK_COUNT + 2];
+
+	// Raz przez io_uring (jeli dostpny), raz przez pul wtkw
+	for (uint Pass = 0; Pass < 2; Pass++)
+	{
+		common::FileIoEngine Engine(16, 4, Pass == 0);
+
+		{
+			common::FileStream File(FileName, common::FM_WRITE);
+			for (uint i = 0; i < BLOCK_COUNT; i++)
+			{
+				Requests[i].File = &File;
+				Requests[i].Write = true;
+				Requests[i].Offset = i * BLOCK_SIZE;
+				Requests[i].Data = &Data[i * BLOCK_SIZE];
+				Requests[i].Size = BLOCK_SIZE;
+				Requests[i].Callback = &FileIoCallback;
+				Requests[i].UserData = &Called[i];
+				Called[i] = false;
+			}
+			Engine.Submit(&Requests[0], BLOCK_COUNT);
+			Engine.Wait();
+			for (uint i = 0; i < BLOCK_COUNT; i++)
+				assert( Called[i] && Requests[i].ErrorCode == 0 && Requests[i].Transferred == BLOCK_SIZE );
+		}
+
+		{
+			common::FileStream File(FileName, common::FM_READ);
+			assert( File.GetSize() == Data.size() );
+			for (uint i = 0; i < BLOCK_COUNT + 2; i++)
+			{
+				// Bloki w odwrotnej kolejnoci
+				uint Block = BLOCK_COUNT - 1 - i;
+				Requests[i].File = &File;
+				Requests[i].Write = false;
+				Requests[i].Offset = Block * BLOCK_SIZE;
+				Requests[i].Data = &ReadData[Block * BLOCK_SIZE];
+				Requests[i].Size = BLOCK_SIZE;
+				Requests[i].Callback = &FileIoCallback;
+				Requests[i].UserData = &Called[i];
+				Called[i] = false;
+			}
+			Requests[BLOCK_COUNT].Offset = Data.size() - 100;
+			Requests[BLOCK_COUNT].Data = &TailData[0];
+			Requests[BLOCK_COUNT+1].Write = true;
+			Requests[BLOCK_COUNT+1].Offset = 0;
+			Requests[BLOCK_COUNT+1].Data = &TailData[0];
+			Engine.Submit(&Requests[0], BLOCK_COUNT + 2);
+			Engine.Wait();
+			for (uint i = 0; i < BLOCK_COUNT; i++)
+				assert( Called[i] && Requests[i].ErrorCode == 0 && Requests[i].Transferred == BLOCK_SIZE );
+			assert( ReadData == Data );
+			assert( Called[BLOCK_COUNT] && Requests[BLOCK_COUNT].ErrorCode == 0 && Requests[BLOCK_COUNT].Transferred == 100 );
+			assert( memcmp(&TailData[0], &Data[Data.size() - 100], 100) == 0 );
+			assert( Called[BLOCK_COUNT+1] && Requests[BLOCK_COUNT+1].ErrorCode != 0 );
+		}
+
+		WriteLine(Format(_T("FileIoEngine test succeeded (#).")) % (Engine.IsKernelAsync() ? _T("io_uring") : _T("thread pool")));
+	}
+
+	common::MustDeleteFile(FileName);
+}
+
 void TestDateTime()
 {
 	WriteLine(_T("==================== DATETIME ===================="));
@@ -1242,6 +2442,17 @@ void TestDateTime()
 		tcout << _T("  Current time = ") << GetCurrentGameTime().ToSeconds_d() << endl;
 	}
 
+	{
+		// Due wartoci licznika (nanosekundy albo TSC po wielu dniach) nie mog si przepenia
+		GameTime Big = GameTime(1ll << 62);
+		int64 Ms = Big.ToMilliseconds();
+		assert( Ms > 0 && fabs((double)Ms - Big.ToSeconds_d() * 1000.0) <= 1.0 );
+		assert( MillisecondsToGameTime(Ms).ToMilliseconds() == Ms );
+		assert( (-Big).ToMilliseconds() == -Ms );
+		assert( MillisecondsToGameTime(1500).ToMilliseconds() == 1500 );
+		assert( MillisecondsToGameTime(-1500).ToMilliseconds() == -1500 );
+	}
+
 	tstring s, s1, s2;
 
 	common::DATETIME dtnow = common::Now();
@@ -1774,6 +2985,16 @@ void LoggingThread::Run()
 	}
 }
 
+// Zapamituje same treci komunikatw
+class CollectingLog : public common::ILog
+{
+public:
+	std::vector<tstring> m_Messages;
+
+protected:
+	virtual void OnLog(uint32 Type, const tstring &Prefix, const tstring &TypePrefix, const tstring &Message) { m_Messages.push_back(Message); }
+};
+
 void TestLogger()
 {
 	WriteLine(_T("==================== LOGGER ===================="));
@@ -1784,9 +3005,21 @@ void TestLogger()
 
 	scoped_ptr<common::ILog> HtmlLog(new common::HtmlFileLog(_T("Log.html"), common::FILE_MODE_NORMAL));
 	scoped_ptr<common::ILog> ConsoleLog(new common::OstreamLog(&tcout));
-
-	Logger.AddLogMapping(0xFFFFFFFF, HtmlLog.get());
-	Logger.AddLogMapping(0xFFFFFFFF, ConsoleLog.get());
+	scoped_ptr<common::ILog> RotatingLog(new common::RotatingFileLog(_T("Log_Rotating.txt"), common::FILE_MODE_NORMAL, EOL_CRLF, 4096, 0, 3));
+	scoped_ptr<common::MappedFileLog> MappedLog(new common::MappedFileLog(_T("Log_Mapped.bin")));
+	scoped_ptr<common::ILog> StructuredLog(new common::StructuredFileLog(_T("Log_Structured.txt"), common::STRUCTURED_LOG_JSON_LINES, common::FILE_MODE_NORMAL));
+	// Wszystkie komunikaty wprost i przez malutk kolejk, ktra czsto bdzie pena
+	scoped_ptr<CollectingLog> DirectLog(new CollectingLog());
+	scoped_ptr<CollectingLog> QueuedLog(new CollectingLog());
+
+	Logger.AddLogMapping(0xFFFFFFFF, HtmlLog.get(), 1024, common::LOG_QUEUE_BLOCK);
+	// Bez komunikatw typu 0x80000000, eby nie zasypa konsoli
+	Logger.AddLogMapping(0x7FFFFFFF, ConsoleLog.get());
+	Logger.AddLogMapping(0xFFFFFFFF, RotatingLog.get());
+	Logger.AddLogMapping(0xFFFFFFFF, MappedLog.get());
+	Logger.AddLogMapping(0xFFFFFFFF, StructuredLog.get());
+	Logger.AddLogMapping(0xFFFFFFFF, DirectLog.get());
+	Logger.AddLogMapping(0xFFFFFFFF, QueuedLog.get(), 4, common::LOG_QUEUE_BLOCK);
 
 	Logger.SetPrefixFormat(_T("[%D %T] "));
 
@@ -1802,8 +3035,114 @@ void TestLogger()
 	Thread2.Join();
 	Thread1.Join();
 
+	LOG_FIELDS(0xFFFFFFFF, _T("Structured message"), common::BeginLogFields().Add("int", 123).Add("float", 0.5f).AddVec3("pos", VEC3(1.f, 2.f, 3.f)).Add("str", _T("abc")));
+
+	Logger.SetSuppressionSummary(0xFFFFFFFF, 1);
+	GameTime RateLimitedStart = GetCurrentGameTime();
+	for (int i = 0; i < 10000; i++)
+		LOG_RATE_LIMITED(0xFFFFFFFF, Format(_T("Rate limited message #")) % i, 10.f, 5);
+	Logger.LogSuppressionSummary();
+	double RateLimitedSeconds = (GetCurrentGameTime() - RateLimitedStart).ToSeconds_d();
+
+	// Tyle, eby log rotujcy przeszed przez kilka segmentw
+	const uint BulkCount = 300;
+	for (uint i = 0; i < BulkCount; i++)
+		Logger.Log(0x80000000, tstring(Format(_T("Bulk message # ")) % i) + tstring(100, _T('x')));
+
+	// Oprnia kolejk loggera i kolejki logw
 	common::DestroyLogger();
 
+	uint FieldsCount = 0, RateLimitedCount = 0, BulkFound = 0;
+	uint64 SuppressedCount = 0;
+	for (size_t i = 0; i < DirectLog->m_Messages.size(); i++)
+	{
+		const tstring &Msg = DirectLog->m_Messages[i];
+		if (Msg == _T("Structured message int=123 float=0.5 pos=1,2,3 str=\"abc\""))
+			FieldsCount++;
+		else if (common::StrBegins(Msg, _T("Rate limited message "), true))
+			RateLimitedCount++;
+		else if (common::StrBegins(Msg, _T("Bulk message "), true))
+			BulkFound++;
+		else if (common::StrBegins(Msg, _T("Suppressed "), true))
+		{
+			size_t End = Msg.find(_T(' '), 11);
+			uint64 Count = 0;
+			int R = common::StrToUint(&Count, Msg.substr(11, End - 11));
+			assert(R == 0);
+			// Jedno miejsce wywoania, wic jego licznik jest taki sam jak suma
+			assert(StrEnds(Msg, Format(_T("): #")) % Count, true));
+			SuppressedCount += Count;
+		}
+	}
+	assert(FieldsCount == 1);
+	assert(BulkFound == BulkCount);
+	// Burst 5 na starcie plus 10 na sekund
+	assert(RateLimitedCount >= 5);
+	assert(RateLimitedCount <= 5 + (uint)(RateLimitedSeconds * 10.0) + 1);
+	assert(RateLimitedCount + SuppressedCount == 10000);
+
+	// Przez pen kolejk LOG_QUEUE_BLOCK doszo wszystko i w tej samej kolejnoci
+	assert(QueuedLog->m_Messages == DirectLog->m_Messages);
+
+	{
+		string Structured;
+		StructuredLog.reset(0);
+		common::LoadStringFromFile(_T("Log_Structured.txt"), &Structured);
+		assert(Structured.find("\"msg\":\"Structured message\",\"int\":123,\"float\":0.5,\"pos\":[1,2,3],\"str\":\"abc\"") != string::npos);
+	}
+
+	// Plik jeszcze nieprzycity, z zerami na kocu - jak po awarii procesu
+	MappedLog->Flush();
+	{
+		common::FileStream RecoveredLog(_T("Log_Mapped_Unclean.txt"), common::FM_WRITE);
+		assert(common::MappedFileLog::Recover(_T("Log_Mapped.bin"), &RecoveredLog, EOL_CRLF) == DirectLog->m_Messages.size());
+	}
+	MappedLog.reset(0);
+	{
+		common::FileStream RecoveredLog(_T("Log_Mapped.txt"), common::FM_WRITE);
+		assert(common::MappedFileLog::Recover(_T("Log_Mapped.bin"), &RecoveredLog, EOL_CRLF) == DirectLog->m_Messages.size());
+	}
+	{
+		string Unclean, Clean;
+		common::LoadStringFromFile(_T("Log_Mapped_Unclean.txt"), &Unclean);
+		common::LoadStringFromFile(_T("Log_Mapped.txt"), &Clean);
+		assert(Unclean == Clean);
+		assert(Clean.find("Bulk message 299 ") != string::npos);
+	}
+
+	// Czeka na spakowanie segmentw. Zostaj 3 archiwa, kade z segmentem co najmniej 4096 B,
+	// a biecy segment przekracza limit najwyej o jeden komunikat.
+	RotatingLog.reset(0);
+	{
+		common::FILE_ITEM_TYPE Type;
+		uint64 Size;
+		common::DATETIME MTime;
+		common::MustGetFileItemInfo(_T("Log_Rotating.txt"), &Type, &Size, &MTime);
+		assert(Size < 4096 + 256);
+
+		tstring Name;
+		uint ArchiveCount = 0;
+		common::DirLister Lister(_T("."));
+		while (Lister.ReadNext(&Name, &Type))
+		{
+			if (Type != common::IT_FILE || !common::StrBegins(Name, _T("Log_Rotating.txt."), true) || !common::StrEnds(Name, _T(".gz"), true))
+				continue;
+			ArchiveCount++;
+			common::GzipFileStream Archive(TstringToStringR(Name), common::GZFM_READ);
+			char Buf[1024];
+			uint64 SegmentSize = 0;
+			size_t Read;
+			do
+			{
+				Read = Archive.Read(Buf, sizeof(Buf));
+				SegmentSize += Read;
+			}
+			while (Read == sizeof(Buf));
+			assert(SegmentSize >= 4096);
+		}
+		assert(ArchiveCount == 3);
+	}
+
 	ConsoleLog.reset(0);
 	HtmlLog.reset(0);
 }
@@ -2080,11 +3419,16 @@ void Test()
 	TestFlatProfiler();
 	TestStream();
 	TestEncoderDecoder();
+	TestHashes();
 	TestSmartPointers();
 	TestFreeList();
 	TestDynamicFreeList();
 	TestZlibUtils();
+	TestAsyncStream();
 	TestFiles();
+	TestFileStream();
+	TestMappedFileStream();
+	TestFileIoEngine();
 	TestDateTime();
 	TestCmdLineParser();
 	TestTokenizer();